@@ -6,10 +6,12 @@
 #define ICON_FOLDER ""
 #define ICON_GIT_FOLDER ""
 #define ICON_FILE ""
+#define ICON_SYM_LINK ""
 
 #define REPL_PROMPT ANSI_FG_WHITE "⟩ "
 
 #define COLOR_FOLDER ANSI_FG_BLUE
 #define COLOR_FILE ANSI_FG_GREEN
+#define COLOR_SYM_LINK ANSI_FG_CYAN
 
 #endif /* CONFIG_H */
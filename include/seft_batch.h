@@ -0,0 +1,154 @@
+#ifndef SFTP_BATCH_H
+#define SFTP_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libssh/libssh.h>
+
+#include "seft_metadata.h"
+
+/** Files a batch has on their way at once, every one holds its contents until the
+ * server opened it */
+#define BATCH_MAX_FILES 64
+
+/** Called once the server is done with a file, ``ok`` is False if any step failed */
+typedef void (*BatchDoneT)(void *data, size_t num_bytes, bool ok);
+
+/** What a slot of a batch waits for */
+typedef enum {
+    /** A small file, see ``Batch_put`` */
+    BATCH_OP_FILE = 0,
+
+    /** A directory, see ``Batch_mkdir`` */
+    BATCH_OP_MKDIR,
+
+    /** The target of a symbolic link, see ``Batch_readlink`` */
+    BATCH_OP_READLINK,
+
+    /** Permissions and times of a path, see ``Batch_setstat`` */
+    BATCH_OP_SETSTAT,
+
+    /** What a symbolic link points to, see ``Batch_follow`` */
+    BATCH_OP_FOLLOW,
+
+    /** A symbolic link to create, see ``Batch_symlink`` */
+    BATCH_OP_SYMLINK,
+
+    /** A large file written chunk by chunk, see ``Batch_open`` */
+    BATCH_OP_STREAM,
+} BatchOpE;
+
+/** What a symbolic link points to, filled in by ``Batch_follow`` */
+typedef struct {
+    /** False if the link dangles, the other fields are left unset then */
+    bool exists;
+    bool is_dir;
+    uint64_t size;
+
+    /** Heap allocated canonical path of the target, NULL if it couldn't be resolved */
+    char *canonical_path;
+} BatchTargetT;
+
+/** A large file written with ``Batch_write``, the writes of a window are in flight */
+typedef struct {
+    /** Handle the server opened the file with */
+    char *handle;
+    uint32_t len_handle;
+
+    /** Slot of the file in the batch */
+    uint32_t slot;
+
+    /** Writes sent so far and writes answered, the server answers them in order */
+    size_t num_sent;
+    size_t num_done;
+
+    /** True until the server is done with the file, after its close or a failure */
+    bool is_open;
+    bool failed;
+} BatchStreamT;
+
+/** A file or path of a batch, waiting for the responses to its requests */
+typedef struct {
+    /** Remote path, NULL while the slot is free */
+    char *path;
+
+    BatchOpE op;
+
+    /** Where the outcome of an operation other than a file goes, owned by the
+     * caller: ``bool *`` for ``BATCH_OP_MKDIR``, ``char **`` for ``BATCH_OP_READLINK``,
+     * ``BatchTargetT *`` for ``BATCH_OP_FOLLOW`` and ``BatchStreamT *`` for
+     * ``BATCH_OP_STREAM`` */
+    void *result;
+
+    /** Contents, freed once they are sent */
+    char *contents;
+    size_t length;
+
+    /** Permissions and times to set before closing it, ``path`` isn't used */
+    MetadataT metadata;
+    bool preserve;
+
+    /** Responses still expected */
+    uint32_t num_pending;
+    bool failed;
+} BatchFileT;
+
+/**
+ * Writes many small files with pipelined requests.
+ *
+ * The batch speaks SFTP over a channel of its own: the open of every file is sent
+ * right away, the write, setstat and close follow as soon as its handle arrives,
+ * without waiting for anything else. Thousands of small files then take a couple
+ * of round trips in all instead of three or four each. Directories are created the
+ * same way, side by side with the files, links are read, followed and created and
+ * metadata is set. Large files are written chunk by chunk with a window of writes
+ * in flight.
+ */
+typedef struct {
+    ssh_channel channel;
+
+    /** The server is OpenSSH, it takes the target of a symlink before the path of
+     * the link, the reverse of the specification */
+    bool symlink_reversed;
+
+    /** Files on their way, a slot is part of the ids of the requests of its file */
+    BatchFileT files[BATCH_MAX_FILES];
+    size_t num_files;
+
+    /** Requests not sent yet */
+    char *out;
+    size_t len_out;
+    size_t cap_out;
+
+    /** Received bytes not handled yet */
+    char *in;
+    size_t len_in;
+    size_t cap_in;
+
+    BatchDoneT done;
+    void *data;
+
+    /** Files, setstats and symlinks that failed since the last ``Batch_flush`` */
+    size_t num_failed;
+} BatchT;
+
+BatchT *Batch_new(ssh_session session_ssh, BatchDoneT done, void *data);
+bool Batch_put(BatchT *self, const char *path, char *contents, size_t length,
+               const MetadataT *metadata);
+bool Batch_mkdir(BatchT *self, const char *path, uint32_t permissions, bool *exists);
+bool Batch_readlink(BatchT *self, const char *path, char **target);
+bool Batch_setstat(BatchT *self, const char *path, const MetadataT *metadata);
+bool Batch_follow(BatchT *self, const char *path, BatchTargetT *target);
+bool Batch_symlink(BatchT *self, const char *target, const char *path);
+bool Batch_open(BatchT *self, const char *path, BatchStreamT *stream);
+bool Batch_write(BatchT *self, BatchStreamT *stream, uint64_t offset, const char *buf,
+                 size_t length);
+bool Batch_drain(BatchT *self, BatchStreamT *stream, size_t num_in_flight);
+bool Batch_close(BatchT *self, BatchStreamT *stream);
+void Batch_wait(BatchT *self);
+bool Batch_flush(BatchT *self);
+void Batch_free(BatchT *self);
+
+#endif /* SFTP_BATCH_H */
@@ -0,0 +1,34 @@
+#ifndef SFTP_CHECKSUM_H
+#define SFTP_CHECKSUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Checksum kernels for one instruction set, picked at runtime by CPUID */
+typedef struct {
+    /** Name of the instruction set, i.e ``avx2`` */
+    const char *name;
+
+    /** See ``checksum_rolling`` */
+    uint32_t (*rolling)(uint32_t sum, const uint8_t *data, size_t length);
+
+    /** See ``checksum_crc32c`` */
+    uint32_t (*crc32c)(uint32_t crc, const uint8_t *data, size_t length);
+
+    /** See ``checksum_is_zero`` */
+    bool (*is_zero)(const uint8_t *data, size_t length);
+} ChecksumKernelsT;
+
+uint32_t checksum_rolling(uint32_t sum, const void *data, size_t length);
+uint32_t checksum_rolling_roll(uint32_t sum, uint8_t out, uint8_t in, size_t window);
+uint32_t checksum_crc32c(uint32_t crc, const void *data, size_t length);
+bool checksum_is_zero(const void *data, size_t length);
+uint64_t checksum_xxh64(uint64_t seed, const void *data, size_t length);
+const ChecksumKernelsT *checksum_get_kernels(void);
+const ChecksumKernelsT *checksum_get_kernels_at(size_t index);
+bool checksum_kernels_supported(const ChecksumKernelsT *kernels);
+bool checksum_self_test(const ChecksumKernelsT *kernels);
+void checksum_benchmark(void);
+
+#endif /* SFTP_CHECKSUM_H */
@@ -1,12 +1,22 @@
 #ifndef SFTP_CLIENT_H
 #define SFTP_CLIENT_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <libssh/sftp.h>
 #include <libssh/libssh.h>
 
+#include "seft_batch.h"
 #include "seft_commands.h"
+#include "seft_crypto.h"
+#include "seft_filter.h"
+#include "seft_list.h"
+#include "seft_path.h"
+#include "seft_sched.h"
+#include "seft_sort.h"
+#include "seft_tune.h"
 
 
 #define FLAG_LIST_BIT_POS_ALL 0x0
@@ -21,22 +31,172 @@
 
 #define FLAG_LIST_BIT_POS_SORT_REVERSE 0x5
 
+#define FLAG_LIST_BIT_POS_LINK_TARGET 0x6
+
+/** How symbolic links are handled when copying */
+typedef enum {
+    /** Recreate the link on the destination */
+    LINK_PRESERVE = 0,
+
+    /** Copy whatever the link points to */
+    LINK_FOLLOW,
+
+    /** Leave the link out */
+    LINK_SKIP,
+} LinkPolicyE;
+
+/** When SSH sessions compress their traffic with zlib */
+typedef enum {
+    COMPRESSION_NO = 0,
+    COMPRESSION_YES,
+
+    /** Copies send compressible files over a second, compressed session */
+    COMPRESSION_AUTO,
+} CompressionE;
+
+/** How directories of many small files are copied */
+typedef enum {
+    /** Stream a tar archive when the file sizes suggest it and the server has ``tar`` */
+    BULK_AUTO = 0,
+
+    /** Always stream a tar archive over an exec channel running ``tar`` */
+    BULK_TAR,
+
+    /** Upload directories as one ``DEST.tar`` file over SFTP, for servers without exec.
+     * The archive is left packed on the server, downloads go file by file */
+    BULK_ARCHIVE,
+
+    /** Copy every file on its own */
+    BULK_NO,
+} BulkModeE;
+
+/** How copies of large files use the page cache of the local machine */
+typedef enum {
+    /** Read ahead of uploads, leave what was copied cached */
+    CACHE_KEEP = 0,
+
+    /** Also drop files from the cache behind the copy, for hosts shared with services
+     * relying on it */
+    CACHE_DROP,
+} CachePolicyE;
+
+/** Progress of a copy, updated by the copy and read from other threads */
+typedef struct {
+    /** Bytes of file contents copied so far */
+    atomic_uint_least64_t num_bytes;
+
+    /** Files copied completely so far */
+    atomic_uint_least64_t num_files;
+
+    /** Set to stop the copy before its next chunk or file */
+    atomic_bool cancelled;
+} CopyProgressT;
+
+/** Whether the server runs a tool a copy would use, i.e ``xxhsum`` for ``copy_verify`` */
+typedef enum {
+    REMOTE_TOOL_UNKNOWN = 0,
+    REMOTE_TOOL_AVAILABLE,
+    REMOTE_TOOL_MISSING,
+} RemoteToolE;
+
+/** Options for ``copy_from_remote_to_local`` and ``copy_from_local_to_remote`` */
+typedef struct {
+    LinkPolicyE link_policy;
+
+    /** Preserve permissions and access/modification times */
+    bool preserve;
+
+    /** Include and exclude rules, NULL to copy everything */
+    FilterT *filter;
+
+    /** Progress to update, NULL for copies that can't be followed or cancelled */
+    CopyProgressT *progress;
+
+    /** Scheduler sharing bandwidth between copies, NULL to copy at full speed */
+    SchedulerT *scheduler;
+
+    /** Flow of this copy registered with ``scheduler`` */
+    SchedFlowT *flow;
+
+    /** Hash files while they are copied and compare against the copy */
+    bool verify;
+
+    /** Found out by the first verification and reused for the rest of the copy */
+    RemoteToolE remote_hash;
+
+    /** Compressed sessions to the same server for compressible files, NULL to copy
+     * everything over the sessions the copy was started with */
+    ssh_session compressed_ssh;
+    sftp_session compressed_sftp;
+
+    /** Chunk size and window learned from earlier transfers, NULL for fixed ones */
+    TuneT *tune;
+
+    /** Pipelines the links of a copy and the files of an upload, small ones whole
+     * and large ones chunk by chunk, opened the first time it is needed */
+    BatchT *batch;
+
+    /** Set once a batch couldn't be opened, files and links are copied one by one
+     * and a write at a time */
+    bool batch_unavailable;
+
+    /** Whether directories are streamed as tar archives */
+    BulkModeE bulk;
+
+    /** Found out by the first bulk copy, see ``remote_hash`` */
+    RemoteToolE remote_tar;
+
+    /** Whether copied files are left in the page cache */
+    CachePolicyE cache;
+} CopyOptionsT;
+
+/** Password of the first session to a server, reused by the sessions opened to it
+ * later, i.e for background jobs and compressed copies */
+typedef struct {
+    /** Set once a session authenticated with ``password`` */
+    bool is_set;
+    char password[BUF_SIZE_PASSPHRASE];
+} CredentialsT;
+
+/** A source of a multi-source copy and where it is copied to */
+typedef struct {
+    char *source;
+    char *dest;
+} CopyPairT;
+
 /** SSH FUNCTIONS */
-ssh_session do_ssh_init(char *host_name, uint32_t port_id);
+ssh_session try_ssh_init(char *host_name, uint32_t port_id, bool compress,
+                         const CryptoPrefsT *crypto, CredentialsT *credentials);
+ssh_session do_ssh_init(char *host_name, uint32_t port_id, bool compress,
+                        const CryptoPrefsT *crypto, CredentialsT *credentials);
+void Credentials_clear(CredentialsT *self);
 void clean_ssh_session(ssh_session session);
 void clean_sftp_session(sftp_session session);
 
+sftp_session try_sftp_init(ssh_session session_ssh);
 sftp_session do_sftp_init(ssh_session session_ssh);
 CommandStatusE list_remote_dir(ssh_session session_ssh, sftp_session session_sftp,
-                               char *directory, uint8_t flag);
+                               char *directory, uint8_t flag, SortFieldE sort_field);
 CommandStatusE create_remote_file(ssh_session session_ssh, sftp_session session_sftp,
                                   char *abs_file_path);
 CommandStatusE create_remote_dir(ssh_session session_ssh, sftp_session session_sftp,
                                  char *abs_dir_path);
 CommandStatusE copy_from_remote_to_local(ssh_session session_ssh,
                                          sftp_session session_sftp, char *abs_path_remote,
-                                         char *abs_path_local);
+                                         char *abs_path_local, CopyOptionsT *options);
 CommandStatusE copy_from_local_to_remote(ssh_session session_ssh,
                                          sftp_session session_sftp, char *abs_path_local,
-                                         char *abs_path_remote);
+                                         char *abs_path_remote, CopyOptionsT *options);
+CommandStatusE copy_many_from_remote_to_local(ssh_session session_ssh,
+                                              sftp_session session_sftp, ListT *sources,
+                                              char *abs_path_local,
+                                              CopyOptionsT *options);
+CommandStatusE copy_many_from_local_to_remote(ssh_session session_ssh,
+                                              sftp_session session_sftp, ListT *sources,
+                                              char *abs_path_remote,
+                                              CopyOptionsT *options);
+bool link_policy_from_str(const char *str, LinkPolicyE *policy);
+bool compression_from_str(const char *str, CompressionE *compression);
+bool bulk_mode_from_str(const char *str, BulkModeE *mode);
+bool cache_policy_from_str(const char *str, CachePolicyE *policy);
 #endif /* SFTP_CLIENT_H */
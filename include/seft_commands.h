@@ -20,6 +20,9 @@ typedef enum {
     /** Internal error */
     CMD_INTERNAL_ERROR,
 
+    /** Command was cancelled before it finished */
+    CMD_CANCELLED,
+
     /** Command not executed */
     CMD_NOT_EXECUTED = -1
 } CommandStatusE;
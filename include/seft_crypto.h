@@ -0,0 +1,38 @@
+#ifndef SFTP_CRYPTO_H
+#define SFTP_CRYPTO_H
+
+#include <stdbool.h>
+
+#include <libssh/libssh.h>
+
+/** Packet size the ciphers are benchmarked with, the SFTP payload of a chunk */
+#define CRYPTO_BENCH_PACKET_SIZE 32768
+
+/** Bytes encrypted by every cipher when benchmarking */
+#define CRYPTO_BENCH_SIZE (16 << 20)
+
+/** Value of ``ciphers`` that orders them by a benchmark of this machine */
+#define CRYPTO_AUTO "auto"
+
+/** Algorithms offered when connecting, NULL leaves the choice to libssh */
+typedef struct {
+    /** Comma separated ciphers, most preferred first */
+    char *ciphers;
+
+    /** Comma separated MACs, only used with ciphers that aren't AEAD */
+    char *macs;
+
+    /** Comma separated key exchange methods */
+    char *kex;
+} CryptoPrefsT;
+
+CryptoPrefsT *CryptoPrefs_new(void);
+CryptoPrefsT *CryptoPrefs_copy(const CryptoPrefsT *self);
+bool CryptoPrefs_set(CryptoPrefsT *self, const char *key, const char *value);
+bool CryptoPrefs_load(CryptoPrefsT *self, const char *path);
+bool CryptoPrefs_load_default(CryptoPrefsT *self);
+bool CryptoPrefs_apply(const CryptoPrefsT *self, ssh_session session);
+void CryptoPrefs_free(CryptoPrefsT *self);
+char *crypto_auto_ciphers(void);
+
+#endif /* SFTP_CRYPTO_H */
@@ -0,0 +1,68 @@
+#ifndef SFTP_FILTER_H
+#define SFTP_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "seft_list.h"
+
+/** Rule index of trie nodes no rule ends at */
+#define FILTER_NO_RULE SIZE_MAX
+
+/** A single include or exclude rule */
+typedef struct {
+    /** Pattern without the leading ``/`` and trailing ``/`` markers */
+    char *pattern;
+
+    /** Include matches, exclude them otherwise */
+    bool include;
+
+    /** Only match directories, the pattern ended with ``/`` */
+    bool dir_only;
+
+    /** Match the whole path relative to the transfer root, not just the name */
+    bool anchored;
+} FilterRuleT;
+
+/** Node of the trie of literal rules, one node per path component */
+typedef struct FilterNode {
+    /** Path component leading to this node */
+    char *name;
+
+    /** Index of the first rule ending here that matches any type */
+    size_t rule_any;
+
+    /** Index of the first rule ending here that only matches directories */
+    size_t rule_dir;
+
+    /** Children sorted by name */
+    struct FilterNode **children;
+    size_t num_children;
+} FilterNodeT;
+
+/**
+ * Include and exclude rules compiled into a matcher. Rules are checked in the
+ * order they were added and the first matching one decides, like rsync.
+ */
+typedef struct {
+    /** ``ListT`` of ``FilterRuleT`` in the order they were added */
+    ListT *rules;
+
+    /** Literal anchored rules, i.e ``/build`` or ``src/gen/`` */
+    FilterNodeT *anchored;
+
+    /** Literal rules matching a name anywhere, i.e ``.git`` */
+    FilterNodeT *names;
+
+    /** Indices of rules with wildcards, in ascending order */
+    size_t *globs;
+    size_t num_globs;
+} FilterT;
+
+FilterT *Filter_new(void);
+bool Filter_add_rule(FilterT *self, const char *pattern, bool include);
+bool Filter_add_file(FilterT *self, const char *path);
+bool Filter_excludes(const FilterT *self, const char *relative_path, bool is_dir);
+void Filter_free(FilterT *self);
+
+#endif /* SFTP_FILTER_H */
@@ -0,0 +1,24 @@
+#ifndef SFTP_GLOB_H
+#define SFTP_GLOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "seft_list.h"
+
+/**
+ * Read a directory for ``glob_expand``.
+ *
+ * :param data: The ``data`` given to ``glob_expand``.
+ * :param path: Path of the directory.
+ * :return: ``ListT`` of ``FileSystemT``, NULL if the directory couldn't be read.
+ */
+typedef ListT *(*GlobReadDirT)(void *data, char *path);
+
+bool glob_has_magic(const char *pattern);
+bool glob_match(const char *pattern, const char *str);
+size_t glob_base_length(const char *pattern);
+char *glob_base(const char *pattern);
+ListT *glob_expand(const char *pattern, GlobReadDirT read_dir, void *data);
+
+#endif /* SFTP_GLOB_H */
@@ -0,0 +1,31 @@
+#ifndef SFTP_HASH_H
+#define SFTP_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Bytes consumed by one round of the four ``HashT`` accumulators */
+#define HASH_STRIPE_SIZE 32
+
+/** Streaming XXH64 state, the digest matches ``xxhsum -H1`` */
+typedef struct {
+    /** Accumulators, one per 8-byte lane of a stripe */
+    uint64_t acc[4];
+
+    /** Bytes of an incomplete stripe, waiting for more input */
+    uint8_t buf[HASH_STRIPE_SIZE];
+
+    /** Number of bytes in ``buf`` */
+    size_t len_buf;
+
+    /** Number of bytes hashed so far */
+    uint64_t total;
+
+    uint64_t seed;
+} HashT;
+
+void Hash_init(HashT *self, uint64_t seed);
+void Hash_update(HashT *self, const void *data, size_t length);
+uint64_t Hash_digest(const HashT *self);
+
+#endif /* SFTP_HASH_H */
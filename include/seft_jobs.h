@@ -0,0 +1,120 @@
+#ifndef SFTP_JOBS_H
+#define SFTP_JOBS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "seft_client.h"
+#include "seft_commands.h"
+#include "seft_list.h"
+
+/** Idle connections kept around for the next background job */
+#define JOB_MAX_IDLE_CONNECTIONS 4
+
+/** A connection to the remote server, owned by one thread at a time */
+typedef struct {
+    ssh_session session_ssh;
+    sftp_session session_sftp;
+
+    /** The session compresses its traffic */
+    bool compressed;
+
+    /** ``server`` of the table when the connection was opened */
+    size_t server;
+} ConnectionT;
+
+typedef enum {
+    JOB_RUNNING = 0,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_CANCELLED,
+} JobStateE;
+
+typedef struct JobT JobT;
+
+/** Work of a job, runs on the thread of the job over its own connection */
+typedef CommandStatusE (*JobRunT)(JobT *job);
+
+/** A command running in the background */
+struct JobT {
+    /** Number shown to the user, starting at 1 */
+    size_t id;
+
+    /** Command line the job was started with */
+    char *command;
+
+    pthread_t thread;
+
+    /** The thread was joined, it must not be joined again */
+    bool joined;
+
+    /** ``JobStateE``, set by the thread of the job once it is over */
+    atomic_int state;
+
+    /** Progress of the copy, also used to cancel it */
+    CopyProgressT progress;
+
+    /** Connection used by the job, taken from the pool of its ``JobTableT`` */
+    ConnectionT connection;
+
+    /** Compressed connection for compressible files, sessions are NULL unless the
+     * table uses ``COMPRESSION_AUTO`` */
+    ConnectionT compressed_connection;
+
+    JobRunT run;
+
+    /** Arguments of ``run``, freed with ``free_data`` once the job is reaped */
+    void *data;
+    void (*free_data)(void *data);
+
+    time_t started;
+};
+
+/** Background jobs of the REPL and the pool of connections they use */
+typedef struct {
+    /** ``ListT`` of ``JobT``, in the order they were started */
+    ListT *jobs;
+
+    /** ``ListT`` of idle ``ConnectionT`` to the current server */
+    ListT *idle;
+
+    /** Server new connections are made to, NULL if not connected */
+    char *host;
+    uint32_t port;
+
+    /** How connections of new jobs compress their traffic */
+    CompressionE compression;
+
+    /** Algorithms offered by new connections, owned by the table */
+    CryptoPrefsT *crypto;
+
+    /** Password new connections authenticate with, the user isn't asked again */
+    CredentialsT credentials;
+
+    /** Changed every time the server is set, connections opened to an earlier one
+     * are closed when their job gives them back */
+    size_t server;
+
+    size_t next_id;
+} JobTableT;
+
+JobTableT *JobTable_new(void);
+void JobTable_set_server(JobTableT *self, const char *host, uint32_t port,
+                         CompressionE compression, const CryptoPrefsT *crypto,
+                         const CredentialsT *credentials);
+JobT *JobTable_spawn(JobTableT *self, const char *command, JobRunT run, void *data,
+                     void (*free_data)(void *data));
+size_t JobTable_reap(JobTableT *self);
+void JobTable_print(JobTableT *self);
+CommandStatusE JobTable_wait(JobTableT *self, size_t id);
+CommandStatusE JobTable_cancel(JobTableT *self, size_t id);
+JobT *JobTable_get(JobTableT *self, size_t id);
+void JobTable_free(JobTableT *self);
+
+#endif /* SFTP_JOBS_H */
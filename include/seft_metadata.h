@@ -0,0 +1,37 @@
+#ifndef SFTP_METADATA_H
+#define SFTP_METADATA_H
+
+#include <stdint.h>
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "seft_commands.h"
+#include "seft_list.h"
+
+/** Mask of the permission bits of a mode, i.e everything except the file type */
+#define MODE_PERMISSION_BITS 07777
+
+/** Permissions and times to apply to a copied filesystem object */
+typedef struct {
+    /** Path of the object on the destination */
+    char *path;
+
+    /** Permission bits, without the file type */
+    uint32_t permissions;
+
+    /** Access time in seconds since the epoch */
+    uint64_t atime;
+
+    /** Modification time in seconds since the epoch */
+    uint64_t mtime;
+} MetadataT;
+
+void Metadata_list_push(ListT *self, const char *path, uint32_t permissions,
+                        uint64_t atime, uint64_t mtime);
+CommandStatusE Metadata_list_apply_remote(ssh_session session_ssh,
+                                          sftp_session session_sftp, ListT *self);
+CommandStatusE Metadata_list_apply_local(ListT *self);
+void Metadata_list_free(ListT *self);
+
+#endif /* SFTP_METADATA_H */
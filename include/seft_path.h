@@ -1,9 +1,12 @@
 #ifndef SFTP_PATH_H
 #define SFTP_PATH_H
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "seft_list.h"
+#include "seft_set.h"
 
 #define BUF_SIZE_FS_NAME 128
 #define BUF_SIZE_FILE_CONTENTS 16384
@@ -18,6 +21,9 @@
 /* File owner has perms to Read, Write and Execute the rest can only Read and Execute */
 #define FS_CREATE_PERM (S_IRWXU | S_IRWXG | S_IRWXO)
 
+/* Same as ``FS_CREATE_PERM`` without execute, the umask narrows it down further */
+#define FS_CREATE_FILE_PERM (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
+
 /* Simple macro to count the number of arguments in ``__VA_ARGS__`` */
 #define __NUM_ARGS(type, ...) (sizeof((type[]){__VA_ARGS__}) / sizeof(type))
 
@@ -48,24 +54,93 @@ typedef struct {
 
     /** Type of the file system object */
     FileTypesT type;
+
+    /** Size in bytes, filled in for remote objects and stat-ed local ones */
+    uint64_t size;
+
+    /** Mode including the file type bits, filled in like ``size`` */
+    uint32_t permissions;
+
+    /** Access time, filled in for remote objects and stat-ed local ones */
+    uint64_t atime;
+
+    /** Modification time, filled in for remote objects and stat-ed local ones */
+    uint64_t mtime;
 } FileSystemT;
 
+/** A path that keeps track of its length and of the memory allocated for it */
+typedef struct {
+    /** NULL terminated path string */
+    char *str;
+
+    /** Length of ``str`` excluding the NULL terminator */
+    size_t length;
+
+    /** Size allocated for ``str`` */
+    size_t capacity;
+} PathBufT;
+
+/** A component of a path, i.e ``is`` in ``/this/is/a/path`` */
+typedef struct {
+    /** Index of the first character of the component in the path */
+    size_t offset;
+
+    /** Length of the component */
+    size_t length;
+} PathViewT;
+
+/** Maps paths under a source root to the same relative path under a destination root */
+typedef struct {
+    /** Normalised source root */
+    PathBufT *source_root;
+
+    /** Normalised destination root, followed by the suffix of the last mapped path */
+    PathBufT *dest_path;
+
+    /** Length of the destination root in ``dest_path`` */
+    size_t len_dest_root;
+} PathMapT;
+
+/** Remembers the local directories created or found to exist during a transfer */
+typedef struct {
+    /** Normalised paths of the directories known to exist */
+    StrSetT *known_dirs;
+
+    /** Guards ``known_dirs``, so a cache can be shared by threads */
+    pthread_mutex_t lock;
+} DirCacheT;
+
 char *path_str_slice(const char *path_str, size_t start, size_t stop);
+size_t path_normalise(char *path_str, size_t length);
 void path_remove_prefix(char *path_str);
 void path_remove_suffix(char *path_str);
 void path_join(char *path_buf, size_t num_paths, ...);
 bool path_is_dotted(const char *path_str, size_t length);
 bool path_is_hidden(const char *path_str, size_t length);
-uint8_t path_mkdir_parents(char *path_str, size_t length);
-ListT *path_split(const char *path_str, size_t length);
-void path_replace_grandparent(char *path_str, char *grandparent);
-void path_replace(char *path_str, char *path_head_to_replace, char *path_head_replacement,
-                  size_t max_count);
-ListT *path_read_local_dir(char *dir_path);
+size_t path_split(const char *path_str, size_t length, PathViewT *views,
+                  size_t max_views);
+ListT *path_read_local_dir(char *dir_path, bool with_stat);
 ListT *path_read_remote_dir(ssh_session session_ssh, sftp_session session_sftp,
                             char *dir_path);
 void path_buf_clear_copy(char *path_dest, size_t dest_length, char *path_to_copy,
                          size_t copy_length);
+PathBufT *PathBuf_new(const char *path_str);
+bool PathBuf_reserve(PathBufT *self, size_t length);
+void PathBuf_set(PathBufT *self, const char *path_str, size_t length);
+void PathBuf_push(PathBufT *self, const char *name, size_t length);
+void PathBuf_truncate(PathBufT *self, size_t length);
+void PathBuf_pop(PathBufT *self);
+size_t PathBuf_split(const PathBufT *self, PathViewT *views, size_t max_views);
+void PathBuf_replace_component(PathBufT *self, PathViewT view, const char *name,
+                               size_t length);
+void PathBuf_free(PathBufT *self);
+PathMapT *PathMap_new(const char *source_root, const char *dest_root);
+char *PathMap_apply(PathMapT *self, const char *source_path, size_t length);
+const char *PathMap_relative(const PathMapT *self, const char *source_path);
+void PathMap_free(PathMapT *self);
+DirCacheT *DirCache_new(void);
+bool DirCache_mkdir_parents(DirCacheT *self, const char *path_str, size_t length);
+void DirCache_free(DirCacheT *self);
 void FileSystem_free(FileSystemT *self);
 void FileSystem_list_free(ListT *self);
 
@@ -0,0 +1,92 @@
+#ifndef SFTP_SCHED_H
+#define SFTP_SCHED_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "seft_list.h"
+
+/** A bucket holds at most this many seconds worth of tokens */
+#define SCHED_BURST_SECONDS 0.25
+
+/** Bytes a flow of weight 1 may send per turn when bandwidth is shared */
+#define SCHED_QUANTUM 65536
+
+/** Longest a waiting flow sleeps before looking at its state again */
+#define SCHED_MAX_WAIT_NS 50000000L
+
+/** Priority classes of transfers, higher ones get a larger share of bandwidth */
+typedef enum {
+    /** Background bulk transfers, i.e nightly pushes */
+    SCHED_PRIORITY_BULK = 0,
+    SCHED_PRIORITY_NORMAL,
+
+    /** Transfers someone is waiting on */
+    SCHED_PRIORITY_HIGH,
+} SchedPriorityE;
+
+/** Rate limiter handing out one token per byte */
+typedef struct {
+    /** Bytes per second, 0 for no limit */
+    double rate;
+
+    /** Available bytes, negative while a large request is paid back */
+    double tokens;
+
+    /** Last time tokens were added */
+    struct timespec last;
+} TokenBucketT;
+
+/** A transfer sharing bandwidth through a ``SchedulerT``, i.e a copy */
+typedef struct {
+    SchedPriorityE priority;
+
+    /** Limit of this flow alone */
+    TokenBucketT bucket;
+
+    /** Bytes the flow may still send in its turn, see ``Scheduler_acquire`` */
+    int64_t deficit;
+} SchedFlowT;
+
+/**
+ * Shares bandwidth between concurrent flows.
+ *
+ * Every flow is limited by its own bucket and all of them by a global one. When the
+ * global limit is set the flows take turns with deficit round robin, each turn
+ * allows a flow ``SCHED_QUANTUM`` bytes times the weight of its priority, so a big
+ * bulk transfer can't starve small urgent ones.
+ *
+ * .. note:: Without a global limit priorities are ignored, every flow sends as fast
+ *    as it can. The scheduler doesn't know the capacity of the link, turns would
+ *    only leave it idle while the flow holding one waits for responses.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    /** Limit shared by all flows */
+    TokenBucketT global;
+
+    /** Registered flows, ``SchedFlowT *`` in the order they take turns */
+    ListT *flows;
+
+    /** Index of the flow whose turn it is */
+    size_t turn;
+} SchedulerT;
+
+bool sched_rate_from_str(const char *str, double *rate);
+bool sched_priority_from_str(const char *str, SchedPriorityE *priority);
+SchedulerT *Scheduler_new(double global_rate);
+void Scheduler_set_rate(SchedulerT *self, SchedFlowT *flow, double rate);
+void SchedFlow_init(SchedFlowT *self, SchedPriorityE priority, double rate);
+void Scheduler_register(SchedulerT *self, SchedFlowT *flow);
+void Scheduler_unregister(SchedulerT *self, SchedFlowT *flow);
+bool Scheduler_acquire(SchedulerT *self, SchedFlowT *flow, size_t num_bytes,
+                       const atomic_bool *cancelled);
+void Scheduler_refund(SchedulerT *self, SchedFlowT *flow, size_t num_bytes);
+void Scheduler_free(SchedulerT *self);
+
+#endif /* SFTP_SCHED_H */
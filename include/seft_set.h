@@ -0,0 +1,32 @@
+#ifndef SFTP_SET_H
+#define SFTP_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Initial number of slots of a ``StrSetT``, always a power of two */
+#define STR_SET_MIN_CAPACITY 64
+
+/** Hash set of strings, using open addressing with linear probing */
+typedef struct {
+    /** Slots of the set, NULL for empty slots. Each item is owned by the set */
+    char **items;
+
+    /** Hash of the item in the same slot */
+    uint64_t *hashes;
+
+    /** Number of items in the set */
+    size_t length;
+
+    /** Number of slots, always a power of two */
+    size_t capacity;
+} StrSetT;
+
+uint64_t str_hash(const char *str, size_t length);
+StrSetT *StrSet_new(size_t capacity);
+bool StrSet_contains(const StrSetT *self, const char *str, size_t length);
+bool StrSet_add(StrSetT *self, const char *str, size_t length);
+void StrSet_free(StrSetT *self);
+
+#endif /* SFTP_SET_H */
@@ -0,0 +1,55 @@
+#ifndef SFTP_SORT_H
+#define SFTP_SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "seft_list.h"
+
+/** Lists with at least these many entries are sorted on multiple threads. */
+#define SORT_PARALLEL_THRESHOLD 65536
+
+/** Upper bound on the number of threads used for a parallel sort. */
+#define SORT_MAX_THREADS 8
+
+/** Fields a listing can be sorted by. */
+typedef enum {
+    /** Name, using the collation order of the current locale */
+    SORT_BY_NAME = 0,
+
+    /** Name, comparing runs of digits by their numeric value, ``f2`` before ``f10`` */
+    SORT_BY_NATURAL,
+
+    /** Size, largest first */
+    SORT_BY_SIZE,
+
+    /** Modification time, newest first */
+    SORT_BY_MTIME,
+
+    /** Type, directories first then links, files and everything else */
+    SORT_BY_TYPE,
+} SortFieldE;
+
+/** A compact sort key, the entry it belongs to is referenced by ``index`` */
+typedef struct {
+    /** Numeric key for size, mtime and type sorts, smaller keys come first */
+    uint64_t key;
+
+    /** Name of the entry, used for name sorts and to break ties */
+    const char *name;
+
+    /** Index of the entry in the list being sorted */
+    size_t index;
+} SortKeyT;
+
+/** Comparator over ``SortKeyT``, compatible with ``qsort`` */
+typedef int (*SortCompareT)(const void *, const void *);
+
+bool sort_field_from_str(const char *str, SortFieldE *field);
+SortCompareT sort_get_compare(SortFieldE field);
+int str_natural_compare(const char *str, const char *other);
+void sort_keys(SortKeyT *keys, size_t length, SortCompareT compare);
+void sort_attributes(ListT *attributes, SortFieldE field, bool reverse);
+
+#endif /* SFTP_SORT_H */
@@ -0,0 +1,66 @@
+#ifndef SFTP_TAR_H
+#define SFTP_TAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Archives are made of blocks of this size, headers take one */
+#define TAR_BLOCK_SIZE 512
+
+/** Names and link targets longer than this go in an entry of their own */
+#define TAR_LEN_NAME 100
+
+/** Types of archive entries */
+typedef enum {
+    /** Old archives mark regular files with a NUL instead */
+    TAR_TYPE_FILE = '0',
+    TAR_TYPE_HARD_LINK = '1',
+    TAR_TYPE_SYM_LINK = '2',
+    TAR_TYPE_DIRECTORY = '5',
+
+    /** GNU entries holding the long name or link target of the entry after them */
+    TAR_TYPE_LONG_NAME = 'L',
+    TAR_TYPE_LONG_LINK = 'K',
+
+    /** POSIX entries holding extended attributes of the next entry or all of them */
+    TAR_TYPE_PAX = 'x',
+    TAR_TYPE_PAX_GLOBAL = 'g',
+} TarTypeE;
+
+/** Read exactly ``length`` bytes of an archive, False on errors and early ends */
+typedef bool (*TarReadT)(void *data, void *buf, size_t length);
+
+/** Write ``length`` bytes of an archive, False on errors */
+typedef bool (*TarWriteT)(void *data, const void *buf, size_t length);
+
+/** A file system object in an archive, its contents follow the header */
+typedef struct {
+    /** Path relative to the root of the archive */
+    char *name;
+
+    /** ``TarTypeE``, or the type flag of an entry of another kind */
+    char type;
+
+    /** Bytes of contents, only regular files have any */
+    uint64_t size;
+
+    /** Permission bits */
+    uint32_t mode;
+
+    /** Modification time in seconds since the epoch */
+    uint64_t mtime;
+
+    /** Target of links, NULL for other entries */
+    char *link_target;
+} TarEntryT;
+
+bool tar_write_header(TarWriteT write, void *data, const TarEntryT *entry);
+bool tar_write_padding(TarWriteT write, void *data, uint64_t size);
+bool tar_write_end(TarWriteT write, void *data);
+bool tar_read_header(TarReadT read, void *data, TarEntryT *entry, bool *is_end);
+bool tar_skip(TarReadT read, void *data, uint64_t size);
+bool tar_name_is_safe(const char *name);
+void TarEntry_clear(TarEntryT *self);
+
+#endif /* SFTP_TAR_H */
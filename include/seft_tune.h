@@ -0,0 +1,88 @@
+#ifndef SFTP_TUNE_H
+#define SFTP_TUNE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <libssh/sftp.h>
+
+/** Smallest chunk read or written with one request, chunks are multiples of it */
+#define TUNE_MIN_CHUNK 16384
+
+/** Largest chunk every server has to accept, used when it can't tell its limits */
+#define TUNE_DEFAULT_MAX_CHUNK 32768
+
+/** Limits of OpenSSH servers that announce ``limits@openssh.com``, used when the
+ * extension can't be queried */
+#define TUNE_OPENSSH_MAX_CHUNK 261120
+
+/** Chunks never exceed this whatever the server claims, common implementations
+ * reject SFTP packets larger than 256 KiB */
+#define TUNE_MAX_CHUNK 262144
+
+/** Bounds of the number of requests a transfer keeps in flight */
+#define TUNE_MIN_WINDOW 4
+#define TUNE_MAX_WINDOW 64
+
+/** Bytes kept in flight as a multiple of the bandwidth-delay product */
+#define TUNE_GAIN 2.0
+
+/** Throughput is measured over at least this long, or one round trip if longer */
+#define TUNE_MIN_INTERVAL 0.01
+
+/** The highest throughput seen decays by this much per interval, so it can drop */
+#define TUNE_RATE_DECAY 0.95
+
+/** The minimum round trip is forgotten after this many samples, so it can rise */
+#define TUNE_RTT_REFRESH 256
+
+/**
+ * Chunk size and request window of transfers, adapted to the link they run over.
+ *
+ * Much like TCP congestion control, the bandwidth-delay product is estimated from
+ * the highest throughput and the lowest round trip measured, and ``TUNE_GAIN``
+ * times it is kept in flight. While the window is what limits the throughput every
+ * interval doubles it, once the link is what limits it the estimate settles.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+
+    /** Largest chunk the server accepts */
+    size_t max_chunk;
+
+    /** Bytes read or written with one request */
+    size_t chunk;
+
+    /** Requests kept in flight */
+    size_t window;
+
+    /** Smoothed round trip of a request in seconds */
+    double srtt;
+
+    /** Lowest round trip in seconds, the delay of the link without queueing */
+    double min_rtt;
+
+    /** Highest throughput in bytes per second, decaying */
+    double max_rate;
+
+    /** Start of the current throughput interval and bytes received in it */
+    struct timespec interval_start;
+    uint64_t interval_bytes;
+
+    /** Requests measured so far */
+    uint64_t num_samples;
+} TuneT;
+
+double tune_elapsed(const struct timespec *since);
+TuneT *Tune_new(sftp_session session_sftp);
+TuneT *Tune_copy(TuneT *self);
+void Tune_begin(TuneT *self);
+void Tune_get(TuneT *self, bool pipelined, size_t *chunk, size_t *window);
+void Tune_sample(TuneT *self, size_t num_bytes, double rtt);
+void Tune_print(TuneT *self);
+void Tune_free(TuneT *self);
+
+#endif /* SFTP_TUNE_H */
@@ -19,7 +19,7 @@
 #define BIT_GET(bit_mask, pos) (((bit_mask) >> (pos)) & 1UL)
 
 /** Macro to get the ceiling of a division */
-#define CEIL(dividend, divisor) ((dividend) / (divisor) + (dividend) % (divisor))
+#define CEIL(dividend, divisor) (((dividend) + (divisor) - 1) / (divisor))
 
 /** Macro to check if ``__VA_ARGS__`` passed to a macro is empty */
 #define VA_ARGS_IS_EMPTY(...) (sizeof((char[]){#__VA_ARGS__}) == 1)
@@ -27,7 +27,7 @@
 uint32_t get_window_column_length(void);
 uint32_t u32_list_sum(ListT *self);
 size_t char_list_max_len(ListT *self);
-ListT *char_list_equalized_slice(ListT *self, size_t len_rows, size_t len_cols);
+uint32_t str_display_width(const char *str);
 void char_list_format_columnwise(ListT *self, size_t width_screen, char *delimiter);
 bool check_show_hidden(char *path_str, size_t length, uint8_t flag);
 bool check_path_type(char *path_str, size_t length, bool is_dir, uint8_t flag);
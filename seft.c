@@ -1,8 +1,13 @@
 #include <argp.h>
+#include <errno.h>
+#include <locale.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <libssh/sftp.h>
 
@@ -10,11 +15,22 @@
 #include "config.h"
 #include "seft_debug.h"
 #include "seft_ansi_colors.h"
+#include "seft_checksum.h"
 #include "seft_client.h"
+#include "seft_crypto.h"
+#include "seft_filter.h"
+#include "seft_jobs.h"
+#include "seft_list.h"
+#include "seft_sched.h"
+#include "seft_sort.h"
+#include "seft_tune.h"
 #include "seft_utils.h"
 
 #define MAX_NUM_COMMANDS 128
 
+/** How often finished background jobs are looked for while waiting for input */
+#define JOB_POLL_INTERVAL_MS 500
+
 const char *argp_program_version = "SFTP-CLI 0.1";
 
 static char doc_header_connect[] =
@@ -24,6 +40,15 @@ static struct argp_option option_connect[] = {
     {"subsystem", 's', "SUBSYSTEM", 0, "Specify the server subsystem to connect to",
     0},
     {"port", 'p', "PORT", 0, "Port number of the server", 0},
+    {"compression", 'C', "MODE", 0,
+    "Compress traffic with zlib: no (default), yes or auto to compress only the files "
+    "that shrink", 0},
+    {"ciphers", 'c', "LIST", 0,
+    "Ciphers to offer, most preferred first, or auto to order them by a benchmark", 0},
+    {"macs", 'm', "LIST", 0, "MACs to offer, most preferred first", 0},
+    {"kex", 'k', "LIST", 0, "Key exchange methods to offer, most preferred first", 0},
+    {"config", 'f', "FILE", 0,
+    "Read 'key = value' lines setting ciphers, macs and kex from FILE", 0},
     {0},
 };
 
@@ -37,17 +62,41 @@ static struct argp_option option_list[] = {
     {"all", 'a', "SHOW_ALL", OPTION_ARG_OPTIONAL, "Show hidden and non-hidden files",
     0},
     {"reverse", 'r', "REVERSE", OPTION_ARG_OPTIONAL, "Display in reverse order", 0},
-    {"sort", 's', "SORT", OPTION_ARG_OPTIONAL, "Sort by specified field", 0},
+    {"targets", 'T', "LINK_TARGETS", OPTION_ARG_OPTIONAL,
+    "Show symbolic link targets in long listing format", 0},
+    {"sort", 's', "SORT", OPTION_ARG_OPTIONAL,
+    "Sort by specified field: name (default), natural, size, mtime or type", 0},
     {"help", 'h', "HELP", OPTION_ARG_OPTIONAL, "Show help documentation", 0},
     {0},
 };
 
 static char doc_header_copy[] =
     "Synchronize filesystem bidirectionally between remote and local destinations.";
-static char doc_copy[] = "[OPTIONS]";
+static char doc_copy[] = "[OPTIONS] SOURCE... DEST";
 static struct argp_option option_copy[] = {
     {"local", 'l', 0, 0, "Copy filesystem object to the local computer", 0},
     {"remote", 'r', 0, 0, "Copy filesystem object to the remote server", 0},
+    {"links", 'k', "POLICY", 0,
+    "How to copy symbolic links: preserve (default), follow or skip", 0},
+    {"preserve", 'p', 0, 0, "Preserve permissions, access and modification times", 0},
+    {"exclude", 'x', "PATTERN", 0, "Skip filesystem objects matching PATTERN", 0},
+    {"include", 'i', "PATTERN", 0,
+    "Copy filesystem objects matching PATTERN, even if a later rule excludes them", 0},
+    {"exclude-from", 'X', "FILE", 0,
+    "Read rules from FILE, one per line: '- PATTERN', '+ PATTERN' or PATTERN", 0},
+    {"priority", 'P', "CLASS", 0,
+    "Share of bandwidth against other copies: bulk, normal (default) or high. Only "
+    "used while the 'bandwidth' command sets a global limit", 0},
+    {"verify", 'V', 0, 0, "Hash files while they are copied and check the copies", 0},
+    {"limit-rate", 'R', "RATE", 0,
+    "Copy at most RATE bytes per second, K, M and G multiply by powers of 1024", 0},
+    {"bulk", 'B', "MODE", 0,
+    "Copy directories of many small files as one tar stream: auto (default), tar, "
+    "archive (upload DEST.tar over SFTP and leave it packed there) or no. Filtered "
+    "downloads always go file by file", 0},
+    {"cache", 'c', "POLICY", 0,
+    "Page cache use of local files: keep (default) or drop, writing downloads back "
+    "and dropping files behind the copy", 0},
     {0},
 };
 
@@ -64,19 +113,47 @@ static struct argp_option option_create[] = {
 typedef struct {
     char *host;
     uint32_t port;
+    CompressionE compression;
+
+    /** Starts as a copy of ``crypto_prefs`` and is changed by the options */
+    CryptoPrefsT *crypto;
+
+    /** Set if an option had an invalid value, nothing is connected to then */
+    bool is_invalid;
 } ConnectArgsT;
 
 typedef struct {
     char *dir;
     uint8_t flag;
+    SortFieldE sort_field;
+
+    /** Set if an option had an invalid value, nothing is listed then */
+    bool is_invalid;
 } ListArgsT;
 
 typedef struct {
 #define FLAG_COPY_BIT_POS_IS_SET 0x0
 #define FLAG_COPY_BIT_POS_IS_REMOTE 0x1
     uint8_t flag;
-    char *source;
+
+    /** Sources followed by the destination, sources can be glob patterns. The
+     * destination is moved to ``dest`` once all arguments are parsed. */
+    ListT *paths;
     char *dest;
+
+    /** Priority of the copy when it shares a global bandwidth limit with others */
+    SchedPriorityE priority;
+
+    /** Limit of the copy alone in bytes per second, 0 for none */
+    double limit_rate;
+
+    /** Flow of the copy, its limit can be changed while a background copy runs */
+    SchedFlowT flow;
+    CopyOptionsT options;
+
+    /** Set if an option had an invalid value or a filter rule couldn't be added,
+     * nothing is copied then */
+    bool is_invalid;
 } CopyArgsT;
 
 typedef struct {
@@ -90,12 +167,30 @@ typedef struct {
 static ssh_session session_ssh = NULL;
 static sftp_session session_sftp = NULL;
 
+/** Background jobs, they use connections of their own */
+static JobTableT *jobs = NULL;
+
+/** Second, compressed sessions used by foreground copies with ``connect -C auto`` */
+static ssh_session compressed_ssh = NULL;
+static sftp_session compressed_sftp = NULL;
+
+/** Algorithms offered when connecting, read from the config file */
+static CryptoPrefsT *crypto_prefs = NULL;
+
+/** Shares bandwidth between the foreground copy and background jobs */
+static SchedulerT *scheduler = NULL;
+
+/** Chunk size and window learned by foreground copies to the current server,
+ * background copies start from a copy of it */
+static TuneT *tune = NULL;
+
 char **
 get_arg_vec(char *input, int32_t *length) {
     static char *arg_vec[MAX_NUM_COMMANDS + 1];
     *length = 0;
 
-    for (char *token = strtok(input, " "); token != NULL; token = strtok(NULL, " ")) {
+    for (char *token = strtok(input, " "); token != NULL && *length < MAX_NUM_COMMANDS;
+         token = strtok(NULL, " ")) {
         arg_vec[(*length)++] = strdup(token);
     }
 
@@ -122,7 +217,14 @@ parse_option_list(int32_t key, char *arg, struct argp_state *state) {
         case 'r':
             BIT_SET(args->flag, FLAG_LIST_BIT_POS_SORT_REVERSE);
             break;
+        case 'T':
+            BIT_SET(args->flag, FLAG_LIST_BIT_POS_LINK_TARGET);
+            break;
         case 's':
+            if (!sort_field_from_str(arg, &args->sort_field)) {
+                DBG_ERR("Unknown sort field: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
             BIT_SET(args->flag, FLAG_LIST_BIT_POS_SORT);
             break;
         case 'h':
@@ -164,6 +266,54 @@ parse_option_copy(int32_t key, char *arg, struct argp_state *state) {
         case 'f':
             BIT_CLEAR(args->flag, FLAG_CREATE_BIT_POS_IS_DIR);
             break;
+        case 'p':
+            args->options.preserve = true;
+            break;
+        case 'V':
+            args->options.verify = true;
+            break;
+        case 'c':
+            if (!cache_policy_from_str(arg, &args->options.cache)) {
+                DBG_ERR("Unknown cache policy: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
+            break;
+        case 'x':
+        case 'i':
+        case 'X':
+            /* Rules are compiled as they come, keeping their order */
+            if (args->options.filter == NULL) {
+                args->options.filter = Filter_new();
+            }
+            if (key == 'X' ? !Filter_add_file(args->options.filter, arg)
+                           : !Filter_add_rule(args->options.filter, arg, key == 'i')) {
+                args->is_invalid = true;
+            }
+            break;
+        case 'k':
+            if (!link_policy_from_str(arg, &args->options.link_policy)) {
+                DBG_ERR("Unknown link policy: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
+            break;
+        case 'B':
+            if (!bulk_mode_from_str(arg, &args->options.bulk)) {
+                DBG_ERR("Unknown bulk mode: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
+            break;
+        case 'P':
+            if (!sched_priority_from_str(arg, &args->priority)) {
+                DBG_ERR("Unknown priority: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
+            break;
+        case 'R':
+            if (!sched_rate_from_str(arg, &args->limit_rate)) {
+                DBG_ERR("Invalid rate: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
+            break;
         case 'h':
             argp_state_help(state, stdout,
                             ARGP_HELP_DOC | ARGP_HELP_LONG | ARGP_HELP_USAGE);
@@ -178,11 +328,7 @@ parse_option_copy(int32_t key, char *arg, struct argp_state *state) {
             if (arg == NULL) {
                 break;
             }
-            if (state->arg_num == 0) {
-                args->source = strdup(arg);
-            } else if (state->arg_num == 1) {
-                args->dest = strdup(arg);
-            }
+            List_push(args->paths, arg, strlen(arg) + 1);
             break;
         }
     }
@@ -236,6 +382,26 @@ parse_option_connect(int32_t key, char *arg, struct argp_state *state) {
         case 'p':
             args->port = atoi(arg);
             break;
+        case 'C':
+            if (!compression_from_str(arg, &args->compression)) {
+                DBG_ERR("Unknown compression mode: " ANSI_FG_GREEN "%s" ANSI_RESET, arg);
+                args->is_invalid = true;
+            }
+            break;
+        case 'c':
+            CryptoPrefs_set(args->crypto, "ciphers", arg);
+            break;
+        case 'm':
+            CryptoPrefs_set(args->crypto, "macs", arg);
+            break;
+        case 'k':
+            CryptoPrefs_set(args->crypto, "kex", arg);
+            break;
+        case 'f':
+            if (!CryptoPrefs_load(args->crypto, arg)) {
+                args->is_invalid = true;
+            }
+            break;
         case 'h':
             argp_state_help(state, stdout,
                             ARGP_HELP_DOC | ARGP_HELP_LONG | ARGP_HELP_USAGE);
@@ -251,18 +417,159 @@ parse_option_connect(int32_t key, char *arg, struct argp_state *state) {
     return 0;
 }
 
+/** Free the arguments of a copy, but not ``args`` itself. */
+static void
+copy_args_clear(CopyArgsT *args) {
+    for (size_t i = 0; i < List_length(args->paths); i++) {
+        free(List_get(args->paths, i));
+    }
+    List_free(args->paths);
+    free(args->dest);
+
+    if (args->options.filter != NULL) {
+        Filter_free(args->options.filter);
+    }
+}
+
+/** Run a copy as a flow of ``scheduler``, for as long as it runs. */
+static CommandStatusE
+copy_run(ssh_session session_ssh, sftp_session session_sftp, CopyArgsT *args) {
+    CommandStatusE result;
+
+    Scheduler_register(scheduler, &args->flow);
+    args->options.scheduler = scheduler;
+    args->options.flow = &args->flow;
+
+    if (BIT_MATCH(args->flag, FLAG_COPY_BIT_POS_IS_REMOTE)) {
+        result = copy_many_from_remote_to_local(session_ssh, session_sftp, args->paths,
+                                                args->dest, &args->options);
+    } else {
+        result = copy_many_from_local_to_remote(session_ssh, session_sftp, args->paths,
+                                                args->dest, &args->options);
+    }
+
+    Scheduler_unregister(scheduler, &args->flow);
+    return result;
+}
+
+/** ``JobRunT`` of a background copy, its data is a heap allocated ``CopyArgsT`` */
+static CommandStatusE
+copy_job_run(JobT *job) {
+    CopyArgsT *args = job->data;
+
+    args->options.progress = &job->progress;
+    args->options.compressed_ssh = job->compressed_connection.session_ssh;
+    args->options.compressed_sftp = job->compressed_connection.session_sftp;
+    return copy_run(job->connection.session_ssh, job->connection.session_sftp, args);
+}
+
+static void
+copy_job_free(void *data) {
+    CopyArgsT *args = data;
+
+    if (args->options.tune != NULL) {
+        Tune_free(args->options.tune);
+    }
+    copy_args_clear(args);
+    free(args);
+}
+
+/** Parse a job number given to ``wait`` or ``cancel``, ``%2`` and ``2`` are the same */
+static size_t
+job_id_from_str(const char *str) {
+    return strtoul(*str == '%' ? str + 1 : str, NULL, 10);
+}
+
+/**
+ * Open the compressed sessions of ``connect -C auto``, authenticated with the
+ * password of the main session. Copies send everything over the main session if
+ * they can't be opened.
+ */
+static void
+compressed_open(char *host, uint32_t port, const CryptoPrefsT *crypto,
+                CredentialsT *credentials) {
+    compressed_ssh = try_ssh_init(host, port, true, crypto, credentials);
+    if (compressed_ssh != NULL) {
+        compressed_sftp = try_sftp_init(compressed_ssh);
+        if (compressed_sftp == NULL) {
+            clean_ssh_session(compressed_ssh);
+            compressed_ssh = NULL;
+        }
+    }
+
+    if (compressed_ssh == NULL) {
+        DBG_ERR("Couldn't open a compressed session to %s, copies won't be compressed",
+                host);
+    }
+}
+
+static void
+compressed_close(void) {
+    if (compressed_sftp != NULL) {
+        clean_sftp_session(compressed_sftp);
+        clean_ssh_session(compressed_ssh);
+    }
+    compressed_sftp = NULL;
+    compressed_ssh = NULL;
+}
+
+/** Print a bandwidth limit in bytes per second, or that there is none. */
+static void
+print_rate(double rate) {
+    if (!rate) {
+        puts("Bandwidth: unlimited");
+    } else if (rate >= 1024 * 1024) {
+        printf("Bandwidth: %.1f MiB/s\n", rate / (1024 * 1024));
+    } else {
+        printf("Bandwidth: %.1f KiB/s\n", rate / 1024);
+    }
+}
+
+/** Join arguments back into a command line, the result must be freed by the caller */
+static char *
+arg_vec_join(char **arg_vec, uint32_t length) {
+    size_t len_command = 1;
+    char *command;
+
+    for (uint32_t i = 0; i < length; i++) {
+        len_command += strlen(arg_vec[i]) + 1;
+    }
+
+    command = DBG_CALLOC(len_command, sizeof *command);
+    for (uint32_t i = 0; i < length; i++) {
+        if (i) {
+            strcat(command, " ");
+        }
+        strcat(command, arg_vec[i]);
+    }
+
+    return command;
+}
+
 static CommandStatusE
 subcommand_dispatcher(char **arg_vec, uint32_t length) {
     char *subcommand;
     struct argp arg_parser;
+    bool background;
 
     if (length < 1) {
         return CMD_INVALID_ARGS_COUNT;
     }
 
+    /* A trailing ``&`` runs the command in the background, like in shells */
+    background = length > 1 && !strcmp(arg_vec[length - 1], "&");
+    if (background) {
+        length--;
+    }
+
     subcommand = arg_vec[0];
+    if (background && strcmp(subcommand, "copy")) {
+        DBG_ERR("Only copy can run in the background, running %s now", subcommand);
+        background = false;
+    }
+
     if (!strcmp(subcommand, "list")) {
-        ListArgsT list_args = {NULL, 0};
+        ListArgsT list_args = {NULL, 0, SORT_BY_NAME, false};
 
         arg_parser = (struct argp){
             option_list, parse_option_list, doc_list, doc_header_list, 0, 0, 0};
@@ -273,39 +580,122 @@ subcommand_dispatcher(char **arg_vec, uint32_t length) {
             return CMD_OK;
         }
 
-        if (list_args.dir == NULL) {
+        if (list_args.dir == NULL || list_args.is_invalid) {
+            free(list_args.dir);
             return CMD_INVALID_ARGS_TYPE;
         }
-        list_remote_dir(session_ssh, session_sftp, list_args.dir, list_args.flag);
+        list_remote_dir(session_ssh, session_sftp, list_args.dir, list_args.flag,
+                        list_args.sort_field);
 
         free(list_args.dir);
 
     } else if (!strcmp(subcommand, "copy")) {
-        CopyArgsT copy_args = {0, NULL, NULL};
+        CopyArgsT copy_args = {
+            .paths = List_new(2, sizeof(char *)),
+            .priority = SCHED_PRIORITY_NORMAL,
+            .options = {.link_policy = LINK_PRESERVE, .bulk = BULK_AUTO,
+                        .cache = CACHE_KEEP},
+        };
+        CopyArgsT *job_args;
+        CommandStatusE result;
+        char *command;
 
         arg_parser = (struct argp){
             option_copy, parse_option_copy, doc_copy, doc_header_copy, 0, 0, 0};
         argp_parse(&arg_parser, length, arg_vec, 0, 0, &copy_args);
 
         /* Print help message and continue */
-        if (length == 1) {
+        if (length == 1 || List_length(copy_args.paths) < 2 || copy_args.is_invalid) {
+            copy_args_clear(&copy_args);
+            return length == 1 ? CMD_OK : CMD_INVALID_ARGS_TYPE;
+        }
+
+        copy_args.dest = List_pop(copy_args.paths);
+        SchedFlow_init(&copy_args.flow, copy_args.priority, copy_args.limit_rate);
+        if (!background) {
+            copy_args.options.compressed_ssh = compressed_ssh;
+            copy_args.options.compressed_sftp = compressed_sftp;
+            copy_args.options.tune = tune;
+            result = copy_run(session_ssh, session_sftp, &copy_args);
+            copy_args_clear(&copy_args);
+            return result;
+        }
+
+        job_args = DBG_MALLOC(sizeof *job_args);
+        *job_args = copy_args;
+        job_args->options.tune = tune != NULL ? Tune_copy(tune) : NULL;
+        command = arg_vec_join(arg_vec, length);
+        JobTable_spawn(jobs, command, copy_job_run, job_args, copy_job_free);
+        free(command);
+
+    } else if (!strcmp(subcommand, "jobs")) {
+        JobTable_print(jobs);
+
+        /* Copies only take turns by priority under a global limit */
+        if (!List_is_empty(jobs->jobs)) {
+            print_rate(scheduler->global.rate);
+            if (!scheduler->global.rate) {
+                puts("Priorities are ignored until 'bandwidth RATE' sets a limit");
+            }
+        }
+
+    } else if (!strcmp(subcommand, "wait")) {
+        return JobTable_wait(jobs, length > 1 ? job_id_from_str(arg_vec[1]) : 0);
+
+    } else if (!strcmp(subcommand, "cancel")) {
+        if (length < 2) {
+            return CMD_INVALID_ARGS_COUNT;
+        }
+        return JobTable_cancel(jobs, job_id_from_str(arg_vec[1]));
+
+    } else if (!strcmp(subcommand, "stats")) {
+        TuneT *shown = tune;
+        JobT *job;
+
+        /* Background copies tune themselves, starting from the foreground tuning */
+        if (length > 1) {
+            if ((job = JobTable_get(jobs, job_id_from_str(arg_vec[1]))) == NULL) {
+                return CMD_INVALID_ARGS_TYPE;
+            }
+            shown = ((CopyArgsT *)job->data)->options.tune;
+        }
+
+        if (shown == NULL) {
+            puts("Not connected");
             return CMD_OK;
         }
+        Tune_print(shown);
+
+    } else if (!strcmp(subcommand, "bench")) {
+        checksum_benchmark();
 
-        if (copy_args.source == NULL || copy_args.dest == NULL) {
+    } else if (!strcmp(subcommand, "bandwidth")) {
+        double rate;
+
+        if (length < 2) {
+            print_rate(scheduler->global.rate);
+            return CMD_OK;
+        }
+        if (!sched_rate_from_str(arg_vec[1], &rate)) {
+            DBG_ERR("Invalid rate: " ANSI_FG_GREEN "%s" ANSI_RESET, arg_vec[1]);
             return CMD_INVALID_ARGS_TYPE;
         }
+        Scheduler_set_rate(scheduler, NULL, rate);
+
+    } else if (!strcmp(subcommand, "limit")) {
+        JobT *job;
+        double rate;
 
-        if (BIT_MATCH(copy_args.flag, FLAG_COPY_BIT_POS_IS_REMOTE)) {
-            copy_from_remote_to_local(session_ssh, session_sftp, copy_args.source,
-                                      copy_args.dest);
-        } else {
-            copy_from_local_to_remote(session_ssh, session_sftp, copy_args.source,
-                                      copy_args.dest);
+        if (length < 3) {
+            return CMD_INVALID_ARGS_COUNT;
+        }
+        if ((job = JobTable_get(jobs, job_id_from_str(arg_vec[1]))) == NULL ||
+            !sched_rate_from_str(arg_vec[2], &rate)) {
+            return CMD_INVALID_ARGS_TYPE;
         }
 
-        free(copy_args.source);
-        free(copy_args.dest);
+        /* Only copies run in the background, the data of every job is a copy */
+        Scheduler_set_rate(scheduler, &((CopyArgsT *)job->data)->flow, rate);
 
     } else if (!strcmp(subcommand, "create")) {
         CreateArgsT create_args = {0, NULL};
@@ -336,7 +726,9 @@ subcommand_dispatcher(char **arg_vec, uint32_t length) {
         free(create_args.filesystem);
 
     } else if (!strcmp(subcommand, "connect")) {
-        ConnectArgsT connect_args = {NULL, 0};
+        ConnectArgsT connect_args = {NULL, 0, COMPRESSION_NO,
+                                     CryptoPrefs_copy(crypto_prefs), false};
+        CredentialsT credentials = {0};
 
         arg_parser = (struct argp){option_connect,
                                    parse_option_connect,
@@ -348,17 +740,32 @@ subcommand_dispatcher(char **arg_vec, uint32_t length) {
         argp_parse(&arg_parser, length, arg_vec, 0, 0, &connect_args);
 
         /* Print help message and continue */
-        if (length == 1) {
-            return CMD_OK;
+        if (length == 1 || connect_args.host == NULL || connect_args.is_invalid) {
+            CryptoPrefs_free(connect_args.crypto);
+            free(connect_args.host);
+            return length == 1 ? CMD_OK : CMD_INVALID_ARGS_TYPE;
         }
 
-        if (connect_args.host == NULL) {
-            return CMD_INVALID_ARGS_TYPE;
-        }
-
-        session_ssh = do_ssh_init(connect_args.host, connect_args.port);
+        session_ssh = do_ssh_init(connect_args.host, connect_args.port,
+                                  connect_args.compression == COMPRESSION_YES,
+                                  connect_args.crypto, &credentials);
         session_sftp = do_sftp_init(session_ssh);
+        if (tune != NULL) {
+            Tune_free(tune);
+        }
+        tune = Tune_new(session_sftp);
+        JobTable_set_server(jobs, connect_args.host, connect_args.port,
+                            connect_args.compression, connect_args.crypto,
+                            &credentials);
+
+        compressed_close();
+        if (connect_args.compression == COMPRESSION_AUTO) {
+            compressed_open(connect_args.host, connect_args.port, connect_args.crypto,
+                            &credentials);
+        }
+        Credentials_clear(&credentials);
 
+        CryptoPrefs_free(connect_args.crypto);
         free(connect_args.host);
     } else {
         return CMD_INVALID_COMMAND;
@@ -366,11 +773,46 @@ subcommand_dispatcher(char **arg_vec, uint32_t length) {
     return CMD_OK;
 }
 
+/**
+ * Wait until a line can be read from ``stdin``, finished background jobs are
+ * reported in the meantime.
+ *
+ * :return: False if ``stdin`` can't be read anymore.
+ */
+static bool
+wait_for_input(void) {
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    int ready;
+
+    while ((ready = poll(&input, 1, JOB_POLL_INTERVAL_MS)) <= 0) {
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+
+        if (JobTable_reap(jobs)) {
+            printf(REPL_PROMPT);
+            fflush(stdout);
+        }
+    }
+
+    return true;
+}
+
 int
 main(int length, char *arg_vec[]) {
     char input[4096];
     CommandStatusE result;
 
+    /* Sort names the way the user's locale collates them */
+    setlocale(LC_COLLATE, "");
+
+    /* Lines are read straight from the terminal, so ``poll`` sees all pending input */
+    setvbuf(stdin, NULL, _IONBF, 0);
+    jobs = JobTable_new();
+    scheduler = Scheduler_new(0);
+    crypto_prefs = CryptoPrefs_new();
+    CryptoPrefs_load_default(crypto_prefs);
+
     /* Skipping file name */
     arg_vec++;
     length--;
@@ -387,8 +829,10 @@ main(int length, char *arg_vec[]) {
             arg_vec[0]);
         }
 
+        JobTable_reap(jobs);
         printf(REPL_PROMPT);
-        if (fgets(input, sizeof(input), stdin) == NULL) {
+        fflush(stdout);
+        if (!wait_for_input() || fgets(input, sizeof(input), stdin) == NULL) {
             break;
         }
 
@@ -397,6 +841,15 @@ main(int length, char *arg_vec[]) {
         arg_vec = get_arg_vec(input, &length);
     }
 
+    /* Background jobs are cancelled, not waited for */
+    JobTable_free(jobs);
+    Scheduler_free(scheduler);
+    CryptoPrefs_free(crypto_prefs);
+    if (tune != NULL) {
+        Tune_free(tune);
+    }
+
+    compressed_close();
     if (session_sftp != NULL && session_ssh != NULL) {
         DBG_INFO("Cleaning up ssh and sftp sessions: %s", "");
         clean_sftp_session(session_sftp);
@@ -0,0 +1,911 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "seft_batch.h"
+#include "seft_debug.h"
+#include "seft_metadata.h"
+#include "seft_path.h"
+
+/** Requests sent for a file, the low bits of their ids, the slot is in the others */
+typedef enum {
+    BATCH_STEP_OPEN = 0,
+    BATCH_STEP_WRITE,
+    BATCH_STEP_SETSTAT,
+    BATCH_STEP_CLOSE,
+
+    /** Other operations send one or two requests: a mkdir checks its outcome with a
+     * stat right after it, a followed link is stated and resolved side by side and
+     * a stale entry is removed right before a symlink is created in its place */
+    BATCH_STEP_REQUEST = 0,
+    BATCH_STEP_STAT,
+    BATCH_STEP_REALPATH,
+    BATCH_STEP_SYMLINK,
+} BatchStepE;
+
+#define BATCH_STEP_BITS 2
+#define BATCH_STEP_MASK ((1U << BATCH_STEP_BITS) - 1)
+
+/** Length, type and id, the header of every request and response */
+#define BATCH_LEN_HEADER 9
+
+/** Grow a buffer to hold at least ``length`` bytes. */
+static bool
+batch_reserve(char **buf, size_t *capacity, size_t length) {
+    size_t new_capacity = *capacity ? *capacity : 4096;
+    char *grown;
+
+    if (length <= *capacity) {
+        return true;
+    }
+    while (new_capacity < length) {
+        new_capacity *= 2;
+    }
+
+    grown = DBG_REALLOC(*buf, new_capacity);
+    if (grown == NULL) {
+        return false;
+    }
+    *buf = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void
+batch_put_u32(char *buf, uint32_t value) {
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+static uint32_t
+batch_get_u32(const char *buf) {
+    const unsigned char *bytes = (const unsigned char *)buf;
+
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+           (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+/**
+ * Queue a request made of the header and ``num_parts`` strings or fixed fields.
+ *
+ * :param parts: Pairs of a pointer and a length. A negative length is a string,
+ *     sent with its length in front, its absolute value is the length.
+ */
+static bool
+batch_queue(BatchT *self, uint8_t type, uint32_t id, size_t num_parts,
+            const void *const *parts, const int64_t *lengths) {
+    size_t length = BATCH_LEN_HEADER;
+    char *buf;
+
+    for (size_t i = 0; i < num_parts; i++) {
+        length += lengths[i] < 0 ? 4 - lengths[i] : lengths[i];
+    }
+    if (!batch_reserve(&self->out, &self->cap_out, self->len_out + length)) {
+        return false;
+    }
+
+    buf = self->out + self->len_out;
+    batch_put_u32(buf, length - 4);
+    buf[4] = type;
+    batch_put_u32(buf + 5, id);
+    buf += BATCH_LEN_HEADER;
+
+    for (size_t i = 0; i < num_parts; i++) {
+        size_t len_part = lengths[i] < 0 ? -lengths[i] : lengths[i];
+
+        if (lengths[i] < 0) {
+            batch_put_u32(buf, len_part);
+            buf += 4;
+        }
+        memcpy(buf, parts[i], len_part);
+        buf += len_part;
+    }
+
+    self->len_out += length;
+    return true;
+}
+
+/** Send every queued request. */
+static bool
+batch_send(BatchT *self) {
+    size_t num_sent = 0;
+
+    while (num_sent < self->len_out) {
+        int num_written = ssh_channel_write(self->channel, self->out + num_sent,
+                                            self->len_out - num_sent);
+        if (num_written <= 0) {
+            return false;
+        }
+        num_sent += num_written;
+    }
+
+    self->len_out = 0;
+    return true;
+}
+
+/**
+ * Read the next response, the body after its header is left at the start of
+ * ``self->in``.
+ *
+ * :param type: [OUT] Type of the response.
+ * :param id: [OUT] Id of the request it responds to.
+ * :return: Length of the body, -1 if the channel failed.
+ */
+static int64_t
+batch_receive(BatchT *self, uint8_t *type, uint32_t *id) {
+    size_t length = BATCH_LEN_HEADER;
+
+    for (bool has_length = false;;) {
+        int num_read;
+
+        if (!has_length && self->len_in >= 4) {
+            length = 4 + batch_get_u32(self->in);
+            has_length = true;
+            if (length < BATCH_LEN_HEADER) {
+                return -1;
+            }
+        }
+        if (has_length && self->len_in >= length) {
+            break;
+        }
+
+        if (!batch_reserve(&self->in, &self->cap_in, length)) {
+            return -1;
+        }
+        num_read = ssh_channel_read(self->channel, self->in + self->len_in,
+                                    self->cap_in - self->len_in, 0);
+        if (num_read <= 0) {
+            return -1;
+        }
+        self->len_in += num_read;
+    }
+
+    *type = self->in[4];
+    *id = batch_get_u32(self->in + 5);
+    return length - BATCH_LEN_HEADER;
+}
+
+/** Drop the response read by ``batch_receive`` once it was handled. */
+static void
+batch_consume(BatchT *self, int64_t len_body) {
+    size_t length = len_body + BATCH_LEN_HEADER;
+
+    memmove(self->in, self->in + length, self->len_in - length);
+    self->len_in -= length;
+}
+
+/** Report a file whose responses have all arrived and free its slot. */
+static void
+batch_file_done(BatchT *self, BatchFileT *file) {
+    /* The writer of a stream learns of its outcome from ``Batch_close`` */
+    if (file->op == BATCH_OP_STREAM) {
+        ((BatchStreamT *)file->result)->failed |= file->failed;
+        ((BatchStreamT *)file->result)->is_open = false;
+    } else if (file->failed) {
+        self->num_failed++;
+    }
+    if (file->op == BATCH_OP_FILE) {
+        self->done(self->data, file->length, !file->failed);
+    }
+
+    free(file->path);
+    free(file->contents);
+    file->path = NULL;
+    file->contents = NULL;
+    self->num_files--;
+}
+
+/** Encode permissions and times as the attributes of a setstat. */
+static void
+batch_put_attrs(char *attrs, const MetadataT *metadata) {
+    /* Times go over as 32 bits in version 3 of the protocol */
+    batch_put_u32(attrs, SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME);
+    batch_put_u32(attrs + 4, metadata->permissions & MODE_PERMISSION_BITS);
+    batch_put_u32(attrs + 8, metadata->atime);
+    batch_put_u32(attrs + 12, metadata->mtime);
+}
+
+/**
+ * Send the write, setstat and close of a file the server just opened. The server
+ * handles the requests of a handle in order, so none of them waits for another.
+ */
+static bool
+batch_file_opened(BatchT *self, BatchFileT *file, uint32_t slot, const char *handle,
+                  uint32_t len_handle) {
+    uint32_t id = slot << BATCH_STEP_BITS;
+    char offset[8] = {0}, attrs[16];
+
+    /* The close only takes the handle, the first of the parts of the write */
+    const void *parts[] = {handle, offset, file->contents};
+    const int64_t lengths[] = {-(int64_t)len_handle, sizeof offset,
+                               -(int64_t)file->length};
+    const void *setstat_parts[] = {handle, attrs};
+    const int64_t setstat_lengths[] = {-(int64_t)len_handle, sizeof attrs};
+
+    if (file->length) {
+        if (!batch_queue(self, SSH_FXP_WRITE, id | BATCH_STEP_WRITE, 3, parts,
+                         lengths)) {
+            return false;
+        }
+        file->num_pending++;
+    }
+
+    if (file->preserve) {
+        batch_put_attrs(attrs, &file->metadata);
+        if (!batch_queue(self, SSH_FXP_FSETSTAT, id | BATCH_STEP_SETSTAT, 2,
+                         setstat_parts, setstat_lengths)) {
+            return false;
+        }
+        file->num_pending++;
+    }
+
+    if (!batch_queue(self, SSH_FXP_CLOSE, id | BATCH_STEP_CLOSE, 1, parts, lengths)) {
+        return false;
+    }
+    file->num_pending++;
+
+    free(file->contents);
+    file->contents = NULL;
+    return true;
+}
+
+/**
+ * Read the type and size from the attributes of an ``SSH_FXP_ATTRS`` response.
+ *
+ * :param size: [OUT] Size of the object, 0 if the server didn't send it.
+ * :return: True if the attributes are a directory's.
+ */
+static bool
+batch_parse_attrs(const char *body, int64_t len_body, uint64_t *size) {
+    uint32_t flags = batch_get_u32(body);
+    int64_t offset = 4;
+
+    *size = 0;
+    if (flags & SSH_FILEXFER_ATTR_SIZE) {
+        if (offset + 8 <= len_body) {
+            *size = (uint64_t)batch_get_u32(body + offset) << 32 |
+                    batch_get_u32(body + offset + 4);
+        }
+        offset += 8;
+    }
+    if (flags & SSH_FILEXFER_ATTR_UIDGID) {
+        offset += 8;
+    }
+    return flags & SSH_FILEXFER_ATTR_PERMISSIONS && offset + 4 <= len_body &&
+           S_ISDIR(batch_get_u32(body + offset));
+}
+
+/**
+ * Get the name of an ``SSH_FXP_NAME`` response to a readlink or a realpath, it has
+ * a count and then a single entry.
+ *
+ * :return: The heap allocated name, NULL if the response is malformed.
+ */
+static char *
+batch_parse_name(const char *body, int64_t len_body) {
+    uint32_t len_name = len_body >= 8 ? batch_get_u32(body + 4) : 0;
+
+    if (batch_get_u32(body) < 1 || len_name > len_body - 8) {
+        return NULL;
+    }
+    return strndup(body + 8, len_name);
+}
+
+/** Handle the next response, blocking until it arrives. */
+static bool
+batch_handle_response(BatchT *self) {
+    uint8_t type;
+    uint32_t id, slot, step;
+    int64_t len_body = batch_receive(self, &type, &id);
+    const char *body = self->in + BATCH_LEN_HEADER;
+    BatchFileT *file;
+    uint64_t size;
+    char *name;
+
+    if (len_body < 0) {
+        return false;
+    }
+
+    slot = id >> BATCH_STEP_BITS;
+    if (slot >= BATCH_MAX_FILES || self->files[slot].path == NULL || len_body < 4) {
+        DBG_ERR("Unexpected SFTP response: %u", type);
+        return false;
+    }
+    file = &self->files[slot];
+    file->num_pending--;
+    step = id & BATCH_STEP_MASK;
+
+    if (file->op == BATCH_OP_FILE && type == SSH_FXP_HANDLE && step == BATCH_STEP_OPEN) {
+        uint32_t len_handle = batch_get_u32(body);
+
+        if (len_handle > len_body - 4 ||
+            !batch_file_opened(self, file, slot, body + 4, len_handle)) {
+            return false;
+        }
+    } else if (file->op == BATCH_OP_STREAM && type == SSH_FXP_HANDLE &&
+               step == BATCH_STEP_OPEN) {
+        BatchStreamT *stream = file->result;
+        uint32_t len_handle = batch_get_u32(body);
+
+        if (len_handle > len_body - 4) {
+            DBG_ERR("Unexpected SFTP response: %u", type);
+            return false;
+        }
+        stream->handle = DBG_MALLOC(len_handle);
+        stream->len_handle = len_handle;
+        memcpy(stream->handle, body + 4, len_handle);
+    } else if (file->op == BATCH_OP_MKDIR && type == SSH_FXP_ATTRS &&
+               step == BATCH_STEP_STAT) {
+        *(bool *)file->result = batch_parse_attrs(body, len_body, &size);
+    } else if (file->op == BATCH_OP_FOLLOW && type == SSH_FXP_ATTRS &&
+               step == BATCH_STEP_STAT) {
+        BatchTargetT *target = file->result;
+
+        target->exists = true;
+        target->is_dir = batch_parse_attrs(body, len_body, &target->size);
+    } else if ((file->op == BATCH_OP_READLINK || file->op == BATCH_OP_FOLLOW) &&
+               type == SSH_FXP_NAME) {
+        name = batch_parse_name(body, len_body);
+        if (name == NULL) {
+            DBG_ERR("Unexpected SFTP response: %u", type);
+            return false;
+        }
+
+        if (file->op == BATCH_OP_READLINK) {
+            *(char **)file->result = name;
+        } else {
+            ((BatchTargetT *)file->result)->canonical_path = name;
+        }
+    } else if (type == SSH_FXP_STATUS) {
+        uint32_t status = batch_get_u32(body);
+
+        if (file->op == BATCH_OP_STREAM && step == BATCH_STEP_WRITE) {
+            ((BatchStreamT *)file->result)->num_done++;
+        }
+
+        /* Servers fail the mkdir of an existing directory, the stat tells instead.
+         * A stream the server couldn't open is opened again the usual way, which
+         * tells why */
+        if (file->op == BATCH_OP_FILE && status != SSH_FX_OK && !file->failed) {
+            DBG_ERR("Couldn't write remote file: %s: Error Code: %u", file->path, status);
+            file->failed = true;
+        } else if (file->op == BATCH_OP_STREAM && status != SSH_FX_OK && !file->failed) {
+            if (step != BATCH_STEP_OPEN) {
+                DBG_ERR("Couldn't write remote file: %s: Error Code: %u", file->path,
+                        status);
+            }
+            file->failed = true;
+        } else if (file->op == BATCH_OP_SETSTAT && status != SSH_FX_OK) {
+            DBG_ERR("Couldn't preserve metadata of %s: Error Code: %u", file->path,
+                    status);
+            file->failed = true;
+        } else if (file->op == BATCH_OP_READLINK) {
+            DBG_INFO("Couldn't read link %s: Error Code: %u", file->path, status);
+        } else if (file->op == BATCH_OP_SYMLINK && step == BATCH_STEP_SYMLINK &&
+                   status != SSH_FX_OK) {
+            DBG_ERR("Couldn't create link %s: Error Code: %u", file->path, status);
+            file->failed = true;
+        }
+    } else {
+        DBG_ERR("Unexpected SFTP response: %u", type);
+        return false;
+    }
+
+    batch_consume(self, len_body);
+    if (!file->num_pending) {
+        batch_file_done(self, file);
+    }
+    return true;
+}
+
+/** Fail every file still on its way, the channel can't be used anymore. */
+static void
+batch_abort(BatchT *self) {
+    for (size_t slot = 0; slot < BATCH_MAX_FILES; slot++) {
+        if (self->files[slot].path != NULL) {
+            self->files[slot].failed = true;
+            batch_file_done(self, &self->files[slot]);
+        }
+    }
+
+    ssh_channel_free(self->channel);
+    self->channel = NULL;
+}
+
+/**
+ * Open a channel to the SFTP subsystem of a session for a batch.
+ *
+ * :param done: Called for every file put in the batch once the server is done
+ *     with it, NULL for a batch that never gets files.
+ * :param data: Passed to ``done``.
+ * :return: The batch, NULL if the channel couldn't be opened. It must be freed with
+ *     ``Batch_free``.
+ */
+BatchT *
+Batch_new(ssh_session session_ssh, BatchDoneT done, void *data) {
+    BatchT *self = DBG_CALLOC(1, sizeof *self);
+    int64_t len_body = -1;
+    uint8_t type;
+    uint32_t id;
+
+    self->done = done;
+    self->data = data;
+    self->symlink_reversed = ssh_get_openssh_version(session_ssh) != 0;
+    self->channel = ssh_channel_new(session_ssh);
+    if (self->channel == NULL) {
+        DBG_SAFE_FREE(self);
+        return NULL;
+    }
+
+    /* The version goes where the id of other requests is */
+    if (ssh_channel_open_session(self->channel) != SSH_OK ||
+        ssh_channel_request_subsystem(self->channel, "sftp") != SSH_OK ||
+        !batch_queue(self, SSH_FXP_INIT, LIBSFTP_VERSION, 0, NULL, NULL) ||
+        !batch_send(self) || (len_body = batch_receive(self, &type, &id)) < 0 ||
+        type != SSH_FXP_VERSION || id != LIBSFTP_VERSION) {
+        DBG_INFO("Couldn't open an SFTP channel for pipelined requests: %s",
+                 ssh_get_error(session_ssh));
+        Batch_free(self);
+        return NULL;
+    }
+
+    batch_consume(self, len_body);
+    return self;
+}
+
+/**
+ * Take a free slot for a new file or path, handling responses until one is free.
+ *
+ * :return: The slot, counted in ``num_files``, -1 if the channel failed.
+ */
+static int
+batch_take_slot(BatchT *self) {
+    int slot = 0;
+
+    if (self->channel == NULL) {
+        return -1;
+    }
+
+    while (self->num_files == BATCH_MAX_FILES) {
+        if (!batch_send(self) || !batch_handle_response(self)) {
+            batch_abort(self);
+            return -1;
+        }
+    }
+    while (self->files[slot].path != NULL) {
+        slot++;
+    }
+
+    self->num_files++;
+    return slot;
+}
+
+/** Send the queued requests, handling the responses that arrived in the meantime. */
+static void
+batch_pump(BatchT *self) {
+    if (!batch_send(self)) {
+        batch_abort(self);
+        return;
+    }
+
+    /* Handles that arrived get the writes of their files on the way */
+    while (ssh_channel_poll(self->channel, 0) > 0) {
+        if (!batch_handle_response(self) || !batch_send(self)) {
+            batch_abort(self);
+            break;
+        }
+    }
+}
+
+/** Encode the flags and attributes of the open of a file to write. */
+static void
+batch_put_open_flags(char *flags) {
+    batch_put_u32(flags, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC);
+    batch_put_u32(flags + 4, SSH_FILEXFER_ATTR_PERMISSIONS);
+    batch_put_u32(flags + 8, FS_CREATE_FILE_PERM);
+}
+
+/**
+ * Add a file to the batch, its open is sent right away.
+ *
+ * :param path: Remote path, the file is created or truncated.
+ * :param contents: Heap allocated contents, the batch takes it over.
+ * :param metadata: Permissions and times to set, NULL to leave the defaults.
+ * :return: False if the channel failed before the file was taken, it has to be
+ *     copied some other way. ``contents`` is freed either way. Once a file is
+ *     taken, failures are reported to ``done``.
+ */
+bool
+Batch_put(BatchT *self, const char *path, char *contents, size_t length,
+          const MetadataT *metadata) {
+    char flags[12];
+    const void *parts[] = {path, flags};
+    const int64_t lengths[] = {-(int64_t)strlen(path), sizeof flags};
+    int slot = batch_take_slot(self);
+    BatchFileT *file;
+
+    if (slot < 0) {
+        free(contents);
+        return false;
+    }
+
+    file = &self->files[slot];
+    *file = (BatchFileT){.path = strdup(path), .op = BATCH_OP_FILE,
+                         .contents = contents, .length = length,
+                         .preserve = metadata != NULL, .num_pending = 1};
+    if (metadata != NULL) {
+        file->metadata = *metadata;
+    }
+
+    /* Open flags followed by the attributes of a new file */
+    batch_put_open_flags(flags);
+    if (!batch_queue(self, SSH_FXP_OPEN, (uint32_t)slot << BATCH_STEP_BITS, 2, parts,
+                     lengths)) {
+        batch_abort(self);
+        return true;
+    }
+
+    batch_pump(self);
+    return true;
+}
+
+/**
+ * Add a directory to the batch, its mkdir and a stat checking it are sent right
+ * away. The server handles the requests on a path in order, so the stat sees the
+ * outcome of the mkdir.
+ *
+ * :param path: Remote path, its parent has to exist once the mkdir is handled.
+ * :param exists: [OUT] Set once the responses arrived, ``Batch_wait`` waits for
+ *     them: True if ``path`` is a directory, whether or not it existed before.
+ * :return: False if the channel failed before the directory was taken.
+ */
+bool
+Batch_mkdir(BatchT *self, const char *path, uint32_t permissions, bool *exists) {
+    char attrs[8];
+    const void *parts[] = {path, attrs};
+    const int64_t lengths[] = {-(int64_t)strlen(path), sizeof attrs};
+    int slot = batch_take_slot(self);
+    uint32_t id = (uint32_t)slot << BATCH_STEP_BITS;
+
+    *exists = false;
+    if (slot < 0) {
+        return false;
+    }
+    self->files[slot] = (BatchFileT){.path = strdup(path), .op = BATCH_OP_MKDIR,
+                                     .result = exists, .num_pending = 2};
+
+    /* The stat only takes the path, the first of the parts of the mkdir */
+    batch_put_u32(attrs, SSH_FILEXFER_ATTR_PERMISSIONS);
+    batch_put_u32(attrs + 4, permissions);
+    if (!batch_queue(self, SSH_FXP_MKDIR, id | BATCH_STEP_REQUEST, 2, parts, lengths) ||
+        !batch_queue(self, SSH_FXP_STAT, id | BATCH_STEP_STAT, 1, parts, lengths)) {
+        batch_abort(self);
+        return true;
+    }
+
+    batch_pump(self);
+    return true;
+}
+
+/**
+ * Add a symbolic link to the batch, its readlink is sent right away.
+ *
+ * :param target: [OUT] Set once the response arrived, ``Batch_wait`` waits for it:
+ *     The heap allocated target, NULL if it couldn't be read.
+ * :return: False if the channel failed before the link was taken.
+ */
+bool
+Batch_readlink(BatchT *self, const char *path, char **target) {
+    const void *parts[] = {path};
+    const int64_t lengths[] = {-(int64_t)strlen(path)};
+    int slot = batch_take_slot(self);
+
+    *target = NULL;
+    if (slot < 0) {
+        return false;
+    }
+    self->files[slot] = (BatchFileT){.path = strdup(path), .op = BATCH_OP_READLINK,
+                                     .result = target, .num_pending = 1};
+
+    if (!batch_queue(self, SSH_FXP_READLINK,
+                     (uint32_t)slot << BATCH_STEP_BITS | BATCH_STEP_REQUEST, 1, parts,
+                     lengths)) {
+        batch_abort(self);
+        return true;
+    }
+
+    batch_pump(self);
+    return true;
+}
+
+/**
+ * Add the permissions and times of a path to the batch, its setstat is sent right
+ * away. Failures are counted like the ones of files.
+ *
+ * :return: False if the channel failed before the path was taken.
+ */
+bool
+Batch_setstat(BatchT *self, const char *path, const MetadataT *metadata) {
+    char attrs[16];
+    const void *parts[] = {path, attrs};
+    const int64_t lengths[] = {-(int64_t)strlen(path), sizeof attrs};
+    int slot = batch_take_slot(self);
+
+    if (slot < 0) {
+        return false;
+    }
+    self->files[slot] = (BatchFileT){.path = strdup(path), .op = BATCH_OP_SETSTAT,
+                                     .num_pending = 1};
+
+    batch_put_attrs(attrs, metadata);
+    if (!batch_queue(self, SSH_FXP_SETSTAT,
+                     (uint32_t)slot << BATCH_STEP_BITS | BATCH_STEP_REQUEST, 2, parts,
+                     lengths)) {
+        batch_abort(self);
+        return true;
+    }
+
+    batch_pump(self);
+    return true;
+}
+
+/**
+ * Add a symbolic link to the batch to find what it points to, its stat and
+ * realpath are sent right away.
+ *
+ * :param target: [OUT] Set once the responses arrived, ``Batch_wait`` waits for
+ *     them. Its canonical path is resolved whatever the type of the target is.
+ * :return: False if the channel failed before the link was taken.
+ */
+bool
+Batch_follow(BatchT *self, const char *path, BatchTargetT *target) {
+    const void *parts[] = {path};
+    const int64_t lengths[] = {-(int64_t)strlen(path)};
+    int slot = batch_take_slot(self);
+    uint32_t id = (uint32_t)slot << BATCH_STEP_BITS;
+
+    *target = (BatchTargetT){0};
+    if (slot < 0) {
+        return false;
+    }
+    self->files[slot] = (BatchFileT){.path = strdup(path), .op = BATCH_OP_FOLLOW,
+                                     .result = target, .num_pending = 2};
+
+    if (!batch_queue(self, SSH_FXP_STAT, id | BATCH_STEP_STAT, 1, parts, lengths) ||
+        !batch_queue(self, SSH_FXP_REALPATH, id | BATCH_STEP_REALPATH, 1, parts,
+                     lengths)) {
+        batch_abort(self);
+        return true;
+    }
+
+    batch_pump(self);
+    return true;
+}
+
+/**
+ * Add a symbolic link to create to the batch, whatever is at ``path`` is removed
+ * first. The remove and the symlink are sent right away, a failed symlink is
+ * counted like the failed files.
+ *
+ * :param target: Path the link points to, copied verbatim.
+ * :param path: Remote path of the link itself.
+ * :return: False if the channel failed before the link was taken.
+ */
+bool
+Batch_symlink(BatchT *self, const char *target, const char *path) {
+    const void *parts[] = {path, target};
+    const int64_t lengths[] = {-(int64_t)strlen(path), -(int64_t)strlen(target)};
+    const void *reversed_parts[] = {target, path};
+    const int64_t reversed_lengths[] = {lengths[1], lengths[0]};
+    int slot = batch_take_slot(self);
+    uint32_t id = (uint32_t)slot << BATCH_STEP_BITS;
+
+    if (slot < 0) {
+        return false;
+    }
+    self->files[slot] = (BatchFileT){.path = strdup(path), .op = BATCH_OP_SYMLINK,
+                                     .num_pending = 2};
+
+    /* The remove only takes the path, the first of the parts of the symlink */
+    if (!batch_queue(self, SSH_FXP_REMOVE, id | BATCH_STEP_REQUEST, 1, parts,
+                     lengths) ||
+        !batch_queue(self, SSH_FXP_SYMLINK, id | BATCH_STEP_SYMLINK, 2,
+                     self->symlink_reversed ? reversed_parts : parts,
+                     self->symlink_reversed ? reversed_lengths : lengths)) {
+        batch_abort(self);
+        return true;
+    }
+
+    batch_pump(self);
+    return true;
+}
+
+/**
+ * Open a large file to write it chunk by chunk, waiting for the server to open it.
+ * It stays in the batch until ``Batch_close`` is answered.
+ *
+ * :param path: Remote path, the file is created or truncated.
+ * :param stream: [OUT] The open file, it has to be closed with ``Batch_close``.
+ * :return: False if the file couldn't be opened, it has to be copied some other way.
+ */
+bool
+Batch_open(BatchT *self, const char *path, BatchStreamT *stream) {
+    char flags[12];
+    const void *parts[] = {path, flags};
+    const int64_t lengths[] = {-(int64_t)strlen(path), sizeof flags};
+    int slot = batch_take_slot(self);
+    BatchFileT *file;
+
+    *stream = (BatchStreamT){0};
+    if (slot < 0) {
+        return false;
+    }
+
+    /* One response more than the open is expected, the one to the close */
+    file = &self->files[slot];
+    *file = (BatchFileT){.path = strdup(path), .op = BATCH_OP_STREAM, .result = stream,
+                         .num_pending = 2};
+    stream->slot = slot;
+    stream->is_open = true;
+
+    batch_put_open_flags(flags);
+    if (!batch_queue(self, SSH_FXP_OPEN, (uint32_t)slot << BATCH_STEP_BITS, 2, parts,
+                     lengths)) {
+        batch_abort(self);
+        return false;
+    }
+
+    while (self->channel != NULL && stream->handle == NULL && !file->failed) {
+        if (!batch_send(self) || !batch_handle_response(self)) {
+            batch_abort(self);
+        }
+    }
+    if (stream->handle != NULL) {
+        return true;
+    }
+
+    /* Nothing is sent to a file that couldn't be opened, not even its close */
+    if (stream->is_open) {
+        file->num_pending--;
+        batch_file_done(self, file);
+    }
+    return false;
+}
+
+/** Check if a stream can still be written, neither it nor the channel failed. */
+static bool
+batch_stream_ok(const BatchT *self, const BatchStreamT *stream) {
+    return stream->is_open && !self->files[stream->slot].failed;
+}
+
+/**
+ * Write a chunk of a file opened with ``Batch_open``, the write is sent right away
+ * without waiting for the previous ones. The chunk is copied, ``buf`` can be reused.
+ *
+ * :param offset: Where the chunk goes in the file, writes past its end leave holes.
+ * :return: False if the file or the channel failed, the file has to be closed.
+ */
+bool
+Batch_write(BatchT *self, BatchStreamT *stream, uint64_t offset, const char *buf,
+            size_t length) {
+    char field[8];
+    const void *parts[] = {stream->handle, field, buf};
+    const int64_t lengths[] = {-(int64_t)stream->len_handle, sizeof field,
+                               -(int64_t)length};
+
+    if (!batch_stream_ok(self, stream)) {
+        return false;
+    }
+
+    batch_put_u32(field, offset >> 32);
+    batch_put_u32(field + 4, offset);
+    if (!batch_queue(self, SSH_FXP_WRITE,
+                     stream->slot << BATCH_STEP_BITS | BATCH_STEP_WRITE, 3, parts,
+                     lengths)) {
+        batch_abort(self);
+        return false;
+    }
+    self->files[stream->slot].num_pending++;
+    stream->num_sent++;
+
+    batch_pump(self);
+    return batch_stream_ok(self, stream);
+}
+
+/**
+ * Wait until no more than ``num_in_flight`` writes of a file are unanswered.
+ *
+ * :return: False if the file or the channel failed, the file has to be closed.
+ */
+bool
+Batch_drain(BatchT *self, BatchStreamT *stream, size_t num_in_flight) {
+    while (batch_stream_ok(self, stream) &&
+           stream->num_sent - stream->num_done > num_in_flight) {
+        if (!batch_send(self) || !batch_handle_response(self)) {
+            batch_abort(self);
+        }
+    }
+
+    return batch_stream_ok(self, stream);
+}
+
+/**
+ * Close a file opened with ``Batch_open``, waiting for the answers to all of its
+ * writes and to the close.
+ *
+ * :return: False if the file couldn't be written or closed.
+ */
+bool
+Batch_close(BatchT *self, BatchStreamT *stream) {
+    const void *parts[] = {stream->handle};
+    const int64_t lengths[] = {-(int64_t)stream->len_handle};
+
+    if (stream->is_open &&
+        !batch_queue(self, SSH_FXP_CLOSE,
+                     stream->slot << BATCH_STEP_BITS | BATCH_STEP_CLOSE, 1, parts,
+                     lengths)) {
+        batch_abort(self);
+    }
+
+    while (stream->is_open) {
+        if (!batch_send(self) || !batch_handle_response(self)) {
+            batch_abort(self);
+        }
+    }
+
+    DBG_SAFE_FREE(stream->handle);
+    stream->handle = NULL;
+    return !stream->failed;
+}
+
+/**
+ * Wait for the server to be done with everything put in the batch. Failed files
+ * stay counted for the next ``Batch_flush``.
+ */
+void
+Batch_wait(BatchT *self) {
+    while (self->channel != NULL && self->num_files) {
+        if (!batch_send(self) || !batch_handle_response(self)) {
+            batch_abort(self);
+        }
+    }
+}
+
+/**
+ * Wait for the server to be done with every file put in the batch.
+ *
+ * :return: False if any file or setstat since the last flush failed.
+ */
+bool
+Batch_flush(BatchT *self) {
+    bool ok;
+
+    Batch_wait(self);
+    ok = !self->num_failed;
+    self->num_failed = 0;
+    return ok;
+}
+
+void
+Batch_free(BatchT *self) {
+    if (self->channel != NULL) {
+        Batch_flush(self);
+    }
+    if (self->channel != NULL) {
+        ssh_channel_send_eof(self->channel);
+        ssh_channel_close(self->channel);
+        ssh_channel_free(self->channel);
+    }
+
+    DBG_SAFE_FREE(self->out);
+    DBG_SAFE_FREE(self->in);
+    DBG_SAFE_FREE(self);
+}
@@ -0,0 +1,604 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+#include "seft_checksum.h"
+#include "seft_debug.h"
+#include "seft_hash.h"
+
+/** Reflected polynomial of CRC32C (Castagnoli) */
+#define CRC32C_POLY 0x82F63B78U
+
+/** Bytes compared between kernels by ``checksum_self_test`` */
+#define CHECKSUM_TEST_SIZE 4096
+
+/** Bytes hashed by every kernel in ``checksum_benchmark`` */
+#define CHECKSUM_BENCH_SIZE (64 << 20)
+
+/** Rounds of every kernel in ``checksum_benchmark``, the fastest one counts */
+#define CHECKSUM_BENCH_ROUNDS 3
+
+/** Weight of each byte of a 64-byte block in the rolling sum, the tail is used for
+ * shorter blocks */
+static const uint8_t rolling_weights[64] = {
+    64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47, 46, 45, 44,
+    43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23,
+    22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+};
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+static const ChecksumKernelsT *checksum_kernels;
+
+static inline uint64_t
+read_le64(const uint8_t *ptr) {
+    uint64_t value;
+
+    memcpy(&value, ptr, sizeof value);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint32_t
+rolling_pack(uint32_t a, uint32_t b) {
+    return (a & 0xffff) | (b << 16);
+}
+
+/**
+ * rsync style weak checksum, the low half sums the bytes and the high half sums
+ * each byte weighted by its distance from the end, both modulo 2^16.
+ */
+static uint32_t
+rolling_scalar(uint32_t sum, const uint8_t *data, size_t length) {
+    uint32_t a = sum & 0xffff, b = sum >> 16;
+
+    for (; length >= 4; data += 4, length -= 4) {
+        b += 4 * a + 4 * data[0] + 3 * data[1] + 2 * data[2] + data[3];
+        a += data[0] + data[1] + data[2] + data[3];
+    }
+    for (; length; data++, length--) {
+        a += *data;
+        b += a;
+    }
+
+    return rolling_pack(a, b);
+}
+
+/** Slice-by-8 table driven CRC32C. */
+static uint32_t
+crc32c_scalar(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t value = read_le64(data) ^ crc;
+
+        crc = crc32c_table[7][value & 0xff] ^ crc32c_table[6][(value >> 8) & 0xff] ^
+              crc32c_table[5][(value >> 16) & 0xff] ^
+              crc32c_table[4][(value >> 24) & 0xff] ^
+              crc32c_table[3][(value >> 32) & 0xff] ^
+              crc32c_table[2][(value >> 40) & 0xff] ^
+              crc32c_table[1][(value >> 48) & 0xff] ^ crc32c_table[0][value >> 56];
+    }
+    for (; length; data++, length--) {
+        crc = crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/** Check if a buffer holds nothing but zeros, 64 bytes at a time. */
+static bool
+zero_scalar(const uint8_t *data, size_t length) {
+    size_t num_blocks = length / 64;
+    uint64_t acc = 0;
+
+    for (size_t i = 0; i < num_blocks && !acc; i++) {
+        for (size_t j = 0; j < 64; j += 8) {
+            acc |= read_le64(data + i * 64 + j);
+        }
+    }
+    for (size_t i = num_blocks * 64; i < length && !acc; i++) {
+        acc |= data[i];
+    }
+
+    return !acc;
+}
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse4.2"))) static inline uint32_t
+hsum_epi32_128(__m128i vec) {
+    vec = _mm_add_epi32(vec, _mm_shuffle_epi32(vec, 0x4e));
+    vec = _mm_add_epi32(vec, _mm_shuffle_epi32(vec, 0xb1));
+    return _mm_cvtsi128_si32(vec);
+}
+
+/** CRC32C with the ``crc32`` instruction, 8 bytes at a time. */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+
+    for (; length >= 8; data += 8, length -= 8) {
+        crc64 = _mm_crc32_u64(crc64, read_le64(data));
+    }
+    crc = crc64;
+#endif
+    for (; length; data++, length--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+
+    return ~crc;
+}
+
+/**
+ * Rolling checksum over 16-byte blocks. ``psadbw`` sums the bytes of a block and
+ * ``pmaddubsw`` weighs them, the weight of every earlier block grows by the block
+ * size, which is added once at the end from the running sum of ``a``.
+ */
+__attribute__((target("sse4.2"))) static uint32_t
+rolling_sse42(uint32_t sum, const uint8_t *data, size_t length) {
+    const __m128i weights = _mm_loadu_si128((const __m128i *)(rolling_weights + 48));
+    const __m128i ones = _mm_set1_epi16(1), zero = _mm_setzero_si128();
+    __m128i vs1 = _mm_cvtsi32_si128(sum & 0xffff);
+    __m128i vs2 = _mm_cvtsi32_si128(sum >> 16);
+    __m128i vps = zero;
+    size_t num_blocks = length / 16;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i * 16));
+
+        vps = _mm_add_epi32(vps, vs1);
+        vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(block, zero));
+        vs2 = _mm_add_epi32(vs2,
+                            _mm_madd_epi16(_mm_maddubs_epi16(block, weights), ones));
+    }
+    vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(vps, 4));
+
+    return rolling_scalar(rolling_pack(hsum_epi32_128(vs1), hsum_epi32_128(vs2)),
+                          data + num_blocks * 16, length % 16);
+}
+
+/** Zero check ORing four vectors together per ``ptest``, a block of 64 bytes. */
+__attribute__((target("sse4.2"))) static bool
+zero_sse42(const uint8_t *data, size_t length) {
+    size_t num_blocks = length / 64;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        const __m128i *block = (const __m128i *)(data + i * 64);
+        __m128i acc = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128(block), _mm_loadu_si128(block + 1)),
+            _mm_or_si128(_mm_loadu_si128(block + 2), _mm_loadu_si128(block + 3)));
+
+        if (!_mm_testz_si128(acc, acc)) {
+            return false;
+        }
+    }
+
+    return zero_scalar(data + num_blocks * 64, length % 64);
+}
+
+/** Same as ``rolling_sse42`` over 32-byte blocks. */
+__attribute__((target("avx2"))) static uint32_t
+rolling_avx2(uint32_t sum, const uint8_t *data, size_t length) {
+    const __m256i weights = _mm256_loadu_si256((const __m256i *)(rolling_weights + 32));
+    const __m256i ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+    __m256i vs1 = _mm256_zextsi128_si256(_mm_cvtsi32_si128(sum & 0xffff));
+    __m256i vs2 = _mm256_zextsi128_si256(_mm_cvtsi32_si128(sum >> 16));
+    __m256i vps = zero;
+    size_t num_blocks = length / 32;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i * 32));
+
+        vps = _mm256_add_epi32(vps, vs1);
+        vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(block, zero));
+        vs2 = _mm256_add_epi32(
+            vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(block, weights), ones));
+    }
+    vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(vps, 5));
+
+    return rolling_scalar(
+        rolling_pack(hsum_epi32_128(_mm_add_epi32(_mm256_castsi256_si128(vs1),
+                                                  _mm256_extracti128_si256(vs1, 1))),
+                     hsum_epi32_128(_mm_add_epi32(_mm256_castsi256_si128(vs2),
+                                                  _mm256_extracti128_si256(vs2, 1)))),
+        data + num_blocks * 32, length % 32);
+}
+
+/** Same as ``zero_sse42`` over 128-byte blocks. */
+__attribute__((target("avx2"))) static bool
+zero_avx2(const uint8_t *data, size_t length) {
+    size_t num_blocks = length / 128;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        const __m256i *block = (const __m256i *)(data + i * 128);
+        __m256i acc =
+            _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(block),
+                                            _mm256_loadu_si256(block + 1)),
+                            _mm256_or_si256(_mm256_loadu_si256(block + 2),
+                                            _mm256_loadu_si256(block + 3)));
+
+        if (!_mm256_testz_si256(acc, acc)) {
+            return false;
+        }
+    }
+
+    return zero_sse42(data + num_blocks * 128, length % 128);
+}
+
+/** Same as ``rolling_sse42`` over 64-byte blocks. */
+__attribute__((target("avx512f,avx512bw"))) static uint32_t
+rolling_avx512(uint32_t sum, const uint8_t *data, size_t length) {
+    const __m512i weights = _mm512_loadu_si512(rolling_weights);
+    const __m512i ones = _mm512_set1_epi16(1), zero = _mm512_setzero_si512();
+    __m512i vs1 = _mm512_zextsi128_si512(_mm_cvtsi32_si128(sum & 0xffff));
+    __m512i vs2 = _mm512_zextsi128_si512(_mm_cvtsi32_si128(sum >> 16));
+    __m512i vps = zero;
+    size_t num_blocks = length / 64;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        __m512i block = _mm512_loadu_si512(data + i * 64);
+
+        vps = _mm512_add_epi32(vps, vs1);
+        vs1 = _mm512_add_epi32(vs1, _mm512_sad_epu8(block, zero));
+        vs2 = _mm512_add_epi32(
+            vs2, _mm512_madd_epi16(_mm512_maddubs_epi16(block, weights), ones));
+    }
+    vs2 = _mm512_add_epi32(vs2, _mm512_slli_epi32(vps, 6));
+
+    return rolling_scalar(
+        rolling_pack(_mm512_reduce_add_epi32(vs1), _mm512_reduce_add_epi32(vs2)),
+        data + num_blocks * 64, length % 64);
+}
+
+/** Same as ``zero_sse42`` over 256-byte blocks. */
+__attribute__((target("avx512f,avx512bw"))) static bool
+zero_avx512(const uint8_t *data, size_t length) {
+    size_t num_blocks = length / 256;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        const uint8_t *block = data + i * 256;
+        __m512i acc = _mm512_or_si512(
+            _mm512_or_si512(_mm512_loadu_si512(block), _mm512_loadu_si512(block + 64)),
+            _mm512_or_si512(_mm512_loadu_si512(block + 128),
+                            _mm512_loadu_si512(block + 192)));
+
+        if (_mm512_test_epi64_mask(acc, acc)) {
+            return false;
+        }
+    }
+
+    return zero_avx2(data + num_blocks * 256, length % 256);
+}
+#endif /* CHECKSUM_X86 */
+
+static const ChecksumKernelsT kernels_scalar = {"scalar", rolling_scalar, crc32c_scalar,
+                                                zero_scalar};
+
+#ifdef CHECKSUM_X86
+/* Wider registers don't help CRC32C, the ``crc32`` instruction is the bottleneck */
+static const ChecksumKernelsT kernels_sse42 = {"sse4.2", rolling_sse42, crc32c_sse42,
+                                               zero_sse42};
+static const ChecksumKernelsT kernels_avx2 = {"avx2", rolling_avx2, crc32c_sse42,
+                                              zero_avx2};
+static const ChecksumKernelsT kernels_avx512 = {"avx512", rolling_avx512, crc32c_sse42,
+                                                zero_avx512};
+#endif
+
+/** Every set of kernels, from the slowest to the fastest */
+static const ChecksumKernelsT *kernels_all[] = {
+    &kernels_scalar,
+#ifdef CHECKSUM_X86
+    &kernels_sse42,
+    &kernels_avx2,
+    &kernels_avx512,
+#endif
+};
+
+/** Check with CPUID if the CPU, and the OS, support a set of kernels. */
+bool
+checksum_kernels_supported(const ChecksumKernelsT *kernels) {
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (kernels == &kernels_sse42) {
+        return __builtin_cpu_supports("sse4.2");
+    }
+    if (kernels == &kernels_avx2) {
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("avx2");
+    }
+    if (kernels == &kernels_avx512) {
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512bw");
+    }
+#endif
+    return kernels == &kernels_scalar;
+}
+
+static void
+crc32c_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (size_t bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        for (size_t k = 1; k < 8; k++) {
+            crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^
+                                 crc32c_table[0][crc32c_table[k - 1][i] & 0xff];
+        }
+    }
+}
+
+/** Pick the fastest supported kernels that agree with the scalar ones. */
+static void
+checksum_init(void) {
+    /* The scalar CRC32C needs its table even when no other kernel is supported */
+    pthread_once(&crc32c_once, crc32c_init_table);
+    checksum_kernels = &kernels_scalar;
+
+    for (size_t i = sizeof kernels_all / sizeof *kernels_all; i-- > 1;) {
+        if (!checksum_kernels_supported(kernels_all[i])) {
+            continue;
+        }
+        if (checksum_self_test(kernels_all[i])) {
+            checksum_kernels = kernels_all[i];
+            break;
+        }
+        DBG_ERR("Checksum kernels for %s disagree with scalar ones, not using them",
+                kernels_all[i]->name);
+    }
+
+    DBG_INFO("Using %s checksum kernels", checksum_kernels->name);
+}
+
+/** Get the kernels in use, they are picked on the first call. */
+const ChecksumKernelsT *
+checksum_get_kernels(void) {
+    pthread_once(&checksum_once, checksum_init);
+    return checksum_kernels;
+}
+
+/**
+ * Get a set of kernels, supported or not, from the slowest to the fastest. The
+ * scalar ones come first.
+ *
+ * :return: NULL past the last set.
+ */
+const ChecksumKernelsT *
+checksum_get_kernels_at(size_t index) {
+    pthread_once(&crc32c_once, crc32c_init_table);
+    if (index >= sizeof kernels_all / sizeof *kernels_all) {
+        return NULL;
+    }
+
+    return kernels_all[index];
+}
+
+/**
+ * Compute or continue a rolling checksum.
+ *
+ * :param sum: 0 to start, or the checksum of the data before ``data``.
+ * :return: Checksum with the byte sum in the low and the weighted sum in the high
+ *     16 bits.
+ */
+uint32_t
+checksum_rolling(uint32_t sum, const void *data, size_t length) {
+    return checksum_get_kernels()->rolling(sum, data, length);
+}
+
+/**
+ * Slide the window of a rolling checksum by one byte.
+ *
+ * :param out: Byte leaving the window at its start.
+ * :param in: Byte entering the window at its end.
+ * :param window: Length of the window.
+ */
+uint32_t
+checksum_rolling_roll(uint32_t sum, uint8_t out, uint8_t in, size_t window) {
+    uint32_t a = (sum & 0xffff) - out + in;
+    uint32_t b = (sum >> 16) - (uint32_t)window * out + a;
+
+    return rolling_pack(a, b);
+}
+
+/**
+ * Compute or continue a CRC32C.
+ *
+ * :param crc: 0 to start, or the CRC of the data before ``data``.
+ */
+uint32_t
+checksum_crc32c(uint32_t crc, const void *data, size_t length) {
+    return checksum_get_kernels()->crc32c(crc, data, length);
+}
+
+/**
+ * Check if a buffer holds nothing but zeros, i.e a chunk that can be left as a hole
+ * in a sparse file.
+ */
+bool
+checksum_is_zero(const void *data, size_t length) {
+    return checksum_get_kernels()->is_zero(data, length);
+}
+
+/**
+ * Compute the XXH64 of a buffer.
+ *
+ * .. note:: XXH64 has no vector kernels, its four lanes are serial chains of 64-bit
+ *    multiplies and scalar ``mul`` beats the long latency of ``vpmullq``.
+ */
+uint64_t
+checksum_xxh64(uint64_t seed, const void *data, size_t length) {
+    HashT hash;
+
+    Hash_init(&hash, seed);
+    Hash_update(&hash, data, length);
+    return Hash_digest(&hash);
+}
+
+/** Fill a buffer with reproducible pseudo random bytes. */
+static void
+checksum_fill(uint8_t *buf, size_t length) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buf[i] = state >> 24;
+    }
+}
+
+/**
+ * Compare a set of kernels against the scalar ones, for lengths around every
+ * block size and unaligned starts.
+ *
+ * :return: True if every result matches.
+ */
+bool
+checksum_self_test(const ChecksumKernelsT *kernels) {
+    static const size_t lengths[] = {0,  1,  3,  15, 16, 17,  31,  32,   33,
+                                     63, 64, 65, 127, 128, 1000, 4000, 4093};
+    uint8_t *buf = DBG_MALLOC(CHECKSUM_TEST_SIZE);
+    bool ok = true;
+
+    if (buf == NULL) {
+        return false;
+    }
+
+    pthread_once(&crc32c_once, crc32c_init_table);
+    checksum_fill(buf, CHECKSUM_TEST_SIZE);
+
+    for (size_t i = 0; ok && i < sizeof lengths / sizeof *lengths; i++) {
+        for (size_t offset = 0; ok && offset < 3; offset++) {
+            const uint8_t *data = buf + offset;
+            uint32_t seed = lengths[i] * 0x01000193U;
+
+            ok = kernels->rolling(seed, data, lengths[i]) ==
+                     rolling_scalar(seed, data, lengths[i]) &&
+                 kernels->crc32c(seed, data, lengths[i]) ==
+                     crc32c_scalar(seed, data, lengths[i]);
+        }
+    }
+
+    /* Known answers, so the scalar kernels are checked as well */
+    ok = ok && kernels->crc32c(0, (const uint8_t *)"123456789", 9) == 0xE3069283U;
+
+    /* Zero checks must spot a single byte set anywhere in the buffer */
+    memset(buf, 0, CHECKSUM_TEST_SIZE);
+    for (size_t i = 0; ok && i < sizeof lengths / sizeof *lengths; i++) {
+        for (size_t offset = 0; ok && offset < 3; offset++) {
+            uint8_t *data = buf + offset;
+
+            ok = kernels->is_zero(data, lengths[i]);
+            for (size_t k = 0; ok && k < lengths[i]; k += 7) {
+                data[k] = 1;
+                ok = !kernels->is_zero(data, lengths[i]);
+                data[k] = 0;
+            }
+        }
+    }
+
+    DBG_SAFE_FREE(buf);
+    return ok;
+}
+
+static double
+checksum_elapsed(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+checksum_print_speed(const char *kernel, const char *isa, double seconds) {
+    printf("%-8s %-8s %8.2f GB/s\n", kernel, isa, CHECKSUM_BENCH_SIZE / seconds / 1e9);
+}
+
+/**
+ * Check every supported set of kernels against the scalar one and print the
+ * throughput of each kernel.
+ */
+void
+checksum_benchmark(void) {
+    uint8_t *buf = DBG_MALLOC(CHECKSUM_BENCH_SIZE);
+    volatile uint64_t sink = 0;
+    struct timespec start;
+    double best[4];
+
+    if (buf == NULL) {
+        return;
+    }
+    checksum_fill(buf, CHECKSUM_BENCH_SIZE);
+    printf("Selected: %s\n", checksum_get_kernels()->name);
+
+    for (size_t i = 0; i < sizeof kernels_all / sizeof *kernels_all; i++) {
+        const ChecksumKernelsT *kernels = kernels_all[i];
+
+        if (!checksum_kernels_supported(kernels)) {
+            printf("%-8s %-8s %13s\n", "*", kernels->name, "unsupported");
+            continue;
+        }
+        printf("%-8s %-8s %13s\n", "test", kernels->name,
+               checksum_self_test(kernels) ? "pass" : "FAIL");
+
+        best[0] = best[1] = 1e9;
+        for (size_t round = 0; round < CHECKSUM_BENCH_ROUNDS; round++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            sink += kernels->rolling(0, buf, CHECKSUM_BENCH_SIZE);
+            best[0] = MIN(best[0], checksum_elapsed(&start));
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            sink += kernels->crc32c(0, buf, CHECKSUM_BENCH_SIZE);
+            best[1] = MIN(best[1], checksum_elapsed(&start));
+        }
+        checksum_print_speed("rolling", kernels->name, best[0]);
+        checksum_print_speed("crc32c", kernels->name, best[1]);
+    }
+
+    best[2] = 1e9;
+    for (size_t round = 0; round < CHECKSUM_BENCH_ROUNDS; round++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sink += checksum_xxh64(0, buf, CHECKSUM_BENCH_SIZE);
+        best[2] = MIN(best[2], checksum_elapsed(&start));
+    }
+    checksum_print_speed("xxh64", "scalar", best[2]);
+
+    /* Zero checks stop at the first byte set, only zeros show their speed */
+    memset(buf, 0, CHECKSUM_BENCH_SIZE);
+    for (size_t i = 0; i < sizeof kernels_all / sizeof *kernels_all; i++) {
+        if (!checksum_kernels_supported(kernels_all[i])) {
+            continue;
+        }
+
+        best[3] = 1e9;
+        for (size_t round = 0; round < CHECKSUM_BENCH_ROUNDS; round++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            sink += kernels_all[i]->is_zero(buf, CHECKSUM_BENCH_SIZE);
+            best[3] = MIN(best[3], checksum_elapsed(&start));
+        }
+        checksum_print_speed("zero", kernels_all[i]->name, best[3]);
+    }
+
+    (void)sink;
+    DBG_SAFE_FREE(buf);
+}
@@ -1,38 +1,105 @@
+/* For ``SEEK_DATA``, ``fallocate`` and ``sync_file_range`` */
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/param.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
 
+#include "seft_checksum.h"
+#include "seft_config.h"
 #include "seft_commands.h"
 #include "seft_debug.h"
 #include "seft_ansi_colors.h"
 #include "seft_client.h"
+#include "seft_glob.h"
+#include "seft_hash.h"
 #include "seft_list.h"
+#include "seft_metadata.h"
 #include "seft_path.h"
+#include "seft_set.h"
+#include "seft_sort.h"
+#include "seft_tar.h"
 #include "seft_utils.h"
 #include "config.h"
 
+/** Length of a ``ls -l`` style permission string, i.e ``drwxr-xr-x`` */
+#define LEN_MODE_STR 10
+
+#define SECONDS_HOUR 3600
+#define SECONDS_SIX_MONTHS (SECONDS_HOUR * 24 * 365 / 2)
+
+/** Listings with fewer links read their targets one by one, opening a batch for
+ * them costs a few round trips of its own */
+#define LIST_BATCH_MIN_LINKS 4
+
+/** Same for the directories of a download, until its batch is open */
+#define COPY_BATCH_MIN_LINKS 4
+
+/** Seed of the hashes compared by ``copy --verify``, ``xxhsum`` uses 0 */
+#define VERIFY_HASH_SEED 0
+
+/** Length of an XXH64 digest in hex, as printed by ``xxhsum`` */
+#define LEN_HASH_HEX 16
+
+/** Samples with less entropy per byte, in bits, are worth sending compressed */
+#define COMPRESS_MAX_ENTROPY 6.0
+
+/** Runs of zeros are left as holes by whole blocks of this size, the block size of
+ * most file systems */
+#define SPARSE_BLOCK_SIZE 4096
+
+/** Downloads of files this big reserve their space before writing, smaller files
+ * hardly fragment */
+#define PREALLOC_MIN_SIZE (1 << 20)
+
+/** Runs of zeros this long are punched out of the space reserved for a download,
+ * shorter ones stay reserved and read as zeros */
+#define PREALLOC_MIN_HOLE (1 << 20)
+
+/** Downloads reach the file system in writes of this size */
+#define LOCAL_WRITE_BUFFER (1 << 20)
+
+/** With ``copy --cache drop``, writeback of downloads starts every this many bytes,
+ * the batch before is waited for and dropped from the page cache */
+#define WRITE_BEHIND_SIZE (8 << 20)
+
+/** With ``copy --cache drop``, uploads drop what they sent from the page cache every
+ * this many bytes */
+#define DROP_BEHIND_SIZE (8 << 20)
+
+/** Directories with fewer files are copied file by file, a remote ``tar`` isn't worth
+ * starting for them */
+#define BULK_MIN_FILES 64
+
+/** Directories read to guess the file sizes of a tree before choosing how to copy it */
+#define BULK_SAMPLE_DIRS 8
+
 /**
- * Function to initialize ssh session.
- *
- * :param host_name: Host name to connect to.
- * :param port_id: Port number to connect to.
- *
- * :return: ssh_session object.
- *
- * .. note:: This function will exit the program if any error occurs.
+ * Connect and authenticate to an ssh server.
  *
- * .. warning:: This function will ask for passphrase from the user.
- *    If the user enters wrong passphrase, the program will exit.
+ * :param compress: Negotiate zlib compression of the session.
+ * :param crypto: Algorithms to offer, NULL for the defaults of libssh.
+ * :param credentials: [IN/OUT] Password of an earlier session to the server. Once
+ *     it is set the user is never asked, a session it doesn't authenticate fails.
+ *     Otherwise the user is asked and it is filled in. NULL to always ask.
+ * :return: The session, NULL if it couldn't be established.
  */
 ssh_session
-do_ssh_init(char *host_name, uint32_t port_id) {
+try_ssh_init(char *host_name, uint32_t port_id, bool compress,
+             const CryptoPrefsT *crypto, CredentialsT *credentials) {
     int8_t result;
     ssh_session session;
     char passphrase[BUF_SIZE_PASSPHRASE] = {0};
@@ -42,48 +109,95 @@ do_ssh_init(char *host_name, uint32_t port_id) {
     session = ssh_new();
     if (session == NULL) {
         DBG_ERR("Couldn't create new ssh session: %s", ssh_get_error(session));
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     ssh_options_set(session, SSH_OPTIONS_HOST, host_name);
     ssh_options_set(session, SSH_OPTIONS_PORT, &port_id);
+    ssh_options_set(session, SSH_OPTIONS_COMPRESSION, compress ? "yes" : "no");
+    if (crypto != NULL && !CryptoPrefs_apply(crypto, session)) {
+        clean_ssh_session(session);
+        return NULL;
+    }
 
     result = ssh_connect(session);
     if (result != SSH_OK) {
         DBG_ERR("Connection error: %s", ssh_get_error(session));
         clean_ssh_session(session);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
-    printf((ANSI_FG_GREEN "%s's passphrase: " ANSI_RESET), host_name);
-    ssh_getpass("", passphrase, BUF_SIZE_PASSPHRASE, 0, 0);
-    result = ssh_userauth_password(session, NULL, passphrase);
+    if (credentials != NULL && credentials->is_set) {
+        result = ssh_userauth_password(session, NULL, credentials->password);
+    } else {
+        printf((ANSI_FG_GREEN "%s's passphrase: " ANSI_RESET), host_name);
+        ssh_getpass("", passphrase, BUF_SIZE_PASSPHRASE, 0, 0);
+        result = ssh_userauth_password(session, NULL, passphrase);
+        if (result == SSH_AUTH_SUCCESS && credentials != NULL) {
+            memcpy(credentials->password, passphrase, sizeof passphrase);
+            credentials->is_set = true;
+        }
+    }
+    memset(passphrase, 0, sizeof passphrase);
     if (result != SSH_AUTH_SUCCESS) {
         DBG_ERR("Authentication error: %s", ssh_get_error(session));
         clean_ssh_session(session);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     return session;
 }
 
 /**
- * Function to clean ssh session.
+ * Function to initialize ssh session.
+ *
+ * :param host_name: Host name to connect to.
+ * :param port_id: Port number to connect to.
+ * :param compress: Negotiate zlib compression of the session.
+ * :param crypto: Algorithms to offer, NULL for the defaults of libssh.
+ * :param credentials: See ``try_ssh_init``.
  *
- * :param session: ssh_session object.
+ * :return: ssh_session object.
  *
  * .. note:: This function will exit the program if any error occurs.
+ *
+ * .. warning:: This function will ask for passphrase from the user.
+ *    If the user enters wrong passphrase, the program will exit.
+ */
+ssh_session
+do_ssh_init(char *host_name, uint32_t port_id, bool compress,
+            const CryptoPrefsT *crypto, CredentialsT *credentials) {
+    ssh_session session = try_ssh_init(host_name, port_id, compress, crypto,
+                                       credentials);
+
+    if (session == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    return session;
+}
+
+/** Forget a password kept by ``try_ssh_init``. */
+void
+Credentials_clear(CredentialsT *self) {
+    memset(self, 0, sizeof *self);
+}
+
+/**
+ * Start an sftp session over an ssh session.
+ *
+ * :return: The session, NULL if it couldn't be started. ``session_ssh`` is left
+ *     untouched either way.
  */
 sftp_session
-do_sftp_init(ssh_session session_ssh) {
+try_sftp_init(ssh_session session_ssh) {
     int8_t result;
     sftp_session session_sftp;
 
     session_sftp = sftp_new(session_ssh);
     if (session_sftp == NULL) {
         DBG_ERR("Connection error: %s", ssh_get_error(session_ssh));
-        clean_ssh_session(session_ssh);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     result = sftp_init(session_sftp);
@@ -91,6 +205,17 @@ do_sftp_init(ssh_session session_ssh) {
         DBG_ERR("Couldn't initialize SFTP session: Error Code %d",
                 sftp_get_error(session_sftp));
         sftp_free(session_sftp);
+        return NULL;
+    }
+
+    return session_sftp;
+}
+
+sftp_session
+do_sftp_init(ssh_session session_ssh) {
+    sftp_session session_sftp = try_sftp_init(session_ssh);
+
+    if (session_sftp == NULL) {
         clean_ssh_session(session_ssh);
         exit(EXIT_FAILURE);
     }
@@ -98,6 +223,314 @@ do_sftp_init(ssh_session session_ssh) {
     return session_sftp;
 }
 
+/**
+ * Read the entries of a remote directory that satisfy ``flag``.
+ *
+ * :return: ``ListT`` of ``sftp_attributes``, must be freed with
+ *     ``attributes_list_free``. NULL if the directory couldn't be read.
+ */
+static ListT *
+read_remote_dir_attributes(ssh_session session_ssh, sftp_session session_sftp,
+                           char *directory, uint8_t flag) {
+    sftp_dir dir;
+    sftp_attributes attr;
+    ListT *entries;
+
+    dir = sftp_opendir(session_sftp, directory);
+    if (dir == NULL) {
+        DBG_ERR("Couldn't open directory: %s\n", ssh_get_error(session_ssh));
+        return NULL;
+    }
+
+    entries = List_new(1, sizeof(sftp_attributes));
+    while ((attr = sftp_readdir(session_sftp, dir)) != NULL) {
+        if (!check_path_type(attr->name, strlen(attr->name),
+                             attr->type == SSH_FILEXFER_TYPE_DIRECTORY, flag)) {
+            sftp_attributes_free(attr);
+            continue;
+        }
+
+        /* The attributes are owned by the list, no need to copy them */
+        List_realloc(entries, entries->length + 1);
+        entries->list[entries->length++] = attr;
+    }
+
+    if (!sftp_dir_eof(dir)) {
+        DBG_ERR("Couldn't read directory %s: %s", directory, ssh_get_error(session_ssh));
+    }
+    sftp_closedir(dir);
+
+    return entries;
+}
+
+/** Free a ``ListT`` of ``sftp_attributes`` along with its items. */
+static void
+attributes_list_free(ListT *self) {
+    for (size_t i = 0; i < List_length(self); i++) {
+        sftp_attributes_free(List_get(self, i));
+    }
+
+    List_free(self);
+}
+
+/** Write the name of an entry prefixed with the icon and color of its type. */
+static void
+format_entry_name(char *buf, size_t size, sftp_attributes attr) {
+    switch (attr->type) {
+        case SSH_FILEXFER_TYPE_DIRECTORY:
+            snprintf(buf, size, (COLOR_FOLDER ICON_FOLDER " %s" ANSI_RESET), attr->name);
+            break;
+        case SSH_FILEXFER_TYPE_SYMLINK:
+            snprintf(buf, size, (COLOR_SYM_LINK ICON_SYM_LINK " %s" ANSI_RESET),
+                     attr->name);
+            break;
+        default:
+            snprintf(buf, size, (COLOR_FILE ICON_FILE " %s" ANSI_RESET), attr->name);
+            break;
+    }
+}
+
+/**
+ * Write the ``ls -l`` style permission string of an entry, i.e ``drwxr-xr-x``.
+ *
+ * :param buf: Buffer of at least ``LEN_MODE_STR + 1`` bytes.
+ * :param attr: Attributes of the entry.
+ */
+static void
+format_mode(char *buf, sftp_attributes attr) {
+    static const char rwx[] = "rwxrwxrwx";
+    uint32_t perm = attr->permissions;
+
+    switch (attr->type) {
+        case SSH_FILEXFER_TYPE_DIRECTORY:
+            buf[0] = 'd';
+            break;
+        case SSH_FILEXFER_TYPE_SYMLINK:
+            buf[0] = 'l';
+            break;
+        case SSH_FILEXFER_TYPE_REGULAR:
+            buf[0] = '-';
+            break;
+        default:
+            buf[0] = S_ISCHR(perm)    ? 'c'
+                     : S_ISBLK(perm)  ? 'b'
+                     : S_ISFIFO(perm) ? 'p'
+                     : S_ISSOCK(perm) ? 's'
+                                      : '?';
+    }
+
+    if (!(attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
+        memset(buf + 1, '?', LEN_MODE_STR - 1);
+        buf[LEN_MODE_STR] = '\0';
+        return;
+    }
+
+    for (size_t i = 0; i < LEN_MODE_STR - 1; i++) {
+        buf[i + 1] = perm & (1 << (LEN_MODE_STR - 2 - i)) ? rwx[i] : '-';
+    }
+    if (perm & S_ISUID) {
+        buf[3] = perm & S_IXUSR ? 's' : 'S';
+    }
+    if (perm & S_ISGID) {
+        buf[6] = perm & S_IXGRP ? 's' : 'S';
+    }
+    if (perm & S_ISVTX) {
+        buf[9] = perm & S_IXOTH ? 't' : 'T';
+    }
+    buf[LEN_MODE_STR] = '\0';
+}
+
+/**
+ * Get the link count of an entry.
+ *
+ * SFTP attributes don't carry the link count, but servers send an ``ls -l`` style
+ * ``longname`` along with every ``readdir`` entry, whose second field is the count.
+ *
+ * :return: The link count, 1 if the server didn't send it.
+ */
+static unsigned long
+attributes_link_count(sftp_attributes attr) {
+    const char *longname = attr->longname;
+    unsigned long count;
+    char *end;
+
+    if (longname == NULL) {
+        return 1;
+    }
+
+    /* Skip the permission string, ``strtoul`` skips the whitespace after it */
+    longname += strcspn(longname, " ");
+    count = strtoul(longname, &end, 10);
+
+    return end == longname ? 1 : count;
+}
+
+/** Write the owner or group name of an entry, or its id if the name is unknown. */
+static void
+format_owner(char *buf, size_t size, const char *name, uint32_t id) {
+    if (name != NULL) {
+        snprintf(buf, size, "%s", name);
+    } else {
+        snprintf(buf, size, "%" PRIu32, id);
+    }
+}
+
+/**
+ * Write the modification time of an entry.
+ * Like ``ls``, entries older than six months or from the future show the year instead
+ * of the time.
+ */
+static void
+format_mtime(char *buf, size_t size, sftp_attributes attr, time_t now) {
+    time_t mtime = attr->mtime64 ? (time_t)attr->mtime64 : (time_t)attr->mtime;
+    struct tm mtime_tm;
+
+    localtime_r(&mtime, &mtime_tm);
+    if (now - mtime > SECONDS_SIX_MONTHS || mtime - now > SECONDS_HOUR) {
+        strftime(buf, size, "%b %e  %Y", &mtime_tm);
+    } else {
+        strftime(buf, size, "%b %e %H:%M", &mtime_tm);
+    }
+}
+
+/**
+ * Resolve the targets of the symbolic links among ``entries``.
+ *
+ * Lookups are only issued for entries that are links once the directory has been
+ * read, every other entry is served from its ``readdir`` attributes. With enough
+ * links they are pipelined over a batch, so they cost a single round trip.
+ *
+ * :return: Array parallel to ``entries`` holding the target of each link and NULL
+ *     for everything else. Must be freed with ``link_targets_free``.
+ */
+static char **
+resolve_link_targets(ssh_session session_ssh, sftp_session session_sftp,
+                     char *directory, ListT *entries) {
+    char link_path[BUF_SIZE_FS_PATH];
+    char **targets = DBG_CALLOC(List_length(entries), sizeof *targets);
+    size_t num_links = 0;
+    BatchT *batch = NULL;
+    sftp_attributes attr;
+
+    if (targets == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < List_length(entries); i++) {
+        attr = List_get(entries, i);
+        num_links += attr->type == SSH_FILEXFER_TYPE_SYMLINK;
+    }
+    if (num_links >= LIST_BATCH_MIN_LINKS) {
+        batch = Batch_new(session_ssh, NULL, NULL);
+    }
+
+    for (size_t i = 0; i < List_length(entries); i++) {
+        attr = List_get(entries, i);
+        if (attr->type != SSH_FILEXFER_TYPE_SYMLINK) {
+            continue;
+        }
+
+        snprintf(link_path, sizeof link_path, "%s%c%s", directory, PATH_SEPARATOR,
+                 attr->name);
+        if (batch != NULL && Batch_readlink(batch, link_path, &targets[i])) {
+            continue;
+        }
+
+        targets[i] = sftp_readlink(session_sftp, link_path);
+        if (targets[i] == NULL) {
+            DBG_INFO("Couldn't read link %s", link_path);
+        }
+    }
+
+    /* Freeing the batch waits for the targets it still reads */
+    if (batch != NULL) {
+        Batch_free(batch);
+    }
+    return targets;
+}
+
+static void
+link_targets_free(char **targets, size_t length) {
+    if (targets == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        ssh_string_free_char(targets[i]);
+    }
+    DBG_SAFE_FREE(targets);
+}
+
+/** Get the number of decimal digits in ``num`` */
+static int
+u64_num_digits(uint64_t num) {
+    int digits = 1;
+
+    for (; num >= 10; num /= 10) {
+        digits++;
+    }
+    return digits;
+}
+
+/**
+ * Print entries in ``ls -l`` format, built entirely from their ``readdir`` attributes.
+ * For example::
+ *
+ *     drwxr-xr-x  2 user group  4096 Oct 16 12:00  dir
+ *     lrwxrwxrwx  1 user group    11 Oct 16 12:00  link -> target
+ *
+ * .. note:: Link targets cost one request per link, so they are only shown when
+ *    ``FLAG_LIST_BIT_POS_LINK_TARGET`` is set.
+ */
+static void
+print_long_listing(ssh_session session_ssh, sftp_session session_sftp,
+                   char *directory, ListT *entries, uint8_t flag) {
+    char mode[LEN_MODE_STR + 1];
+    char owner[BUF_SIZE_FS_NAME], group[BUF_SIZE_FS_NAME];
+    char mtime[BUF_SIZE_FS_NAME];
+    char name[BUF_SIZE_FS_PATH];
+    int width_links = 1, width_owner = 1, width_group = 1, width_size = 1;
+    char **targets = NULL;
+    sftp_attributes attr;
+    time_t now = time(NULL);
+
+    /* First pass only measures, so every column lines up */
+    for (size_t i = 0; i < List_length(entries); i++) {
+        attr = List_get(entries, i);
+
+        format_owner(owner, sizeof owner, attr->owner, attr->uid);
+        format_owner(group, sizeof group, attr->group, attr->gid);
+        width_links = MAX(width_links, u64_num_digits(attributes_link_count(attr)));
+        width_owner = MAX(width_owner, (int)strlen(owner));
+        width_group = MAX(width_group, (int)strlen(group));
+        width_size = MAX(width_size, u64_num_digits(attr->size));
+    }
+
+    if (BIT_MATCH(flag, FLAG_LIST_BIT_POS_LINK_TARGET)) {
+        targets = resolve_link_targets(session_ssh, session_sftp, directory, entries);
+    }
+
+    for (size_t i = 0; i < List_length(entries); i++) {
+        attr = List_get(entries, i);
+
+        format_mode(mode, attr);
+        format_owner(owner, sizeof owner, attr->owner, attr->uid);
+        format_owner(group, sizeof group, attr->group, attr->gid);
+        format_mtime(mtime, sizeof mtime, attr, now);
+        format_entry_name(name, sizeof name, attr);
+
+        printf("%s %*lu %-*s %-*s %*" PRIu64 " %s %s", mode, width_links,
+               attributes_link_count(attr), width_owner, owner, width_group, group,
+               width_size, attr->size, mtime, name);
+        if (targets != NULL && targets[i] != NULL) {
+            printf(" -> %s", targets[i]);
+        }
+        putchar('\n');
+    }
+
+    link_targets_free(targets, List_length(entries));
+}
+
 /**
  * Helper function to print files/directories in list view.
  *
@@ -108,56 +541,51 @@ do_sftp_init(ssh_session session_ssh) {
  *     If 0th bit is set, then list all files/directories in the directory.
  *     If 1st bit is set, then list subdirectories.
  *     If 2nd bit is set, then list files/directories in list view.
+ *     If 3rd bit is set, then list in long listing format.
+ *     If 4th or 5th bit is set, then sort by ``sort_field``, in reverse for the 5th.
+ *     If 6th bit is set, then show symbolic link targets in long listing format.
+ * :param sort_field: Field to sort the entries by.
  * */
 CommandStatusE
 list_remote_dir(ssh_session session_ssh, sftp_session session_sftp, char *directory,
-                uint8_t flag) {
-    sftp_dir dir;
-    sftp_attributes attr;
-    FileSystemT *fs;
+                uint8_t flag, SortFieldE sort_field) {
     ListT *dir_contents;
-    ListT *formatted_contents = List_new(1, sizeof(char *));
-    char *filename = DBG_CALLOC(BUF_SIZE_FS_NAME, sizeof *filename);
+    ListT *formatted_contents;
+    char filename[BUF_SIZE_FS_PATH];
     size_t width_screen = get_window_column_length();
 
-    dir = sftp_opendir(session_sftp, directory);
-    if (dir == NULL) {
-        DBG_ERR("Couldn't open directory: %s\n", ssh_get_error(session_ssh));
+    dir_contents = read_remote_dir_attributes(session_ssh, session_sftp, directory, flag);
+    if (dir_contents == NULL) {
         return CMD_INTERNAL_ERROR;
     }
 
+    if (BIT_MATCH(flag, FLAG_LIST_BIT_POS_SORT) ||
+        BIT_MATCH(flag, FLAG_LIST_BIT_POS_SORT_REVERSE)) {
+        sort_attributes(dir_contents, sort_field,
+                        BIT_MATCH(flag, FLAG_LIST_BIT_POS_SORT_REVERSE));
+    }
+
     if (BIT_MATCH(flag, FLAG_LIST_BIT_POS_LONG_LIST)) /* list view */ {
-        while ((attr = sftp_readdir(session_sftp, dir)) != NULL) {
-            if (check_path_type(attr->name, strlen(attr->name),
-                                attr->type == SSH_FILEXFER_TYPE_DIRECTORY, flag)) {
-                printf("%-25s %-10s %zu\n", attr->name, attr->owner, attr->size);
-            }
-        }
+        print_long_listing(session_ssh, session_sftp, directory, dir_contents, flag);
+        attributes_list_free(dir_contents);
         return CMD_OK;
     }
 
-    sftp_closedir(dir);
-
-    dir_contents = path_read_remote_dir(session_ssh, session_sftp, directory);
+    formatted_contents = List_new(1, sizeof(char *));
     for (size_t i = 0; i < dir_contents->length; i++) {
-        fs = List_get(dir_contents, i);
-        if (fs->type == FS_DIRECTORY) {
-            sprintf(filename, (COLOR_FOLDER ICON_FOLDER " %s" ANSI_RESET), fs->name);
-        } else {
-            sprintf(filename, (COLOR_FILE ICON_FILE " %s" ANSI_RESET), fs->name);
-        }
-        if (check_path_type(fs->name, strlen(fs->name), fs->type == FS_DIRECTORY, flag)) {
-            List_push(formatted_contents, filename, strlen(filename) + 1);
-        }
+        format_entry_name(filename, sizeof filename, List_get(dir_contents, i));
+        List_push(formatted_contents, filename, strlen(filename) + 1);
     }
 
     if (List_length(formatted_contents)) {
         char_list_format_columnwise(formatted_contents, width_screen, "    ");
     }
 
-    FileSystem_list_free(dir_contents);
+    for (size_t i = 0; i < formatted_contents->length; i++) {
+        DBG_SAFE_FREE(List_get(formatted_contents, i));
+    }
     List_free(formatted_contents);
-    DBG_SAFE_FREE(filename);
+    attributes_list_free(dir_contents);
     return CMD_OK;
 }
 
@@ -172,7 +600,7 @@ CommandStatusE
 create_remote_file(ssh_session session_ssh, sftp_session session_sftp,
                    char *abs_file_path) {
     sftp_file file =
-        sftp_open(session_sftp, abs_file_path, O_CREAT | O_WRONLY, FS_CREATE_PERM);
+        sftp_open(session_sftp, abs_file_path, O_CREAT | O_WRONLY, FS_CREATE_FILE_PERM);
 
     if (file == NULL) {
         DBG_ERR("Couldn't create file %s: %s", abs_file_path, ssh_get_error(session_ssh));
@@ -211,265 +639,2833 @@ create_remote_dir(ssh_session session_ssh, sftp_session session_sftp,
     }
 }
 
-static CommandStatusE
-create_parents_remote(ssh_session session_ssh, sftp_session session_sftp,
-                      char *path_str) {
-    char *path_buf = DBG_MALLOC(BUF_SIZE_FS_PATH);
-    ListT *path_list = path_split(path_str, strlen(path_str));
-    int8_t result;
+/**
+ * Check if a directory exists on the remote server. Servers speaking version 3 of
+ * the protocol, like OpenSSH, report a ``mkdir`` of an existing directory as a
+ * plain failure.
+ */
+static bool
+remote_is_dir(sftp_session session_sftp, const char *path) {
+    sftp_attributes attr = sftp_stat(session_sftp, path);
+    bool is_dir = attr != NULL && attr->type == SSH_FILEXFER_TYPE_DIRECTORY;
+
+    sftp_attributes_free(attr);
+    return is_dir;
+}
 
-    path_buf = List_get(path_list, 0);
-    for (size_t i = 0; i < path_list->length; i++) {
-        if (i) {
-            FS_JOIN_PATH(path_buf, List_get(path_list, i));
+/**
+ * Create a remote directory and all of its parents.
+ *
+ * Directories in ``known_dirs`` are taken to exist, only the components below the
+ * deepest known one are created, top-down, and added to the set. So walking a tree
+ * top-down costs a single ``mkdir`` per directory instead of one per component.
+ *
+ * :param path_str: Path of the directory.
+ * :param known_dirs: Set of directories known to exist on the remote server, shared
+ *     by all calls of a transfer.
+ */
+static CommandStatusE
+create_parents_remote(sftp_session session_sftp, char *path_str, StrSetT *known_dirs) {
+    PathBufT *path = PathBuf_new(path_str);
+    CommandStatusE status = CMD_OK;
+    size_t start = path->length;
+
+    /* Find the deepest directory known to exist, searching from the leaf up */
+    while (start && !StrSet_contains(known_dirs, path->str, start)) {
+        for (start--; start && path->str[start] != PATH_SEPARATOR; start--) {
         }
+    }
 
-        result = sftp_mkdir(session_sftp, path_buf, FS_CREATE_PERM);
-        if (!result) {
+    for (size_t i = start + 1; i <= path->length; i++) {
+        if (i < path->length && path->str[i] != PATH_SEPARATOR) {
             continue;
         }
 
+        path->str[i] = '\0';
+        if (sftp_mkdir(session_sftp, path->str, FS_CREATE_PERM)) {
+            /* Taken before the stat of an existing directory replaces it */
+            int error = sftp_get_error(session_sftp);
 
-        switch (sftp_get_error(session_sftp)) {
-            case SSH_FX_FILE_ALREADY_EXISTS:
-                DBG_INFO("Directory %s already exists", path_buf);
-                break;
-            case SSH_FX_PERMISSION_DENIED:
-                DBG_ERR("Permission Denied: directory %s could not be created", path_buf);
-                break;
-            default:
-                DBG_ERR("Error while creating parent:%s:: %s\n", path_buf,
-                        ssh_get_error(session_ssh));
-                break;
+            switch (remote_is_dir(session_sftp, path->str) ? SSH_FX_OK : error) {
+                case SSH_FX_OK:
+                    DBG_INFO("Directory %s already exists", path->str);
+                    break;
+                case SSH_FX_FILE_ALREADY_EXISTS:
+                    DBG_ERR("Couldn't create directory %s: A file is in the way",
+                            path->str);
+                    status = CMD_INTERNAL_ERROR;
+                    break;
+                case SSH_FX_PERMISSION_DENIED:
+                    DBG_ERR("Permission Denied: directory %s could not be created",
+                            path->str);
+                    status = CMD_INTERNAL_ERROR;
+                    break;
+                default:
+                    DBG_ERR("Error while creating parent:%s:: Error Code: %d", path->str,
+                            error);
+                    status = CMD_INTERNAL_ERROR;
+                    break;
+            }
+        }
+
+        if (status != CMD_OK) {
+            break;
         }
+
+        StrSet_add(known_dirs, path->str, i);
+        path->str[i] = i < path->length ? PATH_SEPARATOR : '\0';
     }
 
-    DBG_SAFE_FREE(path_buf);
-    List_free(path_list);
+    PathBuf_free(path);
+    return status;
+}
 
-    return CMD_OK;
+/** Check if the copy was cancelled, copies without progress can't be. */
+static bool
+copy_cancelled(CopyOptionsT *options) {
+    return options->progress != NULL && atomic_load(&options->progress->cancelled);
 }
 
 /**
- * Helper function to copy a file from local to remote server.
+ * Wait until the scheduler lets the copy send its next chunk.
  *
- * :param session_ssh: ssh_session object.
- * :param session_sftp: sftp_session object.
- * :param abs_path_local: Absolute path of the file on local machine.
- * :param abs_path_remote: Absolute path of the file on remote machine.
+ * :return: True once the chunk may be sent, False if the copy was cancelled.
  */
-static CommandStatusE
-copy_file_from_remote_to_local(ssh_session session_ssh, sftp_session session_sftp,
-                               char *abs_path_remote, char *abs_path_local) {
-    int32_t num_bytes_read;
-    char file_buf[BUF_SIZE_FILE_CONTENTS + 1];
-    sftp_file from_file = sftp_open(session_sftp, abs_path_remote, O_RDONLY, 0);
-    FILE *to_file = fopen(abs_path_local, "w");
-
-    if (from_file == NULL) {
-        DBG_ERR("Couldn't open file: %s", ssh_get_error(session_ssh));
-        return CMD_INTERNAL_ERROR;
+static bool
+copy_throttle(CopyOptionsT *options, size_t num_bytes) {
+    if (options->scheduler == NULL) {
+        return !copy_cancelled(options);
     }
 
-    if (to_file == NULL) {
-        DBG_ERR("Couldn't create file: %s", abs_path_local);
-        return CMD_INTERNAL_ERROR;
-    }
+    return Scheduler_acquire(options->scheduler, options->flow, num_bytes,
+                             options->progress != NULL ? &options->progress->cancelled
+                                                       : NULL);
+}
 
-    while ((num_bytes_read = sftp_read(from_file, file_buf, BUF_SIZE_FILE_CONTENTS)) >
-           0) {
-        fwrite(file_buf, sizeof *file_buf, num_bytes_read, to_file);
+/** Give back what ``copy_throttle`` allowed for a chunk but wasn't sent. */
+static void
+copy_throttle_refund(CopyOptionsT *options, size_t num_bytes) {
+    if (options->scheduler != NULL && num_bytes) {
+        Scheduler_refund(options->scheduler, options->flow, num_bytes);
     }
+}
 
-    if (num_bytes_read < 0) {
-        DBG_ERR("Couldn't read remote file: Error Code: %d",
-                sftp_get_error(session_sftp));
-        return CMD_INTERNAL_ERROR;
+/** Get the chunk size and window of a copy, see ``Tune_get``. */
+static void
+copy_tune_get(CopyOptionsT *options, bool pipelined, size_t *chunk, size_t *window) {
+    if (options->tune == NULL) {
+        *chunk = BUF_SIZE_FILE_CONTENTS;
+        *window = pipelined ? TUNE_MIN_WINDOW : 1;
+        return;
     }
 
-    sftp_close(from_file);
-    fclose(to_file);
-
-    return CMD_OK;
+    Tune_get(options->tune, pipelined, chunk, window);
 }
 
-static CommandStatusE
-copy_file_from_local_to_remote(ssh_session session_ssh, sftp_session session_sftp,
-                               char *abs_path_local, char *abs_path_remote) {
-    int32_t num_bytes_read;
-    char file_buf[BUF_SIZE_FILE_CONTENTS + 1] = {0};
-    struct stat from_file_stat;
-    FILE *from_file;
-    sftp_file to_file;
-
-    stat(abs_path_local, &from_file_stat);
+/** Record a request of a copy sent at ``sent`` that has just completed. */
+static void
+copy_tune_sample(CopyOptionsT *options, size_t num_bytes, const struct timespec *sent) {
+    if (options->tune != NULL) {
+        Tune_sample(options->tune, num_bytes, tune_elapsed(sent));
+    }
+}
 
-    /* Not really sure why this is needed but, it doesn't work without it
-     * so  ¯\_(ツ)_/¯ */
-    if (!from_file_stat.st_size) {
-        DBG_INFO("File with 0 size: %s", abs_path_local);
-        create_remote_file(session_ssh, session_sftp, abs_path_remote);
-        return CMD_OK;
+static void
+copy_progress_add(CopyOptionsT *options, uint64_t num_bytes) {
+    if (options->progress != NULL) {
+        atomic_fetch_add(&options->progress->num_bytes, num_bytes);
+    }
+}
+
+static void
+copy_progress_file_done(CopyOptionsT *options) {
+    if (options->progress != NULL) {
+        atomic_fetch_add(&options->progress->num_files, 1);
+    }
+}
+
+/**
+ * Write a whole buffer to a remote file, ``sftp_write`` may write less than asked.
+ *
+ * :return: True if every byte was written, False on errors.
+ */
+static bool
+sftp_write_all(sftp_file file, const char *buf, size_t length) {
+    while (length) {
+        ssize_t num_bytes_written = sftp_write(file, buf, length);
+
+        if (num_bytes_written <= 0) {
+            return false;
+        }
+        buf += num_bytes_written;
+        length -= num_bytes_written;
+    }
+
+    return true;
+}
+
+/**
+ * Find the next region of a local file holding data, the holes of a sparse file
+ * before it read as zeros and needn't be copied.
+ *
+ * :param offset: [IN/OUT] Where to search from, moved to the start of the data, or
+ *     to the end of the file if only a hole is left.
+ * :param data_end: [OUT] End of the data, where the next hole starts.
+ *
+ * .. note:: File systems without holes, or without ``SEEK_DATA``, hold one region
+ *    of data up to the end of the file.
+ */
+static void
+local_next_data(int fd, uint64_t *offset, uint64_t *data_end) {
+#ifdef SEEK_DATA
+    off_t data = lseek(fd, *offset, SEEK_DATA), hole;
+
+    if (data < 0 && errno == ENXIO) {
+        hole = lseek(fd, 0, SEEK_END);
+        *offset = *data_end = MAX(*offset, (uint64_t)MAX(hole, 0));
+        return;
+    }
+    if (data >= 0 && (hole = lseek(fd, data, SEEK_HOLE)) >= 0) {
+        *offset = data;
+        *data_end = hole;
+        return;
+    }
+#else
+    (void)fd;
+    (void)offset;
+#endif
+    *data_end = UINT64_MAX;
+}
+
+/**
+ * Tell the kernel how an upload reads a local file: read ahead what the copy keeps
+ * in flight and, with ``CACHE_DROP``, drop what was sent from the page cache.
+ *
+ * :param offset: Where the next read starts.
+ * :param len_ahead: Bytes to have read ahead of ``offset``.
+ * :param read_ahead: [IN/OUT] End of what was read ahead so far.
+ * :param dropped: [IN/OUT] Dropped from the page cache up to here.
+ *
+ * .. note:: Read ahead is asked for in halves of the window, not for every read.
+ */
+static void
+local_read_advise(int fd, uint64_t offset, uint64_t len_ahead, uint64_t *read_ahead,
+                  uint64_t *dropped, CachePolicyE cache) {
+#ifdef HAVE_POSIX_FADVISE
+    if (*read_ahead < offset + len_ahead / 2) {
+        *read_ahead = MAX(*read_ahead, offset);
+        posix_fadvise(fd, *read_ahead, offset + len_ahead - *read_ahead,
+                      POSIX_FADV_WILLNEED);
+        *read_ahead = offset + len_ahead;
+    }
+
+    /* Pages may be dropped behind the stream, its buffer holds what it read ahead */
+    if (cache == CACHE_DROP && offset >= *dropped + DROP_BEHIND_SIZE) {
+        posix_fadvise(fd, *dropped, offset - *dropped, POSIX_FADV_DONTNEED);
+        *dropped = offset;
+    }
+#else
+    (void)fd;
+    (void)offset;
+    (void)len_ahead;
+    (void)read_ahead;
+    (void)dropped;
+    (void)cache;
+#endif
+}
+
+/** Drop a local file the copy is done with from the page cache, for ``CACHE_DROP``. */
+static void
+local_read_done(FILE *file, CachePolicyE cache) {
+#ifdef HAVE_POSIX_FADVISE
+    if (cache == CACHE_DROP) {
+        posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+    }
+#else
+    (void)file;
+    (void)cache;
+#endif
+}
+
+/** A local file written by a download, see ``local_file_open`` */
+typedef struct {
+    FILE *file;
+
+    /** Buffer of ``file``, batching writes */
+    char *buf;
+
+    /** Where the next chunk goes */
+    uint64_t offset;
+
+    /** Start of the run of zeros the chunks so far end with, ``offset`` if they end
+     * with data */
+    uint64_t hole_start;
+
+    /** End of the space reserved up front, 0 if none was */
+    uint64_t preallocated;
+
+    /** ``CACHE_DROP`` writes the file back as it grows and drops it from the cache */
+    CachePolicyE cache;
+
+    /** Writeback was started up to here */
+    uint64_t written_back;
+
+    /** Dropped from the page cache up to here */
+    uint64_t dropped;
+} LocalFileT;
+
+/**
+ * Create a local file for a download and reserve space for it, so the file system
+ * can lay it out in few extents.
+ *
+ * :param size: Expected size of the file, 0 if unknown.
+ * :param cache: Whether the file is kept out of the page cache, see
+ *     ``WRITE_BEHIND_SIZE``.
+ * :return: False if the file couldn't be created.
+ *
+ * .. note:: The space is reserved without changing the size of the file, a copy
+ *    that stops early leaves a file as long as what it copied.
+ */
+static bool
+local_file_open(LocalFileT *self, const char *path, uint64_t size, CachePolicyE cache) {
+    memset(self, 0, sizeof *self);
+    self->cache = cache;
+
+    self->file = fopen(path, "w");
+    if (self->file == NULL) {
+        return false;
+    }
+
+    self->buf = DBG_MALLOC(LOCAL_WRITE_BUFFER);
+    setvbuf(self->file, self->buf, _IOFBF, LOCAL_WRITE_BUFFER);
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    /* File systems without it are written as before */
+    if (size >= PREALLOC_MIN_SIZE) {
+        if (!fallocate(fileno(self->file), FALLOC_FL_KEEP_SIZE, 0, size)) {
+            self->preallocated = size;
+        } else {
+            DBG_DEBUG("Couldn't reserve %" PRIu64 " bytes for %s: %s", size, path,
+                      strerror(errno));
+        }
+    }
+#else
+    (void)size;
+#endif
+
+    return true;
+}
+
+/**
+ * Give back the space reserved for a download between ``start`` and ``end``.
+ *
+ * .. note:: Some file systems ignore holes punched past the end of the file, the
+ *    data after the hole has to be written first.
+ */
+static void
+local_file_punch(LocalFileT *self, uint64_t start, uint64_t end) {
+    end = MIN(end, self->preallocated);
+    if (start >= end || fflush(self->file)) {
+        return;
+    }
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    /* The range reads as zeros either way, only the space is lost if this fails */
+    fallocate(fileno(self->file), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start,
+              end - start);
+#endif
+}
+
+/**
+ * Write the file back up to the current offset and drop what was written back by
+ * the previous call from the page cache.
+ *
+ * .. note:: Without ``sync_file_range`` everything is written back and dropped at
+ *    once.
+ */
+static void
+local_file_write_behind(LocalFileT *self) {
+    int fd = fileno(self->file);
+
+    if (fflush(self->file)) {
+        return;
+    }
+
+#ifdef HAVE_SYNC_FILE_RANGE
+    sync_file_range(fd, self->written_back, self->offset - self->written_back,
+                    SYNC_FILE_RANGE_WRITE);
+    if (self->written_back > self->dropped) {
+        sync_file_range(fd, self->dropped, self->written_back - self->dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+#else
+    fdatasync(fd);
+    self->written_back = self->offset;
+#endif
+
+#ifdef HAVE_POSIX_FADVISE
+    if (self->written_back > self->dropped) {
+        posix_fadvise(fd, self->dropped, self->written_back - self->dropped,
+                      POSIX_FADV_DONTNEED);
+    }
+#endif
+
+    self->dropped = self->written_back;
+    self->written_back = self->offset;
+}
+
+/**
+ * Write the next chunk of a download, seeking over runs of whole blocks of zeros so
+ * the file system leaves holes there.
+ *
+ * :return: False on write errors.
+ */
+static bool
+local_file_write(LocalFileT *self, const char *buf, size_t length) {
+    size_t offset = 0, end;
+    bool is_zero, ok;
+
+    while (offset < length) {
+        is_zero = checksum_is_zero(buf + offset, MIN(SPARSE_BLOCK_SIZE, length - offset));
+        for (end = offset + SPARSE_BLOCK_SIZE; end < length; end += SPARSE_BLOCK_SIZE) {
+            if (checksum_is_zero(buf + end, MIN(SPARSE_BLOCK_SIZE, length - end)) !=
+                is_zero) {
+                break;
+            }
+        }
+        end = MIN(end, length);
+
+        if (is_zero) {
+            ok = !fseeko(self->file, end - offset, SEEK_CUR);
+        } else {
+            ok = fwrite(buf + offset, 1, end - offset, self->file) == end - offset;
+
+            /* Holes may span chunks, they are punched once their end is known */
+            if (ok && self->offset - self->hole_start >= PREALLOC_MIN_HOLE) {
+                local_file_punch(self, self->hole_start, self->offset);
+            }
+        }
+        if (!ok) {
+            return false;
+        }
+
+        self->offset += end - offset;
+        if (!is_zero) {
+            self->hole_start = self->offset;
+        }
+        offset = end;
+    }
+
+    if (self->cache == CACHE_DROP &&
+        self->offset - self->written_back >= WRITE_BEHIND_SIZE) {
+        local_file_write_behind(self);
+    }
+
+    return true;
+}
+
+/**
+ * Finish a download, extend the file over a trailing hole and give back the space
+ * reserved for it, or past the end of a file that shrank while it was copied.
+ *
+ * :return: False on write errors.
+ */
+static bool
+local_file_close(LocalFileT *self) {
+    bool ok = true;
+
+    /* Seeking over a trailing hole doesn't extend the file, truncating also frees
+     * the space reserved past the end */
+    if (self->hole_start < self->offset || self->preallocated > self->offset) {
+        ok = !fflush(self->file) && !ftruncate(fileno(self->file), self->offset);
+    }
+    local_file_punch(self, self->hole_start, self->offset);
+
+    if (ok && self->cache == CACHE_DROP && !fflush(self->file) &&
+        !fdatasync(fileno(self->file))) {
+        local_read_done(self->file, CACHE_DROP);
+    }
+
+    if (fclose(self->file)) {
+        ok = false;
+    }
+    DBG_SAFE_FREE(self->buf);
+    return ok;
+}
+
+/** Hash the zeros of a hole skipped by a copy, the copy reads them back. */
+static void
+hash_update_zeros(HashT *hash, uint64_t num_bytes) {
+    static const char zeros[BUF_SIZE_FILE_CONTENTS];
+
+    for (; num_bytes; num_bytes -= MIN(num_bytes, sizeof zeros)) {
+        Hash_update(hash, zeros, MIN(num_bytes, sizeof zeros));
+    }
+}
+
+/**
+ * Append a string to a command for the remote shell as one single quoted word, a
+ * ``'`` is written as ``'\''``.
+ *
+ * :param command: NUL terminated command to append to.
+ * :param size: Size of the buffer of ``command``.
+ * :return: False if the quoted string doesn't fit.
+ */
+static bool
+shell_quote(char *command, size_t size, const char *str) {
+    size_t len_command = strlen(command);
+
+    if (len_command + 3 > size) {
+        return false;
+    }
+    command[len_command++] = '\'';
+
+    for (const char *c = str; *c; c++) {
+        if (len_command + 6 >= size) {
+            return false;
+        }
+        if (*c == '\'') {
+            memcpy(command + len_command, "'\\''", 4);
+            len_command += 4;
+        } else {
+            command[len_command++] = *c;
+        }
+    }
+    memcpy(command + len_command, "'", 2);
+
+    return true;
+}
+
+/** Open a channel running ``command`` on the server, NULL if it can't be run. */
+static ssh_channel
+exec_channel_open(ssh_session session_ssh, const char *command) {
+    ssh_channel channel = ssh_channel_new(session_ssh);
+
+    if (channel == NULL) {
+        return NULL;
+    }
+    if (ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, command) != SSH_OK) {
+        ssh_channel_free(channel);
+        return NULL;
+    }
+
+    return channel;
+}
+
+/**
+ * Wait for the command of a channel to exit and free the channel, whatever the
+ * command still prints is thrown away.
+ *
+ * :return: Exit status of the command, -1 if the server didn't send one.
+ */
+static int32_t
+exec_channel_close(ssh_channel channel) {
+    char buf[BUF_SIZE_FS_PATH];
+    int32_t exit_status;
+
+    ssh_channel_send_eof(channel);
+    while (ssh_channel_read(channel, buf, sizeof buf, 0) > 0) {
+    }
+    exit_status = ssh_channel_get_exit_status(channel);
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+
+    return exit_status;
+}
+
+/**
+ * Ask the server to hash a file with ``xxhsum``, the digest is the same as the one
+ * ``HashT`` computes.
+ *
+ * :param digest: [OUT] Digest of the remote file.
+ * :return: False if ``xxhsum`` couldn't be run or didn't print a digest.
+ */
+static bool
+remote_hash_file(ssh_session session_ssh, const char *abs_path_remote,
+                 uint64_t *digest) {
+    char command[BUF_SIZE_FS_PATH * 4 + 32] = "xxhsum -H1 -- ";
+    char output[LEN_HASH_HEX + 1] = {0};
+    size_t len_output = 0;
+    ssh_channel channel;
+    int32_t num_bytes_read;
+    char *end;
+    bool ok = true;
+
+    if (!shell_quote(command, sizeof command, abs_path_remote)) {
+        return false;
+    }
+
+    channel = exec_channel_open(session_ssh, command);
+    if (channel == NULL) {
+        return false;
+    }
+
+    /* Only the digest at the start of the output is kept, the rest is drained */
+    while (ok) {
+        char buf[BUF_SIZE_FS_PATH];
+
+        num_bytes_read = ssh_channel_read(channel, buf, sizeof buf, 0);
+        if (num_bytes_read <= 0) {
+            ok = num_bytes_read == 0;
+            break;
+        }
+        if (len_output < LEN_HASH_HEX) {
+            size_t len_copy = MIN((size_t)num_bytes_read, LEN_HASH_HEX - len_output);
+
+            memcpy(output + len_output, buf, len_copy);
+            len_output += len_copy;
+        }
+    }
+
+    ok = exec_channel_close(channel) == 0 && ok && len_output == LEN_HASH_HEX;
+    if (!ok) {
+        return false;
+    }
+
+    errno = 0;
+    *digest = strtoull(output, &end, 16);
+    return !errno && end == output + LEN_HASH_HEX;
+}
+
+/** Hash a remote file by reading it back. */
+static bool
+remote_read_hash(sftp_session session_sftp, const char *abs_path_remote,
+                 uint64_t *digest) {
+    char file_buf[BUF_SIZE_FILE_CONTENTS];
+    int32_t num_bytes_read;
+    sftp_file file;
+    HashT hash;
+
+    file = sftp_open(session_sftp, abs_path_remote, O_RDONLY, 0);
+    if (file == NULL) {
+        return false;
+    }
+
+    Hash_init(&hash, VERIFY_HASH_SEED);
+    while ((num_bytes_read = sftp_read(file, file_buf, sizeof file_buf)) > 0) {
+        Hash_update(&hash, file_buf, num_bytes_read);
+    }
+    sftp_close(file);
+
+    *digest = Hash_digest(&hash);
+    return num_bytes_read == 0;
+}
+
+/** Hash a local file by reading it back, usually from the page cache. */
+static bool
+local_read_hash(const char *abs_path_local, uint64_t *digest) {
+    char file_buf[BUF_SIZE_FILE_CONTENTS];
+    size_t num_bytes_read;
+    FILE *file;
+    HashT hash;
+    bool ok;
+
+    file = fopen(abs_path_local, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    Hash_init(&hash, VERIFY_HASH_SEED);
+    while ((num_bytes_read = fread(file_buf, 1, sizeof file_buf, file)) > 0) {
+        Hash_update(&hash, file_buf, num_bytes_read);
+    }
+    ok = !ferror(file);
+    fclose(file);
+
+    *digest = Hash_digest(&hash);
+    return ok;
+}
+
+/**
+ * Check a copied file against the hash of the bytes that were transferred.
+ *
+ * The server hashes its side with ``xxhsum`` when it can, that costs no transfer
+ * at all. Otherwise the destination is read back: a local file comes from the page
+ * cache, a remote one is downloaded again.
+ *
+ * :param digest: Hash of the bytes read from the source while copying.
+ * :param is_upload: True if the remote file is the destination.
+ * :return: ``CMD_OK`` if the hashes match, ``CMD_INTERNAL_ERROR`` otherwise.
+ */
+static CommandStatusE
+copy_verify(ssh_session session_ssh, sftp_session session_sftp, CopyOptionsT *options,
+            const char *abs_path_remote, const char *abs_path_local, uint64_t digest,
+            bool is_upload) {
+    uint64_t check;
+    bool ok = false;
+
+    if (options->remote_hash != REMOTE_TOOL_MISSING) {
+        ok = remote_hash_file(session_ssh, abs_path_remote, &check);
+
+        /* A single failure could be this file, only a first one rules ``xxhsum`` out */
+        if (options->remote_hash == REMOTE_TOOL_UNKNOWN) {
+            options->remote_hash = ok ? REMOTE_TOOL_AVAILABLE : REMOTE_TOOL_MISSING;
+            if (!ok) {
+                DBG_ERR("No xxhsum on the server, copied files are verified by %s",
+                        is_upload ? "downloading them again" : "reading them again");
+            }
+        }
+    }
+
+    if (!ok) {
+        ok = is_upload ? remote_read_hash(session_sftp, abs_path_remote, &check)
+                       : local_read_hash(abs_path_local, &check);
+    }
+
+    if (!ok) {
+        DBG_ERR("Couldn't verify: %s", is_upload ? abs_path_remote : abs_path_local);
+        return CMD_INTERNAL_ERROR;
+    }
+    if (check != digest) {
+        DBG_ERR("Checksum mismatch: %s: %016" PRIx64 " != %016" PRIx64,
+                is_upload ? abs_path_remote : abs_path_local, digest, check);
+        return CMD_INTERNAL_ERROR;
+    }
+
+    return CMD_OK;
+}
+
+/** Parse a mode given to ``connect --compression``, ``NULL`` selects ``no``. */
+bool
+compression_from_str(const char *str, CompressionE *compression) {
+    static const char *names[] = {
+        [COMPRESSION_NO] = "no",
+        [COMPRESSION_YES] = "yes",
+        [COMPRESSION_AUTO] = "auto",
+    };
+
+    if (str == NULL) {
+        *compression = COMPRESSION_NO;
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(str, names[i])) {
+            *compression = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** Parse a mode given to ``copy --bulk``. */
+bool
+bulk_mode_from_str(const char *str, BulkModeE *mode) {
+    static const char *names[] = {
+        [BULK_AUTO] = "auto",
+        [BULK_TAR] = "tar",
+        [BULK_ARCHIVE] = "archive",
+        [BULK_NO] = "no",
+    };
+
+    for (size_t i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(str, names[i])) {
+            *mode = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** Parse a policy given to ``copy --cache``. */
+bool
+cache_policy_from_str(const char *str, CachePolicyE *policy) {
+    static const char *names[] = {
+        [CACHE_KEEP] = "keep",
+        [CACHE_DROP] = "drop",
+    };
+
+    for (size_t i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(str, names[i])) {
+            *policy = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** Check if a path has the extension of a format that is compressed already. */
+static bool
+compress_is_precompressed(const char *path) {
+    static const char *extensions[] = {
+        "7z",  "avi",  "br",  "bz2", "gif", "gz",   "jpeg", "jpg",
+        "lz4", "mkv",  "mov", "mp3", "mp4", "parquet", "png", "rar",
+        "tgz", "webm", "webp", "xz", "zip", "zst",
+    };
+    const char *extension = strrchr(path, '.');
+
+    if (extension == NULL || strchr(extension, PATH_SEPARATOR) != NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof extensions / sizeof *extensions; i++) {
+        if (!strcasecmp(extension + 1, extensions[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Guess if a file is worth sending over a compressed session from its name and a
+ * sample of its contents.
+ *
+ * The order-0 entropy of the sample stands in for running zlib on it, text, logs
+ * and CSV score 4 to 5 bits per byte while compressed data is close to 8.
+ */
+static bool
+compress_is_worthwhile(const char *path, const void *sample, size_t length) {
+    const uint8_t *bytes = sample;
+    size_t counts[256] = {0};
+    double entropy = 0;
+
+    if (!length || compress_is_precompressed(path)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        counts[bytes[i]]++;
+    }
+    for (size_t i = 0; i < 256; i++) {
+        if (counts[i]) {
+            double probability = (double)counts[i] / length;
+
+            entropy -= probability * log2(probability);
+        }
+    }
+
+    return entropy < COMPRESS_MAX_ENTROPY;
+}
+
+/**
+ * Move a download over to the compressed sessions if its first chunk shows it is
+ * compressible, the rest of the file is read from there.
+ *
+ * :param session_ssh: [IN/OUT] Session of the download, replaced if it moves.
+ * :param session_sftp: [IN/OUT] Same as ``session_ssh``.
+ * :param file: [IN/OUT] Remote file, replaced by one open at the same offset.
+ * :param sample: First chunk of the file.
+ */
+static void
+copy_route_download(CopyOptionsT *options, ssh_session *session_ssh,
+                    sftp_session *session_sftp, sftp_file *file, const char *path,
+                    const char *sample, size_t len_sample) {
+    sftp_file compressed_file;
+
+    /* A short first chunk is the whole file, there is nothing left to move */
+    if (len_sample < BUF_SIZE_FILE_CONTENTS ||
+        !compress_is_worthwhile(path, sample, len_sample)) {
+        return;
+    }
+
+    /* Carry on over the current session if the file can't be reopened */
+    compressed_file = sftp_open(options->compressed_sftp, path, O_RDONLY, 0);
+    if (compressed_file == NULL) {
+        return;
+    }
+    if (sftp_seek64(compressed_file, len_sample) < 0) {
+        sftp_close(compressed_file);
+        return;
+    }
+
+    sftp_close(*file);
+    *file = compressed_file;
+    *session_ssh = options->compressed_ssh;
+    *session_sftp = options->compressed_sftp;
+}
+
+/** A read request of a download waiting for its response */
+typedef struct {
+    /** Id given by ``sftp_async_read_begin`` */
+    uint32_t id;
+
+    /** Offset of the first byte asked for */
+    uint64_t offset;
+    uint32_t length;
+
+    /** When the request was sent, for the round trip */
+    struct timespec sent;
+} ReadRequestT;
+
+/**
+ * Helper function to copy a file from remote to local server.
+ *
+ * Reads are pipelined, the chunk size and the number of requests in flight come
+ * from ``options->tune``. The responses are handled in the order the requests were
+ * sent, a response shorter than asked for ends the file unless a later one has
+ * data, then the server read less than asked and the reads restart from there.
+ *
+ * :param session_ssh: ssh_session object.
+ * :param session_sftp: sftp_session object.
+ * :param abs_path_remote: Absolute path of the file on remote machine.
+ * :param abs_path_local: Absolute path of the file on local machine.
+ * :param size: Size of the remote file, reserved on the local disk up front.
+ * :param options: Options of the copy, for progress and cancellation.
+ */
+static CommandStatusE
+copy_file_from_remote_to_local(ssh_session session_ssh, sftp_session session_sftp,
+                               char *abs_path_remote, char *abs_path_local, uint64_t size,
+                               CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+    ReadRequestT requests[TUNE_MAX_WINDOW];
+    size_t first = 0, num_in_flight = 0, chunk, window;
+    uint64_t offset = 0;
+    int32_t num_bytes_read = 0;
+    bool is_draining = false, is_gap = false;
+    bool is_sampling = options->compressed_sftp != NULL;
+    char *file_buf;
+    sftp_file from_file;
+    LocalFileT to_file;
+    HashT hash;
+
+    Hash_init(&hash, VERIFY_HASH_SEED);
+    from_file = sftp_open(session_sftp, abs_path_remote, O_RDONLY, 0);
+    if (from_file == NULL) {
+        DBG_ERR("Couldn't open file: %s", ssh_get_error(session_ssh));
+        return CMD_INTERNAL_ERROR;
+    }
+
+    if (!local_file_open(&to_file, abs_path_local, size, options->cache)) {
+        DBG_ERR("Couldn't create file: %s", abs_path_local);
+        sftp_close(from_file);
+        return CMD_INTERNAL_ERROR;
+    }
+
+    file_buf = DBG_MALLOC(TUNE_MAX_CHUNK);
+    if (options->tune != NULL) {
+        Tune_begin(options->tune);
+    }
+
+    while (true) {
+        ReadRequestT *request;
+
+        /* The first chunk of a sampled file is read alone, the rest of the file may
+         * be read over another session */
+        copy_tune_get(options, true, &chunk, &window);
+        while (!is_draining && num_in_flight < (is_sampling ? 1 : window)) {
+            request = &requests[(first + num_in_flight) % TUNE_MAX_WINDOW];
+            if (!copy_throttle(options, chunk)) {
+                result = CMD_CANCELLED;
+                break;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &request->sent);
+            num_bytes_read = sftp_async_read_begin(from_file, chunk);
+            if (num_bytes_read < 0) {
+                copy_throttle_refund(options, chunk);
+                break;
+            }
+
+            request->id = num_bytes_read;
+            request->offset = offset;
+            request->length = chunk;
+            offset += chunk;
+            num_in_flight++;
+        }
+        if (result != CMD_OK || num_bytes_read < 0 || !num_in_flight) {
+            break;
+        }
+
+        request = &requests[first];
+        first = (first + 1) % TUNE_MAX_WINDOW;
+        num_in_flight--;
+
+        num_bytes_read =
+            sftp_async_read(from_file, file_buf, request->length, request->id);
+        if (num_bytes_read < 0) {
+            break;
+        }
+        copy_throttle_refund(options, request->length - num_bytes_read);
+        copy_tune_sample(options, num_bytes_read, &request->sent);
+
+        /* Data after a short read belongs further on, it is read again later */
+        if (is_draining) {
+            is_gap |= num_bytes_read > 0;
+        } else if (num_bytes_read > 0) {
+            if (!local_file_write(&to_file, file_buf, num_bytes_read)) {
+                DBG_ERR("Couldn't write file: %s: %s", abs_path_local, strerror(errno));
+                result = CMD_INTERNAL_ERROR;
+                break;
+            }
+            if (options->verify) {
+                Hash_update(&hash, file_buf, num_bytes_read);
+            }
+            copy_progress_add(options, num_bytes_read);
+        }
+
+        if (!is_draining && (uint32_t)num_bytes_read < request->length) {
+            is_draining = true;
+            offset = request->offset + num_bytes_read;
+
+            /* Only EOF tells for sure the file is over, with no other request to
+             * tell a shorter read is followed up on */
+            is_gap = num_bytes_read > 0 && !num_in_flight;
+        }
+
+        if (is_draining && !num_in_flight) {
+            if (!is_gap) {
+                break;
+            }
+            if (sftp_seek64(from_file, offset) < 0) {
+                num_bytes_read = -1;
+                break;
+            }
+            is_draining = is_gap = false;
+        }
+
+        if (is_sampling) {
+            is_sampling = false;
+            copy_route_download(options, &session_ssh, &session_sftp, &from_file,
+                                abs_path_remote, file_buf, num_bytes_read);
+        }
+    }
+
+    if (num_bytes_read < 0) {
+        DBG_ERR("Couldn't read remote file: Error Code: %d",
+                sftp_get_error(session_sftp));
+        result = CMD_INTERNAL_ERROR;
+    }
+
+    /* Responses still on their way would pile up in the session otherwise */
+    for (; num_in_flight; num_in_flight--, first = (first + 1) % TUNE_MAX_WINDOW) {
+        sftp_async_read(from_file, file_buf, requests[first].length, requests[first].id);
+    }
+
+    DBG_SAFE_FREE(file_buf);
+    sftp_close(from_file);
+    if (!local_file_close(&to_file) && result == CMD_OK) {
+        DBG_ERR("Couldn't write file: %s: %s", abs_path_local, strerror(errno));
+        result = CMD_INTERNAL_ERROR;
+    }
+
+    if (result == CMD_OK && options->verify) {
+        result = copy_verify(session_ssh, session_sftp, options, abs_path_remote,
+                             abs_path_local, Hash_digest(&hash), false);
+    }
+
+    if (result == CMD_OK) {
+        copy_progress_file_done(options);
+    }
+    return result;
+}
+
+/** ``BatchDoneT`` of the batch of a copy, its data is the ``CopyOptionsT`` */
+static void
+copy_batch_done(void *data, size_t num_bytes, bool ok) {
+    if (ok) {
+        copy_progress_add(data, num_bytes);
+        copy_progress_file_done(data);
+    }
+}
+
+/**
+ * Get the batch of an upload, it is opened the first time it is needed.
+ *
+ * :return: The batch, NULL if the server doesn't let it be opened.
+ */
+static BatchT *
+copy_batch_open(ssh_session session_ssh, CopyOptionsT *options) {
+    if (options->batch == NULL && !options->batch_unavailable) {
+        options->batch = Batch_new(session_ssh, copy_batch_done, options);
+        options->batch_unavailable = options->batch == NULL;
+    }
+
+    return options->batch;
+}
+
+/** A write request of an upload waiting for its response */
+typedef struct {
+    uint32_t length;
+
+    /** When the request was sent, for the round trip */
+    struct timespec sent;
+} WriteRequestT;
+
+/**
+ * Count the writes of an upload the server answered since the last call, they are
+ * answered in the order they were sent.
+ *
+ * :param requests: Writes in flight, the ``n``-th one sent is at ``n % TUNE_MAX_WINDOW``.
+ * :param num_done: [IN/OUT] Writes counted so far.
+ */
+static void
+copy_writes_done(CopyOptionsT *options, const BatchStreamT *stream,
+                 const WriteRequestT *requests, size_t *num_done) {
+    for (; *num_done < stream->num_done; (*num_done)++) {
+        const WriteRequestT *request = &requests[*num_done % TUNE_MAX_WINDOW];
+
+        copy_tune_sample(options, request->length, &request->sent);
+        copy_progress_add(options, request->length);
+    }
+}
+
+/**
+ * Helper function to copy a file from local to remote server.
+ *
+ * libssh waits for every write to complete, so the writes go over the channel of
+ * the batch of the upload when it can be opened, the chunk size and the number of
+ * writes in flight come from ``options->tune``. Otherwise one write at a time sends
+ * what would be in flight as one chunk.
+ *
+ * :param session_ssh: ssh_session object.
+ * :param session_sftp: sftp_session object.
+ * :param abs_path_local: Absolute path of the file on local machine.
+ * :param abs_path_remote: Absolute path of the file on remote machine.
+ * :param options: Options of the copy, for progress and cancellation.
+ */
+static CommandStatusE
+copy_file_from_local_to_remote(ssh_session session_ssh, sftp_session session_sftp,
+                               char *abs_path_local, char *abs_path_remote,
+                               CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+    uint64_t offset = 0, data_end = 0, len_written = 0, read_ahead = 0, dropped = 0;
+    struct sftp_attributes_struct attr = {0};
+    WriteRequestT requests[TUNE_MAX_WINDOW];
+    int32_t num_bytes_read = 0;
+    size_t chunk, chunk_ahead, window, length, num_done = 0;
+    BatchStreamT stream = {0};
+    BatchT *batch = NULL;
+    bool is_compressed = false;
+    struct timespec sent;
+    struct stat from_file_stat;
+    char *file_buf;
+    FILE *from_file;
+    sftp_file to_file = NULL;
+    HashT hash;
+
+    Hash_init(&hash, VERIFY_HASH_SEED);
+    if (stat(abs_path_local, &from_file_stat)) {
+        DBG_ERR("Couldn't open file: %s: %s", abs_path_local, strerror(errno));
+        return CMD_INTERNAL_ERROR;
+    }
+
+    /* Not really sure why this is needed but, it doesn't work without it
+     * so  ¯\_(ツ)_/¯ */
+    if (!from_file_stat.st_size) {
+        DBG_INFO("File with 0 size: %s", abs_path_local);
+
+        /* An existing file is emptied, like every other copied file */
+        to_file = sftp_open(session_sftp, abs_path_remote, O_CREAT | O_WRONLY | O_TRUNC,
+                            FS_CREATE_FILE_PERM);
+        if (to_file == NULL) {
+            DBG_ERR("Couldn't create file: %s: %s", abs_path_remote,
+                    ssh_get_error(session_ssh));
+            return CMD_INTERNAL_ERROR;
+        }
+        if (sftp_close(to_file) != SSH_OK) {
+            DBG_ERR("Couldn't close remote file: %s: %s", abs_path_remote,
+                    ssh_get_error(session_ssh));
+            return CMD_INTERNAL_ERROR;
+        }
+        copy_progress_file_done(options);
+        return CMD_OK;
     }
 
     from_file = fopen(abs_path_local, "r");
-    to_file =
-        sftp_open(session_sftp, abs_path_remote, O_CREAT | O_WRONLY, FS_CREATE_PERM);
+    if (from_file == NULL) {
+        DBG_ERR("Couldn't open file: %s", abs_path_local);
+        return CMD_INTERNAL_ERROR;
+    }
+    file_buf = DBG_MALLOC(TUNE_MAX_CHUNK);
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(fileno(from_file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    /* Sampling a local file is a read from the page cache, the copy rereads it */
+    if (options->compressed_sftp != NULL) {
+        size_t len_sample = fread(file_buf, 1, BUF_SIZE_FILE_CONTENTS, from_file);
+
+        if (compress_is_worthwhile(abs_path_local, file_buf, len_sample)) {
+            session_ssh = options->compressed_ssh;
+            session_sftp = options->compressed_sftp;
+            is_compressed = true;
+        }
+        rewind(from_file);
+    }
+
+    /* The batch speaks over the uncompressed session */
+    if (!is_compressed) {
+        batch = copy_batch_open(session_ssh, options);
+    }
+    if (batch != NULL && !Batch_open(batch, abs_path_remote, &stream)) {
+        batch = NULL;
+    }
+
+    if (batch == NULL) {
+        to_file = sftp_open(session_sftp, abs_path_remote,
+                            O_CREAT | O_WRONLY | O_TRUNC, FS_CREATE_FILE_PERM);
+        if (to_file == NULL) {
+            DBG_ERR("Couldn't create file: %s: %s", abs_path_remote,
+                    ssh_get_error(session_ssh));
+            DBG_SAFE_FREE(file_buf);
+            fclose(from_file);
+            return CMD_INTERNAL_ERROR;
+        }
+    }
+
+    if (options->tune != NULL) {
+        Tune_begin(options->tune);
+    }
+
+    while (true) {
+        copy_tune_get(options, batch != NULL, &chunk, &window);
+
+        /* Holes are skipped, writing past them leaves holes on the server as well */
+        if (offset == data_end) {
+            local_next_data(fileno(from_file), &offset, &data_end);
+            if (offset == data_end || fseeko(from_file, offset, SEEK_SET)) {
+                break;
+            }
+        }
+
+        length = MIN(chunk, data_end - offset);
+        if (!copy_throttle(options, length)) {
+            result = CMD_CANCELLED;
+            break;
+        }
+
+        /* Reads run ahead by the bytes in flight, or by what a pipelined copy would
+         * keep in flight when the writes wait for each other */
+        copy_tune_get(options, true, &chunk_ahead, &window);
+        local_read_advise(fileno(from_file), offset, (uint64_t)chunk_ahead * window,
+                          &read_ahead, &dropped, options->cache);
+        num_bytes_read = fread(file_buf, sizeof *file_buf, length, from_file);
+        copy_throttle_refund(options, length - num_bytes_read);
+        if (num_bytes_read <= 0) {
+            break;
+        }
+
+        if (batch != NULL) {
+            WriteRequestT *request = &requests[stream.num_sent % TUNE_MAX_WINDOW];
+
+            /* The oldest writes are waited for once the window is full, the batch
+             * tells why a write failed */
+            if (!Batch_drain(batch, &stream, window - 1)) {
+                result = CMD_INTERNAL_ERROR;
+                break;
+            }
+            copy_writes_done(options, &stream, requests, &num_done);
+
+            request->length = num_bytes_read;
+            clock_gettime(CLOCK_MONOTONIC, &request->sent);
+            if (!Batch_write(batch, &stream, offset, file_buf, num_bytes_read)) {
+                result = CMD_INTERNAL_ERROR;
+                break;
+            }
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &sent);
+            if ((offset != len_written && sftp_seek64(to_file, offset) < 0) ||
+                !sftp_write_all(to_file, file_buf, num_bytes_read)) {
+                DBG_ERR("Couldn't write remote file: %s: Error Code: %d",
+                        abs_path_remote, sftp_get_error(session_sftp));
+                result = CMD_INTERNAL_ERROR;
+                break;
+            }
+            copy_tune_sample(options, num_bytes_read, &sent);
+            copy_progress_add(options, num_bytes_read);
+        }
+
+        if (options->verify) {
+            hash_update_zeros(&hash, offset - len_written);
+            Hash_update(&hash, file_buf, num_bytes_read);
+        }
+        offset += num_bytes_read;
+        len_written = offset;
+    }
+
+    /* The close waits for the writes still in flight */
+    if (batch != NULL) {
+        if (!Batch_close(batch, &stream) && result == CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        copy_writes_done(options, &stream, requests, &num_done);
+    }
+
+    if (ferror(from_file)) {
+        DBG_ERR("Couldn't read local file: Error Code: %d", errno);
+        result = CMD_INTERNAL_ERROR;
+    }
+
+    /* Writes don't extend the remote file over a trailing hole, its size is set */
+    if (result == CMD_OK && offset > len_written) {
+        attr.flags = SSH_FILEXFER_ATTR_SIZE;
+        attr.size = offset;
+        if (sftp_setstat(session_sftp, abs_path_remote, &attr)) {
+            DBG_ERR("Couldn't extend remote file: %s: %s", abs_path_remote,
+                    ssh_get_error(session_ssh));
+            result = CMD_INTERNAL_ERROR;
+        }
+        if (options->verify) {
+            hash_update_zeros(&hash, offset - len_written);
+        }
+    }
+
+    DBG_SAFE_FREE(file_buf);
+    local_read_done(from_file, options->cache);
+    fclose(from_file);
+    if (to_file != NULL && sftp_close(to_file) != SSH_OK && result == CMD_OK) {
+        DBG_ERR("Couldn't close remote file: %s: %s", abs_path_remote,
+                ssh_get_error(session_ssh));
+        result = CMD_INTERNAL_ERROR;
+    }
+
+    if (result == CMD_OK && options->verify) {
+        result = copy_verify(session_ssh, session_sftp, options, abs_path_remote,
+                             abs_path_local, Hash_digest(&hash), true);
+    }
+
+    if (result == CMD_OK) {
+        copy_progress_file_done(options);
+    }
+    return result;
+}
+
+/**
+ * Hand a small file over to the batch of an upload, the batch is opened for the
+ * first one. Files of up to one chunk are small, they are read in one go.
+ *
+ * :param size: Size of the local file.
+ * :param metadata: Permissions and times to preserve, NULL for none.
+ * :return: False if the file has to be copied on its own, because it isn't small
+ *     or the batch can't be used.
+ */
+static bool
+copy_file_batched(ssh_session session_ssh, char *abs_path_local, char *abs_path_remote,
+                  uint64_t size, const MetadataT *metadata, CopyOptionsT *options) {
+    size_t chunk, window, length;
+    char *contents;
+    FILE *from_file;
+
+    /* Batched files are never hashed, the ones to verify are copied one by one */
+    copy_tune_get(options, false, &chunk, &window);
+    if (size > chunk || options->verify ||
+        copy_batch_open(session_ssh, options) == NULL) {
+        return false;
+    }
+
+    from_file = fopen(abs_path_local, "r");
+    if (from_file == NULL) {
+        return false;
+    }
+
+    /* One byte more tells if the file grew since its size was taken */
+    contents = DBG_MALLOC(size + 1);
+    length = fread(contents, 1, size + 1, from_file);
+    if (ferror(from_file) || length > size) {
+        DBG_SAFE_FREE(contents);
+        fclose(from_file);
+        return false;
+    }
+    local_read_done(from_file, options->cache);
+    fclose(from_file);
+
+    if (!copy_throttle(options, length)) {
+        DBG_SAFE_FREE(contents);
+        return true;
+    }
+
+    return Batch_put(options->batch, abs_path_remote, contents, length, metadata);
+}
+
+/**
+ * Wait for the small files of an upload to be written and close its batch.
+ *
+ * :return: ``CMD_INTERNAL_ERROR`` if any of them failed, ``CMD_OK`` otherwise.
+ */
+static CommandStatusE
+copy_batch_close(CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+
+    if (options->batch != NULL) {
+        result = Batch_flush(options->batch) ? CMD_OK : CMD_INTERNAL_ERROR;
+        Batch_free(options->batch);
+        options->batch = NULL;
+    }
+
+    return result;
+}
+
+/** A directory waiting to be copied by a recursive copy. */
+typedef struct {
+    /** Path of the directory on the source */
+    char *path;
+
+    /** Canonical path of a remote directory, used to detect symbolic link cycles */
+    char *canonical_path;
+
+    /** Number of directories between this one and the root of the copy */
+    size_t depth;
+
+    /** Index of the ``DirNodeT`` of the local directory it was found in, ``SIZE_MAX``
+     * for the root of the copy */
+    size_t parent;
+} DirFrameT;
+
+/** Identity of a local directory, used to detect symbolic link cycles. */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} FileIdT;
+
+/** A local directory read by an upload, linked to the one it was found in. */
+typedef struct {
+    FileIdT id;
+
+    /** Index of the directory it was found in, ``SIZE_MAX`` for the root of the copy */
+    size_t parent;
+} DirNodeT;
+
+/** Parse a link policy given to ``copy --links``, ``NULL`` selects ``LINK_PRESERVE``. */
+bool
+link_policy_from_str(const char *str, LinkPolicyE *policy) {
+    static const char *names[] = {
+        [LINK_PRESERVE] = "preserve",
+        [LINK_FOLLOW] = "follow",
+        [LINK_SKIP] = "skip",
+    };
+
+    if (str == NULL) {
+        *policy = LINK_PRESERVE;
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(str, names[i])) {
+            *policy = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+dir_frame_push(ListT *dir_stack, char *path, char *canonical_path, size_t depth) {
+    DirFrameT frame = {strdup(path), canonical_path, depth, SIZE_MAX};
+    List_push(dir_stack, &frame, sizeof frame);
+}
+
+/** Push a local directory found in the directory of the ``DirNodeT`` ``parent``. */
+static void
+local_frame_push(ListT *level, char *path, size_t depth, size_t parent) {
+    DirFrameT frame = {strdup(path), NULL, depth, parent};
+    List_push(level, &frame, sizeof frame);
+}
+
+static void
+dir_frame_free(DirFrameT *self) {
+    DBG_SAFE_FREE(self->path);
+    free(self->canonical_path);
+    DBG_SAFE_FREE(self);
+}
+
+/** Drop ancestors deeper than ``depth``, so only the parents of a frame remain. */
+static void
+ancestors_truncate(ListT *ancestors, size_t depth) {
+    while (List_length(ancestors) > depth) {
+        DBG_SAFE_FREE(List_pop(ancestors));
+    }
+}
+
+/**
+ * Create a local symbolic link, replacing whatever is already at ``link_path``.
+ *
+ * :param target: Path the link points to, copied verbatim.
+ * :param link_path: Path of the link itself.
+ */
+static CommandStatusE
+create_local_link(const char *target, const char *link_path) {
+    if (!symlink(target, link_path)) {
+        return CMD_OK;
+    }
+
+    if (errno == EEXIST && !unlink(link_path) && !symlink(target, link_path)) {
+        return CMD_OK;
+    }
+
+    DBG_ERR("Couldn't create link %s -> %s: %s", link_path, target, strerror(errno));
+    return CMD_INTERNAL_ERROR;
+}
+
+/**
+ * Check if an entry found while copying a directory is excluded by the filter of
+ * the copy, its path is matched relative to the directory being copied.
+ */
+static bool
+copy_excludes(CopyOptionsT *options, PathMapT *path_map, FileSystemT *filesystem) {
+    if (options->filter == NULL) {
+        return false;
+    }
+
+    return Filter_excludes(options->filter,
+                           PathMap_relative(path_map, filesystem->relative_path),
+                           filesystem->type == FS_DIRECTORY);
+}
+
+/** A symbolic link of a remote directory, resolved before the directory is copied */
+typedef struct {
+    /** Target of the link when links are preserved, NULL if it couldn't be read */
+    char *target;
+
+    /** What the link points to when links are followed */
+    BatchTargetT follow;
+} RemoteLinkT;
+
+/**
+ * Find what a remote symbolic link points to with blocking requests, the same as
+ * ``Batch_follow`` except that only directories are resolved.
+ */
+static void
+remote_link_follow(sftp_session session_sftp, const char *path, BatchTargetT *target) {
+    sftp_attributes attr = sftp_stat(session_sftp, path);
+
+    *target = (BatchTargetT){0};
+    if (attr == NULL) {
+        return;
+    }
+
+    target->exists = true;
+    target->is_dir = attr->type == SSH_FILEXFER_TYPE_DIRECTORY;
+    target->size = attr->size;
+    sftp_attributes_free(attr);
+
+    /* Canonical paths are only compared for directories, to detect cycles */
+    if (target->is_dir) {
+        target->canonical_path = sftp_canonicalize_path(session_sftp, path);
+    }
+}
+
+/**
+ * Resolve the symbolic links of a remote directory before its entries are copied,
+ * as ``options->link_policy`` needs them: their targets when preserving and what
+ * they point to when following.
+ *
+ * With enough links, or once the batch of the copy is open, their requests are
+ * pipelined over it, so the links of a directory cost a single round trip instead
+ * of one or two each.
+ *
+ * :param entries: ``ListT`` of ``FileSystemT`` of the directory.
+ * :return: Array parallel to ``entries``, NULL if links are skipped. Must be freed
+ *     with ``remote_links_free``.
+ */
+static RemoteLinkT *
+copy_resolve_remote_links(ssh_session session_ssh, sftp_session session_sftp,
+                          ListT *entries, PathMapT *path_map, CopyOptionsT *options) {
+    RemoteLinkT *links;
+    FileSystemT *filesystem;
+    size_t num_links = 0;
+    BatchT *batch = NULL;
+
+    if (options->link_policy == LINK_SKIP) {
+        return NULL;
+    }
+
+    links = DBG_CALLOC(List_length(entries) + 1, sizeof *links);
+    for (size_t i = 0; i < List_length(entries); i++) {
+        filesystem = List_get(entries, i);
+        num_links += filesystem->type == FS_SYM_LINK;
+    }
+    if (options->batch != NULL || num_links >= COPY_BATCH_MIN_LINKS) {
+        batch = copy_batch_open(session_ssh, options);
+    }
+
+    for (size_t i = 0; num_links && i < List_length(entries); i++) {
+        filesystem = List_get(entries, i);
+
+        /* Links the walk skips are never resolved */
+        if (filesystem->type != FS_SYM_LINK ||
+            path_is_dotted(filesystem->name, strlen(filesystem->name)) ||
+            copy_excludes(options, path_map, filesystem)) {
+            continue;
+        }
+
+        if (options->link_policy == LINK_PRESERVE) {
+            if (batch == NULL ||
+                !Batch_readlink(batch, filesystem->relative_path, &links[i].target)) {
+                links[i].target = sftp_readlink(session_sftp, filesystem->relative_path);
+            }
+        } else if (batch == NULL ||
+                   !Batch_follow(batch, filesystem->relative_path, &links[i].follow)) {
+            remote_link_follow(session_sftp, filesystem->relative_path,
+                               &links[i].follow);
+        }
+    }
+
+    if (batch != NULL) {
+        Batch_wait(batch);
+    }
+    return links;
+}
+
+static void
+remote_links_free(RemoteLinkT *links, size_t length) {
+    if (links == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        ssh_string_free_char(links[i].target);
+        ssh_string_free_char(links[i].follow.canonical_path);
+    }
+    DBG_SAFE_FREE(links);
+}
+
+/**
+ * Copy a symbolic link found while copying a remote directory.
+ *
+ * Depending on ``options->link_policy`` the link is recreated locally, skipped or
+ * followed. Followed links to files are copied as files and followed links to
+ * directories are pushed onto ``dir_stack``, unless they point back to a directory
+ * that is being copied, i.e its canonical path is among ``ancestors``.
+ *
+ * :param resolved: The link resolved by ``copy_resolve_remote_links``, NULL when
+ *     links are skipped.
+ */
+static CommandStatusE
+copy_remote_link(ssh_session session_ssh, sftp_session session_sftp,
+                 FileSystemT *link, const RemoteLinkT *resolved, char *path_local,
+                 DirFrameT *parent, ListT *ancestors, ListT *dir_stack,
+                 CopyOptionsT *options) {
+    const BatchTargetT *target;
+
+    switch (options->link_policy) {
+        case LINK_SKIP:
+            DBG_INFO("Skipping symbolic link %s", link->relative_path);
+            return CMD_OK;
+
+        case LINK_PRESERVE:
+            if (resolved->target == NULL) {
+                DBG_ERR("Couldn't read link %s", link->relative_path);
+                return CMD_INTERNAL_ERROR;
+            }
+            return create_local_link(resolved->target, path_local);
+
+        case LINK_FOLLOW:
+            target = &resolved->follow;
+            if (!target->exists) {
+                DBG_ERR("Skipping dangling link %s", link->relative_path);
+                return CMD_OK;
+            }
+
+            if (target->is_dir) {
+                if (target->canonical_path == NULL) {
+                    DBG_ERR("Couldn't resolve link %s", link->relative_path);
+                    return CMD_INTERNAL_ERROR;
+                }
+
+                for (size_t i = 0; i < List_length(ancestors); i++) {
+                    if (!strcmp(target->canonical_path, List_get(ancestors, i))) {
+                        DBG_ERR("Not following %s, it links back to %s",
+                                link->relative_path, target->canonical_path);
+                        return CMD_OK;
+                    }
+                }
+
+                dir_frame_push(dir_stack, link->relative_path,
+                               strdup(target->canonical_path), parent->depth + 1);
+                return CMD_OK;
+            }
+
+            return copy_file_from_remote_to_local(session_ssh, session_sftp,
+                                                  link->relative_path, path_local,
+                                                  target->size, options);
+    }
+
+    return CMD_OK;
+}
+
+/**
+ * Helper function to copy a directory from remote to local server.
+ *
+ * :param session_ssh: ssh_session object.
+ * :param session_sftp: sftp_session object.
+ * :param abs_path_remote: Absolute path of the directory on remote machine.
+ * :param abs_path_local: Absolute path of the directory on local machine.
+ * :param options: Options of the copy.
+ * :param metadata: ``ListT`` of ``MetadataT`` to queue the metadata of every copied
+ *     object in, NULL if it isn't preserved.
+ */
+static CommandStatusE
+copy_remote_dir_recursively(ssh_session session_ssh, sftp_session session_sftp,
+                            char *abs_path_remote, char *abs_path_local,
+                            CopyOptionsT *options, ListT *metadata) {
+    CommandStatusE result = CMD_OK;
+    ListT *dir_stack = List_new(1, sizeof(DirFrameT));
+    ListT *ancestors = List_new(1, sizeof(char *));
+    ListT *remote_dir;
+    RemoteLinkT *links;
+    FileSystemT *filesystem;
+    DirFrameT *frame;
+    char *dir_path_local;
+    char *file_path_local;
+    char *canonical_path = sftp_canonicalize_path(session_sftp, abs_path_remote);
+
+    PathMapT *path_map = PathMap_new(abs_path_remote, abs_path_local);
+    DirCacheT *dir_cache = DirCache_new();
+
+    dir_frame_push(dir_stack, path_map->source_root->str,
+                   strdup(canonical_path != NULL ? canonical_path : abs_path_remote), 0);
+    ssh_string_free_char(canonical_path);
+
+    while (!copy_cancelled(options) && (frame = List_pop(dir_stack)) != NULL) {
+        ancestors_truncate(ancestors, frame->depth);
+        List_push(ancestors, frame->canonical_path, strlen(frame->canonical_path) + 1);
+
+        dir_path_local = PathMap_apply(path_map, frame->path, strlen(frame->path));
+        if (dir_path_local == NULL ||
+            !DirCache_mkdir_parents(dir_cache, dir_path_local, strlen(dir_path_local))) {
+            result = CMD_INTERNAL_ERROR;
+            dir_frame_free(frame);
+            continue;
+        }
+        remote_dir = path_read_remote_dir(session_ssh, session_sftp, frame->path);
+        if (remote_dir == NULL) {
+            result = CMD_INTERNAL_ERROR;
+            dir_frame_free(frame);
+            continue;
+        }
+        links = copy_resolve_remote_links(session_ssh, session_sftp, remote_dir,
+                                          path_map, options);
+
+        for (size_t i = 0; i < remote_dir->length && !copy_cancelled(options); i++) {
+            CommandStatusE status = CMD_OK;
+
+            filesystem = List_get(remote_dir, i);
+
+            /* Excluded directories are never read */
+            if (path_is_dotted(filesystem->name, strlen(filesystem->name)) ||
+                copy_excludes(options, path_map, filesystem)) {
+                continue;
+            }
+
+            file_path_local = PathMap_apply(path_map, filesystem->relative_path,
+                                            strlen(filesystem->relative_path));
+            if (file_path_local == NULL) {
+                result = CMD_INTERNAL_ERROR;
+                continue;
+            }
+
+            if (metadata != NULL && filesystem->type != FS_SYM_LINK) {
+                Metadata_list_push(metadata, file_path_local, filesystem->permissions,
+                                   filesystem->atime, filesystem->mtime);
+            }
+
+            switch (filesystem->type) {
+                case FS_REG_FILE:
+                    status = copy_file_from_remote_to_local(
+                        session_ssh, session_sftp, filesystem->relative_path,
+                        file_path_local, filesystem->size, options);
+                    break;
+                case FS_DIRECTORY:
+                    /* Canonical paths of plain sub directories are derived from their
+                     * parent, no need to ask the server. */
+                    canonical_path = DBG_MALLOC(strlen(frame->canonical_path) +
+                                                strlen(filesystem->name) + 2);
+                    sprintf(canonical_path, "%s%c%s", frame->canonical_path,
+                            PATH_SEPARATOR, filesystem->name);
+                    dir_frame_push(dir_stack, filesystem->relative_path, canonical_path,
+                                   frame->depth + 1);
+                    break;
+                case FS_SYM_LINK:
+                    status = copy_remote_link(session_ssh, session_sftp, filesystem,
+                                              links != NULL ? &links[i] : NULL,
+                                              file_path_local, frame, ancestors,
+                                              dir_stack, options);
+                    break;
+                default:
+                    DBG_ERR("Unknown type %d", filesystem->type);
+            }
+
+            /* A cancelled copy is reported as such, not as failed */
+            if (status != CMD_OK && status != CMD_CANCELLED) {
+                result = CMD_INTERNAL_ERROR;
+            }
+        }
+
+        remote_links_free(links, remote_dir->length);
+        FileSystem_list_free(remote_dir);
+        dir_frame_free(frame);
+    }
+
+    /* Only left over when the copy was cancelled */
+    while ((frame = List_pop(dir_stack)) != NULL) {
+        dir_frame_free(frame);
+    }
+
+    ancestors_truncate(ancestors, 0);
+    List_free(ancestors);
+    List_free(dir_stack);
+    DirCache_free(dir_cache);
+    PathMap_free(path_map);
+
+    return copy_cancelled(options) ? CMD_CANCELLED : result;
+}
+
+/**
+ * Copy a symbolic link found while copying a local directory.
+ *
+ * Depending on ``options->link_policy`` the link is recreated on the remote server,
+ * skipped or followed. Followed links to directories are pushed onto ``next_level``
+ * unless the device and inode of the target are those of the directory of the link
+ * or of one of its ancestors.
+ *
+ * :param parent: Frame of the directory of the link.
+ * :param nodes: ``ListT`` of the ``DirNodeT`` of every directory read so far.
+ * :param node: Index of the ``DirNodeT`` of the directory of the link.
+ */
+static CommandStatusE
+copy_local_link(ssh_session session_ssh, sftp_session session_sftp, FileSystemT *link,
+                char *path_remote, DirFrameT *parent, ListT *nodes, size_t node,
+                ListT *next_level, CopyOptionsT *options) {
+    char target[BUF_SIZE_FS_PATH];
+    struct stat target_stat;
+    DirNodeT *ancestor;
+    ssize_t len_target;
+
+    switch (options->link_policy) {
+        case LINK_SKIP:
+            DBG_INFO("Skipping symbolic link %s", link->relative_path);
+            return CMD_OK;
+
+        case LINK_PRESERVE:
+            len_target = readlink(link->relative_path, target, sizeof target - 1);
+            if (len_target < 0) {
+                DBG_ERR("Couldn't read link %s: %s", link->relative_path,
+                        strerror(errno));
+                return CMD_INTERNAL_ERROR;
+            }
+            target[len_target] = '\0';
+
+            /* Pipelined with the other links, failures are reported by the batch */
+            if (copy_batch_open(session_ssh, options) != NULL &&
+                Batch_symlink(options->batch, target, path_remote)) {
+                return CMD_OK;
+            }
+
+            /* A stale entry would make the server refuse to create the link */
+            sftp_unlink(session_sftp, path_remote);
+            if (sftp_symlink(session_sftp, target, path_remote)) {
+                DBG_ERR("Couldn't create link %s -> %s: %s", path_remote, target,
+                        ssh_get_error(session_ssh));
+                return CMD_INTERNAL_ERROR;
+            }
+            return CMD_OK;
+
+        case LINK_FOLLOW:
+            if (stat(link->relative_path, &target_stat)) {
+                DBG_ERR("Skipping dangling link %s", link->relative_path);
+                return CMD_OK;
+            }
+
+            if (S_ISDIR(target_stat.st_mode)) {
+                for (size_t i = node; i != SIZE_MAX; i = ancestor->parent) {
+                    ancestor = List_get(nodes, i);
+                    if (ancestor->id.dev == target_stat.st_dev &&
+                        ancestor->id.ino == target_stat.st_ino) {
+                        DBG_ERR("Not following %s, it links back to a parent",
+                                link->relative_path);
+                        return CMD_OK;
+                    }
+                }
+
+                local_frame_push(next_level, link->relative_path, parent->depth + 1,
+                                 node);
+                return CMD_OK;
+            }
+
+            if (copy_file_batched(session_ssh, link->relative_path, path_remote,
+                                  target_stat.st_size, NULL, options)) {
+                return CMD_OK;
+            }
+            return copy_file_from_local_to_remote(session_ssh, session_sftp,
+                                                  link->relative_path, path_remote,
+                                                  options);
+    }
+
+    return CMD_OK;
+}
+
+/**
+ * Create the subdirectories of a level of an upload before the files of the level
+ * are copied. The mkdirs are pipelined over the batch of the copy, so the tree
+ * costs a round trip per level instead of one per directory. Created directories
+ * are added to ``known_dirs``, the walk creates the others on its own.
+ *
+ * :param local_dirs: Entries of the directories of the level, as the walk read them,
+ *     NULL for the ones that couldn't be read.
+ * :param num_dirs: Number of directories of the level.
+ */
+static void
+copy_plan_remote_dirs(ssh_session session_ssh, ListT **local_dirs, size_t num_dirs,
+                      PathMapT *path_map, CopyOptionsT *options, StrSetT *known_dirs) {
+    FileSystemT *filesystem;
+    size_t num_entries = 0, k;
+    char *path_remote;
+    bool *exists;
+
+    for (size_t i = 0; i < num_dirs; i++) {
+        num_entries += local_dirs[i] != NULL ? List_length(local_dirs[i]) : 0;
+    }
+    if (!num_entries || copy_batch_open(session_ssh, options) == NULL) {
+        return;
+    }
+
+    /* Links are never followed here, the walk creates the directories behind */
+    exists = DBG_CALLOC(num_entries, sizeof *exists);
+    k = 0;
+    for (size_t i = 0; i < num_dirs; i++) {
+        for (size_t j = 0; local_dirs[i] != NULL && j < local_dirs[i]->length; j++, k++) {
+            filesystem = List_get(local_dirs[i], j);
+            if (filesystem->type != FS_DIRECTORY ||
+                path_is_dotted(filesystem->name, strlen(filesystem->name)) ||
+                copy_excludes(options, path_map, filesystem)) {
+                continue;
+            }
+
+            path_remote = PathMap_apply(path_map, filesystem->relative_path,
+                                        strlen(filesystem->relative_path));
+            if (path_remote != NULL) {
+                Batch_mkdir(options->batch, path_remote, FS_CREATE_PERM, &exists[k]);
+            }
+        }
+    }
+    Batch_wait(options->batch);
+
+    k = 0;
+    for (size_t i = 0; i < num_dirs; i++) {
+        for (size_t j = 0; local_dirs[i] != NULL && j < local_dirs[i]->length; j++, k++) {
+            if (exists[k]) {
+                filesystem = List_get(local_dirs[i], j);
+                path_remote = PathMap_apply(path_map, filesystem->relative_path,
+                                            strlen(filesystem->relative_path));
+                StrSet_add(known_dirs, path_remote, strlen(path_remote));
+            }
+        }
+    }
+
+    DBG_SAFE_FREE(exists);
+}
+
+/**
+ * Helper function to copy a directory from local to remote server.
+ *
+ * The tree is walked one level after the other. Every directory of a level is read
+ * once, then the subdirectories of the whole level are created together and the
+ * files of the level are copied into them.
+ *
+ * :param session_ssh: ssh_session object.
+ * :param session_sftp: sftp_session object.
+ * :param abs_path_local: Absolute path of the directory on local machine.
+ * :param abs_path_remote: Absolute path of the directory on remote machine.
+ * :param options: Options of the copy.
+ * :param metadata: ``ListT`` of ``MetadataT`` to queue the metadata of every copied
+ *     object in, NULL if it isn't preserved.
+ */
+static CommandStatusE
+copy_local_dir_recursively(ssh_session session_ssh, sftp_session session_sftp,
+                           char *abs_path_local, char *abs_path_remote,
+                           CopyOptionsT *options, ListT *metadata) {
+    CommandStatusE result = CMD_OK;
+    ListT *level = List_new(1, sizeof(DirFrameT));
+    ListT *nodes = List_new(1, sizeof(DirNodeT));
+    ListT **local_dirs, *next;
+    FileSystemT *filesystem;
+    MetadataT file_metadata;
+    DirFrameT *frame;
+    struct stat dir_stat;
+    size_t num_frames, *dir_nodes;
+    char *dir_path_remote;
+    char *file_path_remote;
+
+    PathMapT *path_map = PathMap_new(abs_path_local, abs_path_remote);
+    StrSetT *known_dirs = StrSet_new(STR_SET_MIN_CAPACITY);
+
+    local_frame_push(level, path_map->source_root->str, 0, SIZE_MAX);
+
+    while (!List_is_empty(level) && !copy_cancelled(options)) {
+        num_frames = List_length(level);
+        local_dirs = DBG_CALLOC(num_frames, sizeof *local_dirs);
+        dir_nodes = DBG_CALLOC(num_frames, sizeof *dir_nodes);
+        next = List_new(1, sizeof(DirFrameT));
+
+        /* Every directory is linked to its parent, to tell which links are cycles */
+        for (size_t i = 0; i < num_frames && !copy_cancelled(options); i++) {
+            frame = List_get(level, i);
+            if (stat(frame->path, &dir_stat)) {
+                DBG_ERR("Couldn't read directory %s: %s", frame->path, strerror(errno));
+                result = CMD_INTERNAL_ERROR;
+                continue;
+            }
+            dir_nodes[i] = List_length(nodes);
+            List_push(nodes,
+                      &(DirNodeT){{dir_stat.st_dev, dir_stat.st_ino}, frame->parent},
+                      sizeof(DirNodeT));
+
+            dir_path_remote = PathMap_apply(path_map, frame->path, strlen(frame->path));
+            if (dir_path_remote == NULL ||
+                create_parents_remote(session_sftp, dir_path_remote, known_dirs) !=
+                    CMD_OK) {
+                result = CMD_INTERNAL_ERROR;
+                continue;
+            }
+
+            /* Small files are batched, their sizes are needed to tell them apart */
+            local_dirs[i] = path_read_local_dir(frame->path, true);
+            if (local_dirs[i] == NULL) {
+                result = CMD_INTERNAL_ERROR;
+            }
+        }
+
+        copy_plan_remote_dirs(session_ssh, local_dirs, num_frames, path_map, options,
+                              known_dirs);
+
+        for (size_t i = 0; i < num_frames; i++) {
+            frame = List_get(level, i);
+
+            for (size_t j = 0; local_dirs[i] != NULL && j < local_dirs[i]->length &&
+                               !copy_cancelled(options);
+                 j++) {
+                CommandStatusE status = CMD_OK;
+
+                filesystem = List_get(local_dirs[i], j);
+
+                /* Excluded directories are never read */
+                if (path_is_dotted(filesystem->name, strlen(filesystem->name)) ||
+                    copy_excludes(options, path_map, filesystem)) {
+                    continue;
+                }
+
+                file_path_remote = PathMap_apply(path_map, filesystem->relative_path,
+                                                 strlen(filesystem->relative_path));
+                if (file_path_remote == NULL) {
+                    result = CMD_INTERNAL_ERROR;
+                    continue;
+                }
+
+                file_metadata = (MetadataT){NULL, filesystem->permissions,
+                                            filesystem->atime, filesystem->mtime};
+                if (filesystem->type == FS_REG_FILE &&
+                    copy_file_batched(session_ssh, filesystem->relative_path,
+                                      file_path_remote, filesystem->size,
+                                      metadata != NULL ? &file_metadata : NULL,
+                                      options)) {
+                    continue;
+                }
+
+                if (metadata != NULL && filesystem->type != FS_SYM_LINK) {
+                    Metadata_list_push(metadata, file_path_remote,
+                                       filesystem->permissions, filesystem->atime,
+                                       filesystem->mtime);
+                }
+
+                switch (filesystem->type) {
+                    case FS_REG_FILE:
+                        status = copy_file_from_local_to_remote(
+                            session_ssh, session_sftp, filesystem->relative_path,
+                            file_path_remote, options);
+                        break;
+                    case FS_DIRECTORY:
+                        local_frame_push(next, filesystem->relative_path,
+                                         frame->depth + 1, dir_nodes[i]);
+                        break;
+                    case FS_SYM_LINK:
+                        status = copy_local_link(session_ssh, session_sftp, filesystem,
+                                                 file_path_remote, frame, nodes,
+                                                 dir_nodes[i], next, options);
+                        break;
+                    default:
+                        DBG_ERR("Unknown type %d", filesystem->type);
+                }
+
+                /* A cancelled copy is reported as such, not as failed */
+                if (status != CMD_OK && status != CMD_CANCELLED) {
+                    result = CMD_INTERNAL_ERROR;
+                }
+            }
+
+            if (local_dirs[i] != NULL) {
+                FileSystem_list_free(local_dirs[i]);
+            }
+            dir_frame_free(frame);
+        }
+
+        DBG_SAFE_FREE(local_dirs);
+        DBG_SAFE_FREE(dir_nodes);
+        List_free(level);
+        level = next;
+    }
+
+    /* Only left over when the copy was cancelled */
+    while ((frame = List_pop(level)) != NULL) {
+        dir_frame_free(frame);
+    }
+
+    ancestors_truncate(nodes, 0);
+    List_free(nodes);
+    List_free(level);
+    StrSet_free(known_dirs);
+    PathMap_free(path_map);
+
+    return copy_cancelled(options) ? CMD_CANCELLED : result;
+}
+
+/** Where the archive of a bulk copy is streamed to or from */
+typedef struct {
+    /** Channel running ``tar`` on the server, NULL when writing ``file`` */
+    ssh_channel channel;
+
+    /** Archive written over SFTP by ``BULK_ARCHIVE`` uploads */
+    sftp_file file;
+
+    /** Writes are gathered into chunks of the copy */
+    char *buf;
+    size_t length;
+    size_t capacity;
+
+    CopyOptionsT *options;
+
+    /** Set when the copy was cancelled while streaming */
+    bool cancelled;
+} TarStreamT;
+
+/** Send the chunk gathered so far, once the scheduler lets it through. */
+static bool
+tar_stream_flush(TarStreamT *self) {
+    bool ok;
+
+    if (!self->length) {
+        return true;
+    }
+    if (!copy_throttle(self->options, self->length)) {
+        self->cancelled = true;
+        return false;
+    }
+
+    if (self->channel != NULL) {
+        ok = ssh_channel_write(self->channel, self->buf, self->length) ==
+             (int32_t)self->length;
+    } else {
+        ok = sftp_write_all(self->file, self->buf, self->length);
+    }
+    self->length = 0;
+
+    return ok;
+}
+
+/** ``TarWriteT`` of a ``TarStreamT`` */
+static bool
+tar_stream_write(void *data, const void *buf, size_t length) {
+    TarStreamT *self = data;
+    const char *bytes = buf;
+
+    while (length) {
+        size_t len_copy = MIN(length, self->capacity - self->length);
+
+        memcpy(self->buf + self->length, bytes, len_copy);
+        self->length += len_copy;
+        bytes += len_copy;
+        length -= len_copy;
+        if (self->length == self->capacity && !tar_stream_flush(self)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** ``TarReadT`` of a ``TarStreamT``, what is read is throttled like any chunk. */
+static bool
+tar_stream_read(void *data, void *buf, size_t length) {
+    TarStreamT *self = data;
+    char *bytes = buf;
+    int32_t num_bytes_read;
+
+    if (!copy_throttle(self->options, length)) {
+        self->cancelled = true;
+        return false;
+    }
+
+    while (length) {
+        num_bytes_read = ssh_channel_read(self->channel, bytes, length, 0);
+        if (num_bytes_read <= 0) {
+            copy_throttle_refund(self->options, length);
+            return false;
+        }
+        bytes += num_bytes_read;
+        length -= num_bytes_read;
+    }
+
+    return true;
+}
+
+/**
+ * Write a local file to the archive of a bulk upload. The header holds the size the
+ * file had when its directory was read: a file that shrank since is padded with
+ * zeros and one that grew is cut.
+ *
+ * :param result: [OUT] Set to ``CMD_INTERNAL_ERROR`` if the file couldn't be read.
+ * :return: False if the archive couldn't be written.
+ */
+static bool
+tar_pack_file(TarStreamT *stream, const char *path, const TarEntryT *entry,
+              CommandStatusE *result) {
+    char file_buf[BUF_SIZE_FILE_CONTENTS];
+    uint64_t num_bytes_left = entry->size;
+    size_t length, num_bytes_read;
+    bool ok, is_short = false;
+    FILE *from_file;
+
+    from_file = fopen(path, "r");
+    if (from_file == NULL) {
+        DBG_ERR("Couldn't open file: %s: %s", path, strerror(errno));
+        *result = CMD_INTERNAL_ERROR;
+        return true;
+    }
+
+    ok = tar_write_header(tar_stream_write, stream, entry);
+    while (ok && num_bytes_left) {
+        length = MIN(num_bytes_left, sizeof file_buf);
+        num_bytes_read = is_short ? 0 : fread(file_buf, 1, length, from_file);
+        if (num_bytes_read < length && !is_short) {
+            DBG_ERR("File shrank while copying: %s", path);
+            *result = CMD_INTERNAL_ERROR;
+            is_short = true;
+        }
+        memset(file_buf + num_bytes_read, 0, length - num_bytes_read);
+
+        ok = tar_stream_write(stream, file_buf, length);
+        copy_progress_add(stream->options, length);
+        num_bytes_left -= length;
+    }
+    local_read_done(from_file, stream->options->cache);
+    fclose(from_file);
+
+    ok = ok && tar_write_padding(tar_stream_write, stream, entry->size);
+    if (ok && !is_short) {
+        copy_progress_file_done(stream->options);
+    }
+
+    return ok;
+}
+
+/**
+ * Write the objects under a local directory to the archive of a bulk upload, named
+ * relative to the directory. They are walked and filtered the way
+ * ``copy_local_dir_recursively`` does, except that links are never followed.
+ *
+ * :param result: [OUT] Set to ``CMD_INTERNAL_ERROR`` if any object couldn't be read.
+ * :return: False if the archive couldn't be written.
+ */
+static bool
+tar_pack_local_dir(TarStreamT *stream, char *abs_path_local, CommandStatusE *result) {
+    CopyOptionsT *options = stream->options;
+    ListT *dir_stack = List_new(1, sizeof(char *));
+    PathMapT *path_map = PathMap_new(abs_path_local, abs_path_local);
+    char target[BUF_SIZE_FS_PATH];
+    FileSystemT *filesystem;
+    ListT *local_dir;
+    ssize_t len_target;
+    TarEntryT entry;
+    char *path;
+    bool ok = true;
+
+    List_push(dir_stack, path_map->source_root->str, path_map->source_root->length + 1);
+
+    while (ok && (path = List_pop(dir_stack)) != NULL) {
+        local_dir = path_read_local_dir(path, true);
+        DBG_SAFE_FREE(path);
+        if (local_dir == NULL) {
+            *result = CMD_INTERNAL_ERROR;
+            continue;
+        }
+
+        for (size_t i = 0; ok && i < local_dir->length; i++) {
+            filesystem = List_get(local_dir, i);
+
+            /* Excluded directories are never read */
+            if (path_is_dotted(filesystem->name, strlen(filesystem->name)) ||
+                copy_excludes(options, path_map, filesystem)) {
+                continue;
+            }
+
+            /* Without preserving, the umask on the server decides like for SFTP */
+            entry = (TarEntryT){
+                (char *)PathMap_relative(path_map, filesystem->relative_path), 0, 0,
+                filesystem->permissions & MODE_PERMISSION_BITS, filesystem->mtime, NULL};
+
+            switch (filesystem->type) {
+                case FS_REG_FILE:
+                    entry.type = TAR_TYPE_FILE;
+                    entry.size = filesystem->size;
+                    entry.mode = options->preserve ? entry.mode : FS_CREATE_FILE_PERM;
+                    ok = tar_pack_file(stream, filesystem->relative_path, &entry, result);
+                    break;
+                case FS_DIRECTORY:
+                    entry.type = TAR_TYPE_DIRECTORY;
+                    entry.mode = options->preserve ? entry.mode : FS_CREATE_PERM;
+                    ok = tar_write_header(tar_stream_write, stream, &entry);
+                    List_push(dir_stack, filesystem->relative_path,
+                              strlen(filesystem->relative_path) + 1);
+                    break;
+                case FS_SYM_LINK:
+                    if (options->link_policy == LINK_SKIP) {
+                        break;
+                    }
+                    len_target = readlink(filesystem->relative_path, target,
+                                          sizeof target - 1);
+                    if (len_target < 0) {
+                        DBG_ERR("Couldn't read link %s: %s", filesystem->relative_path,
+                                strerror(errno));
+                        *result = CMD_INTERNAL_ERROR;
+                        break;
+                    }
+                    target[len_target] = '\0';
+
+                    entry.type = TAR_TYPE_SYM_LINK;
+                    entry.link_target = target;
+                    ok = tar_write_header(tar_stream_write, stream, &entry);
+                    break;
+                default:
+                    DBG_ERR("Unknown type %d", filesystem->type);
+            }
+        }
+
+        FileSystem_list_free(local_dir);
+    }
+
+    /* Only left over when the archive couldn't be written */
+    while ((path = List_pop(dir_stack)) != NULL) {
+        DBG_SAFE_FREE(path);
+    }
+    List_free(dir_stack);
+    PathMap_free(path_map);
+
+    return ok && tar_write_end(tar_stream_write, stream) && tar_stream_flush(stream);
+}
+
+/** A symbolic link of a bulk download, created once everything else is extracted */
+typedef struct {
+    char *path;
+    char *target;
+} TarLinkT;
+
+/** State of the extraction of a bulk download */
+typedef struct {
+    TarStreamT *stream;
+
+    /** Local path of the entry being extracted, the root of the copy comes first */
+    PathBufT *path;
+    size_t len_root;
+
+    /** ``ListT`` of ``TarLinkT``, no entry is written through a link of the archive */
+    ListT *links;
+
+    DirCacheT *dir_cache;
+
+    /** ``ListT`` of ``MetadataT`` to queue modes and times in, NULL if not preserved */
+    ListT *metadata;
+
+    CommandStatusE result;
+} TarUnpackT;
+
+/**
+ * Extract a regular file of a bulk download to ``self->path``.
+ *
+ * :return: False if the archive couldn't be read.
+ */
+static bool
+tar_unpack_file(TarUnpackT *self, const TarEntryT *entry) {
+    char file_buf[BUF_SIZE_FILE_CONTENTS];
+    uint64_t num_bytes_left = entry->size;
+    size_t length, len_padded;
+    bool is_open;
+    LocalFileT to_file;
+
+    is_open = local_file_open(&to_file, self->path->str, entry->size,
+                              self->stream->options->cache);
+    if (!is_open) {
+        DBG_ERR("Couldn't create file: %s", self->path->str);
+        self->result = CMD_INTERNAL_ERROR;
+    }
+
+    /* Contents are padded to whole blocks, the buffer holds a whole number of them */
+    while (num_bytes_left) {
+        length = MIN(num_bytes_left, sizeof file_buf);
+        len_padded = (length + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        if (!tar_stream_read(self->stream, file_buf, len_padded)) {
+            break;
+        }
+
+        if (is_open && !local_file_write(&to_file, file_buf, length)) {
+            DBG_ERR("Couldn't write file: %s: %s", self->path->str, strerror(errno));
+            self->result = CMD_INTERNAL_ERROR;
+            local_file_close(&to_file);
+            is_open = false;
+        }
+        copy_progress_add(self->stream->options, length);
+        num_bytes_left -= length;
+    }
+
+    if (is_open) {
+        if (!local_file_close(&to_file)) {
+            DBG_ERR("Couldn't write file: %s: %s", self->path->str, strerror(errno));
+            self->result = CMD_INTERNAL_ERROR;
+        } else if (!num_bytes_left) {
+            copy_progress_file_done(self->stream->options);
+        }
+    }
 
-    if (from_file == NULL) {
-        DBG_ERR("Couldn't open file: %s", abs_path_local);
-        return CMD_INTERNAL_ERROR;
+    return !num_bytes_left;
+}
+
+/**
+ * Recreate a hard link of a bulk download, its target was extracted before it.
+ * Targets are named relative to the root of the archive, like entries.
+ */
+static void
+tar_unpack_hard_link(TarUnpackT *self, const char *target) {
+    PathBufT *target_path;
+
+    for (; target[0] == '.' && target[1] == PATH_SEPARATOR; target += 2) {
+    }
+    if (!tar_name_is_safe(target)) {
+        DBG_ERR("Refusing link %s to %s, it leaves the copy", self->path->str, target);
+        self->result = CMD_INTERNAL_ERROR;
+        return;
     }
 
-    if (to_file == NULL) {
-        DBG_ERR("Couldn't create file: %s: %s", abs_path_remote,
-                ssh_get_error(session_ssh));
-        return CMD_INTERNAL_ERROR;
+    target_path = PathBuf_new(NULL);
+    PathBuf_set(target_path, self->path->str, self->len_root);
+    PathBuf_push(target_path, target, strlen(target));
+
+    unlink(self->path->str);
+    if (link(target_path->str, self->path->str)) {
+        DBG_ERR("Couldn't create link %s -> %s: %s", self->path->str, target_path->str,
+                strerror(errno));
+        self->result = CMD_INTERNAL_ERROR;
     }
 
-    while ((num_bytes_read = fread(file_buf, sizeof *file_buf, BUF_SIZE_FILE_CONTENTS,
-                                   from_file)) > 0) {
-        sftp_write(to_file, file_buf, num_bytes_read);
+    PathBuf_free(target_path);
+}
+
+/**
+ * Queue a symbolic link of a bulk download, see ``tar_unpack_links``. Its target is
+ * kept verbatim, like the file by file copy does.
+ */
+static void
+tar_unpack_sym_link(TarUnpackT *self, const char *target) {
+    TarLinkT link = {strdup(self->path->str), strdup(target)};
+
+    List_push(self->links, &link, sizeof link);
+}
+
+/** Get the number of components in a path. */
+static size_t
+path_depth(const char *path) {
+    size_t depth = 1;
+
+    for (; *path; path++) {
+        depth += *path == PATH_SEPARATOR;
     }
+    return depth;
+}
 
-    if (num_bytes_read < 0) {
-        DBG_ERR("Couldn't read local file: Error Code: %d", errno);
-        return CMD_INTERNAL_ERROR;
+/** ``qsort`` comparator putting the deepest ``TarLinkT`` first. */
+static int
+tar_link_cmp_depth(const void *a, const void *b) {
+    size_t depth_a = path_depth((*(TarLinkT *const *)a)->path);
+    size_t depth_b = path_depth((*(TarLinkT *const *)b)->path);
+
+    return (depth_a < depth_b) - (depth_a > depth_b);
+}
+
+/**
+ * Create the symbolic links of a bulk download once everything else is extracted,
+ * so no entry is ever written through one of them, wherever it points to. The
+ * deepest come first, so none is created through another one: a link ``a``
+ * followed by ``a/b`` would otherwise place ``b`` wherever ``a`` points to.
+ */
+static void
+tar_unpack_links(TarUnpackT *self) {
+    TarLinkT *link;
+
+    qsort(self->links->list, List_length(self->links), sizeof *self->links->list,
+          tar_link_cmp_depth);
+
+    for (size_t i = 0; i < List_length(self->links); i++) {
+        link = List_get(self->links, i);
+        if (create_local_link(link->target, link->path) != CMD_OK) {
+            self->result = CMD_INTERNAL_ERROR;
+        }
+        DBG_SAFE_FREE(link->path);
+        DBG_SAFE_FREE(link->target);
+        DBG_SAFE_FREE(link);
     }
+}
 
-    fclose(from_file);
-    sftp_close(to_file);
+/**
+ * Extract an entry of a bulk download to ``self->path``, its contents included.
+ *
+ * :return: False if the archive couldn't be read.
+ */
+static bool
+tar_unpack_entry(TarUnpackT *self, const TarEntryT *entry) {
+    LinkPolicyE link_policy = self->stream->options->link_policy;
+    char *separator = strrchr(self->path->str, PATH_SEPARATOR);
+    bool ok = true;
+
+    /* Parents are listed before their contents, unless the archive leaves them out */
+    DirCache_mkdir_parents(self->dir_cache, self->path->str, separator - self->path->str);
+
+    switch (entry->type) {
+        case TAR_TYPE_FILE:
+            ok = tar_unpack_file(self, entry);
+            break;
+        case TAR_TYPE_DIRECTORY:
+            if (!DirCache_mkdir_parents(self->dir_cache, self->path->str,
+                                        self->path->length)) {
+                DBG_ERR("Couldn't create directory: %s", self->path->str);
+                self->result = CMD_INTERNAL_ERROR;
+            }
+            break;
+        case TAR_TYPE_SYM_LINK:
+            if (link_policy != LINK_SKIP) {
+                tar_unpack_sym_link(self, entry->link_target);
+            }
+            break;
+        case TAR_TYPE_HARD_LINK:
+            tar_unpack_hard_link(self, entry->link_target);
+            break;
+        default:
+            DBG_INFO("Skipping %s, entries of type %c aren't copied", self->path->str,
+                     entry->type);
+    }
 
-    return CMD_OK;
+    /* Archives don't hold access times, they are set to the modification time */
+    if (self->metadata != NULL &&
+        (entry->type == TAR_TYPE_FILE || entry->type == TAR_TYPE_DIRECTORY)) {
+        Metadata_list_push(self->metadata, self->path->str, entry->mode, entry->mtime,
+                           entry->mtime);
+    }
+
+    return ok && (entry->type == TAR_TYPE_FILE ||
+                  tar_skip(tar_stream_read, self->stream, entry->size));
 }
 
 /**
- * Helper function to copy a file from remote to local server.
+ * Extract the archive of a bulk download under a local directory. Names that would
+ * leave the directory are refused, symbolic links are created last.
  *
- * :param session_ssh: ssh_session object.
- * :param session_sftp: sftp_session object.
- * :param abs_path_local: Absolute path of the file on local machine.
- * :param abs_path_remote: Absolute path of the file on remote machine.
+ * :param metadata: ``ListT`` of ``MetadataT`` to queue modes and times in, NULL if
+ *     they aren't preserved.
  */
 static CommandStatusE
-copy_remote_dir_recursively(ssh_session session_ssh, sftp_session session_sftp,
-                            char *abs_path_remote, char *abs_path_local) {
-    ListT *sub_dir_path_stack = List_new(1, sizeof(char *));
-    ListT *remote_dir;
-    FileSystemT *filesystem;
-    char *dir_path_remote = NULL;
-    char *dir_path_local = NULL;
-    char *file_path_local = NULL;
-
-    do {
-        if (dir_path_remote == NULL || dir_path_local == NULL) {
-            dir_path_remote = abs_path_remote;
-            dir_path_local = abs_path_local;
+tar_unpack_local_dir(TarStreamT *stream, char *abs_path_local, ListT *metadata) {
+    TarUnpackT self = {stream, PathBuf_new(abs_path_local), 0,
+                       List_new(1, sizeof(TarLinkT)), DirCache_new(), metadata, CMD_OK};
+    bool ok = true, is_end = false;
+    TarEntryT entry;
+    size_t len_name;
+    char *name;
+
+    self.len_root = self.path->length;
+    DirCache_mkdir_parents(self.dir_cache, self.path->str, self.path->length);
+
+    while (ok && tar_read_header(tar_stream_read, stream, &entry, &is_end) && !is_end) {
+        /* Archives made with ``-C dir .`` name everything ``./path``, the root ``.`` */
+        for (name = entry.name; name[0] == '.' && name[1] == PATH_SEPARATOR; name += 2) {
+        }
+        for (len_name = strlen(name); len_name && name[len_name - 1] == PATH_SEPARATOR;
+             len_name--) {
+            name[len_name - 1] = '\0';
+        }
+
+        if (!len_name || !strcmp(name, ".")) {
+            ok = tar_skip(tar_stream_read, stream, entry.size);
+        } else if (!tar_name_is_safe(name)) {
+            DBG_ERR("Refusing %s, it leaves the copy", entry.name);
+            self.result = CMD_INTERNAL_ERROR;
+            ok = tar_skip(tar_stream_read, stream, entry.size);
         } else {
-            dir_path_remote = List_pop(sub_dir_path_stack);
-            dir_path_local = dir_path_remote;
-            path_replace(dir_path_local, abs_path_remote, abs_path_local, 1);
+            PathBuf_truncate(self.path, self.len_root);
+            PathBuf_push(self.path, name, len_name);
+            ok = tar_unpack_entry(&self, &entry);
         }
 
-        path_mkdir_parents(dir_path_local, strlen(dir_path_local));
-        remote_dir = path_read_remote_dir(session_ssh, session_sftp, dir_path_remote);
-        if (remote_dir == NULL) {
-            return CMD_INTERNAL_ERROR;
+        TarEntry_clear(&entry);
+    }
+
+    if (!is_end && !stream->cancelled) {
+        DBG_ERR("The archive of %s ended early", abs_path_local);
+        self.result = CMD_INTERNAL_ERROR;
+    }
+
+    tar_unpack_links(&self);
+    List_free(self.links);
+    DirCache_free(self.dir_cache);
+    PathBuf_free(self.path);
+
+    return self.result;
+}
+
+/**
+ * Check once per copy if the server runs ``tar``. Servers only meant for SFTP may
+ * accept any command and start their SFTP server instead, so ``tar`` has to print
+ * its version.
+ */
+static bool
+remote_tar_available(ssh_session session_ssh, CopyOptionsT *options) {
+    char output[BUF_SIZE_FS_NAME] = {0};
+    int32_t num_bytes_read, exit_status = -1;
+    size_t len_output = 0;
+    ssh_channel channel;
+    bool ok;
+
+    if (options->remote_tar != REMOTE_TOOL_UNKNOWN) {
+        return options->remote_tar == REMOTE_TOOL_AVAILABLE;
+    }
+
+    channel = exec_channel_open(session_ssh, "tar --version");
+    if (channel != NULL) {
+        while (len_output < sizeof output - 1) {
+            num_bytes_read = ssh_channel_read(channel, output + len_output,
+                                              sizeof output - 1 - len_output, 0);
+            if (num_bytes_read <= 0) {
+                break;
+            }
+            len_output += num_bytes_read;
         }
+        exit_status = exec_channel_close(channel);
+    }
 
-        for (size_t i = 0; i < remote_dir->length; i++) {
-            filesystem = List_get(remote_dir, i);
+    ok = exit_status == 0 && strstr(output, "tar") != NULL;
+    if (!ok) {
+        DBG_INFO("No tar on the server (status %d), copying directories file by file",
+                 exit_status);
+    }
+
+    options->remote_tar = ok ? REMOTE_TOOL_AVAILABLE : REMOTE_TOOL_MISSING;
+    return ok;
+}
+
+/**
+ * Guess if a directory holds enough files, small enough, to be copied as one
+ * archive: most of them must fit in one chunk. Only ``BULK_SAMPLE_DIRS`` directories
+ * are read, the files of the others are extrapolated from them.
+ */
+static bool
+copy_bulk_worthwhile(ssh_session session_ssh, sftp_session session_sftp,
+                     char *abs_path, bool is_remote, CopyOptionsT *options) {
+    ListT *dir_stack = List_new(1, sizeof(char *));
+    uint64_t num_files = 0, num_small = 0, num_dirs = 0, num_estimated;
+    FileSystemT *filesystem;
+    size_t chunk, window;
+    ListT *entries;
+    char *path;
+
+    copy_tune_get(options, false, &chunk, &window);
+    List_push(dir_stack, abs_path, strlen(abs_path) + 1);
+
+    while (num_dirs < BULK_SAMPLE_DIRS && (path = List_pop(dir_stack)) != NULL) {
+        entries = is_remote ? path_read_remote_dir(session_ssh, session_sftp, path)
+                            : path_read_local_dir(path, true);
+        DBG_SAFE_FREE(path);
+        if (entries == NULL) {
+            continue;
+        }
 
-            puts(filesystem->name);
+        num_dirs++;
+        for (size_t i = 0; i < entries->length; i++) {
+            filesystem = List_get(entries, i);
             if (path_is_dotted(filesystem->name, strlen(filesystem->name))) {
                 continue;
             }
 
-            switch (filesystem->type) {
-                case FS_REG_FILE:
-                    file_path_local = strdup(filesystem->relative_path);
-                    path_replace(file_path_local, abs_path_remote, abs_path_local, 1);
-                    copy_from_remote_to_local(session_ssh, session_sftp,
-                                              filesystem->relative_path, file_path_local);
-
-                    break;
-                case FS_DIRECTORY:
-                    List_push(sub_dir_path_stack, filesystem->relative_path,
-                              (sizeof *filesystem->relative_path) *
-                                  (strlen(filesystem->relative_path) + 1));
-                    break;
-                case FS_SYM_LINK:
-                    break; /* TODO */
-                default:
-                    DBG_ERR("Unknown type %d", filesystem->type);
+            if (filesystem->type == FS_DIRECTORY) {
+                List_push(dir_stack, filesystem->relative_path,
+                          strlen(filesystem->relative_path) + 1);
+            } else if (filesystem->type == FS_REG_FILE) {
+                num_files++;
+                num_small += filesystem->size <= chunk;
             }
         }
+        FileSystem_list_free(entries);
+    }
 
-        DBG_SAFE_FREE(file_path_local);
+    num_estimated = num_files;
+    if (num_dirs) {
+        num_estimated += List_length(dir_stack) * num_files / num_dirs;
+    }
 
-    } while (!List_is_empty(sub_dir_path_stack));
+    while ((path = List_pop(dir_stack)) != NULL) {
+        DBG_SAFE_FREE(path);
+    }
+    List_free(dir_stack);
 
-    return CMD_OK;
+    return num_estimated >= BULK_MIN_FILES && num_small * 4 >= num_files * 3;
 }
 
-static CommandStatusE
-copy_local_dir_recursively(ssh_session session_ssh, sftp_session session_sftp,
-                           char *abs_path_local, char *abs_path_remote) {
-    ListT *sub_dir_path_stack = List_new(1, sizeof(char *));
-    ListT *local_dir;
-    FileSystemT *filesystem;
-    char *dir_path_remote = NULL;
-    char *dir_path_local = NULL;
-    char *file_path_remote = NULL;
-
-    do {
-        if (dir_path_remote == NULL || dir_path_local == NULL) {
-            dir_path_remote = abs_path_remote;
-            dir_path_local = abs_path_local;
-        } else {
-            dir_path_local = List_pop(sub_dir_path_stack);
-            dir_path_remote = strdup(dir_path_local);
-            path_replace(dir_path_remote, abs_path_local, abs_path_remote, 1);
-        }
+/**
+ * Check if a directory is copied as one archive, see ``BulkModeE``. Copies that
+ * verify or follow links always go file by file, the archive can't be hashed on the
+ * way and ``tar`` doesn't detect link cycles. So do filtered downloads, the filter
+ * only runs here and the server would send the excluded trees anyway.
+ *
+ * :param is_remote: True if the directory is the source of a download.
+ */
+static bool
+copy_bulk_wanted(ssh_session session_ssh, sftp_session session_sftp, char *abs_path,
+                 bool is_remote, CopyOptionsT *options) {
+    if (options->bulk == BULK_NO || options->verify ||
+        options->link_policy == LINK_FOLLOW || (is_remote && options->filter != NULL)) {
+        return false;
+    }
 
-        create_parents_remote(session_ssh, session_sftp, dir_path_remote);
-        local_dir = path_read_local_dir(dir_path_local);
-        if (local_dir == NULL) {
-            return CMD_INTERNAL_ERROR;
-        }
+    /* An archive left on the local side would only have to be unpacked by hand */
+    if (options->bulk == BULK_ARCHIVE) {
+        return !is_remote;
+    }
 
-        for (size_t i = 0; i < local_dir->length; i++) {
-            filesystem = List_get(local_dir, i);
+    if (options->bulk == BULK_AUTO &&
+        !copy_bulk_worthwhile(session_ssh, session_sftp, abs_path, is_remote, options)) {
+        return false;
+    }
 
-            if (path_is_dotted(filesystem->name, strlen(filesystem->name))) {
-                continue;
-            }
+    return remote_tar_available(session_ssh, options);
+}
 
-            switch (filesystem->type) {
-                case FS_REG_FILE:
-                    file_path_remote = strdup(filesystem->relative_path);
-                    path_replace(file_path_remote, abs_path_local, abs_path_remote, 1);
-                    copy_from_local_to_remote(session_ssh, session_sftp,
-                                              filesystem->relative_path,
-                                              file_path_remote);
+/**
+ * Download a directory as one tar archive streamed by ``tar`` on the server, small
+ * files then cost a header of a block each instead of several round trips.
+ *
+ * :param metadata: ``ListT`` of ``MetadataT`` to queue the metadata of every copied
+ *     object in, NULL if it isn't preserved.
+ * :param result: [OUT] Status of the copy, only set if it was done in bulk.
+ * :return: False if the directory has to be copied file by file.
+ */
+static bool
+copy_remote_dir_bulk(ssh_session session_ssh, char *abs_path_remote,
+                     char *abs_path_local, CopyOptionsT *options, ListT *metadata,
+                     CommandStatusE *result) {
+    char command[BUF_SIZE_FS_PATH * 4 + 32] = "exec tar -cf - -C ";
+    TarStreamT stream = {NULL, NULL, NULL, 0, 0, options, false};
+    int32_t exit_status;
+
+    if (!shell_quote(command, sizeof command, abs_path_remote) ||
+        strlen(command) + sizeof " ." > sizeof command) {
+        return false;
+    }
+    strcat(command, " .");
 
-                    break;
-                case FS_DIRECTORY:
-                    List_push(sub_dir_path_stack, filesystem->relative_path,
-                              (sizeof *filesystem->relative_path) *
-                                  (strlen(filesystem->relative_path) + 1));
-                    break;
-                case FS_SYM_LINK:
-                    break; /* TODO */
-                default:
-                    DBG_ERR("Unknown type %d", filesystem->type);
-            }
+    stream.channel = exec_channel_open(session_ssh, command);
+    if (stream.channel == NULL) {
+        return false;
+    }
+
+    DBG_DEBUG("Copying dir from %s to %s in bulk", abs_path_remote, abs_path_local);
+    *result = tar_unpack_local_dir(&stream, abs_path_local, metadata);
+
+    /* The rest of a cancelled archive isn't worth draining */
+    if (stream.cancelled) {
+        ssh_channel_free(stream.channel);
+        *result = CMD_CANCELLED;
+        return true;
+    }
+
+    exit_status = exec_channel_close(stream.channel);
+    if (exit_status) {
+        DBG_ERR("Remote tar failed with status %d: %s", exit_status, abs_path_remote);
+        *result = CMD_INTERNAL_ERROR;
+    }
+    return true;
+}
+
+/**
+ * Upload a directory as one tar archive, streamed to ``tar`` on the server. With
+ * ``BULK_ARCHIVE`` it is written to ``DEST.tar`` over SFTP instead, for servers that
+ * don't run commands, and left there to be unpacked.
+ *
+ * :param metadata: ``ListT`` of ``MetadataT`` holding the metadata of the directory,
+ *     NULL if it isn't preserved.
+ * :param result: [OUT] Status of the copy, only set if it was done in bulk.
+ * :return: False if the directory has to be copied file by file.
+ */
+static bool
+copy_local_dir_bulk(ssh_session session_ssh, sftp_session session_sftp,
+                    char *abs_path_local, char *abs_path_remote, CopyOptionsT *options,
+                    ListT *metadata, CommandStatusE *result) {
+    MetadataT *dir_metadata;
+    char command[BUF_SIZE_FS_PATH * 8 + 64] = "mkdir -p -- ";
+    TarStreamT stream = {NULL, NULL, NULL, 0, 0, options, false};
+    size_t len_command, window;
+    int32_t exit_status;
+    bool ok;
+
+    if (options->bulk == BULK_ARCHIVE) {
+        snprintf(command, sizeof command, "%s.tar", abs_path_remote);
+        stream.file = sftp_open(session_sftp, command, O_CREAT | O_WRONLY | O_TRUNC,
+                                FS_CREATE_FILE_PERM);
+        if (stream.file == NULL) {
+            DBG_ERR("Couldn't create archive: %s: %s", command,
+                    ssh_get_error(session_ssh));
+            return false;
+        }
+    } else {
+        /* Owners are never restored, modes and times only when preserving */
+        if (!shell_quote(command, sizeof command, abs_path_remote)) {
+            return false;
+        }
+        len_command = strlen(command);
+        snprintf(command + len_command, sizeof command - len_command,
+                 " && exec tar -x%sof - -C ", options->preserve ? "p" : "m");
+        if (!shell_quote(command, sizeof command, abs_path_remote)) {
+            return false;
         }
-        DBG_SAFE_FREE(file_path_remote);
 
-    } while (!List_is_empty(sub_dir_path_stack));
+        stream.channel = exec_channel_open(session_ssh, command);
+        if (stream.channel == NULL) {
+            return false;
+        }
+    }
 
-    return CMD_OK;
+    DBG_DEBUG("Copying dir from %s to %s in bulk", abs_path_local, abs_path_remote);
+    copy_tune_get(options, false, &stream.capacity, &window);
+    stream.buf = DBG_MALLOC(stream.capacity);
+    *result = CMD_OK;
+    ok = tar_pack_local_dir(&stream, abs_path_local, result);
+    DBG_SAFE_FREE(stream.buf);
+
+    if (stream.file != NULL) {
+        ok = !sftp_close(stream.file) && ok;
+        exit_status = 0;
+
+        /* The directory itself is only in the archive, there is nothing to apply its
+         * metadata to */
+        if (metadata != NULL && (dir_metadata = List_pop(metadata)) != NULL) {
+            DBG_SAFE_FREE(dir_metadata->path);
+            DBG_SAFE_FREE(dir_metadata);
+        }
+    } else if (stream.cancelled) {
+        ssh_channel_free(stream.channel);
+        exit_status = 0;
+    } else {
+        exit_status = exec_channel_close(stream.channel);
+    }
+
+    if (stream.cancelled) {
+        *result = CMD_CANCELLED;
+    } else if (!ok || exit_status) {
+        DBG_ERR("Couldn't write the archive of %s to %s", abs_path_local,
+                abs_path_remote);
+        *result = CMD_INTERNAL_ERROR;
+    }
+    return true;
 }
 
 /**
@@ -479,11 +3475,23 @@ copy_local_dir_recursively(ssh_session session_ssh, sftp_session session_sftp,
  * :param session_sftp: sftp_session object.
  * :param abs_path_local: Absolute path of the file on local machine.
  * :param abs_path_remote: Absolute path of the file on remote machine.
+ * :param options: Options of the copy.
  */
 CommandStatusE
 copy_from_remote_to_local(ssh_session session_ssh, sftp_session session_sftp,
-                          char *abs_path_remote, char *abs_path_local) {
-    sftp_attributes from = sftp_stat(session_sftp, abs_path_remote);
+                          char *abs_path_remote, char *abs_path_local,
+                          CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+    ListT *metadata = NULL;
+    sftp_attributes from;
+    char *target;
+
+    /* The source itself is only dereferenced when links are followed */
+    if (options->link_policy == LINK_FOLLOW) {
+        from = sftp_stat(session_sftp, abs_path_remote);
+    } else {
+        from = sftp_lstat(session_sftp, abs_path_remote);
+    }
 
     if (from == NULL) {
         DBG_ERR("Failed to get attributes for %s: %s", abs_path_remote,
@@ -491,36 +3499,365 @@ copy_from_remote_to_local(ssh_session session_ssh, sftp_session session_sftp,
         return CMD_INTERNAL_ERROR;
     }
 
+    if (options->preserve && from->type != SSH_FILEXFER_TYPE_SYMLINK) {
+        metadata = List_new(1, sizeof(MetadataT));
+        Metadata_list_push(metadata, abs_path_local, from->permissions,
+                           from->atime64 ? from->atime64 : from->atime,
+                           from->mtime64 ? from->mtime64 : from->mtime);
+    }
+
     if (from->type == SSH_FILEXFER_TYPE_DIRECTORY) {
-        DBG_DEBUG("Copying dir from %s to %s", abs_path_remote, abs_path_local);
-        return copy_remote_dir_recursively(session_ssh, session_sftp, abs_path_remote,
-                                           abs_path_local);
+        if (!copy_bulk_wanted(session_ssh, session_sftp, abs_path_remote, true,
+                              options) ||
+            !copy_remote_dir_bulk(session_ssh, abs_path_remote, abs_path_local, options,
+                                  metadata, &result)) {
+            DBG_DEBUG("Copying dir from %s to %s", abs_path_remote, abs_path_local);
+            result = copy_remote_dir_recursively(session_ssh, session_sftp,
+                                                 abs_path_remote, abs_path_local, options,
+                                                 metadata);
+        }
     } else if (from->type == SSH_FILEXFER_TYPE_REGULAR) {
         DBG_DEBUG("Copying file from %s to %s", abs_path_remote, abs_path_local);
-        return copy_file_from_remote_to_local(session_ssh, session_sftp, abs_path_remote,
-                                              abs_path_local);
+        result = copy_file_from_remote_to_local(session_ssh, session_sftp,
+                                                abs_path_remote, abs_path_local,
+                                                from->size, options);
+    } else if (from->type == SSH_FILEXFER_TYPE_SYMLINK &&
+               options->link_policy == LINK_PRESERVE) {
+        DBG_DEBUG("Copying link from %s to %s", abs_path_remote, abs_path_local);
+        target = sftp_readlink(session_sftp, abs_path_remote);
+        result = target != NULL ? create_local_link(target, abs_path_local)
+                                : CMD_INTERNAL_ERROR;
+        ssh_string_free_char(target);
     }
 
-    return CMD_OK;
+    /* Metadata is applied once all the data is in place */
+    if (metadata != NULL) {
+        if (Metadata_list_apply_local(metadata) != CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        Metadata_list_free(metadata);
+    }
+
+    sftp_attributes_free(from);
+    return result;
 }
 
+/**
+ * Helper function to copy a file from local to remote server.
+ *
+ * :param session_ssh: ssh_session object.
+ * :param session_sftp: sftp_session object.
+ * :param abs_path_local: Absolute path of the file on local machine.
+ * :param abs_path_remote: Absolute path of the file on remote machine.
+ * :param options: Options of the copy.
+ */
 CommandStatusE
 copy_from_local_to_remote(ssh_session session_ssh, sftp_session session_sftp,
-                          char *abs_path_local, char *abs_path_remote) {
+                          char *abs_path_local, char *abs_path_remote,
+                          CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+    ListT *metadata = NULL;
+    MetadataT file_metadata;
+    char target[BUF_SIZE_FS_PATH];
+    ssize_t len_target;
     struct stat from;
-    stat(abs_path_local, &from);
+
+    /* The source itself is only dereferenced when links are followed */
+    if ((options->link_policy == LINK_FOLLOW ? stat : lstat)(abs_path_local, &from)) {
+        DBG_ERR("Failed to get attributes for %s: %s", abs_path_local, strerror(errno));
+        return CMD_INTERNAL_ERROR;
+    }
+
+    file_metadata = (MetadataT){NULL, from.st_mode, from.st_atime, from.st_mtime};
+    if (S_ISREG(from.st_mode) &&
+        copy_file_batched(session_ssh, abs_path_local, abs_path_remote, from.st_size,
+                          options->preserve ? &file_metadata : NULL, options)) {
+        return CMD_OK;
+    }
+
+    if (options->preserve && !S_ISLNK(from.st_mode)) {
+        metadata = List_new(1, sizeof(MetadataT));
+        Metadata_list_push(metadata, abs_path_remote, from.st_mode, from.st_atime,
+                           from.st_mtime);
+    }
 
     if (S_ISDIR(from.st_mode)) {
-        DBG_DEBUG("Copying dir from %s to %s", abs_path_local, abs_path_remote);
-        return copy_local_dir_recursively(session_ssh, session_sftp, abs_path_local,
-                                          abs_path_remote);
+        if (!copy_bulk_wanted(session_ssh, session_sftp, abs_path_local, false,
+                              options) ||
+            !copy_local_dir_bulk(session_ssh, session_sftp, abs_path_local,
+                                 abs_path_remote, options, metadata, &result)) {
+            DBG_DEBUG("Copying dir from %s to %s", abs_path_local, abs_path_remote);
+            result = copy_local_dir_recursively(session_ssh, session_sftp,
+                                                abs_path_local, abs_path_remote, options,
+                                                metadata);
+        }
     } else if (S_ISREG(from.st_mode)) {
         DBG_DEBUG("Copying file from %s to %s", abs_path_local, abs_path_remote);
-        return copy_file_from_local_to_remote(session_ssh, session_sftp, abs_path_local,
-                                              abs_path_remote);
+        result = copy_file_from_local_to_remote(session_ssh, session_sftp,
+                                                abs_path_local, abs_path_remote,
+                                                options);
+    } else if (S_ISLNK(from.st_mode) && options->link_policy == LINK_PRESERVE) {
+        DBG_DEBUG("Copying link from %s to %s", abs_path_local, abs_path_remote);
+        len_target = readlink(abs_path_local, target, sizeof target - 1);
+        if (len_target < 0) {
+            DBG_ERR("Couldn't read link %s: %s", abs_path_local, strerror(errno));
+            return CMD_INTERNAL_ERROR;
+        }
+        target[len_target] = '\0';
+
+        sftp_unlink(session_sftp, abs_path_remote);
+        if (sftp_symlink(session_sftp, target, abs_path_remote)) {
+            DBG_ERR("Couldn't create link %s -> %s: %s", abs_path_remote, target,
+                    ssh_get_error(session_ssh));
+            result = CMD_INTERNAL_ERROR;
+        }
     }
 
-    return CMD_OK;
+    /* Metadata is applied once all the data is in place, batched files included */
+    if (metadata != NULL) {
+        if (options->batch != NULL && !Batch_flush(options->batch)) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        if (Metadata_list_apply_remote(session_ssh, session_sftp, metadata) != CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        Metadata_list_free(metadata);
+    }
+
+    return result;
+}
+
+/** Directory reader for ``glob_expand`` over the remote server */
+static ListT *
+glob_read_remote_dir(void *data, char *path) {
+    void **sessions = data;
+
+    return path_read_remote_dir(sessions[0], sessions[1], path);
+}
+
+/** Directory reader for ``glob_expand`` over the local filesystem */
+static ListT *
+glob_read_local_dir(void *data, char *path) {
+    (void)data;
+
+    return path_read_local_dir(path, false);
+}
+
+/** Append a source and its destination to a copy plan. */
+static void
+copy_plan_push(ListT *plan, const char *source, const char *dest) {
+    CopyPairT pair = {strdup(source), strdup(dest)};
+
+    List_push(plan, &pair, sizeof pair);
+}
+
+/**
+ * Build the list of sources and destinations of a multi-source copy.
+ *
+ * Patterns are expanded with a single scan of the tree below their base, every
+ * match keeps its path relative to the base inside ``dest``. Plain paths are
+ * copied into ``dest`` under their own name.
+ *
+ * :param sources: ``ListT`` of NULL terminated paths and patterns.
+ * :param dest: Directory to copy the sources into.
+ * :param from_remote: True if the sources are on the remote server.
+ * :param filter: Rules matches of patterns are filtered with, relative to their
+ *     base. NULL to keep all of them.
+ * :return: ``ListT`` of ``CopyPairT``, it must be freed with ``copy_plan_free``.
+ */
+static ListT *
+copy_plan_new(ssh_session session_ssh, sftp_session session_sftp, ListT *sources,
+              char *dest, bool from_remote, const FilterT *filter) {
+    ListT *plan = List_new(1, sizeof(CopyPairT));
+    void *sessions[] = {session_ssh, session_sftp};
+    PathBufT *dest_path = PathBuf_new(dest);
+    size_t len_dest = dest_path->length;
+
+    for (size_t i = 0; i < List_length(sources); i++) {
+        char *source = List_get(sources, i);
+        ListT *matches;
+        PathMapT *path_map;
+        char *base;
+
+        if (!glob_has_magic(source)) {
+            PathBufT *source_path = PathBuf_new(source);
+            char *name = strrchr(source_path->str, PATH_SEPARATOR);
+
+            name = name != NULL ? name + 1 : source_path->str;
+            PathBuf_truncate(dest_path, len_dest);
+            PathBuf_push(dest_path, name, strlen(name));
+            copy_plan_push(plan, source_path->str, dest_path->str);
+            PathBuf_free(source_path);
+            continue;
+        }
+
+        matches = glob_expand(source, from_remote ? glob_read_remote_dir
+                                                  : glob_read_local_dir,
+                              sessions);
+        if (List_is_empty(matches)) {
+            DBG_ERR("No match for pattern %s", source);
+        }
+
+        base = glob_base(source);
+        path_map = PathMap_new(base, dest);
+        for (size_t j = 0; j < List_length(matches); j++) {
+            FileSystemT *match = List_get(matches, j);
+            char *match_dest;
+
+            if (filter != NULL &&
+                Filter_excludes(filter, PathMap_relative(path_map, match->relative_path),
+                                match->type == FS_DIRECTORY)) {
+                continue;
+            }
+
+            match_dest = PathMap_apply(path_map, match->relative_path,
+                                       strlen(match->relative_path));
+            if (match_dest != NULL) {
+                copy_plan_push(plan, match->relative_path, match_dest);
+            }
+        }
+
+        PathMap_free(path_map);
+        free(base);
+        FileSystem_list_free(matches);
+    }
+
+    PathBuf_free(dest_path);
+    return plan;
+}
+
+static void
+copy_plan_free(ListT *plan) {
+    for (size_t i = 0; i < List_length(plan); i++) {
+        CopyPairT *pair = List_get(plan, i);
+        free(pair->source);
+        free(pair->dest);
+        free(pair);
+    }
+
+    List_free(plan);
+}
+
+/**
+ * Get the length of the parent directory part of a path.
+ * 0 if there is none or it is the root directory, which always exists.
+ */
+static size_t
+path_parent_length(const char *path_str) {
+    const char *separator = strrchr(path_str, PATH_SEPARATOR);
+
+    return separator == NULL ? 0 : (size_t)(separator - path_str);
+}
+
+/**
+ * Copy any number of remote paths and glob patterns to a local directory.
+ *
+ * A single plain source behaves like ``copy_from_remote_to_local``, otherwise every
+ * source is copied into ``abs_path_local`` as a single job: all patterns are
+ * expanded first and parent directories are created once for the whole job.
+ *
+ * :param sources: ``ListT`` of NULL terminated remote paths and patterns.
+ * :param abs_path_local: Destination on the local machine.
+ * :param options: Options of the copy.
+ */
+CommandStatusE
+copy_many_from_remote_to_local(ssh_session session_ssh, sftp_session session_sftp,
+                               ListT *sources, char *abs_path_local,
+                               CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+    DirCacheT *dir_cache;
+    ListT *plan;
+
+    if (List_length(sources) == 1 && !glob_has_magic(List_get(sources, 0))) {
+        result = copy_from_remote_to_local(session_ssh, session_sftp,
+                                           List_get(sources, 0), abs_path_local,
+                                           options);
+        if (copy_batch_close(options) != CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        return result;
+    }
+
+    plan = copy_plan_new(session_ssh, session_sftp, sources, abs_path_local, true,
+                         options->filter);
+    dir_cache = DirCache_new();
+
+    for (size_t i = 0; i < List_length(plan) && !copy_cancelled(options); i++) {
+        CopyPairT *pair = List_get(plan, i);
+        size_t len_parent = path_parent_length(pair->dest);
+
+        if ((len_parent && !DirCache_mkdir_parents(dir_cache, pair->dest, len_parent)) ||
+            copy_from_remote_to_local(session_ssh, session_sftp, pair->source,
+                                      pair->dest, options) != CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+    }
+
+    if (copy_batch_close(options) != CMD_OK) {
+        result = CMD_INTERNAL_ERROR;
+    }
+
+    DirCache_free(dir_cache);
+    copy_plan_free(plan);
+    return copy_cancelled(options) ? CMD_CANCELLED : result;
+}
+
+/**
+ * Copy any number of local paths and glob patterns to a remote directory.
+ *
+ * Same as ``copy_many_from_remote_to_local`` in the other direction.
+ *
+ * :param sources: ``ListT`` of NULL terminated local paths and patterns.
+ * :param abs_path_remote: Destination on the remote server.
+ * :param options: Options of the copy.
+ */
+CommandStatusE
+copy_many_from_local_to_remote(ssh_session session_ssh, sftp_session session_sftp,
+                               ListT *sources, char *abs_path_remote,
+                               CopyOptionsT *options) {
+    CommandStatusE result = CMD_OK;
+    StrSetT *known_dirs;
+    ListT *plan;
+
+    if (List_length(sources) == 1 && !glob_has_magic(List_get(sources, 0))) {
+        result = copy_from_local_to_remote(session_ssh, session_sftp,
+                                           List_get(sources, 0), abs_path_remote,
+                                           options);
+        if (copy_batch_close(options) != CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        return result;
+    }
+
+    plan = copy_plan_new(session_ssh, session_sftp, sources, abs_path_remote, false,
+                         options->filter);
+    known_dirs = StrSet_new(STR_SET_MIN_CAPACITY);
+
+    for (size_t i = 0; i < List_length(plan) && !copy_cancelled(options); i++) {
+        CopyPairT *pair = List_get(plan, i);
+        size_t len_parent = path_parent_length(pair->dest);
+        CommandStatusE status = CMD_OK;
+
+        if (len_parent) {
+            pair->dest[len_parent] = '\0';
+            status = create_parents_remote(session_sftp, pair->dest, known_dirs);
+            pair->dest[len_parent] = PATH_SEPARATOR;
+        }
+
+        if (status != CMD_OK ||
+            copy_from_local_to_remote(session_ssh, session_sftp, pair->source,
+                                      pair->dest, options) != CMD_OK) {
+            result = CMD_INTERNAL_ERROR;
+        }
+    }
+
+    if (copy_batch_close(options) != CMD_OK) {
+        result = CMD_INTERNAL_ERROR;
+    }
+
+    StrSet_free(known_dirs);
+    copy_plan_free(plan);
+    return copy_cancelled(options) ? CMD_CANCELLED : result;
 }
 
 /**
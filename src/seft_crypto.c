@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libssh/libssh.h>
+
+#include "seft_config.h"
+#include "seft_crypto.h"
+#include "seft_debug.h"
+#include "seft_path.h"
+
+#if defined(HAVE_LIBCRYPTO) && defined(HAVE_OPENSSL_EVP_H)
+#define CRYPTO_BENCHMARK
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#endif
+
+/** A cipher offered by ``auto`` and how fast this machine runs it */
+typedef struct {
+    /** Name of the cipher in SSH */
+    const char *name;
+
+    /** Bytes per second, 0 if it couldn't be measured */
+    double speed;
+} CipherSpeedT;
+
+/** Ciphers ordered by ``auto``, libssh supports all of them */
+static CipherSpeedT cipher_speeds[] = {
+    {"aes128-gcm@openssh.com", 0},        {"aes256-gcm@openssh.com", 0},
+    {"chacha20-poly1305@openssh.com", 0}, {"aes128-ctr", 0},
+    {"aes256-ctr", 0},
+};
+
+static pthread_once_t auto_ciphers_once = PTHREAD_ONCE_INIT;
+static char *auto_ciphers;
+
+/** Create an empty ``CryptoPrefsT``, it must be freed with ``CryptoPrefs_free``. */
+CryptoPrefsT *
+CryptoPrefs_new(void) {
+    return DBG_CALLOC(1, sizeof(CryptoPrefsT));
+}
+
+static char *
+str_dup_or_null(const char *str) {
+    return str != NULL ? strdup(str) : NULL;
+}
+
+CryptoPrefsT *
+CryptoPrefs_copy(const CryptoPrefsT *self) {
+    CryptoPrefsT *copy = CryptoPrefs_new();
+
+    copy->ciphers = str_dup_or_null(self->ciphers);
+    copy->macs = str_dup_or_null(self->macs);
+    copy->kex = str_dup_or_null(self->kex);
+    return copy;
+}
+
+/**
+ * Set one of the preferences.
+ *
+ * :param key: ``ciphers``, ``macs`` or ``kex``.
+ * :param value: Comma separated algorithms, ``CRYPTO_AUTO`` for ciphers orders
+ *     them by speed.
+ * :return: False if ``key`` is unknown.
+ */
+bool
+CryptoPrefs_set(CryptoPrefsT *self, const char *key, const char *value) {
+    char **field;
+
+    if (!strcmp(key, "ciphers")) {
+        field = &self->ciphers;
+    } else if (!strcmp(key, "macs")) {
+        field = &self->macs;
+    } else if (!strcmp(key, "kex")) {
+        field = &self->kex;
+    } else {
+        return false;
+    }
+
+    free(*field);
+    *field = !strcmp(key, "ciphers") && !strcmp(value, CRYPTO_AUTO)
+                 ? crypto_auto_ciphers()
+                 : strdup(value);
+    return true;
+}
+
+/** Strip leading and trailing whitespace, the end of ``str`` is overwritten. */
+static char *
+str_trim(char *str) {
+    size_t length;
+
+    str += strspn(str, " \t");
+    for (length = strlen(str); length && strchr(" \t\r\n", str[length - 1]); length--) {
+    }
+    str[length] = '\0';
+
+    return str;
+}
+
+/**
+ * Read preferences from a file of ``key = value`` lines, i.e
+ * ``ciphers = aes128-gcm@openssh.com,chacha20-poly1305@openssh.com``.
+ * Empty lines and lines starting with ``#`` are ignored.
+ *
+ * :return: False if the file couldn't be read, True otherwise.
+ */
+bool
+CryptoPrefs_load(CryptoPrefsT *self, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[BUF_SIZE_FS_PATH];
+    size_t num_line = 0;
+
+    if (file == NULL) {
+        DBG_ERR("Couldn't open config file %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    while (fgets(line, sizeof line, file) != NULL) {
+        char *key, *value;
+
+        num_line++;
+        key = str_trim(line);
+        if (!*key || *key == '#') {
+            continue;
+        }
+
+        value = strchr(key, '=');
+        if (value == NULL) {
+            DBG_ERR("%s:%zu: Expected key = value", path, num_line);
+            continue;
+        }
+
+        *value = '\0';
+        key = str_trim(key);
+        value = str_trim(value + 1);
+
+        if (!CryptoPrefs_set(self, key, value)) {
+            DBG_ERR("%s:%zu: Unknown key: %s", path, num_line, key);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * Write the path of a file of seft under an XDG base directory.
+ *
+ * :param env: Variable of the base directory, i.e ``XDG_CONFIG_HOME``.
+ * :param fallback: Base directory under ``$HOME`` if ``env`` isn't set.
+ * :return: False if neither ``env`` nor ``HOME`` is set.
+ */
+static bool
+crypto_xdg_path(char *buf, size_t size, const char *env, const char *fallback,
+                const char *name) {
+    const char *base = getenv(env), *home = getenv("HOME");
+
+    if (base != NULL && *base) {
+        snprintf(buf, size, "%s/seft/%s", base, name);
+    } else if (home != NULL && *home) {
+        snprintf(buf, size, "%s/%s/seft/%s", home, fallback, name);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/** Load ``$XDG_CONFIG_HOME/seft/config`` if it exists. */
+bool
+CryptoPrefs_load_default(CryptoPrefsT *self) {
+    char path[BUF_SIZE_FS_PATH];
+
+    if (!crypto_xdg_path(path, sizeof path, "XDG_CONFIG_HOME", ".config", "config") ||
+        access(path, R_OK)) {
+        return false;
+    }
+
+    return CryptoPrefs_load(self, path);
+}
+
+/**
+ * Offer the preferred algorithms when ``session`` connects.
+ *
+ * :return: False if libssh rejected some of them, none of them are applied then.
+ */
+bool
+CryptoPrefs_apply(const CryptoPrefsT *self, ssh_session session) {
+    struct {
+        enum ssh_options_e option;
+        const char *value;
+    } options[] = {
+        {SSH_OPTIONS_CIPHERS_C_S, self->ciphers},
+        {SSH_OPTIONS_CIPHERS_S_C, self->ciphers},
+        {SSH_OPTIONS_HMAC_C_S, self->macs},
+        {SSH_OPTIONS_HMAC_S_C, self->macs},
+        {SSH_OPTIONS_KEY_EXCHANGE, self->kex},
+    };
+
+    for (size_t i = 0; i < sizeof options / sizeof *options; i++) {
+        if (options[i].value != NULL &&
+            ssh_options_set(session, options[i].option, options[i].value) < 0) {
+            DBG_ERR("Unsupported algorithms: %s: %s", options[i].value,
+                    ssh_get_error(session));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+CryptoPrefs_free(CryptoPrefsT *self) {
+    free(self->ciphers);
+    free(self->macs);
+    free(self->kex);
+    DBG_SAFE_FREE(self);
+}
+
+#ifdef CRYPTO_BENCHMARK
+/** Get the OpenSSL cipher doing the same work as an SSH cipher. */
+static const EVP_CIPHER *
+crypto_evp_cipher(const char *name) {
+    if (!strcmp(name, "aes128-gcm@openssh.com")) {
+        return EVP_aes_128_gcm();
+    }
+    if (!strcmp(name, "aes256-gcm@openssh.com")) {
+        return EVP_aes_256_gcm();
+    }
+    if (!strcmp(name, "chacha20-poly1305@openssh.com")) {
+        return EVP_chacha20_poly1305();
+    }
+    if (!strcmp(name, "aes128-ctr")) {
+        return EVP_aes_128_ctr();
+    }
+    return EVP_aes_256_ctr();
+}
+
+/**
+ * Measure how fast a cipher encrypts packets on this machine. The CTR ciphers
+ * aren't authenticated, their packets get an HMAC-SHA256 on top like in a session.
+ *
+ * :return: Bytes per second, 0 if the cipher isn't available.
+ */
+static double
+crypto_measure(const char *name) {
+    static unsigned char key[32], iv[16];
+    unsigned char *buf = DBG_CALLOC(CRYPTO_BENCH_PACKET_SIZE + 16, 1);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    bool needs_mac = strstr(name, "-ctr") != NULL;
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int len_mac;
+    struct timespec start, stop;
+    double seconds;
+    int length;
+    bool ok;
+
+    ok = buf != NULL && ctx != NULL &&
+         EVP_EncryptInit_ex(ctx, crypto_evp_cipher(name), NULL, key, iv);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; ok && i < CRYPTO_BENCH_SIZE / CRYPTO_BENCH_PACKET_SIZE; i++) {
+        /* Every packet gets a new nonce, like SSH does */
+        iv[0] = i;
+        ok = EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) &&
+             EVP_EncryptUpdate(ctx, buf, &length, buf, CRYPTO_BENCH_PACKET_SIZE) &&
+             EVP_EncryptFinal_ex(ctx, buf + length, &length);
+
+        if (ok && needs_mac) {
+            ok = HMAC(EVP_sha256(), key, sizeof key, buf, CRYPTO_BENCH_PACKET_SIZE, mac,
+                      &len_mac) != NULL;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    EVP_CIPHER_CTX_free(ctx);
+    free(buf);
+
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    return ok && seconds > 0 ? CRYPTO_BENCH_SIZE / seconds : 0;
+}
+
+#else
+/**
+ * Guess the speed of a cipher without OpenSSL: AES-GCM is fastest with AES-NI and
+ * carry-less multiply, ChaCha20-Poly1305 otherwise.
+ */
+static double
+crypto_guess(const char *name) {
+    bool has_aes = false;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    has_aes = __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#endif
+
+    if (strstr(name, "gcm") != NULL) {
+        return has_aes ? 3 : 1;
+    }
+    return strstr(name, "chacha20") != NULL ? 2 : 0.5;
+}
+#endif /* CRYPTO_BENCHMARK */
+
+static int
+cipher_speed_compare(const void *self, const void *other) {
+    double a = ((const CipherSpeedT *)self)->speed;
+    double b = ((const CipherSpeedT *)other)->speed;
+
+    return (a < b) - (a > b);
+}
+
+/** Create the directories of a path, like ``mkdir -p`` on its parent. */
+static void
+crypto_mkdir_parents(const char *path) {
+    char buf[BUF_SIZE_FS_PATH];
+
+    snprintf(buf, sizeof buf, "%s", path);
+    for (char *sep = strchr(buf + 1, PATH_SEPARATOR); sep != NULL;
+         sep = strchr(sep + 1, PATH_SEPARATOR)) {
+        *sep = '\0';
+        mkdir(buf, FS_CREATE_PERM);
+        *sep = PATH_SEPARATOR;
+    }
+}
+
+/** Benchmark the ciphers, or read the order of an earlier run from the cache. */
+static void
+crypto_init_auto_ciphers(void) {
+    char path[BUF_SIZE_FS_PATH], line[BUF_SIZE_FS_PATH] = {0};
+    bool has_cache = crypto_xdg_path(path, sizeof path, "XDG_CACHE_HOME", ".cache",
+                                     "ciphers");
+    size_t num_ciphers = sizeof cipher_speeds / sizeof *cipher_speeds;
+    size_t length = 0;
+    FILE *file;
+
+    if (has_cache && (file = fopen(path, "r")) != NULL) {
+        if (fgets(line, sizeof line, file) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+        }
+        fclose(file);
+
+        if (*line) {
+            auto_ciphers = strdup(line);
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < num_ciphers; i++) {
+#ifdef CRYPTO_BENCHMARK
+        cipher_speeds[i].speed = crypto_measure(cipher_speeds[i].name);
+#else
+        cipher_speeds[i].speed = crypto_guess(cipher_speeds[i].name);
+#endif
+    }
+    qsort(cipher_speeds, num_ciphers, sizeof *cipher_speeds, cipher_speed_compare);
+
+    for (size_t i = 0; i < num_ciphers; i++) {
+        DBG_INFO("Cipher %s: %.0f MB/s", cipher_speeds[i].name,
+                 cipher_speeds[i].speed / 1e6);
+        length += snprintf(line + length, sizeof line - length, "%s%s", i ? "," : "",
+                           cipher_speeds[i].name);
+    }
+    auto_ciphers = strdup(line);
+
+    if (has_cache) {
+        crypto_mkdir_parents(path);
+        if ((file = fopen(path, "w")) != NULL) {
+            fprintf(file, "%s\n", line);
+            fclose(file);
+        }
+    }
+}
+
+/**
+ * Get the ciphers libssh supports ordered from the fastest on this machine.
+ *
+ * The ciphers are benchmarked once and the order is cached in
+ * ``$XDG_CACHE_HOME/seft/ciphers``, delete it to benchmark again.
+ *
+ * :return: Comma separated ciphers, must be freed by the caller.
+ */
+char *
+crypto_auto_ciphers(void) {
+    pthread_once(&auto_ciphers_once, crypto_init_auto_ciphers);
+    return strdup(auto_ciphers);
+}
@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seft_debug.h"
+#include "seft_filter.h"
+#include "seft_glob.h"
+#include "seft_list.h"
+#include "seft_path.h"
+
+static FilterNodeT *
+FilterNode_new(const char *name, size_t length) {
+    FilterNodeT *self = DBG_CALLOC(1, sizeof *self);
+
+    self->name = strndup(name, length);
+    self->rule_any = FILTER_NO_RULE;
+    self->rule_dir = FILTER_NO_RULE;
+
+    return self;
+}
+
+static void
+FilterNode_free(FilterNodeT *self) {
+    for (size_t i = 0; i < self->num_children; i++) {
+        FilterNode_free(self->children[i]);
+    }
+
+    free(self->name);
+    free(self->children);
+    DBG_SAFE_FREE(self);
+}
+
+/**
+ * Binary search the children of a node for a component.
+ *
+ * :param position: [OUT] Index of the child, or where it would be inserted.
+ * :return: True if the child exists.
+ */
+static bool
+FilterNode_find(const FilterNodeT *self, const char *name, size_t length,
+                size_t *position) {
+    size_t low = 0, high = self->num_children;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const char *child = self->children[middle]->name;
+        int order = strncmp(child, name, length);
+
+        if (!order && child[length] != '\0') {
+            order = 1;
+        }
+
+        if (!order) {
+            *position = middle;
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    *position = low;
+    return false;
+}
+
+/** Get the child of a node for a component, creating it if it doesn't exist. */
+static FilterNodeT *
+FilterNode_child(FilterNodeT *self, const char *name, size_t length) {
+    FilterNodeT **children;
+    size_t position;
+
+    if (FilterNode_find(self, name, length, &position)) {
+        return self->children[position];
+    }
+
+    children = realloc(self->children, (self->num_children + 1) * sizeof *children);
+    if (children == NULL) {
+        DBG_ERR("Couldn't allocate filter node for %.*s", (int)length, name);
+        return NULL;
+    }
+
+    memmove(children + position + 1, children + position,
+            (self->num_children - position) * sizeof *children);
+    children[position] = FilterNode_new(name, length);
+    self->children = children;
+    self->num_children++;
+
+    return children[position];
+}
+
+/** Walk the trie along the components of a path, NULL if it isn't in the trie. */
+static const FilterNodeT *
+FilterNode_lookup(const FilterNodeT *self, const char *path_str, size_t length) {
+    PathViewT view;
+    size_t position;
+
+    for (size_t offset = 0; self != NULL && offset < length;) {
+        if (!path_split(path_str + offset, length - offset, &view, 1)) {
+            break;
+        }
+
+        self = FilterNode_find(self, path_str + offset + view.offset, view.length,
+                               &position)
+                   ? self->children[position]
+                   : NULL;
+        offset += view.offset + view.length;
+    }
+
+    return self;
+}
+
+/** Create an empty ``FilterT``, it excludes nothing. */
+FilterT *
+Filter_new(void) {
+    FilterT *self = DBG_CALLOC(1, sizeof *self);
+
+    self->rules = List_new(1, sizeof(FilterRuleT));
+    self->anchored = FilterNode_new("", 0);
+    self->names = FilterNode_new("", 0);
+
+    return self;
+}
+
+/**
+ * Compile a rule into the filter.
+ *
+ * A leading ``/`` anchors the pattern to the root of the transfer, as does a ``/``
+ * inside it. Other patterns match the name of an object at any depth. A trailing
+ * ``/`` only matches directories. Patterns can have wildcards, see ``glob_match``.
+ *
+ * :param pattern: Pattern of the rule.
+ * :param include: Include the matches, exclude them otherwise.
+ * :return: False if the pattern is empty, True otherwise.
+ */
+bool
+Filter_add_rule(FilterT *self, const char *pattern, bool include) {
+    FilterRuleT rule = {NULL, include, false, false};
+    size_t index = List_length(self->rules);
+    size_t length = strlen(pattern);
+    const char *given = pattern;
+    FilterNodeT *node;
+    size_t *globs;
+
+    if (*pattern == PATH_SEPARATOR) {
+        rule.anchored = true;
+        pattern++;
+        length--;
+    }
+    for (; length && pattern[length - 1] == PATH_SEPARATOR; length--) {
+        rule.dir_only = true;
+    }
+    if (!length) {
+        DBG_ERR("Filter pattern without a name: %s", given);
+        return false;
+    }
+
+    rule.pattern = strndup(pattern, length);
+    rule.anchored |= strchr(rule.pattern, PATH_SEPARATOR) != NULL;
+    List_push(self->rules, &rule, sizeof rule);
+
+    /* Escaped characters are left to the glob matcher too */
+    if (glob_has_magic(rule.pattern) || strchr(rule.pattern, '\\') != NULL) {
+        globs = realloc(self->globs, (self->num_globs + 1) * sizeof *globs);
+        if (globs == NULL) {
+            return false;
+        }
+        globs[self->num_globs++] = index;
+        self->globs = globs;
+        return true;
+    }
+
+    node = rule.anchored ? self->anchored : self->names;
+    for (size_t offset = 0; node != NULL && offset < length;) {
+        PathViewT view;
+
+        path_split(rule.pattern + offset, length - offset, &view, 1);
+        node = FilterNode_child(node, rule.pattern + offset + view.offset, view.length);
+        offset += view.offset + view.length;
+    }
+    if (node == NULL) {
+        return false;
+    }
+
+    /* The first rule wins, later ones for the same path are shadowed */
+    if (rule.dir_only && node->rule_dir == FILTER_NO_RULE) {
+        node->rule_dir = index;
+    } else if (!rule.dir_only && node->rule_any == FILTER_NO_RULE) {
+        node->rule_any = index;
+    }
+
+    return true;
+}
+
+/**
+ * Read rules from a file, one per line.
+ *
+ * Lines starting with ``+ `` are include rules and lines starting with ``- `` or
+ * without a prefix are exclude rules. Empty lines and lines starting with ``#``
+ * are ignored.
+ *
+ * :param path: Path of the local file.
+ * :return: False if the file couldn't be read or has a rule that couldn't be added,
+ *     True otherwise.
+ */
+bool
+Filter_add_file(FilterT *self, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[BUF_SIZE_FS_PATH];
+    size_t length, num_line = 0;
+    bool ok = true;
+
+    if (file == NULL) {
+        DBG_ERR("Couldn't open filter file %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    while (ok && fgets(line, sizeof line, file) != NULL) {
+        length = strcspn(line, "\r\n");
+        line[length] = '\0';
+        num_line++;
+
+        if (!length || *line == '#') {
+            continue;
+        }
+
+        if ((*line == '+' || *line == '-') && line[1] == ' ') {
+            ok = Filter_add_rule(self, line + 2, *line == '+');
+        } else {
+            ok = Filter_add_rule(self, line, false);
+        }
+        if (!ok) {
+            DBG_ERR("Invalid rule at line %zu of filter file %s", num_line, path);
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/** Get the first rule of a trie node matching an object, ``FILTER_NO_RULE`` if none. */
+static size_t
+FilterNode_rule(const FilterNodeT *self, bool is_dir) {
+    if (self == NULL) {
+        return FILTER_NO_RULE;
+    }
+    if (is_dir && self->rule_dir < self->rule_any) {
+        return self->rule_dir;
+    }
+    return self->rule_any;
+}
+
+/**
+ * Check if an object is excluded by the filter.
+ *
+ * Literal rules are found with one trie lookup each for the path and the name,
+ * only rules with wildcards ordered before the best literal match are matched one
+ * by one.
+ *
+ * :param relative_path: Path of the object relative to the root of the transfer.
+ * :param is_dir: True if the object is a directory.
+ * :return: True if the first matching rule excludes the object.
+ */
+bool
+Filter_excludes(const FilterT *self, const char *relative_path, bool is_dir) {
+    const char *name = strrchr(relative_path, PATH_SEPARATOR);
+    size_t best, candidate;
+
+    name = name != NULL ? name + 1 : relative_path;
+
+    best = FilterNode_rule(
+        FilterNode_lookup(self->anchored, relative_path, strlen(relative_path)), is_dir);
+    candidate = FilterNode_rule(FilterNode_lookup(self->names, name, strlen(name)),
+                                is_dir);
+    if (candidate < best) {
+        best = candidate;
+    }
+
+    for (size_t i = 0; i < self->num_globs && self->globs[i] < best; i++) {
+        const FilterRuleT *rule = List_get(self->rules, self->globs[i]);
+
+        if ((!rule->dir_only || is_dir) &&
+            glob_match(rule->pattern, rule->anchored ? relative_path : name)) {
+            best = self->globs[i];
+        }
+    }
+
+    if (best == FILTER_NO_RULE) {
+        return false;
+    }
+
+    return !((FilterRuleT *)List_get(self->rules, best))->include;
+}
+
+/** Free a ``FilterT`` and all of its rules. */
+void
+Filter_free(FilterT *self) {
+    for (size_t i = 0; i < List_length(self->rules); i++) {
+        FilterRuleT *rule = List_get(self->rules, i);
+        free(rule->pattern);
+        free(rule);
+    }
+
+    List_free(self->rules);
+    FilterNode_free(self->anchored);
+    FilterNode_free(self->names);
+    free(self->globs);
+    DBG_SAFE_FREE(self);
+}
@@ -0,0 +1,316 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seft_debug.h"
+#include "seft_glob.h"
+#include "seft_list.h"
+#include "seft_path.h"
+
+/** Check if ``str`` points at the first character of a hidden path component. */
+static bool
+glob_is_hidden_at(const char *str_start, const char *str) {
+    return *str == '.' && (str == str_start || str[-1] == PATH_SEPARATOR);
+}
+
+/**
+ * Match a single character against a bracket expression, i.e ``[a-z]`` or ``[!.]``
+ *
+ * :param pattern: [IN/OUT] Points at the opening ``[``, advanced past the closing
+ *     ``]`` if the expression is well formed.
+ * :param chr: Character to match.
+ * :return: 1 on a match, 0 on a mismatch, -1 if the expression isn't closed, in
+ *     which case the ``[`` is taken literally.
+ */
+static int
+glob_match_class(const char **pattern, char chr) {
+    const char *p = *pattern + 1;
+    bool negate = false, matched = false;
+
+    if (*p == '!' || *p == '^') {
+        negate = true;
+        p++;
+    }
+
+    /* A ``]`` right after the opening bracket is part of the class */
+    do {
+        if (*p == '\0') {
+            return -1;
+        }
+
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            matched |= (unsigned char)p[0] <= (unsigned char)chr &&
+                       (unsigned char)chr <= (unsigned char)p[2];
+            p += 3;
+        } else {
+            matched |= *p == chr;
+            p++;
+        }
+    } while (*p != ']');
+
+    *pattern = p + 1;
+    return matched != negate;
+}
+
+static bool
+glob_match_from(const char *pattern_start, const char *pattern, const char *str_start,
+                const char *str) {
+    while (*pattern) {
+        /* ``**`` as a whole component matches any number of components */
+        if (pattern[0] == '*' && pattern[1] == '*' &&
+            (pattern == pattern_start || pattern[-1] == PATH_SEPARATOR) &&
+            (pattern[2] == PATH_SEPARATOR || pattern[2] == '\0')) {
+            pattern += pattern[2] ? 3 : 2;
+
+            for (;;) {
+                if (glob_is_hidden_at(str_start, str)) {
+                    return false;
+                }
+                if (glob_match_from(pattern_start, pattern, str_start, str)) {
+                    return true;
+                }
+
+                str = strchr(str, PATH_SEPARATOR);
+                if (str == NULL) {
+                    return !*pattern;
+                }
+                str++;
+            }
+        }
+
+        switch (*pattern) {
+            case '*':
+                for (; *pattern == '*'; pattern++) {
+                }
+                if (glob_is_hidden_at(str_start, str)) {
+                    return false;
+                }
+
+                for (;; str++) {
+                    if (glob_match_from(pattern_start, pattern, str_start, str)) {
+                        return true;
+                    }
+                    if (*str == '\0' || *str == PATH_SEPARATOR) {
+                        return false;
+                    }
+                }
+
+            case '?':
+                if (*str == '\0' || *str == PATH_SEPARATOR ||
+                    glob_is_hidden_at(str_start, str)) {
+                    return false;
+                }
+                pattern++;
+                str++;
+                break;
+
+            case '[': {
+                int matched;
+
+                if (*str == '\0' || *str == PATH_SEPARATOR ||
+                    glob_is_hidden_at(str_start, str)) {
+                    return false;
+                }
+
+                matched = glob_match_class(&pattern, *str);
+                if (matched == 0) {
+                    return false;
+                }
+                if (matched < 0) {
+                    if (*str != '[') {
+                        return false;
+                    }
+                    pattern++;
+                }
+                str++;
+                break;
+            }
+
+            case '\\':
+                if (pattern[1] != '\0') {
+                    pattern++;
+                }
+                /* fall through */
+            default:
+                if (*pattern != *str) {
+                    return false;
+                }
+                pattern++;
+                str++;
+        }
+    }
+
+    return *str == '\0';
+}
+
+/** Check if a pattern has any wildcards, i.e ``*``, ``?`` or ``[`` */
+bool
+glob_has_magic(const char *pattern) {
+    for (; *pattern; pattern++) {
+        if (*pattern == '\\' && pattern[1] != '\0') {
+            pattern++;
+        } else if (*pattern == '*' || *pattern == '?' || *pattern == '[') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Match a path against a glob pattern.
+ *
+ * ``*`` matches any run of characters within a component, ``?`` any single one and
+ * ``[...]`` one of a set, ``[!...]`` negates it. A ``**`` component matches zero or
+ * more whole components. ``\`` escapes the next character.
+ *
+ * .. note:: Like in shells wildcards don't match a leading ``.`` of a component, so
+ *    hidden files have to be matched explicitly, i.e ``.*``
+ */
+bool
+glob_match(const char *pattern, const char *str) {
+    return glob_match_from(pattern, pattern, str, str);
+}
+
+/**
+ * Get the length of the part of a pattern before its first component with
+ * wildcards, it is the directory the pattern is expanded from.
+ * For example: ``logs/2024/[0-9]*.log`` has the base ``logs/2024`` and ``*.log``
+ * has none.
+ */
+size_t
+glob_base_length(const char *pattern) {
+    size_t len_base = 0;
+
+    for (size_t i = 0; pattern[i]; i++) {
+        if (pattern[i] == '\\' && pattern[i + 1] != '\0') {
+            i++;
+        } else if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[') {
+            break;
+        } else if (pattern[i] == PATH_SEPARATOR) {
+            /* Keep the separator of the root directory */
+            len_base = i ? i : 1;
+        }
+    }
+
+    return len_base;
+}
+
+/**
+ * Get the directory a pattern is expanded from, see ``glob_base_length``. Escapes
+ * are removed from it, i.e ``foo\*bar/x*`` is expanded from ``foo*bar``.
+ *
+ * :return: The directory, ``.`` if the pattern has no base. It must be freed by the
+ *     caller.
+ */
+char *
+glob_base(const char *pattern) {
+    size_t len_base = glob_base_length(pattern);
+    char *base, *dst;
+
+    if (!len_base) {
+        return strdup(".");
+    }
+
+    base = dst = DBG_MALLOC(len_base + 1);
+    for (size_t i = 0; i < len_base; i++) {
+        if (pattern[i] == '\\' && i + 1 < len_base) {
+            i++;
+        }
+        *dst++ = pattern[i];
+    }
+    *dst = '\0';
+
+    return base;
+}
+
+/** Get the number of components of a pattern, ``SIZE_MAX`` if it has ``**``. */
+static size_t
+glob_max_depth(const char *pattern) {
+    size_t depth = 1;
+
+    for (const char *p = pattern; *p; p++) {
+        if (p[0] == '*' && p[1] == '*' && (p == pattern || p[-1] == PATH_SEPARATOR)) {
+            return SIZE_MAX;
+        }
+        depth += *p == PATH_SEPARATOR;
+    }
+
+    return depth;
+}
+
+/**
+ * Expand a glob pattern by scanning the tree below its base directory once.
+ *
+ * Directories are only descended into while the pattern can still match below
+ * them, a matching directory is not descended into as copying it covers its
+ * contents. Symbolic links are never followed.
+ *
+ * :param pattern: Pattern to expand, see ``glob_match``.
+ * :param read_dir: Function reading a directory, local or remote.
+ * :param data: Passed to ``read_dir`` as is.
+ * :return: ``ListT`` of matching ``FileSystemT``, in the order they were found.
+ */
+ListT *
+glob_expand(const char *pattern, GlobReadDirT read_dir, void *data) {
+    ListT *matches = List_new(1, sizeof(FileSystemT *));
+    ListT *dir_stack = List_new(1, sizeof(char *));
+    size_t len_base = glob_base_length(pattern);
+    const char *sub_pattern = pattern + len_base;
+    size_t max_depth, len_root;
+    char *base, *dir_path;
+    PathBufT *root;
+
+    for (; *sub_pattern == PATH_SEPARATOR; sub_pattern++) {
+    }
+    max_depth = glob_max_depth(sub_pattern);
+
+    base = glob_base(pattern);
+    root = PathBuf_new(base);
+    free(base);
+
+    /* Entries are named ``<root>/<relative path>``, unless the root is ``/`` */
+    len_root = root->length + (root->str[root->length - 1] != PATH_SEPARATOR);
+    List_push(dir_stack, root->str, root->length + 1);
+
+    while ((dir_path = List_pop(dir_stack)) != NULL) {
+        ListT *entries = read_dir(data, dir_path);
+
+        for (size_t i = 0; entries != NULL && i < List_length(entries); i++) {
+            FileSystemT *entry = List_get(entries, i);
+            const char *relative_path = entry->relative_path + len_root;
+            size_t depth = 1;
+
+            if (path_is_dotted(entry->name, strlen(entry->name))) {
+                FileSystem_free(entry);
+                continue;
+            }
+
+            if (glob_match(sub_pattern, relative_path)) {
+                entries->list[i] = NULL;
+                List_realloc(matches, matches->length + 1);
+                matches->list[matches->length++] = entry;
+                continue;
+            }
+
+            for (const char *p = relative_path; *p; p++) {
+                depth += *p == PATH_SEPARATOR;
+            }
+            if (entry->type == FS_DIRECTORY && depth < max_depth) {
+                List_push(dir_stack, entry->relative_path,
+                          strlen(entry->relative_path) + 1);
+            }
+            FileSystem_free(entry);
+        }
+
+        if (entries != NULL) {
+            List_free(entries);
+        }
+        free(dir_path);
+    }
+
+    List_free(dir_stack);
+    PathBuf_free(root);
+
+    return matches;
+}
@@ -0,0 +1,160 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "seft_hash.h"
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+rotl64(uint64_t value, uint32_t shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+/** Read a little endian integer, XXH64 is defined over little endian lanes. */
+static inline uint64_t
+read_le64(const uint8_t *ptr) {
+    uint64_t value;
+
+    memcpy(&value, ptr, sizeof value);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint32_t
+read_le32(const uint8_t *ptr) {
+    uint32_t value;
+
+    memcpy(&value, ptr, sizeof value);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t lane) {
+    acc += lane * XXH_PRIME64_2;
+    return rotl64(acc, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/** Feed whole stripes to the accumulators, returns the number of bytes consumed. */
+static size_t
+xxh64_stripes(uint64_t *acc, const uint8_t *data, size_t length) {
+    const uint8_t *start = data;
+    uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+
+    /* Four independent chains, so the multiplies of a stripe overlap */
+    for (; length >= HASH_STRIPE_SIZE;
+         data += HASH_STRIPE_SIZE, length -= HASH_STRIPE_SIZE) {
+        v1 = xxh64_round(v1, read_le64(data));
+        v2 = xxh64_round(v2, read_le64(data + 8));
+        v3 = xxh64_round(v3, read_le64(data + 16));
+        v4 = xxh64_round(v4, read_le64(data + 24));
+    }
+
+    acc[0] = v1;
+    acc[1] = v2;
+    acc[2] = v3;
+    acc[3] = v4;
+    return data - start;
+}
+
+/** Start a new hash, the same seed must be used on both ends of a comparison. */
+void
+Hash_init(HashT *self, uint64_t seed) {
+    self->acc[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    self->acc[1] = seed + XXH_PRIME64_2;
+    self->acc[2] = seed;
+    self->acc[3] = seed - XXH_PRIME64_1;
+    self->len_buf = 0;
+    self->total = 0;
+    self->seed = seed;
+}
+
+/**
+ * Hash more data. Chunks can be of any size, hashing a stream in pieces gives the
+ * same digest as hashing it at once.
+ */
+void
+Hash_update(HashT *self, const void *data, size_t length) {
+    const uint8_t *ptr = data;
+    size_t len_stripes;
+
+    self->total += length;
+
+    if (self->len_buf) {
+        size_t len_fill = HASH_STRIPE_SIZE - self->len_buf;
+
+        if (length < len_fill) {
+            memcpy(self->buf + self->len_buf, ptr, length);
+            self->len_buf += length;
+            return;
+        }
+
+        memcpy(self->buf + self->len_buf, ptr, len_fill);
+        xxh64_stripes(self->acc, self->buf, HASH_STRIPE_SIZE);
+        ptr += len_fill;
+        length -= len_fill;
+        self->len_buf = 0;
+    }
+
+    /* Hash straight from the caller's buffer, only the tail is copied */
+    len_stripes = xxh64_stripes(self->acc, ptr, length);
+    memcpy(self->buf, ptr + len_stripes, length - len_stripes);
+    self->len_buf = length - len_stripes;
+}
+
+/** Get the digest of everything hashed so far, more data can still be added. */
+uint64_t
+Hash_digest(const HashT *self) {
+    const uint8_t *ptr = self->buf;
+    size_t length = self->len_buf;
+    uint64_t hash;
+
+    if (self->total >= HASH_STRIPE_SIZE) {
+        hash = rotl64(self->acc[0], 1) + rotl64(self->acc[1], 7) +
+               rotl64(self->acc[2], 12) + rotl64(self->acc[3], 18);
+        for (size_t i = 0; i < 4; i++) {
+            hash = xxh64_merge_round(hash, self->acc[i]);
+        }
+    } else {
+        hash = self->seed + XXH_PRIME64_5;
+    }
+    hash += self->total;
+
+    for (; length >= 8; ptr += 8, length -= 8) {
+        hash ^= xxh64_round(0, read_le64(ptr));
+        hash = rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (length >= 4) {
+        hash ^= read_le32(ptr) * XXH_PRIME64_1;
+        hash = rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        ptr += 4;
+        length -= 4;
+    }
+    for (; length; ptr++, length--) {
+        hash ^= *ptr * XXH_PRIME64_5;
+        hash = rotl64(hash, 11) * XXH_PRIME64_1;
+    }
+
+    /* Avalanche */
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
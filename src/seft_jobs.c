@@ -0,0 +1,372 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "seft_ansi_colors.h"
+#include "seft_client.h"
+#include "seft_debug.h"
+#include "seft_jobs.h"
+#include "seft_list.h"
+
+#define BYTES_KIB 1024.0
+
+/** Create an empty ``JobTableT``, it must be freed with ``JobTable_free``. */
+JobTableT *
+JobTable_new(void) {
+    JobTableT *self = DBG_MALLOC(sizeof *self);
+
+    *self = (JobTableT){List_new(1, sizeof(JobT)), List_new(1, sizeof(ConnectionT)), NULL,
+                        0, COMPRESSION_NO, NULL, {0}, 0, 1};
+    return self;
+}
+
+static void
+connection_close(ConnectionT *connection) {
+    clean_sftp_session(connection->session_sftp);
+    clean_ssh_session(connection->session_ssh);
+}
+
+/**
+ * Set the server new background connections are made to. Idle connections to the
+ * previous server are closed, the ones jobs still use are closed once they are done.
+ *
+ * :param compression: How the connections compress their traffic.
+ * :param crypto: Algorithms the connections offer, NULL for the defaults.
+ * :param credentials: Password the connections authenticate with, NULL for none.
+ */
+void
+JobTable_set_server(JobTableT *self, const char *host, uint32_t port,
+                    CompressionE compression, const CryptoPrefsT *crypto,
+                    const CredentialsT *credentials) {
+    ConnectionT *connection;
+
+    while ((connection = List_pop(self->idle)) != NULL) {
+        connection_close(connection);
+        free(connection);
+    }
+
+    self->server++;
+    free(self->host);
+    self->host = host != NULL ? strdup(host) : NULL;
+    self->port = port;
+    self->compression = compression;
+
+    if (self->crypto != NULL) {
+        CryptoPrefs_free(self->crypto);
+    }
+    self->crypto = crypto != NULL ? CryptoPrefs_copy(crypto) : NULL;
+
+    Credentials_clear(&self->credentials);
+    if (credentials != NULL) {
+        self->credentials = *credentials;
+    }
+}
+
+/**
+ * Take an idle connection from the pool or open a new one.
+ *
+ * :param compressed: Take a connection that compresses its traffic.
+ *
+ * .. note:: New connections authenticate with the password of the session the
+ *    server was set with, the user is never asked for it again.
+ */
+static bool
+JobTable_acquire_connection(JobTableT *self, ConnectionT *connection,
+                            bool compressed) {
+    for (size_t i = 0; i < List_length(self->idle); i++) {
+        ConnectionT *idle = List_get(self->idle, i);
+
+        if (idle->compressed != compressed) {
+            continue;
+        }
+
+        *connection = *idle;
+        free(idle);
+        self->idle->list[i] = self->idle->list[--self->idle->length];
+        return true;
+    }
+
+    if (self->host == NULL) {
+        DBG_ERR("Not connected to a server %s", "");
+        return false;
+    }
+
+    connection->compressed = compressed;
+    connection->server = self->server;
+    connection->session_ssh = try_ssh_init(self->host, self->port, compressed,
+                                           self->crypto, &self->credentials);
+    if (connection->session_ssh == NULL) {
+        return false;
+    }
+
+    connection->session_sftp = try_sftp_init(connection->session_ssh);
+    if (connection->session_sftp == NULL) {
+        clean_ssh_session(connection->session_ssh);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Give a connection back to the pool, or close it if the pool is full or the server
+ * was changed since it was opened.
+ */
+static void
+JobTable_release_connection(JobTableT *self, ConnectionT *connection) {
+    if (connection->session_ssh == NULL) {
+        return;
+    }
+
+    if (connection->server == self->server &&
+        List_length(self->idle) < JOB_MAX_IDLE_CONNECTIONS &&
+        ssh_is_connected(connection->session_ssh)) {
+        List_push(self->idle, connection, sizeof *connection);
+    } else {
+        connection_close(connection);
+    }
+}
+
+static void *
+job_thread(void *arg) {
+    JobT *job = arg;
+    CommandStatusE result = job->run(job);
+
+    if (result == CMD_CANCELLED) {
+        atomic_store(&job->state, JOB_CANCELLED);
+    } else {
+        atomic_store(&job->state, result == CMD_OK ? JOB_DONE : JOB_FAILED);
+    }
+
+    return NULL;
+}
+
+/**
+ * Start a command in the background.
+ *
+ * The job gets a connection of its own, so the REPL keeps using its session while
+ * the job runs. ``run`` gets the job and should pass ``&job->progress`` to the copy.
+ *
+ * :param command: Command line to show in ``jobs``.
+ * :param run: Work of the job.
+ * :param data: Arguments of ``run``, the job takes ownership of it.
+ * :param free_data: Frees ``data`` once the job is reaped.
+ * :return: The job, NULL if it couldn't be started, ``data`` is freed then.
+ */
+JobT *
+JobTable_spawn(JobTableT *self, const char *command, JobRunT run, void *data,
+               void (*free_data)(void *data)) {
+    JobT *job = DBG_CALLOC(1, sizeof *job);
+
+    job->id = self->next_id;
+    job->command = strdup(command);
+    job->run = run;
+    job->data = data;
+    job->free_data = free_data;
+    job->started = time(NULL);
+    atomic_init(&job->state, JOB_RUNNING);
+    atomic_init(&job->progress.num_bytes, 0);
+    atomic_init(&job->progress.num_files, 0);
+    atomic_init(&job->progress.cancelled, false);
+
+    if (!JobTable_acquire_connection(self, &job->connection,
+                                     self->compression == COMPRESSION_YES)) {
+        goto fail;
+    }
+
+    /* Without a compressed connection the job copies everything uncompressed */
+    if (self->compression == COMPRESSION_AUTO &&
+        !JobTable_acquire_connection(self, &job->compressed_connection, true)) {
+        DBG_ERR("Couldn't open a compressed connection, job %zu copies uncompressed",
+                job->id);
+        job->compressed_connection = (ConnectionT){NULL, NULL, false, 0};
+    }
+
+    if (pthread_create(&job->thread, NULL, job_thread, job)) {
+        DBG_ERR("Couldn't start job for %s", command);
+        JobTable_release_connection(self, &job->connection);
+        JobTable_release_connection(self, &job->compressed_connection);
+        goto fail;
+    }
+
+    List_realloc(self->jobs, self->jobs->length + 1);
+    self->jobs->list[self->jobs->length++] = job;
+    self->next_id++;
+
+    printf("[%zu] %s\n", job->id, job->command);
+    return job;
+
+fail:
+    free_data(data);
+    free(job->command);
+    DBG_SAFE_FREE(job);
+    return NULL;
+}
+
+/** Join the thread of a finished job and free it, its connection goes to the pool. */
+static void
+JobTable_finish(JobTableT *self, size_t index) {
+    JobT *job = List_get(self->jobs, index);
+
+    if (!job->joined) {
+        pthread_join(job->thread, NULL);
+    }
+    JobTable_release_connection(self, &job->connection);
+    JobTable_release_connection(self, &job->compressed_connection);
+
+    job->free_data(job->data);
+    free(job->command);
+    DBG_SAFE_FREE(job);
+
+    memmove(self->jobs->list + index, self->jobs->list + index + 1,
+            (self->jobs->length - index - 1) * sizeof *self->jobs->list);
+    self->jobs->length--;
+}
+
+/** Print a job as ``[ID] STATE FILES BYTES ELAPSED COMMAND`` */
+static void
+job_print(JobT *job) {
+    static const char *states[] = {
+        [JOB_RUNNING] = "Running",
+        [JOB_DONE] = "Done",
+        [JOB_FAILED] = "Failed",
+        [JOB_CANCELLED] = "Cancelled",
+    };
+    static const char *colors[] = {
+        [JOB_RUNNING] = ANSI_RESET,
+        [JOB_DONE] = ANSI_FG_GREEN,
+        [JOB_FAILED] = ANSI_FG_RED,
+        [JOB_CANCELLED] = ANSI_FG_YELLOW,
+    };
+    static const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    JobStateE state = atomic_load(&job->state);
+    double num_bytes = atomic_load(&job->progress.num_bytes);
+    size_t unit = 0;
+
+    for (; num_bytes >= BYTES_KIB && unit + 1 < sizeof units / sizeof *units; unit++) {
+        num_bytes /= BYTES_KIB;
+    }
+
+    printf("[%zu] %s%-9s" ANSI_RESET " %6llu files %8.1f %-3s %5lds  %s\n", job->id,
+           colors[state], states[state],
+           (unsigned long long)atomic_load(&job->progress.num_files), num_bytes,
+           units[unit], (long)(time(NULL) - job->started), job->command);
+}
+
+/**
+ * Report and free the jobs that are over, like a shell does before its prompt.
+ *
+ * :return: Number of jobs reaped.
+ */
+size_t
+JobTable_reap(JobTableT *self) {
+    size_t num_reaped = 0;
+
+    for (size_t i = 0; i < List_length(self->jobs);) {
+        JobT *job = List_get(self->jobs, i);
+
+        if (atomic_load(&job->state) == JOB_RUNNING) {
+            i++;
+            continue;
+        }
+
+        job_print(job);
+        JobTable_finish(self, i);
+        num_reaped++;
+    }
+
+    return num_reaped;
+}
+
+/** Print every job with its progress. */
+void
+JobTable_print(JobTableT *self) {
+    for (size_t i = 0; i < List_length(self->jobs); i++) {
+        job_print(List_get(self->jobs, i));
+    }
+}
+
+/** Find the index of the job with ``id``, SIZE_MAX if there is none. */
+static size_t
+JobTable_find(JobTableT *self, size_t id) {
+    for (size_t i = 0; i < List_length(self->jobs); i++) {
+        if (((JobT *)List_get(self->jobs, i))->id == id) {
+            return i;
+        }
+    }
+
+    DBG_ERR("No such job: %zu", id);
+    return SIZE_MAX;
+}
+
+/**
+ * Block until a job is over and reap it.
+ *
+ * :param id: Job to wait for, 0 to wait for all of them.
+ */
+CommandStatusE
+JobTable_wait(JobTableT *self, size_t id) {
+    if (id && JobTable_find(self, id) == SIZE_MAX) {
+        return CMD_INVALID_ARGS_TYPE;
+    }
+
+    for (size_t i = 0; i < List_length(self->jobs);) {
+        JobT *job = List_get(self->jobs, i);
+
+        if (id && job->id != id) {
+            i++;
+            continue;
+        }
+
+        pthread_join(job->thread, NULL);
+        job->joined = true;
+        job_print(job);
+        JobTable_finish(self, i);
+    }
+
+    return CMD_OK;
+}
+
+/**
+ * Ask a job to stop, it stops before its next chunk or file and is reaped as
+ * cancelled.
+ */
+CommandStatusE
+JobTable_cancel(JobTableT *self, size_t id) {
+    size_t index = JobTable_find(self, id);
+
+    if (index == SIZE_MAX) {
+        return CMD_INVALID_ARGS_TYPE;
+    }
+
+    atomic_store(&((JobT *)List_get(self->jobs, index))->progress.cancelled, true);
+    return CMD_OK;
+}
+
+/** Get the job with ``id``, NULL if there is none. The job is valid until reaped. */
+JobT *
+JobTable_get(JobTableT *self, size_t id) {
+    size_t index = JobTable_find(self, id);
+
+    return index == SIZE_MAX ? NULL : List_get(self->jobs, index);
+}
+
+/** Cancel and wait for all jobs, then close every connection of the pool. */
+void
+JobTable_free(JobTableT *self) {
+    for (size_t i = 0; i < List_length(self->jobs); i++) {
+        atomic_store(&((JobT *)List_get(self->jobs, i))->progress.cancelled, true);
+    }
+    JobTable_wait(self, 0);
+
+    JobTable_set_server(self, NULL, 0, COMPRESSION_NO, NULL, NULL);
+    List_free(self->jobs);
+    List_free(self->idle);
+    DBG_SAFE_FREE(self);
+}
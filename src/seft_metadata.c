@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "seft_batch.h"
+#include "seft_commands.h"
+#include "seft_debug.h"
+#include "seft_list.h"
+#include "seft_metadata.h"
+
+/** Fewer objects get their metadata one by one, opening a batch for them costs a
+ * few round trips of its own */
+#define METADATA_BATCH_MIN_OBJECTS 4
+
+/**
+ * Queue the metadata of a copied object, to be applied once all data is copied.
+ *
+ * Deferring the metadata keeps it out of the data phase, so read-only directories
+ * can still be filled and directory times aren't bumped by the entries created in
+ * them afterwards.
+ *
+ * :param self: ``ListT`` of ``MetadataT``.
+ * :param path: Path of the object on the destination.
+ * :param permissions: Mode of the source, the file type bits are ignored.
+ * :param atime: Access time of the source.
+ * :param mtime: Modification time of the source.
+ */
+void
+Metadata_list_push(ListT *self, const char *path, uint32_t permissions, uint64_t atime,
+                   uint64_t mtime) {
+    MetadataT metadata = {strdup(path), permissions & MODE_PERMISSION_BITS, atime, mtime};
+    List_push(self, &metadata, sizeof metadata);
+}
+
+/**
+ * Apply queued metadata to objects on the remote server.
+ *
+ * Permissions and both times are sent in a single ``setstat`` per object, after
+ * the data phase, children before their parents. With enough objects the requests
+ * are pipelined over a batch, the server still handles them in that order.
+ *
+ * :return: ``CMD_INTERNAL_ERROR`` if any object couldn't be updated, ``CMD_OK``
+ *     otherwise.
+ */
+CommandStatusE
+Metadata_list_apply_remote(ssh_session session_ssh, sftp_session session_sftp,
+                           ListT *self) {
+    CommandStatusE result = CMD_OK;
+    struct sftp_attributes_struct attr;
+    BatchT *batch = NULL;
+    MetadataT *metadata;
+
+    if (List_length(self) >= METADATA_BATCH_MIN_OBJECTS) {
+        batch = Batch_new(session_ssh, NULL, NULL);
+    }
+
+    for (size_t i = List_length(self); i-- > 0;) {
+        metadata = List_get(self, i);
+        if (batch != NULL && Batch_setstat(batch, metadata->path, metadata)) {
+            continue;
+        }
+
+        memset(&attr, 0, sizeof attr);
+        attr.flags = SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME;
+        attr.permissions = metadata->permissions;
+        attr.atime64 = attr.atime = metadata->atime;
+        attr.mtime64 = attr.mtime = metadata->mtime;
+
+        if (sftp_setstat(session_sftp, metadata->path, &attr)) {
+            DBG_ERR("Couldn't preserve metadata of %s: %s", metadata->path,
+                    ssh_get_error(session_ssh));
+            result = CMD_INTERNAL_ERROR;
+        }
+    }
+
+    if (batch != NULL) {
+        if (!Batch_flush(batch)) {
+            result = CMD_INTERNAL_ERROR;
+        }
+        Batch_free(batch);
+    }
+    return result;
+}
+
+/**
+ * Apply queued metadata to objects on the local computer, children before their
+ * parents.
+ *
+ * :return: ``CMD_INTERNAL_ERROR`` if any object couldn't be updated, ``CMD_OK``
+ *     otherwise.
+ */
+CommandStatusE
+Metadata_list_apply_local(ListT *self) {
+    CommandStatusE result = CMD_OK;
+    struct timespec times[2] = {0};
+    MetadataT *metadata;
+
+    for (size_t i = List_length(self); i-- > 0;) {
+        metadata = List_get(self, i);
+
+        times[0].tv_sec = metadata->atime;
+        times[1].tv_sec = metadata->mtime;
+
+        if (chmod(metadata->path, metadata->permissions) ||
+            utimensat(AT_FDCWD, metadata->path, times, 0)) {
+            DBG_ERR("Couldn't preserve metadata of %s: %s", metadata->path,
+                    strerror(errno));
+            result = CMD_INTERNAL_ERROR;
+        }
+    }
+
+    return result;
+}
+
+/** Free a ``ListT`` of ``MetadataT`` along with its items. */
+void
+Metadata_list_free(ListT *self) {
+    MetadataT *metadata;
+
+    for (size_t i = 0; i < List_length(self); i++) {
+        metadata = List_get(self, i);
+        DBG_SAFE_FREE(metadata->path);
+        DBG_SAFE_FREE(metadata);
+    }
+
+    List_free(self);
+}
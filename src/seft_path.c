@@ -1,9 +1,17 @@
+/* For ``O_PATH`` and ``syscall`` */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
@@ -13,6 +21,28 @@
 #include "seft_debug.h"
 #include "seft_list.h"
 #include "seft_path.h"
+#include "seft_set.h"
+
+/* Directories are only opened to resolve paths relative to them */
+#ifdef O_PATH
+#define DIR_CACHE_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIR_CACHE_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+/* Size of the buffer directory entries are read into */
+#define BUF_SIZE_DIR_ENTRIES 65536
+
+#ifdef SYS_getdents64
+/** Layout of the records returned by ``getdents64`` */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
 
 /**
  * Split a path string into a list of path components and return the sliced string.
@@ -41,20 +71,51 @@ path_str_slice(const char *path_str, size_t start, size_t stop) {
     return sliced_path_str;
 }
 
-void
-path_str_shift_left(char *path_str, size_t num_shifts) {
-    size_t len_path_str = strlen(path_str);
+/**
+ * Normalise a path in place, in a single pass.
+ * Repeated separators are collapsed, ``.`` components are dropped and trailing
+ * separators are removed. For example: ``.//this/./is/`` to ``this/is``
+ *
+ * .. note:: ``..`` components are kept, resolving them needs the filesystem as
+ *    they might follow a symbolic link.
+ *
+ * :param path_str: Path string, it must be at least ``length + 1`` bytes.
+ * :param length: Length of the path string.
+ * :return: Length of the normalised path.
+ */
+size_t
+path_normalise(char *path_str, size_t length) {
+    size_t read = 0, write = 0, start;
+    bool is_absolute = length && path_str[0] == PATH_SEPARATOR;
 
-    if (num_shifts > len_path_str) {
-        return;
+    if (is_absolute) {
+        write = 1;
     }
 
-    for (size_t i = 0; i < num_shifts; i++, len_path_str--) {
-        for (size_t j = 0; j < len_path_str; j++) {
-            path_str[j] = path_str[j + 1];
+    while (read < length) {
+        for (; read < length && path_str[read] == PATH_SEPARATOR; read++) {
         }
+        for (start = read; read < length && path_str[read] != PATH_SEPARATOR; read++) {
+        }
+
+        if (read == start || (read - start == 1 && path_str[start] == '.')) {
+            continue;
+        }
+
+        if (write && path_str[write - 1] != PATH_SEPARATOR) {
+            path_str[write++] = PATH_SEPARATOR;
+        }
+        memmove(path_str + write, path_str + start, read - start);
+        write += read - start;
     }
-    path_str[len_path_str] = '\0';
+
+    /* Path only had ``.`` components, i.e ``./`` */
+    if (!write && length) {
+        path_str[write++] = '.';
+    }
+    path_str[write] = '\0';
+
+    return write;
 }
 
 /**
@@ -63,30 +124,28 @@ path_str_shift_left(char *path_str, size_t num_shifts) {
  */
 void
 path_remove_prefix(char *path_str) {
-    size_t num_slash_prefix = 0;
-    int8_t root_dir_slash = 1;
     size_t len_path_str = strlen(path_str);
+    size_t num_prefix = 0;
 
     if (len_path_str < 2) {
         return;
     }
 
-    /* Checking is path starts with ``./`` */
+    /* Checking is path starts with ``./``, all separators after it are redundant */
     if (path_str[0] == '.' && path_str[1] == PATH_SEPARATOR) {
-        path_str_shift_left(path_str, 2);
-        len_path_str -= 2;
-        root_dir_slash = 0;
-    }
-
-    for (size_t i = 0; i < len_path_str; i++, num_slash_prefix++) {
-        /* Break as soon as the first non path separator is found. */
-        if (path_str[i] != PATH_SEPARATOR) {
-            break;
+        for (num_prefix = 2; path_str[num_prefix] == PATH_SEPARATOR; num_prefix++) {
+        }
+    } else {
+        /* Keep one separator for the root directory */
+        for (; path_str[num_prefix + 1] == PATH_SEPARATOR; num_prefix++) {
+        }
+        if (path_str[0] != PATH_SEPARATOR) {
+            num_prefix = 0;
         }
     }
 
-    if (num_slash_prefix) {
-        path_str_shift_left(path_str, num_slash_prefix - root_dir_slash);
+    if (num_prefix) {
+        memmove(path_str, path_str + num_prefix, len_path_str - num_prefix + 1);
     }
 }
 
@@ -96,30 +155,21 @@ path_remove_prefix(char *path_str) {
  */
 void
 path_remove_suffix(char *path_str) {
-    size_t num_slash_suffix = 0;
     size_t len_path_str = strlen(path_str);
 
-    if (len_path_str < 2) {
-        return;
+    while (len_path_str > 1 && path_str[len_path_str - 1] == PATH_SEPARATOR) {
+        len_path_str--;
     }
-
-    for (ssize_t i = (ssize_t)len_path_str - 1; i > -1; i--, num_slash_suffix++) {
-        if (path_str[i] != PATH_SEPARATOR) {
-            break;
-        }
-    }
-
-    puts(path_str);
-    printf("%zu %zu\n", len_path_str, num_slash_suffix);
-    path_str[len_path_str - num_slash_suffix] = '\0';
+    path_str[len_path_str] = '\0';
 }
 
 /**
  * Join multiple paths into a single path.
  *
+ * :param path_buf: Buffer of ``BUF_SIZE_FS_PATH`` bytes holding the head of the path,
+ *     the paths are appended to it.
  * :param num_paths: Number of paths to join.
- * :param ...: Variable number of paths to join.
- * :return: Joined path string. It must be freed by the caller.
+ * :param ...: Variable number of paths to join, they are not modified.
  *
  * .. note:: Recommended to use ``FS_PATH_JOIN(...)` instead of this function.
  */
@@ -127,28 +177,30 @@ void
 path_join(char *path_buf, size_t num_paths, ...) {
     va_list args;
     size_t path_len = strlen(path_buf);
+    size_t len_fs_name;
     char *fs_name;
 
     va_start(args, num_paths);
-    for (size_t i = 0; i < num_paths && path_len < BUF_SIZE_FS_PATH; i++) {
+    for (size_t i = 0; i < num_paths; i++) {
         fs_name = va_arg(args, char *);
-        path_remove_prefix(fs_name);
-        path_remove_suffix(fs_name);
+        len_fs_name = strlen(fs_name);
+
+        if (path_len + len_fs_name + 1 >= BUF_SIZE_FS_PATH) {
+            DBG_ERR("Path is longer than %d bytes, truncated at %s", BUF_SIZE_FS_PATH,
+                    fs_name);
+            break;
+        }
 
         if (path_len) {
             path_buf[path_len++] = PATH_SEPARATOR;
         }
-
-        path_len += strlen(fs_name);
-        strcat(path_buf, fs_name);
+        memcpy(path_buf + path_len, fs_name, len_fs_name);
+        path_len += len_fs_name;
     }
     va_end(args);
-}
 
-/** Clear a path buffer. */
-void
-path_buf_clear(char *path_buf, size_t length) {
-    memset(path_buf, 0, length);
+    path_buf[path_len] = '\0';
+    path_normalise(path_buf, path_len);
 }
 
 void
@@ -159,35 +211,36 @@ path_buf_clear_copy(char *path_dest, size_t dest_length, char *path_to_copy,
 }
 
 /**
- * Split a path string into a list of path components.
+ * Split a path string into its components without copying them.
  * For example: ``/this/is/a/path`` to ``["this", "is", "a", "path"]``
  *
- * :param path_str:  NULL terminated string representing a path. The path can be
- * absolute or relative. :param length: Length of the path string. :return: List of
- * path components. It must be freed by the caller.
+ * :param path_str: String representing a path. The path can be absolute or relative.
+ * :param length: Length of the path string.
+ * :param views: [OUT] Array to store the components in.
+ * :param max_views: Number of components ``views`` can hold.
+ * :return: Number of components in the path, which can be more than ``max_views``,
+ *     in which case only the first ``max_views`` are stored.
  */
-ListT *
-path_split(const char *path_str, size_t length) {
-    ListT *path_list = List_new(0, sizeof(char *));
-    char *path_buf = DBG_CALLOC(BUF_SIZE_FS_NAME, sizeof *path_buf);
-    size_t path_buf_len = 0;
-
-    for (size_t i = 0; i < length; i++) {
-        if (path_str[i] != PATH_SEPARATOR) {
-            path_buf[path_buf_len++] = path_str[i];
-            continue;
+size_t
+path_split(const char *path_str, size_t length, PathViewT *views, size_t max_views) {
+    size_t num_views = 0, start;
+
+    for (size_t i = 0; i < length;) {
+        for (; i < length && path_str[i] == PATH_SEPARATOR; i++) {
+        }
+        for (start = i; i < length && path_str[i] != PATH_SEPARATOR; i++) {
+        }
+
+        if (i == start) {
+            break;
         }
-        path_buf[path_buf_len] = '\0';
-        DBG_INFO("Splitting: %s, Len: %zu", path_buf, path_buf_len);
-        List_push(path_list, path_buf, path_buf_len + 1);
-        path_buf_clear(path_buf, BUF_SIZE_FS_NAME);
-        path_buf_len = 0;
+        if (num_views < max_views) {
+            views[num_views] = (PathViewT){start, i - start};
+        }
+        num_views++;
     }
-    path_buf[path_buf_len] = '\0';
-    List_push(path_list, path_buf, path_buf_len + 1);
-    free(path_buf);
 
-    return path_list;
+    return num_views;
 }
 
 /**
@@ -200,10 +253,8 @@ path_split(const char *path_str, size_t length) {
  */
 bool
 path_is_dotted(const char *path_str, size_t length) {
-    if (length > 2) {
-        return false;
-    }
-    return !strcmp(path_str, ".") || !strcmp(path_str, "..");
+    return (length == 1 && path_str[0] == '.') ||
+           (length == 2 && path_str[0] == '.' && path_str[1] == '.');
 }
 
 /**
@@ -224,131 +275,383 @@ path_is_hidden(const char *path_str, size_t length) {
 }
 
 /**
- * Replace the head (grandparent) of a path with a new head.
- * For example: ``/this/is/a/path`` to ``/new/head/is/a/path``
+ * Create a new ``DirCacheT``.
  *
- * :param path_str:  NULL terminated string representing a path. The path can be
- * absolute or relative. :param length: Length of the path string. :param grandparent:
- * New head of the path.
+ * :return: The cache. It must be freed with ``DirCache_free``.
  */
-void
-path_replace_grandparent(char *path_str, char *grandparent) {
-    size_t slash_index = 0;
-    char *replaced_head = path_str;
-    size_t len_path_str = strlen(path_str);
+DirCacheT *
+DirCache_new(void) {
+    DirCacheT *self = DBG_MALLOC(sizeof *self);
 
-    if (len_path_str < 3) {
-        return;
+    self->known_dirs = StrSet_new(STR_SET_MIN_CAPACITY);
+    pthread_mutex_init(&self->lock, NULL);
+
+    return self;
+}
+
+/** Check if a directory is known to exist, the cache may be shared by threads. */
+static bool
+DirCache_contains(DirCacheT *self, const char *path_str, size_t length) {
+    bool result;
+
+    pthread_mutex_lock(&self->lock);
+    result = StrSet_contains(self->known_dirs, path_str, length);
+    pthread_mutex_unlock(&self->lock);
+
+    return result;
+}
+
+static void
+DirCache_add(DirCacheT *self, const char *path_str, size_t length) {
+    pthread_mutex_lock(&self->lock);
+    StrSet_add(self->known_dirs, path_str, length);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * Create a local directory and all of its parents.
+ *
+ * Only the components below the deepest directory known to exist are created. The
+ * known directory is opened once and every missing component is created with
+ * ``mkdirat`` and opened with ``openat`` relative to its parent, so no path is
+ * resolved more than once. Created and existing directories are remembered.
+ *
+ * .. note:: Concurrent calls are safe, a directory created by another thread in
+ *    the meantime is simply found to exist.
+ *
+ * :param path_str: Path of the directory.
+ * :param length: Length of ``path_str``.
+ * :return: True if the directory exists once done, False otherwise.
+ */
+bool
+DirCache_mkdir_parents(DirCacheT *self, const char *path_str, size_t length) {
+    PathBufT *path = PathBuf_new(NULL);
+    size_t start, stop;
+    int dir_fd, next_fd;
+    bool result = true;
+
+    PathBuf_set(path, path_str, length);
+    start = path->length;
+
+    /* Find the deepest directory known to exist, searching from the leaf up */
+    while (start && !DirCache_contains(self, path->str, start)) {
+        for (start--; start && path->str[start] != PATH_SEPARATOR; start--) {
+        }
+    }
+
+    if (start == path->length) {
+        PathBuf_free(path);
+        return true;
     }
 
-    for (; slash_index < len_path_str; slash_index++) {
-        if (path_str[slash_index] == PATH_SEPARATOR) {
+    if (start) {
+        path->str[start] = '\0';
+        dir_fd = open(path->str, DIR_CACHE_OPEN_FLAGS);
+        path->str[start] = PATH_SEPARATOR;
+    } else if (path->str[0] == PATH_SEPARATOR) {
+        dir_fd = open("/", DIR_CACHE_OPEN_FLAGS);
+    } else {
+        dir_fd = AT_FDCWD;
+    }
+
+    for (; start < path->length && dir_fd != -1; start = stop) {
+        for (; path->str[start] == PATH_SEPARATOR; start++) {
+        }
+        for (stop = start; stop < path->length && path->str[stop] != PATH_SEPARATOR;
+             stop++) {
+        }
+
+        path->str[stop] = '\0';
+        if (mkdirat(dir_fd, path->str + start, FS_CREATE_PERM) && errno != EEXIST) {
+            DBG_ERR("Couldn't create directory %s: %s", path->str, strerror(errno));
+            result = false;
+            break;
+        }
+
+        next_fd = openat(dir_fd, path->str + start, DIR_CACHE_OPEN_FLAGS);
+        if (next_fd == -1) {
+            DBG_ERR("Couldn't open directory %s: %s", path->str, strerror(errno));
+            result = false;
             break;
         }
+
+        DirCache_add(self, path->str, stop);
+        path->str[stop] = stop < path->length ? PATH_SEPARATOR : '\0';
+
+        if (dir_fd != AT_FDCWD) {
+            close(dir_fd);
+        }
+        dir_fd = next_fd;
     }
 
-    if (slash_index == len_path_str) {
-        return;
+    if (dir_fd == -1) {
+        DBG_ERR("Couldn't open parent of %s: %s", path->str, strerror(errno));
+        result = false;
+    } else if (dir_fd != AT_FDCWD) {
+        close(dir_fd);
     }
 
-    path_str_shift_left(replaced_head, slash_index + 1);
-    path_buf_clear(path_str, strlen(path_str));
-    FS_JOIN_PATH(path_str, grandparent, replaced_head);
-    DBG_SAFE_FREE(replaced_head);
+    PathBuf_free(path);
+    return result;
 }
 
+/** Free a ``DirCacheT`` and all of the directories it remembers. */
 void
-path_replace(char *path_str, char *path_head_to_replace, char *path_head_replacement,
-             size_t max_count) {
-    size_t len_path_head_to_replace;
-    size_t len_path_head_replacement;
-    size_t remaining_len;
-    char *occurrence;
-
-    // path_remove_prefix(path_head_to_replace);
-    // path_remove_prefix(path_head_replacement);
-    // path_remove_suffix(path_head_to_replace);
-    // path_remove_suffix(path_head_replacement);
-
-    len_path_head_to_replace = strlen(path_head_to_replace);
-    len_path_head_replacement = strlen(path_head_replacement);
-
-    while (max_count--) {
-        /* ``occurrence`` is a reference to first occurrence of ``path_head_to_replace``
-         * in ``path_str``. No need to free ``occurrence`` */
-        occurrence = strstr(path_str, path_head_to_replace);
-        if (occurrence == NULL) {
-            break;
-        }
+DirCache_free(DirCacheT *self) {
+    pthread_mutex_destroy(&self->lock);
+    StrSet_free(self->known_dirs);
+    DBG_SAFE_FREE(self);
+}
 
-        remaining_len = strlen(occurrence + len_path_head_to_replace);
-        memmove(occurrence + len_path_head_replacement + 1,
-                occurrence + len_path_head_to_replace, remaining_len + 1);
-        occurrence[len_path_head_replacement] = PATH_SEPARATOR;
-        memcpy(occurrence, path_head_replacement, len_path_head_replacement);
-        path_str = occurrence + len_path_head_replacement + 1;
+/**
+ * Create a new ``PathBufT``.
+ *
+ * :param path_str: NULL terminated path to initialize the buffer with, it is
+ *     normalised. NULL creates an empty path.
+ * :return: The path buffer. It must be freed with ``PathBuf_free``.
+ */
+PathBufT *
+PathBuf_new(const char *path_str) {
+    PathBufT *self = DBG_MALLOC(sizeof *self);
+
+    *self = (PathBufT){.str = DBG_MALLOC(BUF_SIZE_FS_PATH), .length = 0,
+                       .capacity = BUF_SIZE_FS_PATH};
+    self->str[0] = '\0';
+
+    if (path_str != NULL) {
+        PathBuf_set(self, path_str, strlen(path_str));
     }
+
+    return self;
 }
 
-/** Create parent directories of the given path if they don't exist. */
-uint8_t
-path_mkdir_parents(char *path_str, size_t length) {
-    struct stat _dir_stats;
-    int8_t result;
-    char *path_buf;
-    ListT *path_list = path_split(path_str, length);
-    path_buf = List_get(path_list, 0);
+/**
+ * Make sure the buffer can hold a path of ``length`` characters.
+ *
+ * .. note:: Like ``List_realloc`` this only allocates if the buffer is too small and
+ *    over-allocates, so its safe to call it without checking ``self->capacity``.
+ *
+ * :return: False if memory couldn't be allocated, True otherwise.
+ */
+bool
+PathBuf_reserve(PathBufT *self, size_t length) {
+    size_t capacity = self->capacity;
+    char *str;
 
-    for (size_t i = 0; i < path_list->length; i++) {
-        if (i) {
-            FS_JOIN_PATH(path_buf, List_get(path_list, i));
-        }
+    if (length < capacity) {
+        return true;
+    }
 
-        if (stat(path_buf, &_dir_stats) == -1) {
-            /* Directory does not exist */
+    while (capacity <= length) {
+        capacity *= 2;
+    }
 
-            if ((result = mkdir(path_buf, FS_CREATE_PERM))) {
-                DBG_ERR("Couldn't create directory %s: Error code: %d\n", path_buf,
-                        result);
-                return 0;
-            }
-        }
+    str = DBG_REALLOC(self->str, capacity);
+    if (str == NULL) {
+        return false;
+    }
+
+    self->str = str;
+    self->capacity = capacity;
+    return true;
+}
+
+/** Replace the contents of the buffer with a normalised copy of ``path_str``. */
+void
+PathBuf_set(PathBufT *self, const char *path_str, size_t length) {
+    if (!PathBuf_reserve(self, length)) {
+        return;
+    }
+
+    memcpy(self->str, path_str, length);
+    self->str[length] = '\0';
+    self->length = path_normalise(self->str, length);
+}
+
+/**
+ * Append a component to the path, adding a separator if needed.
+ * Separators around ``name`` are ignored, so ``this`` + ``/is/`` is ``this/is``.
+ *
+ * :param name: Component to append, it is not modified.
+ * :param length: Length of ``name``.
+ */
+void
+PathBuf_push(PathBufT *self, const char *name, size_t length) {
+    for (; length && *name == PATH_SEPARATOR; name++, length--) {
+    }
+    for (; length && name[length - 1] == PATH_SEPARATOR; length--) {
+    }
+
+    if (!length || !PathBuf_reserve(self, self->length + length + 1)) {
+        return;
     }
 
-    DBG_SAFE_FREE(path_buf);
-    List_free(path_list);
+    if (self->length && self->str[self->length - 1] != PATH_SEPARATOR) {
+        self->str[self->length++] = PATH_SEPARATOR;
+    }
+    memcpy(self->str + self->length, name, length);
+    self->length += length;
+    self->str[self->length] = '\0';
+}
 
-    return 1;
+/** Shorten the path to ``length`` characters, it is a no-op for longer lengths. */
+void
+PathBuf_truncate(PathBufT *self, size_t length) {
+    if (length < self->length) {
+        self->length = length;
+        self->str[length] = '\0';
+    }
 }
 
-/** Create a new file system object from a path. */
+/** Remove the last component of the path, i.e ``/this/is`` to ``/this``. */
 void
-FileSystem_from_path(FileSystemT *filesystem, char *name, char *path) {
-    path_buf_clear(filesystem->name, strlen(filesystem->name));
-    path_buf_clear(filesystem->relative_path, strlen(filesystem->relative_path));
+PathBuf_pop(PathBufT *self) {
+    size_t length = self->length;
+
+    while (length && self->str[length - 1] != PATH_SEPARATOR) {
+        length--;
+    }
 
-    filesystem->name = strcpy(filesystem->name, name);
-    filesystem->relative_path = strcpy(filesystem->relative_path, path);
+    /* Keep the root directory, drop the separator otherwise */
+    PathBuf_truncate(self, length > 1 ? length - 1 : length);
 }
 
-FileSystemT *
-FileSystem_new(void) {
-    FileSystemT *filesystem = DBG_MALLOC(sizeof *filesystem);
-    filesystem->name = DBG_MALLOC(BUF_SIZE_FS_NAME);
-    filesystem->relative_path = DBG_MALLOC(BUF_SIZE_FS_PATH);
+/** Same as ``path_split`` for a ``PathBufT``. */
+size_t
+PathBuf_split(const PathBufT *self, PathViewT *views, size_t max_views) {
+    return path_split(self->str, self->length, views, max_views);
+}
 
-    return filesystem;
+/**
+ * Replace a component of the path in place.
+ * For example: replacing ``is`` in ``/this/is/a/path`` with ``was`` gives
+ * ``/this/was/a/path``
+ *
+ * :param view: The component to replace, from ``PathBuf_split``.
+ * :param name: Replacement component.
+ * :param length: Length of ``name``.
+ */
+void
+PathBuf_replace_component(PathBufT *self, PathViewT view, const char *name,
+                          size_t length) {
+    size_t len_tail = self->length - view.offset - view.length;
+
+    if (!PathBuf_reserve(self, self->length - view.length + length)) {
+        return;
+    }
+
+    /* The NULL terminator moves along with the tail */
+    memmove(self->str + view.offset + length, self->str + view.offset + view.length,
+            len_tail + 1);
+    memcpy(self->str + view.offset, name, length);
+    self->length = self->length - view.length + length;
 }
 
-FileSystemT *
-FileSystem_duplicate(FileSystemT *self) {
-    FileSystemT *new = DBG_MALLOC(sizeof *new);
+/** Free a ``PathBufT`` and its string. */
+void
+PathBuf_free(PathBufT *self) {
+    DBG_SAFE_FREE(self->str);
+    DBG_SAFE_FREE(self);
+}
 
-    new->name = strdup(self->name);
-    new->relative_path = strdup(self->relative_path);
-    new->type = self->type;
+/**
+ * Create a new ``PathMapT``.
+ *
+ * :param source_root: Root of the paths to map, i.e the directory being copied.
+ * :param dest_root: Root the paths are mapped to, i.e the destination of the copy.
+ * :return: The path map. It must be freed with ``PathMap_free``.
+ */
+PathMapT *
+PathMap_new(const char *source_root, const char *dest_root) {
+    PathMapT *self = DBG_MALLOC(sizeof *self);
+
+    self->source_root = PathBuf_new(source_root);
+    self->dest_path = PathBuf_new(dest_root);
+    self->len_dest_root = self->dest_path->length;
+
+    return self;
+}
 
-    return new;
+/**
+ * Map a path under the source root to the destination root.
+ * For example: with the roots ``src`` and ``/tmp/dest``, ``src/this/is`` is mapped to
+ * ``/tmp/dest/this/is``
+ *
+ * The destination is the destination root followed by the part of ``source_path``
+ * after the source root, no matter what the rest of the path contains.
+ *
+ * :param source_path: Path starting with the source root, like the
+ *     ``relative_path`` of the entries read from it.
+ * :param length: Length of ``source_path``.
+ * :return: The mapped path, it is owned by the map and only valid until the next
+ *     call. NULL if ``source_path`` is not under the source root.
+ */
+char *
+PathMap_apply(PathMapT *self, const char *source_path, size_t length) {
+    const PathBufT *root = self->source_root;
+
+    if (length < root->length || memcmp(source_path, root->str, root->length) ||
+        (length > root->length && source_path[root->length] != PATH_SEPARATOR &&
+         root->str[root->length - 1] != PATH_SEPARATOR)) {
+        DBG_ERR("Path %s is not under %s", source_path, root->str);
+        return NULL;
+    }
+
+    PathBuf_truncate(self->dest_path, self->len_dest_root);
+    PathBuf_push(self->dest_path, source_path + root->length, length - root->length);
+
+    return self->dest_path->str;
+}
+
+/**
+ * Get the part of a path under the source root after the root, without copying.
+ * For example: with the source root ``src``, ``src/this/is`` gives ``this/is``
+ *
+ * .. note:: ``source_path`` must start with the source root, see ``PathMap_apply``.
+ */
+const char *
+PathMap_relative(const PathMapT *self, const char *source_path) {
+    source_path += self->source_root->length;
+
+    for (; *source_path == PATH_SEPARATOR; source_path++) {
+    }
+
+    return source_path;
+}
+
+/** Free a ``PathMapT`` and both of its paths. */
+void
+PathMap_free(PathMapT *self) {
+    PathBuf_free(self->source_root);
+    PathBuf_free(self->dest_path);
+    DBG_SAFE_FREE(self);
+}
+
+/**
+ * Append a new ``FileSystemT`` to a list.
+ *
+ * :param self: ``ListT`` of ``FileSystemT``.
+ * :param name: Name of the object.
+ * :param len_name: Length of ``name``.
+ * :param path: Path of the object.
+ * :param type: Type of the object.
+ * :return: The appended object, owned by the list.
+ */
+static FileSystemT *
+FileSystem_list_push_new(ListT *self, const char *name, size_t len_name,
+                         const PathBufT *path, FileTypesT type) {
+    FileSystemT *filesystem = DBG_CALLOC(1, sizeof *filesystem);
+
+    filesystem->name = DBG_MALLOC(len_name + 1);
+    memcpy(filesystem->name, name, len_name + 1);
+    filesystem->relative_path = DBG_MALLOC(path->length + 1);
+    memcpy(filesystem->relative_path, path->str, path->length + 1);
+    filesystem->type = type;
+
+    List_realloc(self, self->length + 1);
+    self->list[self->length++] = filesystem;
+
+    return filesystem;
 }
 
 /**
@@ -369,25 +672,11 @@ FileSystem_list_free(ListT *self) {
         FileSystem_free(List_get(self, i));
     }
 
-    DBG_SAFE_FREE(self);
-}
-
-void
-FileSystem_copy(FileSystemT *self, FileSystemT *dest) {
-    strcpy(dest->name, self->name);
-    strcpy(dest->relative_path, self->relative_path);
-    DBG_INFO("Self type: %d", self->type);
-    dest->type = self->type;
-}
-
-void
-FileSystem_list_push(ListT *self, FileSystemT *fs) {
-    List_realloc(self, self->length + 1);
-    self->list[self->length++] = FileSystem_duplicate(fs);
+    List_free(self);
 }
 
 /**
- * Read the contents of a local directory and return a list of file system objects.
+ * Read the contents of a remote directory and return a list of file system objects.
  *
  * :param path: Path to the directory.
  * :return: List of file system objects.
@@ -395,11 +684,12 @@ FileSystem_list_push(ListT *self, FileSystemT *fs) {
 ListT *
 path_read_remote_dir(ssh_session session_ssh, sftp_session session_sftp, char *path) {
     sftp_dir dir;
-    uint8_t result;
     sftp_attributes attr;
-    FileSystemT *filesystem = FileSystem_new();
-    char *attr_relative_path = DBG_CALLOC(BUF_SIZE_FS_PATH, sizeof *attr_relative_path);
-    ListT *path_content_list = List_new(1, sizeof(FileSystemT *));
+    FileSystemT *filesystem;
+    FileTypesT type;
+    PathBufT *entry_path;
+    size_t len_dir_path;
+    ListT *path_content_list;
 
     dir = sftp_opendir(session_sftp, path);
     if (dir == NULL) {
@@ -408,81 +698,170 @@ path_read_remote_dir(ssh_session session_ssh, sftp_session session_sftp, char *p
         return NULL;
     }
 
-    while ((attr = sftp_readdir(session_sftp, dir)) != NULL) {
-        FS_JOIN_PATH(attr_relative_path, path, attr->name);
+    entry_path = PathBuf_new(path);
+    len_dir_path = entry_path->length;
+    path_content_list = List_new(1, sizeof(FileSystemT *));
 
+    while ((attr = sftp_readdir(session_sftp, dir)) != NULL) {
         switch (attr->type) {
             case SSH_FILEXFER_TYPE_REGULAR:
-                filesystem->type = FS_REG_FILE;
+                type = FS_REG_FILE;
                 break;
             case SSH_FILEXFER_TYPE_DIRECTORY:
-                filesystem->type = FS_DIRECTORY;
+                type = FS_DIRECTORY;
+                break;
+            case SSH_FILEXFER_TYPE_SYMLINK:
+                type = FS_SYM_LINK;
                 break;
             default:
                 DBG_INFO("Ignoring filetype %d\n", attr->type);
+                sftp_attributes_free(attr);
                 continue;
         }
 
-        FileSystem_from_path(filesystem, attr->name, attr_relative_path);
-        path_buf_clear(attr_relative_path, strlen(attr_relative_path));
-        FileSystem_list_push(path_content_list, filesystem);
+        /* The directory part of the path is reused for every entry */
+        PathBuf_truncate(entry_path, len_dir_path);
+        PathBuf_push(entry_path, attr->name, strlen(attr->name));
+
+        filesystem = FileSystem_list_push_new(path_content_list, attr->name,
+                                              strlen(attr->name), entry_path, type);
+        filesystem->size = attr->size;
+        filesystem->permissions = attr->permissions;
+        filesystem->atime = attr->atime64 ? attr->atime64 : attr->atime;
+        filesystem->mtime = attr->mtime64 ? attr->mtime64 : attr->mtime;
+
+        sftp_attributes_free(attr);
     }
 
-    DBG_SAFE_FREE(attr_relative_path);
-    FileSystem_free(filesystem);
+    PathBuf_free(entry_path);
 
-    result = sftp_closedir(dir);
-    if (result != SSH_FX_OK) {
-        DBG_ERR("Couldn't close directory %s: %s\n", dir->name,
-                ssh_get_error(session_ssh));
-        return NULL;
+    if (sftp_closedir(dir) != SSH_FX_OK) {
+        DBG_ERR("Couldn't close directory %s: %s\n", path, ssh_get_error(session_ssh));
     }
 
     return path_content_list;
 }
 
-ListT *
-path_read_local_dir(char *path) {
-    DIR *dir;
-    uint32_t result;
-    struct dirent *attr;
-    FileSystemT *filesystem = FileSystem_new();
-    char *attr_relative_path = DBG_CALLOC(BUF_SIZE_FS_PATH, sizeof *attr_relative_path);
-    ListT *path_content_list = List_new(1, sizeof(FileSystemT *));
+/** Map a ``d_type`` or a ``st_mode`` to a ``FileTypesT``, 0 for ignored types. */
+static FileTypesT
+local_file_type(unsigned char d_type, mode_t mode) {
+    if (d_type == DT_REG || (d_type == DT_UNKNOWN && S_ISREG(mode))) {
+        return FS_REG_FILE;
+    }
+    if (d_type == DT_DIR || (d_type == DT_UNKNOWN && S_ISDIR(mode))) {
+        return FS_DIRECTORY;
+    }
+    if (d_type == DT_LNK || (d_type == DT_UNKNOWN && S_ISLNK(mode))) {
+        return FS_SYM_LINK;
+    }
+    return 0;
+}
 
-    dir = opendir(path);
-    if (dir == NULL) {
+/**
+ * Append an entry of a local directory to a list of file system objects.
+ *
+ * The entry is only ``fstatat``-ed relative to its directory when its type is
+ * unknown or ``with_stat`` is set, the path is never resolved again.
+ */
+static void
+local_dir_push_entry(ListT *self, int dir_fd, const char *name, unsigned char d_type,
+                     PathBufT *entry_path, size_t len_dir_path, bool with_stat) {
+    FileSystemT *filesystem;
+    FileTypesT type;
+    struct stat entry_stat = {0};
+    size_t len_name = strlen(name);
+
+    if (path_is_dotted(name, len_name)) {
+        return;
+    }
+
+    if ((d_type == DT_UNKNOWN || with_stat) &&
+        fstatat(dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW)) {
+        DBG_ERR("Couldn't stat %s: %s", name, strerror(errno));
+        return;
+    }
+
+    type = local_file_type(d_type, entry_stat.st_mode);
+    if (!type) {
+        DBG_INFO("Ignoring filetype %d\n", d_type);
+        return;
+    }
+
+    /* The directory part of the path is reused for every entry */
+    PathBuf_truncate(entry_path, len_dir_path);
+    PathBuf_push(entry_path, name, len_name);
+    filesystem = FileSystem_list_push_new(self, name, len_name, entry_path, type);
+
+    if (with_stat) {
+        filesystem->size = entry_stat.st_size;
+        filesystem->permissions = entry_stat.st_mode;
+        filesystem->atime = entry_stat.st_atime;
+        filesystem->mtime = entry_stat.st_mtime;
+    }
+}
+
+/**
+ * Read the contents of a local directory and return a list of file system objects.
+ *
+ * The directory is read with ``getdents64`` into a ``BUF_SIZE_DIR_ENTRIES`` buffer,
+ * so even huge directories take a handful of system calls. ``.`` and ``..`` are
+ * left out.
+ *
+ * :param path: Path to the directory.
+ * :param with_stat: Fill in the size, permissions and times of every entry.
+ * :return: List of file system objects.
+ */
+ListT *
+path_read_local_dir(char *path, bool with_stat) {
+    int dir_fd;
+    PathBufT *entry_path;
+    size_t len_dir_path;
+    ListT *path_content_list;
+
+    dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
         DBG_ERR("Couldn't open local directory `%s`", path);
         return NULL;
     }
 
-    while ((attr = readdir(dir)) != NULL) {
-        FS_JOIN_PATH(attr_relative_path, path, attr->d_name);
+    entry_path = PathBuf_new(path);
+    len_dir_path = entry_path->length;
+    path_content_list = List_new(1, sizeof(FileSystemT *));
 
-        switch (attr->d_type) {
-            case DT_REG:
-                filesystem->type = FS_REG_FILE;
-                break;
-            case DT_DIR:
-                filesystem->type = FS_DIRECTORY;
-                break;
-            default:
-                DBG_INFO("Ignoring filetype %d\n", attr->d_type);
-                continue;
+#ifdef SYS_getdents64
+    char *buf = DBG_MALLOC(BUF_SIZE_DIR_ENTRIES);
+    long num_bytes;
+
+    while ((num_bytes = syscall(SYS_getdents64, dir_fd, buf, BUF_SIZE_DIR_ENTRIES)) > 0) {
+        for (long offset = 0; offset < num_bytes;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buf + offset);
+
+            local_dir_push_entry(path_content_list, dir_fd, entry->d_name,
+                                 entry->d_type, entry_path, len_dir_path, with_stat);
+            offset += entry->d_reclen;
         }
-        FileSystem_from_path(filesystem, attr->d_name, attr_relative_path);
-        path_buf_clear(attr_relative_path, strlen(attr_relative_path) + 1);
-        FileSystem_list_push(path_content_list, filesystem);
     }
 
-    DBG_SAFE_FREE(attr_relative_path);
-    FileSystem_free(filesystem);
+    if (num_bytes < 0) {
+        DBG_ERR("Couldn't read directory %s: %s", path, strerror(errno));
+    }
+    DBG_SAFE_FREE(buf);
+    close(dir_fd);
+#else
+    DIR *dir = fdopendir(dir_fd);
+    struct dirent *attr;
 
-    result = closedir(dir);
-    if (result) {
+    while (dir != NULL && (attr = readdir(dir)) != NULL) {
+        local_dir_push_entry(path_content_list, dir_fd, attr->d_name, attr->d_type,
+                             entry_path, len_dir_path, with_stat);
+    }
+
+    if (dir == NULL || closedir(dir)) {
         DBG_ERR("Couldn't close directory %s", path);
-        return NULL;
     }
+#endif
+
+    PathBuf_free(entry_path);
 
     return path_content_list;
 }
@@ -0,0 +1,315 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "seft_debug.h"
+#include "seft_list.h"
+#include "seft_sched.h"
+
+#define NS_PER_SECOND 1000000000L
+
+/**
+ * Parse a rate in bytes per second, ``K``, ``M`` and ``G`` suffixes multiply it
+ * by powers of 1024. For example: ``500K`` or ``2.5M``. ``0`` means no limit.
+ *
+ * :param rate: [OUT] Parsed rate, untouched if ``str`` is invalid.
+ * :return: True if ``str`` is a valid rate, False otherwise.
+ */
+bool
+sched_rate_from_str(const char *str, double *rate) {
+    char *end;
+    double value = strtod(str, &end);
+
+    switch (*end) {
+        case 'G':
+        case 'g':
+            value *= 1024;
+            /* fall through */
+        case 'M':
+        case 'm':
+            value *= 1024;
+            /* fall through */
+        case 'K':
+        case 'k':
+            value *= 1024;
+            end++;
+            break;
+    }
+
+    if (end == str || *end != '\0' || !isfinite(value) || value < 0) {
+        return false;
+    }
+
+    *rate = value;
+    return true;
+}
+
+/**
+ * Parse a priority given to ``copy --priority``.
+ *
+ * :param str: One of ``bulk``, ``normal`` or ``high``.
+ * :param priority: [OUT] Parsed priority, untouched if ``str`` is invalid.
+ */
+bool
+sched_priority_from_str(const char *str, SchedPriorityE *priority) {
+    static const char *names[] = {
+        [SCHED_PRIORITY_BULK] = "bulk",
+        [SCHED_PRIORITY_NORMAL] = "normal",
+        [SCHED_PRIORITY_HIGH] = "high",
+    };
+
+    for (size_t i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(str, names[i])) {
+            *priority = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static double
+timespec_diff(const struct timespec *later, const struct timespec *earlier) {
+    return (later->tv_sec - earlier->tv_sec) +
+           (later->tv_nsec - earlier->tv_nsec) / (double)NS_PER_SECOND;
+}
+
+/** Start a bucket empty, so a new limit isn't exceeded by a burst right away. */
+static void
+TokenBucket_init(TokenBucketT *self, double rate) {
+    self->rate = rate;
+    self->tokens = 0;
+    clock_gettime(CLOCK_MONOTONIC, &self->last);
+}
+
+/** Add the tokens earned since the last refill, an idle bucket fills up to a burst. */
+static void
+TokenBucket_refill(TokenBucketT *self, const struct timespec *now) {
+    self->tokens += self->rate * timespec_diff(now, &self->last);
+    if (self->tokens > self->rate * SCHED_BURST_SECONDS) {
+        self->tokens = self->rate * SCHED_BURST_SECONDS;
+    }
+    self->last = *now;
+}
+
+/** Check if a request can be served now, the bucket may go into debt for it. */
+static bool
+TokenBucket_ready(const TokenBucketT *self) {
+    return !self->rate || self->tokens >= 0;
+}
+
+/** Get the seconds until the bucket is ready again. */
+static double
+TokenBucket_delay(const TokenBucketT *self) {
+    return TokenBucket_ready(self) ? 0 : -self->tokens / self->rate;
+}
+
+/** Take tokens from the bucket, a negative count puts them back. */
+static void
+TokenBucket_take(TokenBucketT *self, double num_bytes) {
+    if (self->rate) {
+        self->tokens -= num_bytes;
+    }
+}
+
+/**
+ * Create a new ``SchedulerT``.
+ *
+ * :param global_rate: Limit shared by all flows in bytes per second, 0 for none.
+ * :return: The scheduler. It must be freed with ``Scheduler_free``.
+ */
+SchedulerT *
+Scheduler_new(double global_rate) {
+    SchedulerT *self = DBG_MALLOC(sizeof *self);
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->changed, NULL);
+    TokenBucket_init(&self->global, global_rate);
+    self->flows = List_new(1, sizeof(SchedFlowT *));
+    self->turn = 0;
+
+    return self;
+}
+
+/**
+ * Change a limit while flows are running, waiting flows pick it up immediately.
+ *
+ * :param flow: Flow to limit, NULL for the global limit.
+ * :param rate: Bytes per second, 0 for no limit.
+ */
+void
+Scheduler_set_rate(SchedulerT *self, SchedFlowT *flow, double rate) {
+    pthread_mutex_lock(&self->lock);
+    TokenBucket_init(flow != NULL ? &flow->bucket : &self->global, rate);
+    pthread_cond_broadcast(&self->changed);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/** Pass the turn on to the next flow and give it its quantum. */
+static void
+Scheduler_next_turn(SchedulerT *self) {
+    SchedFlowT *flow;
+
+    if (List_is_empty(self->flows)) {
+        return;
+    }
+
+    self->turn = (self->turn + 1) % List_length(self->flows);
+    flow = List_get(self->flows, self->turn);
+
+    /* Unused quantum doesn't carry over, it would only allow a burst later */
+    flow->deficit = (int64_t)SCHED_QUANTUM * (flow->priority + 1);
+    pthread_cond_broadcast(&self->changed);
+}
+
+/**
+ * Initialise a flow before it is registered.
+ *
+ * :param priority: Priority class of the flow.
+ * :param rate: Limit of the flow in bytes per second, 0 for none. It can be changed
+ *     later with ``Scheduler_set_rate``, even before the flow is registered.
+ */
+void
+SchedFlow_init(SchedFlowT *self, SchedPriorityE priority, double rate) {
+    self->priority = priority;
+    self->deficit = (int64_t)SCHED_QUANTUM * (priority + 1);
+    TokenBucket_init(&self->bucket, rate);
+}
+
+/** Add a flow to the scheduler, it must be unregistered before it goes away. */
+void
+Scheduler_register(SchedulerT *self, SchedFlowT *flow) {
+    pthread_mutex_lock(&self->lock);
+    List_realloc(self->flows, self->flows->length + 1);
+    self->flows->list[self->flows->length++] = flow;
+    pthread_mutex_unlock(&self->lock);
+}
+
+void
+Scheduler_unregister(SchedulerT *self, SchedFlowT *flow) {
+    pthread_mutex_lock(&self->lock);
+
+    for (size_t i = 0; i < List_length(self->flows); i++) {
+        if (List_get(self->flows, i) != flow) {
+            continue;
+        }
+
+        memmove(self->flows->list + i, self->flows->list + i + 1,
+                (self->flows->length - i - 1) * sizeof *self->flows->list);
+        self->flows->length--;
+
+        /* Keep the turn with the same flow, or hand it on if it was this one's */
+        if (i < self->turn) {
+            self->turn--;
+        } else if (i == self->turn && !List_is_empty(self->flows)) {
+            self->turn = (self->turn + List_length(self->flows) - 1) %
+                         List_length(self->flows);
+            Scheduler_next_turn(self);
+        }
+        break;
+    }
+
+    if (self->turn >= List_length(self->flows)) {
+        self->turn = 0;
+    }
+    pthread_cond_broadcast(&self->changed);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * Block until a flow may send ``num_bytes``.
+ *
+ * The flow has to wait for its own bucket and, when a global limit is set, for its
+ * turn and the global bucket. A flow that can't use its turn passes it on.
+ *
+ * :param flow: A registered flow.
+ * :param num_bytes: Size of the chunk about to be sent.
+ * :param cancelled: Stop waiting once it is set, NULL if the wait can't be
+ *     cancelled.
+ * :return: True once the bytes may be sent, False if the wait was cancelled.
+ */
+bool
+Scheduler_acquire(SchedulerT *self, SchedFlowT *flow, size_t num_bytes,
+                  const atomic_bool *cancelled) {
+    struct timespec now, deadline;
+    bool granted = false;
+    double delay;
+
+    pthread_mutex_lock(&self->lock);
+
+    while (cancelled == NULL || !atomic_load(cancelled)) {
+        bool is_turn = List_get(self->flows, self->turn) == flow;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        TokenBucket_refill(&flow->bucket, &now);
+        TokenBucket_refill(&self->global, &now);
+
+        if (!TokenBucket_ready(&flow->bucket)) {
+            /* Don't hold up the others while waiting for our own limit */
+            if (self->global.rate && is_turn) {
+                Scheduler_next_turn(self);
+            }
+            delay = TokenBucket_delay(&flow->bucket);
+        } else if (!self->global.rate) {
+            granted = true;
+            break;
+        } else if (!is_turn) {
+            delay = SCHED_MAX_WAIT_NS / (double)NS_PER_SECOND;
+        } else if (!TokenBucket_ready(&self->global)) {
+            delay = TokenBucket_delay(&self->global);
+        } else {
+            flow->deficit -= num_bytes;
+            if (flow->deficit <= 0) {
+                Scheduler_next_turn(self);
+            }
+            granted = true;
+            break;
+        }
+
+        /* Waits are cut short by limit changes, turns and cancellation checks */
+        if (delay * NS_PER_SECOND > SCHED_MAX_WAIT_NS) {
+            delay = SCHED_MAX_WAIT_NS / (double)NS_PER_SECOND;
+        }
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(delay * NS_PER_SECOND);
+        deadline.tv_sec += deadline.tv_nsec / NS_PER_SECOND;
+        deadline.tv_nsec %= NS_PER_SECOND;
+        pthread_cond_timedwait(&self->changed, &self->lock, &deadline);
+    }
+
+    if (granted) {
+        TokenBucket_take(&flow->bucket, num_bytes);
+        TokenBucket_take(&self->global, num_bytes);
+    }
+
+    pthread_mutex_unlock(&self->lock);
+    return granted;
+}
+
+/**
+ * Give back tokens taken by ``Scheduler_acquire`` that weren't used, i.e when the
+ * last chunk of a file is shorter than the one asked for.
+ */
+void
+Scheduler_refund(SchedulerT *self, SchedFlowT *flow, size_t num_bytes) {
+    pthread_mutex_lock(&self->lock);
+    TokenBucket_take(&flow->bucket, -(double)num_bytes);
+    TokenBucket_take(&self->global, -(double)num_bytes);
+    flow->deficit += num_bytes;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/** Free a ``SchedulerT``, all of its flows must be unregistered. */
+void
+Scheduler_free(SchedulerT *self) {
+    pthread_cond_destroy(&self->changed);
+    pthread_mutex_destroy(&self->lock);
+    List_free(self->flows);
+    DBG_SAFE_FREE(self);
+}
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "seft_debug.h"
+#include "seft_set.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/** Hash ``length`` bytes of a string with 64-bit FNV-1a. */
+uint64_t
+str_hash(const char *str, size_t length) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Create a new ``StrSetT``.
+ *
+ * :param capacity: Expected number of items, the set grows past it as needed.
+ * :return: The set. It must be freed with ``StrSet_free``.
+ */
+StrSetT *
+StrSet_new(size_t capacity) {
+    StrSetT *self = DBG_MALLOC(sizeof *self);
+    size_t num_slots = STR_SET_MIN_CAPACITY;
+
+    /* Keep the load factor at or below half */
+    while (num_slots < 2 * capacity) {
+        num_slots *= 2;
+    }
+
+    *self = (StrSetT){.items = DBG_CALLOC(num_slots, sizeof *self->items),
+                      .hashes = DBG_MALLOC(num_slots * sizeof *self->hashes),
+                      .length = 0,
+                      .capacity = num_slots};
+    return self;
+}
+
+/** Get the slot holding ``str`` or the empty slot it would be stored in. */
+static size_t
+StrSet_find_slot(const StrSetT *self, const char *str, size_t length, uint64_t hash) {
+    size_t mask = self->capacity - 1;
+    size_t slot = hash & mask;
+
+    while (self->items[slot] != NULL) {
+        if (self->hashes[slot] == hash && !strncmp(self->items[slot], str, length) &&
+            self->items[slot][length] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/** Double the number of slots of the set and rehash every item. */
+static bool
+StrSet_grow(StrSetT *self) {
+    size_t capacity = self->capacity * 2;
+    char **items = DBG_CALLOC(capacity, sizeof *items);
+    uint64_t *hashes = DBG_MALLOC(capacity * sizeof *hashes);
+
+    if (items == NULL || hashes == NULL) {
+        DBG_ERR("Couldn't grow set to %zu slots", capacity);
+        free(items);
+        free(hashes);
+        return false;
+    }
+
+    for (size_t i = 0; i < self->capacity; i++) {
+        size_t slot;
+
+        if (self->items[i] == NULL) {
+            continue;
+        }
+
+        /* Items are unique, so only an empty slot has to be found */
+        for (slot = self->hashes[i] & (capacity - 1); items[slot] != NULL;
+             slot = (slot + 1) & (capacity - 1)) {
+        }
+        items[slot] = self->items[i];
+        hashes[slot] = self->hashes[i];
+    }
+
+    DBG_SAFE_FREE(self->items);
+    DBG_SAFE_FREE(self->hashes);
+    self->items = items;
+    self->hashes = hashes;
+    self->capacity = capacity;
+    return true;
+}
+
+/**
+ * Check if a string is in the set.
+ *
+ * :param str: String to look for, it need not be NULL terminated.
+ * :param length: Length of ``str``.
+ */
+bool
+StrSet_contains(const StrSetT *self, const char *str, size_t length) {
+    uint64_t hash = str_hash(str, length);
+
+    return self->items[StrSet_find_slot(self, str, length, hash)] != NULL;
+}
+
+/**
+ * Add a copy of a string to the set.
+ *
+ * :param str: String to add, it need not be NULL terminated.
+ * :param length: Length of ``str``.
+ * :return: True if the string was added, False if it already was in the set or
+ *     memory couldn't be allocated.
+ */
+bool
+StrSet_add(StrSetT *self, const char *str, size_t length) {
+    uint64_t hash = str_hash(str, length);
+    size_t slot = StrSet_find_slot(self, str, length, hash);
+    char *item;
+
+    if (self->items[slot] != NULL) {
+        return false;
+    }
+
+    if (2 * (self->length + 1) > self->capacity) {
+        if (!StrSet_grow(self)) {
+            return false;
+        }
+        slot = StrSet_find_slot(self, str, length, hash);
+    }
+
+    item = DBG_MALLOC(length + 1);
+    if (item == NULL) {
+        return false;
+    }
+    memcpy(item, str, length);
+    item[length] = '\0';
+
+    self->items[slot] = item;
+    self->hashes[slot] = hash;
+    self->length++;
+    return true;
+}
+
+/** Free a ``StrSetT`` and all of its items. */
+void
+StrSet_free(StrSetT *self) {
+    for (size_t i = 0; i < self->capacity; i++) {
+        if (self->items[i] != NULL) {
+            DBG_SAFE_FREE(self->items[i]);
+        }
+    }
+
+    DBG_SAFE_FREE(self->items);
+    DBG_SAFE_FREE(self->hashes);
+    DBG_SAFE_FREE(self);
+}
@@ -0,0 +1,403 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libssh/sftp.h>
+
+#include "seft_debug.h"
+#include "seft_list.h"
+#include "seft_sort.h"
+
+/** A slice of the key array handled by one thread of a parallel sort. */
+typedef struct {
+    SortKeyT *keys;
+
+    /** Scratch space of the same length as ``keys`` used while merging */
+    SortKeyT *buf;
+
+    /** [INCLUSIVE] Start of the slice */
+    size_t start;
+
+    /** End of the left half of the slice when merging */
+    size_t middle;
+
+    /** [EXCLUSIVE] End of the slice */
+    size_t stop;
+
+    SortCompareT compare;
+} SortTaskT;
+
+/**
+ * Parse a field name given to ``list --sort``.
+ *
+ * :param str: One of ``name``, ``natural``, ``size``, ``mtime``, ``type``.
+ *     ``NULL`` selects ``name``.
+ * :param field: [OUT] Parsed field, untouched if ``str`` is invalid.
+ * :return: True if ``str`` names a field, False otherwise.
+ */
+bool
+sort_field_from_str(const char *str, SortFieldE *field) {
+    static const char *names[] = {
+        [SORT_BY_NAME] = "name",   [SORT_BY_NATURAL] = "natural",
+        [SORT_BY_SIZE] = "size",   [SORT_BY_MTIME] = "mtime",
+        [SORT_BY_TYPE] = "type",
+    };
+
+    if (str == NULL) {
+        *field = SORT_BY_NAME;
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(str, names[i])) {
+            *field = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Compare two strings treating runs of digits as numbers.
+ * For example: ``file2`` < ``file10`` and ``v1.9`` < ``v1.10``
+ *
+ * .. note:: Leading zeros are ignored when comparing numbers, if two numbers are
+ *    equal the one with fewer leading zeros comes first.
+ */
+int
+str_natural_compare(const char *str, const char *other) {
+    const unsigned char *a = (const unsigned char *)str;
+    const unsigned char *b = (const unsigned char *)other;
+
+    while (*a && *b) {
+        if (isdigit(*a) && isdigit(*b)) {
+            const unsigned char *start_a, *start_b;
+            size_t len_a, len_b, zeros_a = 0, zeros_b = 0;
+
+            for (; *a == '0'; a++, zeros_a++) {
+            }
+            for (; *b == '0'; b++, zeros_b++) {
+            }
+            for (start_a = a; isdigit(*a); a++) {
+            }
+            for (start_b = b; isdigit(*b); b++) {
+            }
+
+            len_a = a - start_a;
+            len_b = b - start_b;
+            if (len_a != len_b) {
+                return len_a < len_b ? -1 : 1;
+            }
+
+            /* Same number of significant digits, the first differing digit decides */
+            for (size_t i = 0; i < len_a; i++) {
+                if (start_a[i] != start_b[i]) {
+                    return start_a[i] < start_b[i] ? -1 : 1;
+                }
+            }
+
+            if (zeros_a != zeros_b) {
+                return zeros_a < zeros_b ? -1 : 1;
+            }
+            continue;
+        }
+
+        if (*a != *b) {
+            return *a < *b ? -1 : 1;
+        }
+        a++;
+        b++;
+    }
+
+    return (*a > *b) - (*a < *b);
+}
+
+static int
+compare_name(const void *self, const void *other) {
+    return strcoll(((const SortKeyT *)self)->name, ((const SortKeyT *)other)->name);
+}
+
+static int
+compare_natural(const void *self, const void *other) {
+    return str_natural_compare(((const SortKeyT *)self)->name,
+                               ((const SortKeyT *)other)->name);
+}
+
+/** Smaller keys first, ties are ordered by name */
+static int
+compare_key(const void *self, const void *other) {
+    const SortKeyT *a = self, *b = other;
+
+    if (a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    }
+    return strcoll(a->name, b->name);
+}
+
+/** Get the comparator used to sort keys built for ``field``. */
+SortCompareT
+sort_get_compare(SortFieldE field) {
+    switch (field) {
+        case SORT_BY_NATURAL:
+            return compare_natural;
+        case SORT_BY_SIZE:
+        case SORT_BY_MTIME:
+        case SORT_BY_TYPE:
+            return compare_key;
+        case SORT_BY_NAME:
+        default:
+            return compare_name;
+    }
+}
+
+static void *
+sort_task_sort(void *arg) {
+    SortTaskT *task = arg;
+
+    qsort(task->keys + task->start, task->stop - task->start, sizeof *task->keys,
+          task->compare);
+    return NULL;
+}
+
+/** Merge the sorted halves ``[start, middle)`` and ``[middle, stop)`` of a task. */
+static void *
+sort_task_merge(void *arg) {
+    SortTaskT *task = arg;
+    size_t i = task->start, j = task->middle, k = task->start;
+
+    while (i < task->middle && j < task->stop) {
+        /* Taking from the left half on ties keeps the merge stable */
+        if (task->compare(&task->keys[j], &task->keys[i]) < 0) {
+            task->buf[k++] = task->keys[j++];
+        } else {
+            task->buf[k++] = task->keys[i++];
+        }
+    }
+    memcpy(task->buf + k, task->keys + i, (task->middle - i) * sizeof *task->keys);
+    k += task->middle - i;
+    memcpy(task->buf + k, task->keys + j, (task->stop - j) * sizeof *task->keys);
+
+    memcpy(task->keys + task->start, task->buf + task->start,
+           (task->stop - task->start) * sizeof *task->keys);
+    return NULL;
+}
+
+/** Run ``routine`` for every task on its own thread and wait for all of them. */
+static void
+sort_run_tasks(SortTaskT *tasks, size_t num_tasks, void *(*routine)(void *)) {
+    pthread_t threads[SORT_MAX_THREADS];
+    bool started[SORT_MAX_THREADS] = {0};
+
+    for (size_t i = 0; i < num_tasks; i++) {
+        started[i] = !pthread_create(&threads[i], NULL, routine, &tasks[i]);
+
+        /* Couldn't spawn a thread, do the work on this one instead */
+        if (!started[i]) {
+            routine(&tasks[i]);
+        }
+    }
+
+    for (size_t i = 0; i < num_tasks; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+/**
+ * Sort keys by their numeric ``key`` with a least significant digit radix sort and
+ * order runs of equal keys with ``compare``.
+ *
+ * .. note:: Passes over a byte that is equal for every key are skipped, so 32-bit
+ *    timestamps only take four passes.
+ */
+static void
+sort_keys_radix(SortKeyT *keys, size_t length, SortCompareT compare) {
+    size_t counts[256];
+    SortKeyT *from = keys, *to, *swap;
+    SortKeyT *buf = DBG_MALLOC(length * sizeof *buf);
+
+    if (buf == NULL) {
+        qsort(keys, length, sizeof *keys, compare);
+        return;
+    }
+
+    to = buf;
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        size_t offset = 0;
+
+        memset(counts, 0, sizeof counts);
+        for (size_t i = 0; i < length; i++) {
+            counts[(from[i].key >> shift) & 0xff]++;
+        }
+
+        if (counts[(from[0].key >> shift) & 0xff] == length) {
+            continue;
+        }
+
+        for (size_t i = 0; i < 256; i++) {
+            size_t count = counts[i];
+            counts[i] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < length; i++) {
+            to[counts[(from[i].key >> shift) & 0xff]++] = from[i];
+        }
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != keys) {
+        memcpy(keys, from, length * sizeof *keys);
+    }
+    DBG_SAFE_FREE(buf);
+
+    for (size_t start = 0, stop; start < length; start = stop) {
+        for (stop = start + 1; stop < length && keys[stop].key == keys[start].key;
+             stop++) {
+        }
+        if (stop - start > 1) {
+            qsort(keys + start, stop - start, sizeof *keys, compare);
+        }
+    }
+}
+
+/** Get the number of threads to sort with, always a power of two. */
+static size_t
+sort_num_threads(void) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = 1;
+
+    while (num_threads * 2 <= SORT_MAX_THREADS && (long)num_threads * 2 <= num_cpus) {
+        num_threads *= 2;
+    }
+
+    return num_threads;
+}
+
+/**
+ * Sort an array of keys.
+ *
+ * Numeric keys are radix sorted. Otherwise arrays shorter than
+ * ``SORT_PARALLEL_THRESHOLD`` are sorted with ``qsort``, longer ones are split into
+ * one slice per thread, the slices are sorted concurrently and then merged pairwise,
+ * with all merges of a level running concurrently.
+ *
+ * :param keys: Keys to sort.
+ * :param length: Number of keys.
+ * :param compare: Comparator from ``sort_get_compare``.
+ */
+void
+sort_keys(SortKeyT *keys, size_t length, SortCompareT compare) {
+    SortTaskT tasks[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    size_t num_threads = sort_num_threads();
+    SortKeyT *buf;
+
+    if (compare == compare_key && length > 1) {
+        sort_keys_radix(keys, length, compare);
+        return;
+    }
+
+    if (length < SORT_PARALLEL_THRESHOLD || num_threads < 2 ||
+        (buf = DBG_MALLOC(length * sizeof *buf)) == NULL) {
+        qsort(keys, length, sizeof *keys, compare);
+        return;
+    }
+
+    for (size_t i = 0; i <= num_threads; i++) {
+        bounds[i] = length * i / num_threads;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        tasks[i] = (SortTaskT){keys, buf, bounds[i], bounds[i], bounds[i + 1], compare};
+    }
+    sort_run_tasks(tasks, num_threads, sort_task_sort);
+
+    for (size_t width = 1; width < num_threads; width *= 2) {
+        size_t num_tasks = 0;
+
+        for (size_t i = 0; i < num_threads; i += 2 * width) {
+            tasks[num_tasks++] = (SortTaskT){keys,          buf,
+                                             bounds[i],     bounds[i + width],
+                                             bounds[i + 2 * width], compare};
+        }
+        sort_run_tasks(tasks, num_tasks, sort_task_merge);
+    }
+
+    DBG_SAFE_FREE(buf);
+}
+
+/** Map an sftp file type to its position in a ``SORT_BY_TYPE`` listing. */
+static uint64_t
+sort_type_rank(uint8_t type) {
+    switch (type) {
+        case SSH_FILEXFER_TYPE_DIRECTORY:
+            return 0;
+        case SSH_FILEXFER_TYPE_SYMLINK:
+            return 1;
+        case SSH_FILEXFER_TYPE_REGULAR:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+/**
+ * Sort a ``ListT`` of ``sftp_attributes`` in place.
+ *
+ * The attributes themselves are never compared, a compact key is built for each
+ * entry, the keys are sorted and the list is permuted to match.
+ *
+ * :param attributes: List of ``sftp_attributes``.
+ * :param field: Field to sort by.
+ * :param reverse: Reverse the resultant order.
+ */
+void
+sort_attributes(ListT *attributes, SortFieldE field, bool reverse) {
+    size_t length = List_length(attributes);
+    SortKeyT *keys;
+    void **sorted;
+
+    if (length < 2) {
+        return;
+    }
+
+    keys = DBG_MALLOC(length * sizeof *keys);
+    sorted = DBG_MALLOC(length * sizeof *sorted);
+    if (keys == NULL || sorted == NULL) {
+        free(keys);
+        free(sorted);
+        return;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        sftp_attributes attr = List_get(attributes, i);
+
+        /* Largest and newest come first, so those keys are inverted */
+        keys[i] = (SortKeyT){0, attr->name, i};
+        if (field == SORT_BY_SIZE) {
+            keys[i].key = UINT64_MAX - attr->size;
+        } else if (field == SORT_BY_MTIME) {
+            keys[i].key = UINT64_MAX - (attr->mtime64 ? attr->mtime64 : attr->mtime);
+        } else if (field == SORT_BY_TYPE) {
+            keys[i].key = sort_type_rank(attr->type);
+        }
+    }
+
+    sort_keys(keys, length, sort_get_compare(field));
+
+    for (size_t i = 0; i < length; i++) {
+        sorted[reverse ? length - i - 1 : i] = attributes->list[keys[i].index];
+    }
+    memcpy(attributes->list, sorted, length * sizeof *sorted);
+
+    DBG_SAFE_FREE(keys);
+    DBG_SAFE_FREE(sorted);
+}
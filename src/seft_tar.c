@@ -0,0 +1,350 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seft_debug.h"
+#include "seft_tar.h"
+
+/** Offsets and lengths of the fields of a header */
+#define TAR_OFF_NAME 0
+#define TAR_OFF_MODE 100
+#define TAR_OFF_UID 108
+#define TAR_OFF_GID 116
+#define TAR_OFF_SIZE 124
+#define TAR_OFF_MTIME 136
+#define TAR_OFF_CHECKSUM 148
+#define TAR_OFF_TYPE 156
+#define TAR_OFF_LINK 157
+#define TAR_OFF_MAGIC 257
+#define TAR_OFF_PREFIX 345
+
+#define TAR_LEN_MODE 8
+#define TAR_LEN_NUMBER 12
+#define TAR_LEN_CHECKSUM 8
+#define TAR_LEN_PREFIX 155
+
+/** Magic and version of GNU headers, the ones long names work with everywhere */
+#define TAR_MAGIC_GNU "ustar  "
+
+/** Magic of POSIX headers, they can split long names into a prefix */
+#define TAR_MAGIC_USTAR "ustar"
+
+/** Name of the entries that carry long names and link targets */
+#define TAR_LONG_LINK_NAME "././@LongLink"
+
+/** Longest name or link target read from an entry of its own */
+#define TAR_MAX_LONG_NAME 65536
+
+/**
+ * Write a number as a NUL terminated octal string filling a field, numbers too big
+ * for it are stored as big endian binary, after a byte with the high bit set.
+ */
+static void
+tar_put_number(char *field, size_t length, uint64_t value) {
+    if (length < 2 || value >> (3 * (length - 1)) == 0) {
+        field[length - 1] = '\0';
+        for (size_t i = length - 1; i-- > 0; value >>= 3) {
+            field[i] = '0' + (value & 7);
+        }
+        return;
+    }
+
+    for (size_t i = length; i-- > 1; value >>= 8) {
+        field[i] = value & 0xff;
+    }
+    field[0] = (char)0x80;
+}
+
+/** Read a number written by ``tar_put_number``, octal fields may be space padded */
+static uint64_t
+tar_get_number(const char *field, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)field;
+    uint64_t value = 0;
+    size_t i = 0;
+
+    if (bytes[0] & 0x80) {
+        for (i = 1; i < length; i++) {
+            value = value << 8 | bytes[i];
+        }
+        return value;
+    }
+
+    for (; i < length && bytes[i] == ' '; i++) {
+    }
+    for (; i < length && bytes[i] >= '0' && bytes[i] <= '7'; i++) {
+        value = value << 3 | (bytes[i] - '0');
+    }
+    return value;
+}
+
+/** Sum of the bytes of a header, with the checksum field counted as spaces. */
+static uint32_t
+tar_checksum(const char *header) {
+    const unsigned char *bytes = (const unsigned char *)header;
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        bool is_checksum = i >= TAR_OFF_CHECKSUM &&
+                           i < TAR_OFF_CHECKSUM + TAR_LEN_CHECKSUM;
+
+        sum += is_checksum ? ' ' : bytes[i];
+    }
+    return sum;
+}
+
+/** Write one header block. */
+static bool
+tar_write_block(TarWriteT write, void *data, const char *name, char type,
+                uint64_t size, uint32_t mode, uint64_t mtime, const char *link_target) {
+    char header[TAR_BLOCK_SIZE] = {0};
+
+    strncpy(header + TAR_OFF_NAME, name, TAR_LEN_NAME);
+    tar_put_number(header + TAR_OFF_MODE, TAR_LEN_MODE, mode);
+    tar_put_number(header + TAR_OFF_UID, TAR_LEN_MODE, 0);
+    tar_put_number(header + TAR_OFF_GID, TAR_LEN_MODE, 0);
+    tar_put_number(header + TAR_OFF_SIZE, TAR_LEN_NUMBER, size);
+    tar_put_number(header + TAR_OFF_MTIME, TAR_LEN_NUMBER, mtime);
+    header[TAR_OFF_TYPE] = type;
+    if (link_target != NULL) {
+        strncpy(header + TAR_OFF_LINK, link_target, TAR_LEN_NAME);
+    }
+    memcpy(header + TAR_OFF_MAGIC, TAR_MAGIC_GNU, sizeof TAR_MAGIC_GNU);
+
+    /* Six octal digits, a NUL and a space, the way every tar writes it */
+    tar_put_number(header + TAR_OFF_CHECKSUM, TAR_LEN_CHECKSUM - 1, tar_checksum(header));
+    header[TAR_OFF_CHECKSUM + TAR_LEN_CHECKSUM - 1] = ' ';
+
+    return write(data, header, sizeof header);
+}
+
+/** Write an entry holding a name too long for a header, for the entry after it. */
+static bool
+tar_write_long(TarWriteT write, void *data, char type, const char *str) {
+    size_t length = strlen(str) + 1;
+
+    return tar_write_block(write, data, TAR_LONG_LINK_NAME, type, length, 0, 0, NULL) &&
+           write(data, str, length) && tar_write_padding(write, data, length);
+}
+
+/**
+ * Write the header of an entry, its contents and ``tar_write_padding`` follow.
+ * Long names and link targets get GNU entries of their own before the header.
+ */
+bool
+tar_write_header(TarWriteT write, void *data, const TarEntryT *entry) {
+    if (strlen(entry->name) > TAR_LEN_NAME &&
+        !tar_write_long(write, data, TAR_TYPE_LONG_NAME, entry->name)) {
+        return false;
+    }
+    if (entry->link_target != NULL && strlen(entry->link_target) > TAR_LEN_NAME &&
+        !tar_write_long(write, data, TAR_TYPE_LONG_LINK, entry->link_target)) {
+        return false;
+    }
+
+    return tar_write_block(write, data, entry->name, entry->type, entry->size,
+                           entry->mode, entry->mtime, entry->link_target);
+}
+
+/** Fill the last block of ``size`` bytes of contents with zeros. */
+bool
+tar_write_padding(TarWriteT write, void *data, uint64_t size) {
+    static const char zeros[TAR_BLOCK_SIZE];
+    size_t len_padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+    return !len_padding || write(data, zeros, len_padding);
+}
+
+/** End an archive with two blocks of zeros. */
+bool
+tar_write_end(TarWriteT write, void *data) {
+    static const char zeros[2 * TAR_BLOCK_SIZE];
+
+    return write(data, zeros, sizeof zeros);
+}
+
+/** Skip ``size`` bytes of contents and their padding. */
+bool
+tar_skip(TarReadT read, void *data, uint64_t size) {
+    char buf[TAR_BLOCK_SIZE];
+
+    for (uint64_t num_blocks = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE;
+         num_blocks; num_blocks--) {
+        if (!read(data, buf, sizeof buf)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Read the contents of an entry as a NUL terminated string, NULL on errors. */
+static char *
+tar_read_string(TarReadT read, void *data, uint64_t size) {
+    size_t len_padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    char *str;
+
+    if (size > TAR_MAX_LONG_NAME) {
+        return NULL;
+    }
+
+    str = DBG_MALLOC(len_padded + 1);
+    if (!read(data, str, len_padded)) {
+        DBG_SAFE_FREE(str);
+        return NULL;
+    }
+    str[size] = '\0';
+    return str;
+}
+
+/**
+ * Pick the path and link target out of POSIX extended attributes. Records look like
+ * ``30 path=some/long/file/name\n``, where 30 is the length of the whole record.
+ */
+static void
+tar_parse_pax(char *records, size_t length, char **name, char **link_target) {
+    for (size_t offset = 0; offset < length;) {
+        char *record = records + offset, *key, *value;
+        size_t len_record = strtoul(record, &key, 10);
+
+        if (!len_record || offset + len_record > length || *key != ' ') {
+            return;
+        }
+        record[len_record - 1] = '\0';
+        value = strchr(++key, '=');
+        offset += len_record;
+        if (value == NULL) {
+            continue;
+        }
+
+        *value++ = '\0';
+        if (!strcmp(key, "path")) {
+            free(*name);
+            *name = strdup(value);
+        } else if (!strcmp(key, "linkpath")) {
+            free(*link_target);
+            *link_target = strdup(value);
+        }
+    }
+}
+
+/**
+ * Read the header of the next entry, the contents are left to the caller. GNU long
+ * names and POSIX extended attributes are applied to the entry they belong to.
+ *
+ * :param entry: [OUT] The entry, cleared with ``TarEntry_clear`` once done.
+ * :param is_end: [OUT] Set at the end of the archive, ``entry`` is empty then.
+ * :return: False if the archive couldn't be read or is corrupt.
+ */
+bool
+tar_read_header(TarReadT read, void *data, TarEntryT *entry, bool *is_end) {
+    char header[TAR_BLOCK_SIZE], *long_name = NULL, *long_link = NULL;
+    static const char zeros[TAR_BLOCK_SIZE];
+
+    *entry = (TarEntryT){0};
+    *is_end = false;
+
+    while (true) {
+        uint64_t size;
+        char type, *str;
+
+        if (!read(data, header, sizeof header)) {
+            break;
+        }
+        if (!memcmp(header, zeros, sizeof zeros)) {
+            *is_end = true;
+            break;
+        }
+        if (tar_get_number(header + TAR_OFF_CHECKSUM, TAR_LEN_CHECKSUM) !=
+            tar_checksum(header)) {
+            DBG_ERR("Corrupt archive header: %.100s", header);
+            break;
+        }
+
+        type = header[TAR_OFF_TYPE];
+        size = tar_get_number(header + TAR_OFF_SIZE, TAR_LEN_NUMBER);
+        if (type == TAR_TYPE_PAX_GLOBAL) {
+            if (!tar_skip(read, data, size)) {
+                break;
+            }
+            continue;
+        }
+        if (type != TAR_TYPE_LONG_NAME && type != TAR_TYPE_LONG_LINK &&
+            type != TAR_TYPE_PAX) {
+            char name[TAR_LEN_PREFIX + 1 + TAR_LEN_NAME + 1] = {0};
+
+            /* POSIX headers may put the start of a long name in the prefix */
+            if (!memcmp(header + TAR_OFF_MAGIC, TAR_MAGIC_USTAR "\0", 6) &&
+                header[TAR_OFF_PREFIX]) {
+                snprintf(name, sizeof name, "%.155s/%.100s", header + TAR_OFF_PREFIX,
+                         header + TAR_OFF_NAME);
+            } else {
+                memcpy(name, header + TAR_OFF_NAME, TAR_LEN_NAME);
+            }
+
+            entry->name = long_name != NULL ? long_name : strdup(name);
+            entry->type = type ? type : TAR_TYPE_FILE;
+            entry->size = size;
+            entry->mode = tar_get_number(header + TAR_OFF_MODE, TAR_LEN_MODE);
+            entry->mtime = tar_get_number(header + TAR_OFF_MTIME, TAR_LEN_NUMBER);
+            if (long_link != NULL) {
+                entry->link_target = long_link;
+            } else if (type == TAR_TYPE_SYM_LINK || type == TAR_TYPE_HARD_LINK) {
+                entry->link_target = strndup(header + TAR_OFF_LINK, TAR_LEN_NAME);
+            } else {
+                entry->link_target = NULL;
+            }
+            return true;
+        }
+
+        if ((str = tar_read_string(read, data, size)) == NULL) {
+            break;
+        }
+        if (type == TAR_TYPE_LONG_NAME) {
+            free(long_name);
+            long_name = str;
+        } else if (type == TAR_TYPE_LONG_LINK) {
+            free(long_link);
+            long_link = str;
+        } else {
+            tar_parse_pax(str, size, &long_name, &long_link);
+            DBG_SAFE_FREE(str);
+        }
+    }
+
+    free(long_name);
+    free(long_link);
+    return *is_end;
+}
+
+/**
+ * Check that a name read from an archive stays under the directory it is extracted
+ * to, it must be relative and can't have ``..`` components.
+ */
+bool
+tar_name_is_safe(const char *name) {
+    if (*name == '/' || *name == '\0') {
+        return false;
+    }
+
+    for (const char *c = name; *c;) {
+        size_t len_component = strcspn(c, "/");
+
+        if (len_component == 2 && c[0] == '.' && c[1] == '.') {
+            return false;
+        }
+        c += len_component;
+        c += *c == '/';
+    }
+    return true;
+}
+
+/** Free the name and link target of an entry. */
+void
+TarEntry_clear(TarEntryT *self) {
+    free(self->name);
+    free(self->link_target);
+    self->name = NULL;
+    self->link_target = NULL;
+}
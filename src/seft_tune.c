@@ -0,0 +1,195 @@
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libssh/sftp.h>
+
+#include "seft_config.h"
+#include "seft_debug.h"
+#include "seft_tune.h"
+
+#define NS_PER_SECOND 1000000000L
+
+/** Get the seconds passed since ``since``, on the monotonic clock. */
+double
+tune_elapsed(const struct timespec *since) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) +
+           (now.tv_nsec - since->tv_nsec) / (double)NS_PER_SECOND;
+}
+
+/**
+ * Find the largest chunk the server reads and writes with one request.
+ *
+ * .. note:: libssh only queries ``limits@openssh.com`` since 0.11, older versions
+ *    can only tell if the server supports it.
+ */
+static size_t
+tune_server_max_chunk(sftp_session session_sftp) {
+    size_t max_chunk = TUNE_DEFAULT_MAX_CHUNK;
+
+#ifdef HAVE_SFTP_LIMITS
+    sftp_limits_t limits = sftp_limits(session_sftp);
+
+    if (limits != NULL) {
+        uint64_t max_length = limits->max_read_length < limits->max_write_length
+                                  ? limits->max_read_length
+                                  : limits->max_write_length;
+
+        /* 0 means the server doesn't say */
+        if (max_length) {
+            max_chunk = max_length < TUNE_MAX_CHUNK ? max_length : TUNE_MAX_CHUNK;
+        }
+        sftp_limits_free(limits);
+        return max_chunk;
+    }
+#endif
+
+    if (sftp_extension_supported(session_sftp, "limits@openssh.com", "1")) {
+        max_chunk = TUNE_OPENSSH_MAX_CHUNK;
+    }
+    return max_chunk;
+}
+
+/**
+ * Create a new ``TuneT`` for transfers over ``session_sftp``, it starts from chunks
+ * every server accepts and ``TUNE_MIN_WINDOW`` requests in flight.
+ *
+ * :return: The tuning. It must be freed with ``Tune_free``.
+ */
+TuneT *
+Tune_new(sftp_session session_sftp) {
+    TuneT *self = DBG_CALLOC(1, sizeof *self);
+
+    pthread_mutex_init(&self->lock, NULL);
+    self->max_chunk = tune_server_max_chunk(session_sftp);
+    self->chunk = self->max_chunk < TUNE_DEFAULT_MAX_CHUNK ? self->max_chunk
+                                                           : TUNE_DEFAULT_MAX_CHUNK;
+    self->window = TUNE_MIN_WINDOW;
+    clock_gettime(CLOCK_MONOTONIC, &self->interval_start);
+
+    return self;
+}
+
+/**
+ * Create a ``TuneT`` starting from what ``self`` learned so far, i.e for a background
+ * copy to the same server.
+ */
+TuneT *
+Tune_copy(TuneT *self) {
+    TuneT *copy = DBG_MALLOC(sizeof *copy);
+
+    pthread_mutex_lock(&self->lock);
+    *copy = *self;
+    pthread_mutex_unlock(&self->lock);
+
+    pthread_mutex_init(&copy->lock, NULL);
+    Tune_begin(copy);
+    return copy;
+}
+
+/** Start a new throughput interval, the time between files isn't counted. */
+void
+Tune_begin(TuneT *self) {
+    pthread_mutex_lock(&self->lock);
+    clock_gettime(CLOCK_MONOTONIC, &self->interval_start);
+    self->interval_bytes = 0;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * Get the chunk size and window to transfer with.
+ *
+ * :param pipelined: False for transfers sending one request at a time, they get
+ *     the bytes of a whole window in one chunk, as far as the server allows.
+ * :param chunk: [OUT] Bytes to read or write with one request.
+ * :param window: [OUT] Requests to keep in flight.
+ */
+void
+Tune_get(TuneT *self, bool pipelined, size_t *chunk, size_t *window) {
+    pthread_mutex_lock(&self->lock);
+    if (pipelined) {
+        *chunk = self->chunk;
+        *window = self->window;
+    } else {
+        *chunk = self->chunk * self->window;
+        *chunk = *chunk < self->max_chunk ? *chunk : self->max_chunk;
+        *window = 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+/** Size the chunk and window to keep ``TUNE_GAIN`` bandwidth-delay products in flight. */
+static void
+Tune_adjust(TuneT *self) {
+    double target = TUNE_GAIN * self->max_rate * self->min_rtt;
+    size_t chunk = (size_t)(target / TUNE_MIN_WINDOW) / TUNE_MIN_CHUNK * TUNE_MIN_CHUNK;
+    double window;
+
+    /* Fewer, larger requests cost less per byte, so chunks grow before the window */
+    chunk = chunk > TUNE_MIN_CHUNK ? chunk : TUNE_MIN_CHUNK;
+    self->chunk = chunk < self->max_chunk ? chunk : self->max_chunk;
+
+    window = ceil(target / self->chunk);
+    self->window = window < TUNE_MIN_WINDOW   ? TUNE_MIN_WINDOW
+                   : window > TUNE_MAX_WINDOW ? TUNE_MAX_WINDOW
+                                              : (size_t)window;
+}
+
+/**
+ * Record a request that completed.
+ *
+ * :param num_bytes: Bytes the request read or wrote.
+ * :param rtt: Seconds between sending the request and getting its response.
+ */
+void
+Tune_sample(TuneT *self, size_t num_bytes, double rtt) {
+    double elapsed;
+
+    pthread_mutex_lock(&self->lock);
+    self->num_samples++;
+    self->srtt = self->srtt ? 0.875 * self->srtt + 0.125 * rtt : rtt;
+    if (!self->min_rtt || rtt < self->min_rtt ||
+        self->num_samples % TUNE_RTT_REFRESH == 0) {
+        self->min_rtt = rtt;
+    }
+
+    self->interval_bytes += num_bytes;
+    elapsed = tune_elapsed(&self->interval_start);
+    if (elapsed >= fmax(self->srtt, TUNE_MIN_INTERVAL)) {
+        self->max_rate =
+            fmax(self->interval_bytes / elapsed, self->max_rate * TUNE_RATE_DECAY);
+        clock_gettime(CLOCK_MONOTONIC, &self->interval_start);
+        self->interval_bytes = 0;
+        Tune_adjust(self);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+/** Print the current chunk size, window and the measurements they come from. */
+void
+Tune_print(TuneT *self) {
+    pthread_mutex_lock(&self->lock);
+    printf("Chunk: %.1f KiB (server limit %.1f KiB)\n", self->chunk / 1024.0,
+           self->max_chunk / 1024.0);
+    printf("Window: %zu requests\n", self->window);
+    printf("Round trip: %.2f ms (min %.2f ms)\n", self->srtt * 1000,
+           self->min_rtt * 1000);
+    printf("Throughput: %.1f MiB/s\n", self->max_rate / (1024 * 1024));
+    printf("Bandwidth-delay product: %.1f KiB\n",
+           self->max_rate * self->min_rtt / 1024);
+    printf("Samples: %" PRIu64 "\n", self->num_samples);
+    pthread_mutex_unlock(&self->lock);
+}
+
+void
+Tune_free(TuneT *self) {
+    pthread_mutex_destroy(&self->lock);
+    DBG_SAFE_FREE(self);
+}
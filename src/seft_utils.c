@@ -9,6 +9,7 @@
 #include "seft_path.h"
 #include "seft_utils.h"
 #include "seft_ansi_colors.h"
+#include "seft_debug.h"
 
 #define MAX_COLS 128
 
@@ -21,36 +22,6 @@ get_window_column_length(void) {
     return window_size.ws_col;
 }
 
-/** Find the sum of a ``u32`` list.
- *
- * .. note:: Currently, resultant sum is adjusted to match the length
- *    ansi-color-formatted string, its not the absolute length of sum.
- *    Won't work for lists which store non-ansi-color-formatted strings.
- */
-uint32_t
-u32_array_sum(const uint32_t *array, size_t length) {
-    uint32_t sum = 0;
-
-    for (size_t i = 0; i < length; i++) {
-        sum += array[i];
-    }
-
-    return sum - ANSI_COLOR_COMBINED_LEN * (length + 1);
-}
-
-/** Copy a ``u32`` list.
- *
- * .. note:: This will also change ``len_dest`` to actual length of
- *    ``dest`` after copying.
- */
-void
-u32_array_copy(uint32_t *dest, size_t *len_dest, const uint32_t *src, size_t len_src) {
-    for (size_t i = 0; i < len_src; i++) {
-        dest[i] = src[i];
-    }
-    *len_dest = len_src;
-}
-
 /** Get the length of the longest string in the list */
 size_t
 char_list_max_len(ListT *self) {
@@ -68,116 +39,127 @@ char_list_max_len(ListT *self) {
     return len_max;
 }
 
-/** Get the sum of the lengths of all strings in the list
+/**
+ * Get the number of terminal cells a string occupies when printed.
  *
- * .. note:: Currently, resultant sum is adjusted to match the length
- *    ansi-color-formatted string, its not the absolute length of sum.
- *    Won't work for lists which store non-ansi-color-formatted strings.
- * */
-size_t
-char_list_sum_len(ListT *self) {
-    size_t len = 0;
-
-    for (size_t i = 0; i < self->length; i++) {
-        len += strlen(List_get(self, i));
-    }
-
-    return len - ANSI_COLOR_COMBINED_LEN * (self->length + 1);
-}
-
-/** Get a slice of a ``ListT`` of ``char *``
+ * ANSI escape sequences (``ESC [ ... <final byte>``) take up no cells and every UTF-8
+ * encoded code point is counted once, so ``COLOR_FOLDER ICON_FOLDER " name"`` has the
+ * same width as ``"x name"``.
  *
- * :param self: The list to slice
- * :param start: [INCLUSIVE] The starting index of the slice
- * :param stop: [EXCLUSIVE] The ending index of the slice
+ * :param str: NULL terminated string.
+ * :return: Display width of ``str``.
  */
-ListT *
-char_list_slice(ListT *self, size_t start, size_t stop) {
-    size_t length = stop - start;
-    ListT *sliced_list;
-
-    if (length < 1) {
-        return NULL;
-    }
-
-    if (stop > self->length) {
-        stop = self->length;
-    }
+uint32_t
+str_display_width(const char *str) {
+    uint32_t width = 0;
+    const unsigned char *c = (const unsigned char *)str;
+
+    while (*c) {
+        if (*c == '\x1b' && c[1] == '[') {
+            /* Skip parameter and intermediate bytes up to the final byte */
+            for (c += 2; *c && (*c < 0x40 || *c > 0x7e); c++) {
+            }
+            if (*c) {
+                c++;
+            }
+            continue;
+        }
 
-    sliced_list = List_new(1, sizeof(char *));
-    for (size_t i = start; i < stop; i++) {
-        List_push(sliced_list, self->list[i], strlen(self->list[i]) + 1);
+        /* UTF-8 continuation bytes are ``10xxxxxx`` */
+        if ((*c & 0xc0) != 0x80) {
+            width++;
+        }
+        c++;
     }
 
-    return sliced_list;
+    return width;
 }
 
-/** Get a slice of a ``ListT`` of ``char *`` with equalized lengths
- *  For example::
- *
- *      A list of strings: ["a", "b", "c", "d", "e", "f", "g", "h", "i", "j]
- *      Equalized slice of length 3: [["a", "d", "g"], ["b", "e", "h"], ["c", "f"], ["i",
- * "j"]] Instead of: [["a", "b", "c"], ["d", "e", "f"], ["g", "h", "i"], ["j"]]
- *
- * :param self: The list to slice
- * :param len_rows: The number of rows in the slice
- * :param len_cols: The number of columns in the slice
- *
- * .. note:: The resultant slice will be a ``ListT`` of ``ListT`` of ``char *``
- *    with ``len_rows`` rows and ``len_cols`` columns.
+/**
+ * Find the widths of each column when ``length`` items are laid out columnwise.
  *
+ * :param widths: Display width of every item.
+ * :param length: Number of items in ``widths``.
+ * :param len_rows: Number of rows in the layout.
+ * :param col_widths: [OUT] Width of each column, must hold ``CEIL(length, len_rows)``
+ *     items.
+ * :return: Sum of all column widths.
  */
-ListT *
-char_list_equalized_slice(ListT *self, size_t len_rows, size_t len_cols) {
-    ListT *rows = List_new(1, sizeof *rows);
-    ListT *row, *slice;
-    size_t start, stop;
-    char *list_item;
-
-    for (size_t i = 0; i < len_rows; i++) {
-        row = List_new(1, sizeof *list_item);
-
-        for (size_t j = 0; j < len_cols; j++) {
-            start = len_rows * j;
-            stop = len_rows * (j + 1);
-
-            slice = char_list_slice(self, start, stop);
-            list_item = List_get(slice, i);
-            if (list_item != NULL) {
-                List_push(row, list_item, strlen(list_item) + 1);
+static size_t
+layout_column_widths(const uint32_t *widths, size_t length, size_t len_rows,
+                     uint32_t *col_widths) {
+    size_t sum = 0;
+    size_t col = 0;
+
+    for (size_t start = 0; start < length; start += len_rows, col++) {
+        size_t stop = start + len_rows < length ? start + len_rows : length;
+        uint32_t len_max = 0;
+
+        for (size_t i = start; i < stop; i++) {
+            if (len_max < widths[i]) {
+                len_max = widths[i];
             }
         }
-        List_push(rows, row, (sizeof *row));
+        col_widths[col] = len_max;
+        sum += len_max;
     }
 
-    return rows;
+    return sum;
+}
+
+/** Print ``str`` followed by enough spaces to fill ``width`` cells. */
+static void
+print_padded(const char *str, uint32_t str_width, uint32_t width) {
+    fputs(str, stdout);
+    for (; str_width < width; str_width++) {
+        putchar(' ');
+    }
 }
 
 /** Format a ``ListT`` of ``char *`` columnwise
+ *  For example::
+ *
+ *      A list of strings: ["a", "b", "c", "d", "e", "f", "g", "h", "i", "j"]
+ *      With 4 rows: a  e  i
+ *                   b  f  j
+ *                   c  g
+ *                   d  h
  *
  * :param self: The list to format
  * :param width_screen: The width of the screen
  * :param delimiter: The delimiter to use between columns
  *
  * .. note:: This function will print the formatted list to stdout.
+ *    Display widths are computed once and every candidate column count is
+ *    checked with a single pass over them, no strings are copied.
  */
 void
 char_list_format_columnwise(ListT *self, size_t width_screen, char *delimiter) {
-    size_t len_cols = 2;
-    size_t len_delimiter = strlen(delimiter);
-    size_t len_rows, start, stop, len_max, len_buf_widths, len_col_widths = 0;
+    size_t len_delimiter = str_display_width(delimiter);
+    size_t len_cols_max, len_rows, len_cols, best_rows;
+    size_t sum_widths = 0;
     uint32_t col_widths[MAX_COLS] = {0};
-    uint32_t buf_widths[MAX_COLS] = {0};
-    ListT *slice, *rows = NULL, *row = NULL;
+    uint32_t *widths;
+
+    if (List_is_empty(self)) {
+        return;
+    }
+
+    widths = DBG_MALLOC(self->length * sizeof *widths);
+    for (size_t i = 0; i < self->length; i++) {
+        widths[i] = str_display_width(List_get(self, i));
+        sum_widths += widths[i];
+    }
 
     /** If the sum of the lengths of all strings in the list is less than
      *  the width of the screen, then print the list as is.
      */
-    if (char_list_sum_len(self) + len_delimiter * self->length < width_screen) {
+    if (sum_widths + len_delimiter * self->length < width_screen) {
         for (size_t i = 0; i < self->length; i++) {
             printf("%s%s", ((char *)List_get(self, i)), delimiter);
         }
         putchar('\n');
+        DBG_SAFE_FREE(widths);
         return;
     }
 
@@ -185,44 +167,58 @@ char_list_format_columnwise(ListT *self, size_t width_screen, char *delimiter) {
      * This algorithm is based on::
      *
      *      https://github.com/changyuheng/columnify.py/blob/main/columnify/columnify.py
+     *
+     * Every column needs at least one cell and a delimiter, which bounds the
+     * number of candidates independently of the number of items.
      */
-    for (;; len_cols++) {
-        len_rows = CEIL(self->length, len_cols);
-        len_buf_widths = 0;
+    len_cols_max = width_screen / (len_delimiter + 1) + 1;
+    if (len_cols_max > MAX_COLS) {
+        len_cols_max = MAX_COLS;
+    }
+    if (len_cols_max > self->length) {
+        len_cols_max = self->length;
+    }
 
-        for (size_t i = 0; i < len_cols && (start = len_rows * i) < self->length; i++) {
-            stop = len_rows * (i + 1);
+    best_rows = self->length;
+    for (len_cols = 2; len_cols <= len_cols_max; len_cols++) {
+        len_rows = CEIL(self->length, len_cols);
 
-            slice = char_list_slice(self, start, stop);
-            len_max = char_list_max_len(slice);
-            buf_widths[len_buf_widths++] = len_max;
+        /* Different column counts can share a row count, only the first is needed */
+        if (len_rows == best_rows) {
+            continue;
         }
 
-        if (u32_array_sum(buf_widths, len_buf_widths) + len_delimiter * (len_cols - 1) >
+        if (layout_column_widths(widths, self->length, len_rows, col_widths) +
+                len_delimiter * (CEIL(self->length, len_rows) - 1) <=
             width_screen) {
-            break;
+            best_rows = len_rows;
         }
+    }
 
-        u32_array_copy(col_widths, &len_col_widths, buf_widths, len_buf_widths);
-        rows = char_list_equalized_slice(self, len_rows, len_cols);
+    len_cols = CEIL(self->length, best_rows);
+    layout_column_widths(widths, self->length, best_rows, col_widths);
 
-        List_free(slice);
-    }
+    for (size_t row = 0; row < best_rows; row++) {
+        for (size_t col = 0; col < len_cols; col++) {
+            size_t index = col * best_rows + row;
+
+            if (index >= self->length) {
+                break;
+            }
 
-    for (size_t i = 0; i < rows->length; i++) {
-        row = List_get(rows, i);
-        for (size_t j = 0; j < row->length - 1; j++) {
-            printf("%-*s%s", col_widths[j], (char *)List_get(row, j), delimiter);
+            /* Print the last column without the delimiter or padding */
+            if (index + best_rows >= self->length) {
+                fputs(List_get(self, index), stdout);
+                break;
+            }
+
+            print_padded(List_get(self, index), widths[index], col_widths[col]);
+            fputs(delimiter, stdout);
         }
-        /* Print the last column without the delimiter */
-        printf("%-*s\n", col_widths[row->length - 1],
-               (char *)List_get(row, row->length - 1));
-        List_free(row);
+        putchar('\n');
     }
 
-    if (rows != NULL) {
-        List_free(rows);
-    }
+    DBG_SAFE_FREE(widths);
 }
 
 /** Helper function to check if flag is set to ``show all`` and if the path satisfies the
@@ -0,0 +1,240 @@
+/**
+ * Cross checks of the checksum kernels and the XXH64 hash, run by ``make check``.
+ *
+ * Every set of kernels the CPU supports is compared against plain reference
+ * implementations on random buffers, at every alignment and around every block size
+ * the vector kernels use. Known answers catch references that are wrong too.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "seft_checksum.h"
+#include "seft_hash.h"
+
+/** Bytes of the random buffer, the longest length tested plus the largest offset */
+#define TEST_BUF_SIZE 8192
+
+/** Starts of the data past a 64-byte aligned address, ``AVX-512`` loads are 64 bytes */
+#define TEST_MAX_OFFSET 64
+
+/** Random starting sums and contents tried for every length and offset */
+#define TEST_ROUNDS 4
+
+/** Reflected polynomial of CRC32C (Castagnoli) */
+#define CRC32C_POLY 0x82F63B78U
+
+/** A known XXH64 digest, from the reference implementation */
+typedef struct {
+    const char *input;
+    uint64_t seed;
+    uint64_t digest;
+} HashVectorT;
+
+static const HashVectorT hash_vectors[] = {
+    {"", 0, 0xEF46DB3751D8E999ULL},
+    {"", 1, 0xD5AFBA1336A3BE4BULL},
+    {"a", 0, 0xD24EC4F1A98C6E5BULL},
+    {"abc", 0, 0x44BC2CF5AD770999ULL},
+    {"abc", 0x9E3779B97F4A7C15ULL, 0x2ED0F59D6B43AC8BULL},
+    {"message digest", 0, 0x066ED728FCEEB3BEULL},
+    {"abcdefghijklmnopqrstuvwxyz", 0, 0xCFE1F278FA89835CULL},
+    {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 0,
+     0xAAA46907D3047814ULL},
+    {"1234567890123456789012345678901234567890"
+     "1234567890123456789012345678901234567890",
+     0, 0xE04A477F19EE145DULL},
+};
+
+/** Lengths around the 4, 16, 32, 64 and 256 byte blocks of the kernels */
+static const size_t lengths[] = {0,   1,   2,   3,   4,   5,   7,   8,    9,    15,
+                                 16,  17,  31,  32,  33,  63,  64,  65,   127,  128,
+                                 129, 191, 255, 256, 257, 511, 512, 1000, 4093, 8000};
+
+static uint64_t rng_state;
+
+static uint64_t
+rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/** Byte by byte rolling checksum, see ``checksum_rolling``. */
+static uint32_t
+reference_rolling(uint32_t sum, const uint8_t *data, size_t length) {
+    uint32_t a = sum & 0xffff, b = sum >> 16;
+
+    for (size_t i = 0; i < length; i++) {
+        a += data[i];
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+/** Bit by bit CRC32C. */
+static uint32_t
+reference_crc32c(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (size_t bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * Compare a set of kernels against the references.
+ *
+ * :return: Number of mismatches, each one is printed.
+ */
+static size_t
+test_kernels(const ChecksumKernelsT *kernels, uint8_t *buf) {
+    size_t num_failed = 0;
+
+    for (size_t i = 0; i < sizeof lengths / sizeof *lengths; i++) {
+        for (size_t offset = 0; offset < TEST_MAX_OFFSET; offset++) {
+            for (size_t round = 0; round < TEST_ROUNDS; round++) {
+                const uint8_t *data = buf + offset;
+                uint32_t sum = rng_next(), got, want;
+
+                for (size_t k = 0; k < lengths[i]; k++) {
+                    buf[offset + k] = rng_next();
+                }
+
+                got = kernels->rolling(sum, data, lengths[i]);
+                want = reference_rolling(sum, data, lengths[i]);
+                if (got != want) {
+                    printf("FAIL %s rolling: length %zu offset %zu: %08" PRIx32
+                           " instead of %08" PRIx32 "\n",
+                           kernels->name, lengths[i], offset, got, want);
+                    num_failed++;
+                }
+
+                got = kernels->crc32c(sum, data, lengths[i]);
+                want = reference_crc32c(sum, data, lengths[i]);
+                if (got != want) {
+                    printf("FAIL %s crc32c: length %zu offset %zu: %08" PRIx32
+                           " instead of %08" PRIx32 "\n",
+                           kernels->name, lengths[i], offset, got, want);
+                    num_failed++;
+                }
+            }
+        }
+    }
+
+    if (kernels->crc32c(0, (const uint8_t *)"123456789", 9) != 0xE3069283U) {
+        printf("FAIL %s crc32c: known answer\n", kernels->name);
+        num_failed++;
+    }
+
+    /* A single byte set anywhere must be seen */
+    memset(buf, 0, TEST_BUF_SIZE);
+    for (size_t i = 0; i < sizeof lengths / sizeof *lengths; i++) {
+        for (size_t offset = 0; offset < TEST_MAX_OFFSET; offset += 7) {
+            uint8_t *data = buf + offset;
+            bool ok = kernels->is_zero(data, lengths[i]);
+
+            for (size_t k = 0; ok && k < lengths[i]; k++) {
+                data[k] = 0x80;
+                ok = !kernels->is_zero(data, lengths[i]);
+                data[k] = 0;
+            }
+            if (!ok) {
+                printf("FAIL %s is_zero: length %zu offset %zu\n", kernels->name,
+                       lengths[i], offset);
+                num_failed++;
+            }
+        }
+    }
+
+    return num_failed;
+}
+
+/**
+ * Check XXH64 against the reference digests, hashed in one go and in pieces of
+ * every size, and random buffers in pieces against one go.
+ *
+ * :return: Number of mismatches, each one is printed.
+ */
+static size_t
+test_hash(uint8_t *buf) {
+    size_t num_failed = 0;
+    HashT hash;
+
+    for (size_t i = 0; i < sizeof hash_vectors / sizeof *hash_vectors; i++) {
+        const HashVectorT *vector = &hash_vectors[i];
+        size_t length = strlen(vector->input);
+
+        for (size_t piece = 1; piece <= length + 1; piece++) {
+            Hash_init(&hash, vector->seed);
+            for (size_t k = 0; k < length; k += piece) {
+                Hash_update(&hash, vector->input + k,
+                            length - k < piece ? length - k : piece);
+            }
+
+            if (Hash_digest(&hash) != vector->digest) {
+                printf("FAIL xxh64: \"%s\" seed %" PRIx64 " in pieces of %zu\n",
+                       vector->input, vector->seed, piece);
+                num_failed++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < sizeof lengths / sizeof *lengths; i++) {
+        size_t length = lengths[i], piece = 1 + rng_next() % (length + 1);
+        uint64_t seed = rng_next();
+
+        for (size_t k = 0; k < length; k++) {
+            buf[k] = rng_next();
+        }
+
+        Hash_init(&hash, seed);
+        for (size_t k = 0; k < length; k += piece) {
+            Hash_update(&hash, buf + k, length - k < piece ? length - k : piece);
+        }
+        if (Hash_digest(&hash) != checksum_xxh64(seed, buf, length)) {
+            printf("FAIL xxh64: length %zu in pieces of %zu\n", length, piece);
+            num_failed++;
+        }
+    }
+
+    return num_failed;
+}
+
+int
+main(int argc, char **argv) {
+    static uint8_t buf[TEST_BUF_SIZE + TEST_MAX_OFFSET] __attribute__((aligned(64)));
+    const ChecksumKernelsT *kernels;
+    size_t num_failed = 0, num_kernel_failed;
+
+    /* A seed given on the command line reproduces a failed run */
+    rng_state = argc > 1 ? strtoull(argv[1], NULL, 0) : (uint64_t)time(NULL);
+    rng_state |= 1;
+    printf("Seed: %" PRIu64 "\n", rng_state);
+
+    for (size_t i = 0; (kernels = checksum_get_kernels_at(i)) != NULL; i++) {
+        if (!checksum_kernels_supported(kernels)) {
+            printf("SKIP %s: unsupported\n", kernels->name);
+            continue;
+        }
+
+        num_kernel_failed = test_kernels(kernels, buf);
+        printf("%s %s\n", num_kernel_failed ? "FAIL" : "PASS", kernels->name);
+        num_failed += num_kernel_failed;
+    }
+
+    num_failed += test_hash(buf);
+    printf("Selected: %s\n", checksum_get_kernels()->name);
+    printf("%zu failures\n", num_failed);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+/**
+ * Checks of the glob matcher and the include and exclude rules, run by ``make check``.
+ *
+ * Rules are compiled into a trie for literal patterns and a list of globs, so the
+ * same paths are checked against rules of both kinds and their orders.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seft_filter.h"
+#include "seft_glob.h"
+
+/** A string checked against a glob pattern */
+typedef struct {
+    const char *pattern;
+    const char *str;
+    bool matches;
+} MatchCaseT;
+
+/** A pattern and the directory it is expanded from */
+typedef struct {
+    const char *pattern;
+    const char *base;
+    bool has_magic;
+} BaseCaseT;
+
+/** A path checked against the rules of ``filter_rules`` */
+typedef struct {
+    const char *path;
+    bool is_dir;
+    bool excluded;
+} ExcludeCaseT;
+
+/** A rule, ``+`` includes and ``-`` excludes */
+typedef struct {
+    char sign;
+    const char *pattern;
+} RuleT;
+
+static const MatchCaseT match_cases[] = {
+    {"*", "file", true},
+    {"*", "", true},
+    {"*.log", "a.log", true},
+    {"*.log", "a.log.gz", false},
+    {"*.log", "dir/a.log", false},
+    {"a*b*c", "aXbYc", true},
+    {"a*b*c", "aXbY", false},
+    {"?", "a", true},
+    {"?", "", false},
+    {"??", "a", false},
+    {"a?c", "a/c", false},
+    {"[a-c]x", "bx", true},
+    {"[a-c]x", "dx", false},
+    {"[!a-c]x", "dx", true},
+    {"[!a-c]x", "ax", false},
+    {"[^a]", "b", true},
+    {"[]]", "]", true},
+    {"[]a]", "a", true},
+    {"[a-]", "-", true},
+    {"[abc", "[abc", true},
+    {"[abc", "a", false},
+    {"\\*", "*", true},
+    {"\\*", "a", false},
+    {"a\\?", "a?", true},
+    {"\\[a]", "[a]", true},
+    {"a\\", "a\\", true},
+    {"**", "a/b/c", true},
+    {"**/c", "c", true},
+    {"**/c", "a/b/c", true},
+    {"a/**/c", "a/c", true},
+    {"a/**/c", "a/x/y/c", true},
+    {"a/**/c", "b/x/c", false},
+    {"a/**", "a/b/c", true},
+    {"a**", "ab/c", false},
+    {"*", ".hidden", false},
+    {".*", ".hidden", true},
+    {"?hidden", ".hidden", false},
+    {"[.]hidden", ".hidden", false},
+    {"a/*", "a/.b", false},
+    {"**/c", ".git/c", false},
+    {"a.*", "a.b", true},
+};
+
+static const BaseCaseT base_cases[] = {
+    {"*.log", ".", true},
+    {"logs/2024/[0-9]*.log", "logs/2024", true},
+    {"/x*", "/", true},
+    {"/var/log/*", "/var/log", true},
+    {"foo\\*bar/x*", "foo*bar", true},
+    {"a\\/b/c*", "a/b", true},
+    {"a/b?/c", "a", true},
+    {"plain/path", "plain", false},
+    {"esc\\*aped", ".", false},
+};
+
+/** Rules in the order they are added, the first matching one decides */
+static const RuleT filter_rules[] = {
+    {'+', "keep.log"},  {'-', "*.log"},    {'-', "/build/"},   {'-', ".git"},
+    {'-', "src/gen"},   {'+', "*.md"},     {'-', "/docs/"},    {'-', "\\*literal"},
+    {'+', "twice"},     {'-', "twice"},    {'-', "cache/"},    {'-', "/tmp/**/*.o"},
+};
+
+static const ExcludeCaseT exclude_cases[] = {
+    {"keep.log", false, false},
+    {"deep/dir/keep.log", false, false},
+    {"other.log", false, true},
+    {"deep/other.log", false, true},
+    {"build", true, true},
+    {"build", false, false},
+    {"sub/build", true, false},
+    {".git", true, true},
+    {".git", false, true},
+    {"a/b/.git", true, true},
+    {".github", true, false},
+    {"src/gen", true, true},
+    {"src/gen", false, true},
+    {"other/src/gen", true, false},
+    {"gen", true, false},
+    {"docs", true, true},
+    {"docs/readme.md", false, false},
+    {"readme.md", false, false},
+    {"*literal", false, true},
+    {"xliteral", false, false},
+    {"twice", false, false},
+    {"cache", true, true},
+    {"a/cache", true, true},
+    {"a/cache", false, false},
+    {"tmp/a/b/x.o", false, true},
+    {"tmp/x.o", false, true},
+    {"other/tmp/x.o", false, false},
+    {"plain", false, false},
+};
+
+static size_t num_failed;
+
+static void
+test_check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        num_failed++;
+    }
+}
+
+static void
+test_glob_match(void) {
+    char message[128];
+
+    for (size_t i = 0; i < sizeof match_cases / sizeof *match_cases; i++) {
+        const MatchCaseT *c = &match_cases[i];
+
+        snprintf(message, sizeof message, "glob_match(\"%s\", \"%s\") != %d", c->pattern,
+                 c->str, c->matches);
+        test_check(glob_match(c->pattern, c->str) == c->matches, message);
+    }
+}
+
+static void
+test_glob_base(void) {
+    char message[128];
+
+    for (size_t i = 0; i < sizeof base_cases / sizeof *base_cases; i++) {
+        const BaseCaseT *c = &base_cases[i];
+        char *base = glob_base(c->pattern);
+
+        snprintf(message, sizeof message, "glob_base(\"%s\") = \"%s\"", c->pattern, base);
+        test_check(!strcmp(base, c->base), message);
+        snprintf(message, sizeof message, "glob_has_magic(\"%s\") != %d", c->pattern,
+                 c->has_magic);
+        test_check(glob_has_magic(c->pattern) == c->has_magic, message);
+        free(base);
+    }
+}
+
+static void
+test_filter(void) {
+    FilterT *filter = Filter_new();
+    char message[128];
+
+    for (size_t i = 0; i < sizeof filter_rules / sizeof *filter_rules; i++) {
+        snprintf(message, sizeof message, "Filter_add_rule(\"%s\")",
+                 filter_rules[i].pattern);
+        test_check(Filter_add_rule(filter, filter_rules[i].pattern,
+                                   filter_rules[i].sign == '+'),
+                   message);
+    }
+
+    /* Patterns without a name are refused */
+    test_check(!Filter_add_rule(filter, "", false), "Filter_add_rule(\"\")");
+    test_check(!Filter_add_rule(filter, "/", false), "Filter_add_rule(\"/\")");
+    test_check(!Filter_add_rule(filter, "//", true), "Filter_add_rule(\"//\")");
+
+    for (size_t i = 0; i < sizeof exclude_cases / sizeof *exclude_cases; i++) {
+        const ExcludeCaseT *c = &exclude_cases[i];
+
+        snprintf(message, sizeof message, "Filter_excludes(\"%s\", %d) != %d", c->path,
+                 c->is_dir, c->excluded);
+        test_check(Filter_excludes(filter, c->path, c->is_dir) == c->excluded, message);
+    }
+
+    Filter_free(filter);
+}
+
+int
+main(void) {
+    test_glob_match();
+    test_glob_base();
+    test_filter();
+
+    printf("%zu failures\n", num_failed);
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,352 @@
+/**
+ * Checks of the archive reader and writer used by bulk copies, run by ``make check``.
+ *
+ * Archives are written to and read from memory. Besides round trips through the
+ * writer, headers are made by hand for what only other tars write: POSIX extended
+ * attributes, prefixes of long names and corrupt or truncated archives.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seft_tar.h"
+
+/** Offsets of the header fields the hand made headers fill in */
+#define TEST_OFF_SIZE 124
+#define TEST_OFF_CHECKSUM 148
+#define TEST_OFF_TYPE 156
+#define TEST_OFF_LINK 157
+#define TEST_OFF_MAGIC 257
+#define TEST_OFF_PREFIX 345
+
+/** An archive in memory */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+
+    /** Where the next read starts */
+    size_t offset;
+} TestBufT;
+
+/** A name checked by ``tar_name_is_safe`` */
+typedef struct {
+    const char *name;
+    bool is_safe;
+} NameCaseT;
+
+static const NameCaseT name_cases[] = {
+    {"a", true},          {"a/b/c", true},     {"./a", true},     {"a//b", true},
+    {"..a", true},        {"a..", true},       {"a/..b/c", true}, {".../a", true},
+    {"", false},          {"/", false},        {"/etc", false},   {"..", false},
+    {"../a", false},      {"a/..", false},     {"a/../b", false}, {"a/b/../../..", false},
+    {"./../a", false},    {"a/../../b", false},
+};
+
+static size_t num_failed;
+
+static bool
+test_write(void *data, const void *buf, size_t length) {
+    TestBufT *self = data;
+
+    if (self->length + length > self->capacity) {
+        self->capacity = (self->length + length) * 2;
+        self->data = realloc(self->data, self->capacity);
+    }
+    memcpy(self->data + self->length, buf, length);
+    self->length += length;
+    return true;
+}
+
+static bool
+test_read(void *data, void *buf, size_t length) {
+    TestBufT *self = data;
+
+    if (self->length - self->offset < length) {
+        return false;
+    }
+    memcpy(buf, self->data + self->offset, length);
+    self->offset += length;
+    return true;
+}
+
+static void
+test_check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        num_failed++;
+    }
+}
+
+/** Compare two strings that may be NULL. */
+static bool
+test_str_eq(const char *a, const char *b) {
+    return a == NULL || b == NULL ? a == b : !strcmp(a, b);
+}
+
+/** Write a number as an octal field, the way headers of other tars have it. */
+static void
+test_put_octal(char *field, size_t length, uint64_t value) {
+    field[length - 1] = '\0';
+    for (size_t i = length - 1; i-- > 0; value >>= 3) {
+        field[i] = '0' + (value & 7);
+    }
+}
+
+/**
+ * Append a header made by hand.
+ *
+ * :param magic: ``ustar`` for POSIX headers, NULL for old ones without a magic.
+ * :param prefix: Start of the name in the prefix of a POSIX header, NULL for none.
+ */
+static void
+test_put_header(TestBufT *buf, const char *name, char type, uint64_t size,
+                const char *link_target, const char *magic, const char *prefix) {
+    char header[TAR_BLOCK_SIZE] = {0};
+    uint32_t sum = 0;
+
+    strncpy(header, name, TAR_LEN_NAME);
+    test_put_octal(header + 100, 8, 0644);
+    test_put_octal(header + TEST_OFF_SIZE, 12, size);
+    test_put_octal(header + 136, 12, 1700000000);
+    header[TEST_OFF_TYPE] = type;
+    if (link_target != NULL) {
+        strncpy(header + TEST_OFF_LINK, link_target, TAR_LEN_NAME);
+    }
+    if (magic != NULL) {
+        memcpy(header + TEST_OFF_MAGIC, magic, strlen(magic) + 1);
+        memcpy(header + TEST_OFF_MAGIC + 6, "00", 2);
+    }
+    if (prefix != NULL) {
+        strncpy(header + TEST_OFF_PREFIX, prefix, 155);
+    }
+
+    memset(header + TEST_OFF_CHECKSUM, ' ', 8);
+    for (size_t i = 0; i < sizeof header; i++) {
+        sum += (unsigned char)header[i];
+    }
+    test_put_octal(header + TEST_OFF_CHECKSUM, 7, sum);
+
+    test_write(buf, header, sizeof header);
+}
+
+/** Append contents and their padding. */
+static void
+test_put_contents(TestBufT *buf, const char *contents, size_t length) {
+    test_write(buf, contents, length);
+    tar_write_padding(test_write, buf, length);
+}
+
+/** Append a POSIX extended attribute record, its length counts its own digits. */
+static size_t
+test_put_pax_record(char *records, const char *key, const char *value) {
+    size_t length = strlen(key) + strlen(value) + 3, total = length + 1;
+
+    while (total != length + snprintf(NULL, 0, "%zu", total)) {
+        total++;
+    }
+    return sprintf(records, "%zu %s=%s\n", total, key, value);
+}
+
+/**
+ * Read the next entry and compare it.
+ *
+ * :return: False if it couldn't be read, the mismatch is printed.
+ */
+static bool
+test_expect_entry(TestBufT *buf, const char *what, const TarEntryT *expected) {
+    TarEntryT entry;
+    bool is_end, ok;
+    char message[256];
+
+    ok = tar_read_header(test_read, buf, &entry, &is_end) && !is_end;
+    snprintf(message, sizeof message, "%s: read", what);
+    test_check(ok, message);
+    if (!ok) {
+        return false;
+    }
+
+    snprintf(message, sizeof message, "%s: got %s -> %s type %c size %" PRIu64, what,
+             entry.name, entry.link_target ? entry.link_target : "(none)", entry.type,
+             entry.size);
+    test_check(test_str_eq(entry.name, expected->name) &&
+                   test_str_eq(entry.link_target, expected->link_target) &&
+                   entry.type == expected->type && entry.size == expected->size &&
+                   (!expected->mode || entry.mode == expected->mode) &&
+                   (!expected->mtime || entry.mtime == expected->mtime),
+               message);
+
+    TarEntry_clear(&entry);
+    return true;
+}
+
+static void
+test_expect_end(TestBufT *buf, const char *what) {
+    TarEntryT entry;
+    bool is_end;
+
+    test_check(tar_read_header(test_read, buf, &entry, &is_end) && is_end, what);
+}
+
+static void
+test_expect_corrupt(TestBufT *buf, const char *what) {
+    TarEntryT entry;
+    bool is_end;
+
+    test_check(!tar_read_header(test_read, buf, &entry, &is_end) && !is_end, what);
+}
+
+static void
+test_names(void) {
+    char message[64];
+
+    for (size_t i = 0; i < sizeof name_cases / sizeof *name_cases; i++) {
+        snprintf(message, sizeof message, "tar_name_is_safe(\"%s\")", name_cases[i].name);
+        test_check(tar_name_is_safe(name_cases[i].name) == name_cases[i].is_safe,
+                   message);
+    }
+}
+
+/** Entries written by ``tar_write_header`` read back the same, long names too. */
+static void
+test_round_trip(void) {
+    char long_name[300], long_target[200];
+    TestBufT buf = {0};
+    TarEntryT entries[] = {
+        {"dir", TAR_TYPE_DIRECTORY, 0, 0755, 1700000000, NULL},
+        {"dir/file", TAR_TYPE_FILE, 5, 0640, 1700000001, NULL},
+        {"dir/link", TAR_TYPE_SYM_LINK, 0, 0777, 1700000002, "../lib/bin"},
+        {"dir/hard", TAR_TYPE_HARD_LINK, 0, 0640, 1700000003, "dir/file"},
+        {long_name, TAR_TYPE_FILE, 0, 0600, 1, NULL},
+        {"dir/long_link", TAR_TYPE_SYM_LINK, 0, 0777, 1, long_target},
+        {long_name, TAR_TYPE_SYM_LINK, 0, 0777, 1, long_target},
+        {"huge", TAR_TYPE_FILE, (uint64_t)1 << 36, 0600, (uint64_t)1 << 34, NULL},
+    };
+    size_t num_entries = sizeof entries / sizeof *entries;
+
+    memset(long_name, 'n', sizeof long_name - 1);
+    long_name[sizeof long_name - 1] = '\0';
+    long_name[TAR_LEN_NAME] = '/';
+    memset(long_target, 't', sizeof long_target - 1);
+    long_target[sizeof long_target - 1] = '\0';
+
+    /* The contents of the last one are never read */
+    for (size_t i = 0; i < num_entries; i++) {
+        tar_write_header(test_write, &buf, &entries[i]);
+        if (entries[i].size && i < num_entries - 1) {
+            test_put_contents(&buf, "hello", entries[i].size);
+        }
+    }
+
+    for (size_t i = 0; i < num_entries; i++) {
+        if (!test_expect_entry(&buf, "round trip", &entries[i])) {
+            break;
+        }
+        if (entries[i].size && i < num_entries - 1) {
+            tar_skip(test_read, &buf, entries[i].size);
+        }
+    }
+
+    free(buf.data);
+}
+
+/** Headers of other tars: extended attributes, prefixes and old headers. */
+static void
+test_foreign(void) {
+    char records[1024], long_name[400];
+    TestBufT buf = {0};
+    size_t length;
+
+    memset(long_name, 'p', sizeof long_name - 1);
+    long_name[sizeof long_name - 1] = '\0';
+
+    /* Global attributes are skipped, the ones of an entry replace its names */
+    length = test_put_pax_record(records, "comment", "made by hand");
+    test_put_header(&buf, "pax_global_header", TAR_TYPE_PAX_GLOBAL, length, NULL,
+                    "ustar", NULL);
+    test_put_contents(&buf, records, length);
+
+    length = test_put_pax_record(records, "mtime", "1700000000.5");
+    length += test_put_pax_record(records + length, "path", long_name);
+    length += test_put_pax_record(records + length, "linkpath", "../../x y=z");
+    test_put_header(&buf, "PaxHeaders/short", TAR_TYPE_PAX, length, NULL, "ustar",
+                    NULL);
+    test_put_contents(&buf, records, length);
+    test_put_header(&buf, "short", TAR_TYPE_SYM_LINK, 0, "short_target", "ustar", NULL);
+
+    test_put_header(&buf, "file", TAR_TYPE_FILE, 0, NULL, "ustar", "some/prefix");
+    test_put_header(&buf, "old", '\0', 3, NULL, NULL, "not/a/prefix");
+    test_put_contents(&buf, "old", 3);
+
+    /* Records that don't add up are ignored, the names of the header stay */
+    strcpy(records, "99 path=never\n0 path=zero\n");
+    length = strlen(records);
+    test_put_header(&buf, "PaxHeaders/bad", TAR_TYPE_PAX, length, NULL, "ustar", NULL);
+    test_put_contents(&buf, records, length);
+    test_put_header(&buf, "kept", TAR_TYPE_DIRECTORY, 0, NULL, "ustar", NULL);
+
+    tar_write_end(test_write, &buf);
+
+    test_expect_entry(&buf, "pax",
+                      &(TarEntryT){long_name, TAR_TYPE_SYM_LINK, 0, 0644, 0,
+                                   "../../x y=z"});
+    test_expect_entry(&buf, "ustar prefix",
+                      &(TarEntryT){"some/prefix/file", TAR_TYPE_FILE, 0, 0644, 0, NULL});
+    if (test_expect_entry(&buf, "old header",
+                          &(TarEntryT){"old", TAR_TYPE_FILE, 3, 0644, 0, NULL})) {
+        tar_skip(test_read, &buf, 3);
+    }
+    test_expect_entry(&buf, "bad pax records",
+                      &(TarEntryT){"kept", TAR_TYPE_DIRECTORY, 0, 0644, 0, NULL});
+    test_expect_end(&buf, "end of a foreign archive");
+
+    free(buf.data);
+}
+
+/** Corrupt and truncated archives are errors, never entries or ends. */
+static void
+test_corrupt(void) {
+    TestBufT buf = {0};
+
+    test_put_header(&buf, "file", TAR_TYPE_FILE, 0, NULL, "ustar", NULL);
+    buf.data[0] ^= 1;
+    test_expect_corrupt(&buf, "bad checksum");
+    free(buf.data);
+
+    buf = (TestBufT){0};
+    test_put_header(&buf, "file", TAR_TYPE_FILE, 0, NULL, "ustar", NULL);
+    buf.length -= 1;
+    test_expect_corrupt(&buf, "truncated header");
+    free(buf.data);
+
+    buf = (TestBufT){0};
+    test_put_header(&buf, "././@LongLink", TAR_TYPE_LONG_NAME, 1 << 20, NULL, NULL,
+                    NULL);
+    test_put_contents(&buf, "a", 1);
+    test_expect_corrupt(&buf, "oversized long name");
+    free(buf.data);
+
+    buf = (TestBufT){0};
+    test_put_header(&buf, "././@LongLink", TAR_TYPE_LONG_LINK, 600, NULL, NULL, NULL);
+    test_put_contents(&buf, "abc", 3);
+    test_expect_corrupt(&buf, "truncated long link");
+    free(buf.data);
+
+    buf = (TestBufT){0};
+    test_expect_corrupt(&buf, "empty archive");
+}
+
+int
+main(void) {
+    test_names();
+    test_round_trip();
+    test_foreign();
+    test_corrupt();
+
+    printf("%zu failures\n", num_failed);
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}